@@ -207,3 +207,48 @@ void intbuf_add(struct intbuf *buf, unsigned int i) {
 void intbuf_remove(struct intbuf *buf, size_t pos) {
   memmove(buf->buf + pos, buf->buf + pos + 1, (buf->len-- - pos) * sizeof(*buf->buf));
 }
+
+static void regionbuf_grow(struct regionbuf *buf, size_t cap) {
+  buf->buf = xrealloc(buf->buf, cap * sizeof(*buf->buf));
+  buf->cap = cap;
+}
+
+struct regionbuf *regionbuf_create(size_t cap) {
+  struct regionbuf *buf = xmalloc(sizeof(*buf));
+
+  buf->buf = NULL;
+  buf->cap = 0;
+  regionbuf_grow(buf, max(1, cap));
+
+  buf->len = 0;
+  return buf;
+}
+
+void regionbuf_free(struct regionbuf *buf) {
+  free(buf->buf);
+  free(buf);
+}
+
+void regionbuf_insert(struct regionbuf *buf, struct region *region, size_t pos) {
+  regionbuf_insert_n(buf, region, 1, pos);
+}
+
+void regionbuf_insert_n(struct regionbuf *buf, struct region *regions,
+    size_t n, size_t pos) {
+  if (buf->len + n > buf->cap) {
+    regionbuf_grow(buf, max(2 * buf->cap, buf->len + n));
+  }
+
+  memmove(buf->buf + pos + n, buf->buf + pos, (buf->len - pos) * sizeof(*buf->buf));
+  memcpy(buf->buf + pos, regions, n * sizeof(*buf->buf));
+  buf->len += n;
+}
+
+void regionbuf_add(struct regionbuf *buf, struct region *region) {
+  regionbuf_insert(buf, region, buf->len);
+}
+
+void regionbuf_remove(struct regionbuf *buf, size_t pos, size_t n) {
+  memmove(buf->buf + pos, buf->buf + pos + n, (buf->len - pos - n) * sizeof(*buf->buf));
+  buf->len -= n;
+}
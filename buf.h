@@ -55,3 +55,22 @@ void intbuf_free(struct intbuf *buf);
 void intbuf_insert(struct intbuf *buf, unsigned int i, size_t pos);
 void intbuf_add(struct intbuf *buf, unsigned int i);
 void intbuf_remove(struct intbuf *buf, size_t pos);
+
+// Similar to struct buf but for regions.
+struct region;
+struct regionbuf {
+  struct region *buf;
+  size_t len;
+  size_t cap;
+};
+
+struct regionbuf *regionbuf_create(size_t cap);
+void regionbuf_free(struct regionbuf *buf);
+
+void regionbuf_insert(struct regionbuf *buf, struct region *region, size_t pos);
+// Insert the n regions starting at regions before index pos.
+void regionbuf_insert_n(struct regionbuf *buf, struct region *regions,
+    size_t n, size_t pos);
+void regionbuf_add(struct regionbuf *buf, struct region *region);
+// Remove n regions starting at index pos.
+void regionbuf_remove(struct regionbuf *buf, size_t pos, size_t n);
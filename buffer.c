@@ -11,6 +11,10 @@
 
 #include "buf.h"
 #include "gap.h"
+#include "matchset.h"
+#include "parse.h"
+#include "trigram.h"
+#include "utf8.h"
 #include "util.h"
 
 static struct buffer *buffer_of(char *path, struct gapbuf *gb, bool dir) {
@@ -25,6 +29,14 @@ static struct buffer *buffer_of(char *path, struct gapbuf *gb, bool dir) {
   TAILQ_INIT(&buffer->redo_stack);
 
   TAILQ_INIT(&buffer->marks);
+  TAILQ_INIT(&buffer->listeners);
+  buffer->matches = NULL;
+  buffer->trigrams = NULL;
+  buffer->version = 0;
+  buffer->utf8 = utf8_index_create(buffer);
+  buffer->syntax_checkpoints = NULL;
+  buffer->syntax_cache = NULL;
+  buffer->parse = NULL;
 
   return buffer;
 }
@@ -47,6 +59,16 @@ static void action_list_clear(struct action_group_list *list) {
 }
 
 void buffer_free(struct buffer *buffer) {
+  if (buffer->matches) {
+    match_set_free(buffer->matches);
+  }
+  if (buffer->trigrams) {
+    trigram_index_free(buffer->trigrams);
+  }
+  utf8_index_free(buffer->utf8);
+  parse_free(buffer->parse);
+  syntax_cache_free(buffer->syntax_cache);
+  syntax_checkpoints_free(buffer->syntax_checkpoints);
   free(buffer->path);
   gb_free(buffer->text);
   action_list_clear(&buffer->undo_stack);
@@ -114,6 +136,14 @@ struct buffer *buffer_open(char *path) {
   return buffer_of(path, gb, directory);
 }
 
+struct buffer *buffer_snapshot(struct buffer *buffer, size_t pos, size_t n) {
+  struct buf *text = gb_getstring(buffer->text, pos, n);
+  struct buffer *snapshot = buffer_of(NULL, gb_fromstring(text), false);
+  buf_free(text);
+  snapshot->opt.filetype = xstrdup(buffer->opt.filetype);
+  return snapshot;
+}
+
 bool buffer_write(struct buffer *buffer) {
   if (!buffer->path) {
     return false;
@@ -158,6 +188,46 @@ static void buffer_update_marks_after_delete(
   }
 }
 
+void buffer_add_listener(
+    struct buffer *buffer, struct buffer_listener *listener) {
+  TAILQ_INSERT_TAIL(&buffer->listeners, listener, pointers);
+}
+
+void buffer_remove_listener(
+    struct buffer *buffer, struct buffer_listener *listener) {
+  TAILQ_REMOVE(&buffer->listeners, listener, pointers);
+}
+
+// All changes to the text go through these two functions, so that marks and
+// listeners always see every edit.
+static void buffer_text_insert(
+    struct buffer *buffer, char *s, size_t n, size_t pos) {
+  gb_putstring(buffer->text, s, n, pos);
+  buffer->version++;
+  buffer_update_marks_after_insert(buffer, pos, n);
+
+  struct buffer_listener *listener;
+  TAILQ_FOREACH(listener, &buffer->listeners, pointers) {
+    listener->inserted(listener, pos, n);
+  }
+}
+
+static void buffer_text_delete(struct buffer *buffer, size_t n, size_t pos) {
+  bool emptied = n == gb_size(buffer->text);
+  gb_del(buffer->text, n, pos + n);
+  buffer->version++;
+  buffer_update_marks_after_delete(buffer, pos, n);
+
+  struct buffer_listener *listener;
+  TAILQ_FOREACH(listener, &buffer->listeners, pointers) {
+    listener->deleted(listener, pos, n);
+    // gb_del puts back a newline if the buffer would become empty.
+    if (emptied) {
+      listener->inserted(listener, 0, 1);
+    }
+  }
+}
+
 void buffer_do_insert(struct buffer *buffer, struct buf *buf, size_t pos) {
   struct edit_action_group *group = TAILQ_FIRST(&buffer->undo_stack);
   if (group) {
@@ -167,11 +237,9 @@ void buffer_do_insert(struct buffer *buffer, struct buf *buf, size_t pos) {
     action->buf = buf;
     TAILQ_INSERT_HEAD(&group->actions, action, pointers);
   }
-  gb_putstring(buffer->text, buf->buf, buf->len, pos);
+  buffer_text_insert(buffer, buf->buf, buf->len, pos);
   buffer->opt.modified = true;
 
-  buffer_update_marks_after_insert(buffer, pos, buf->len);
-
   if (!group) {
     buf_free(buf);
   }
@@ -186,10 +254,72 @@ void buffer_do_delete(struct buffer *buffer, size_t n, size_t pos) {
     action->buf = gb_getstring(buffer->text, pos, n);
     TAILQ_INSERT_HEAD(&group->actions, action, pointers);
   }
-  gb_del(buffer->text, n, pos + n);
+  buffer_text_delete(buffer, n, pos);
   buffer->opt.modified = true;
+}
 
-  buffer_update_marks_after_delete(buffer, pos, n);
+// Where the character at pos ends up after the changes are made. The changes
+// before changes[i] add added[i] characters and remove removed[i].
+static size_t buffer_change_map(size_t pos, struct buffer_change *changes,
+    size_t *added, size_t *removed, size_t nchanges) {
+  // Find the last change starting at or before pos.
+  size_t lo = 0, hi = nchanges;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (changes[mid].start <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return pos;
+  }
+  size_t i = lo - 1;
+  if (pos < changes[i].end) {
+    return changes[i].start + added[i] - removed[i];
+  }
+  return pos + added[i] + changes[i].len -
+      removed[i] - (changes[i].end - changes[i].start);
+}
+
+void buffer_do_replace(struct buffer *buffer, size_t pos, size_t n,
+    struct buf *buf, struct buffer_change *changes, size_t nchanges) {
+  size_t *added = xmalloc(2 * nchanges * sizeof(*added));
+  size_t *removed = added + nchanges;
+  size_t total_added = 0, total_removed = 0;
+  for (size_t i = 0; i < nchanges; ++i) {
+    added[i] = total_added;
+    removed[i] = total_removed;
+    total_added += changes[i].len;
+    total_removed += changes[i].end - changes[i].start;
+  }
+
+  // Work out where the marks go before the text changes under them.
+  size_t nmarks = 0;
+  struct mark *mark;
+  TAILQ_FOREACH(mark, &buffer->marks, pointers) {
+    nmarks++;
+  }
+  size_t *positions = xmalloc(nmarks * sizeof(*positions));
+  size_t i = 0;
+  TAILQ_FOREACH(mark, &buffer->marks, pointers) {
+    positions[i++] = buffer_change_map(
+        mark->region.start, changes, added, removed, nchanges);
+  }
+
+  buffer_do_delete(buffer, n, pos);
+  buffer_do_insert(buffer, buf, pos);
+
+  size_t last = gb_size(buffer->text) - 1;
+  i = 0;
+  TAILQ_FOREACH(mark, &buffer->marks, pointers) {
+    size_t mapped = min(positions[i], last);
+    i++;
+    region_set(&mark->region, mapped, mapped + 1);
+  }
+  free(positions);
+  free(added);
 }
 
 bool buffer_undo(struct buffer* buffer, size_t *cursor_pos) {
@@ -200,17 +330,15 @@ bool buffer_undo(struct buffer* buffer, size_t *cursor_pos) {
 
   TAILQ_REMOVE(&buffer->undo_stack, group, pointers);
 
-  struct gapbuf *gb = buffer->text;
   struct edit_action *action;
   TAILQ_FOREACH(action, &group->actions, pointers) {
     switch (action->type) {
     case EDIT_ACTION_INSERT:
-      gb_del(gb, action->buf->len, action->pos + action->buf->len);
-      buffer_update_marks_after_delete(buffer, action->pos, action->buf->len);
+      buffer_text_delete(buffer, action->buf->len, action->pos);
       break;
     case EDIT_ACTION_DELETE:
-      gb_putstring(gb, action->buf->buf, action->buf->len, action->pos);
-      buffer_update_marks_after_insert(buffer, action->pos, action->buf->len);
+      buffer_text_insert(
+          buffer, action->buf->buf, action->buf->len, action->pos);
       break;
     }
   }
@@ -228,17 +356,15 @@ bool buffer_redo(struct buffer* buffer, size_t *cursor_pos) {
 
   TAILQ_REMOVE(&buffer->redo_stack, group, pointers);
 
-  struct gapbuf *gb = buffer->text;
   struct edit_action *action;
   TAILQ_FOREACH_REVERSE(action, &group->actions, action_list, pointers) {
     switch (action->type) {
     case EDIT_ACTION_INSERT:
-      gb_putstring(gb, action->buf->buf, action->buf->len, action->pos);
-      buffer_update_marks_after_insert(buffer, action->pos, action->buf->len);
+      buffer_text_insert(
+          buffer, action->buf->buf, action->buf->len, action->pos);
       break;
     case EDIT_ACTION_DELETE:
-      gb_del(gb, action->buf->len, action->pos + action->buf->len);
-      buffer_update_marks_after_delete(buffer, action->pos, action->buf->len);
+      buffer_text_delete(buffer, action->buf->len, action->pos);
       break;
     }
   }
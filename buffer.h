@@ -10,6 +10,7 @@
 #include "util.h"
 
 struct buf;
+struct parse;
 
 struct mark {
   struct region region;
@@ -36,12 +37,26 @@ struct edit_action_group {
 
 TAILQ_HEAD(action_group_list, edit_action_group);
 
+// Something that wants to be told about changes to a buffer's text, e.g. to
+// keep a cache derived from the text up to date. The callbacks run after the
+// text has been changed.
+struct buffer_listener {
+  // Called after n characters were inserted at offset pos.
+  void (*inserted)(struct buffer_listener *listener, size_t pos, size_t n);
+  // Called after the n characters starting at offset pos were deleted.
+  void (*deleted)(struct buffer_listener *listener, size_t pos, size_t n);
+
+  TAILQ_ENTRY(buffer_listener) pointers;
+};
+
 // struct buffer is the in-memory text of a file.
 struct buffer {
   // The absolute path of the file this buffer was loaded from (possibly NULL).
   char *path;
   // The text proper.
   struct gapbuf *text;
+  // Incremented whenever the text changes.
+  size_t version;
   // Whether this is a directory buffer.
   bool directory;
 
@@ -54,6 +69,28 @@ struct buffer {
   // buffer_do_insert and buffer_do_delete.
   TAILQ_HEAD(mark_list, mark) marks;
 
+  // Listeners notified of every change made to the text.
+  TAILQ_HEAD(listener_list, buffer_listener) listeners;
+
+  // The matches of the pattern being highlighted by 'hlsearch', shared by all
+  // the windows showing this buffer (possibly NULL).
+  struct match_set *matches;
+
+  // The index used to speed up searches if 'trigramindex' is set (or NULL).
+  struct trigram_index *trigrams;
+
+  // Which parts of the text are known to be valid UTF-8.
+  struct utf8_index *utf8;
+
+  // Where the syntax highlighting tokenizer can pick up from, and the tokens
+  // on each line (or NULL).
+  struct syntax_checkpoints *syntax_checkpoints;
+  struct syntax_cache *syntax_cache;
+
+  // The structure of the text if it's C, for motions and highlighting types
+  // (or NULL).
+  struct parse *parse;
+
   struct {
 #define OPTION(name, type, _) type name;
   BUFFER_OPTIONS
@@ -70,6 +107,10 @@ struct buffer *buffer_open(char *path);
 // Returns an empty buffer (i.e. with a single empty line).
 struct buffer *buffer_create(char *path);
 
+// Returns a buffer holding a copy of the n characters at pos (with the same
+// filetype), which can be handed to another thread.
+struct buffer *buffer_snapshot(struct buffer *buffer, size_t pos, size_t n);
+
 // Free the given buffer.
 void buffer_free(struct buffer *buffer);
 
@@ -88,11 +129,30 @@ void buffer_do_insert(struct buffer *buffer, struct buf *buf, size_t pos);
 // updating the undo information along the way.
 void buffer_do_delete(struct buffer *buffer, size_t n, size_t pos);
 
+// One of the changes made by buffer_do_replace: the characters at
+// [start, end) in the old text were replaced with len new ones.
+struct buffer_change {
+  size_t start;
+  size_t end;
+  size_t len;
+};
+
+// Replace the n characters at offset pos with buf, which holds the old text
+// with the given changes (sorted and not overlapping) made to it. This is
+// recorded as a single deletion and insertion, but marks are moved as if each
+// change had been made separately, so that marks outside of the changed text
+// stay where they were.
+void buffer_do_replace(struct buffer *buffer, size_t pos, size_t n,
+    struct buf *buf, struct buffer_change *changes, size_t nchanges);
+
 // Undo the last action group. Return false if there is nothing to undo.
 bool buffer_undo(struct buffer *buffer, size_t *cursor_pos);
 // Redo the last undone action group. Return false if there is nothing to redo.
 bool buffer_redo(struct buffer *buffer, size_t *cursor_pos);
 
+void buffer_add_listener(struct buffer *buffer, struct buffer_listener *listener);
+void buffer_remove_listener(struct buffer *buffer, struct buffer_listener *listener);
+
 // Start a new action group, clearing the redo stack as a side effect.
 // Subsequent calls to buffer_do_insert or buffer_do_delete will add actions to
 // this group, which will be the target of the next buffer_undo call.
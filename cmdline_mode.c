@@ -15,6 +15,7 @@
 #include "editor.h"
 #include "history.h"
 #include "search.h"
+#include "substitute.h"
 #include "tags.h"
 #include "util.h"
 #include "window.h"
@@ -29,6 +30,7 @@ void cmdline_mode_entered(struct editor *editor) {
 
   mode->completions = NULL;
   mode->completion = NULL;
+  incsearch_init(&mode->incsearch);
 
   editor->status_cursor = 1;
   editor->status_silence = true;
@@ -42,6 +44,9 @@ void cmdline_mode_exited(struct editor *editor) {
   }
   editor->status_silence = false;
   editor->window->have_incsearch_match = false;
+  incsearch_deinit(&mode->incsearch);
+  substitute_preview_free(editor->window->substitute_preview);
+  editor->window->substitute_preview = NULL;
 
   mode->completion = NULL;
   if (mode->completions) {
@@ -56,13 +61,18 @@ static void search_done_cb(struct editor *editor, char *command) {
   struct cmdline_mode *mode = editor_get_cmdline_mode(editor);
   enum search_direction direction =
       mode->prompt == '/' ? SEARCH_FORWARDS : SEARCH_BACKWARDS;
+  struct editor_register *lsp = editor_get_register(editor, '/');
+  bool found;
   if (*command) {
-    editor_jump_to_match(editor, command, mode->cursor, direction);
-    struct editor_register *lsp = editor_get_register(editor, '/');
+    found = editor_jump_to_match(editor, command, mode->cursor, direction);
     lsp->write(lsp, command);
     history_add_item(&editor->search_history, command);
   } else {
-    editor_jump_to_match(editor, NULL, mode->cursor, direction);
+    found = editor_jump_to_match(editor, NULL, mode->cursor, direction);
+  }
+  if (found) {
+    editor_count_matches(
+        editor, lsp->buf->buf, window_cursor(editor->window));
   }
   editor->highlight_search_matches = true;
 }
@@ -78,8 +88,9 @@ static void search_char_cb(struct editor *editor, char *command) {
   struct cmdline_mode *mode = editor_get_cmdline_mode(editor);
   enum search_direction direction =
       mode->prompt == '/' ? SEARCH_FORWARDS : SEARCH_BACKWARDS;
-  editor->window->have_incsearch_match = editor_search(
-      editor, command, mode->cursor, direction, &editor->window->incsearch_match);
+  editor->window->have_incsearch_match = editor_incsearch(
+      editor, &mode->incsearch, command, mode->cursor, direction,
+      &editor->window->incsearch_match) == INCSEARCH_FOUND;
   if (editor->window->have_incsearch_match) {
     window_set_cursor(editor->window, editor->window->incsearch_match.start);
   } else {
@@ -87,6 +98,10 @@ static void search_char_cb(struct editor *editor, char *command) {
   }
 }
 
+static void command_char_cb(struct editor *editor, char *command) {
+  editor_preview_substitute(editor, command);
+}
+
 static void command_done_cb(struct editor *editor, char *command) {
   editor->status_silence = false;
   history_add_item(&editor->command_history, command);
@@ -163,7 +178,7 @@ void cmdline_mode_key_pressed(struct editor *editor, struct tb_event *ev) {
     case ':':
       history = &editor->command_history;
       done_cb = command_done_cb;
-      char_cb = NULL;
+      char_cb = command_char_cb;
       break;
     case '/': case '?':
       history = &editor->search_history;
@@ -1,6 +1,7 @@
 #include "window.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,7 +12,11 @@
 #include "buffer.h"
 #include "editor.h"
 #include "gap.h"
+#include "matchset.h"
+#include "parse.h"
 #include "search.h"
+#include "substitute.h"
+#include "utf8.h"
 #include "util.h"
 
 #define COLOR_DEFAULT TB_DEFAULT
@@ -22,24 +27,451 @@
 #define COLOR_WHITE 0x07
 #define COLOR_GREY TB_DARK_GRAY
 
-// Number of columns to use for the line number (including the trailing space).
-static size_t window_numberwidth(struct window* window) {
+// Where the characters of a line go on screen, worked out only as far into
+// the line as has been needed. Each character takes up one cell, except tabs,
+// which take up 'tabstop' cells, and wide characters, which take up two. The
+// newline ending the line is laid out too, so that the cursor can be shown on
+// it.
+struct line_layout {
+  bool valid;
+  int tabstop;
+  // Whether the newline has been laid out.
+  bool complete;
+  struct line_layout_char {
+    // From the start of the line.
+    size_t offset;
+    size_t col;
+    size_t width;
+  } *chars;
+  size_t len;
+  size_t cap;
+};
+
+// Lays out the line starting at line_pos at least as far as the character at
+// pos and the one covering col.
+static void line_layout_extend(struct line_layout *layout, struct gapbuf *gb,
+    size_t line_pos, int tabstop, size_t pos, size_t col) {
+  if (!layout->valid || layout->tabstop != tabstop) {
+    layout->valid = true;
+    layout->tabstop = tabstop;
+    layout->complete = false;
+    layout->len = 0;
+  }
+
+  while (!layout->complete) {
+    size_t offset = 0;
+    size_t start = 0;
+    if (layout->len) {
+      struct line_layout_char *last = &layout->chars[layout->len - 1];
+      if (line_pos + last->offset >= pos && last->col + last->width > col) {
+        break;
+      }
+      offset = last->offset + (size_t) gb_utf8len(gb, line_pos + last->offset);
+      start = last->col + last->width;
+    }
+
+    char c = gb_getchar(gb, line_pos + offset);
+    size_t width = 1;
+    if (c == '\t') {
+      width = (size_t) tabstop;
+    } else if (c & 0x80) {
+      width = (size_t) utf8_width(gb_utf8(gb, line_pos + offset));
+    }
+
+    if (layout->len == layout->cap) {
+      layout->cap = max(layout->cap * 2, 64);
+      layout->chars = xrealloc(
+          layout->chars, sizeof(*layout->chars) * layout->cap);
+    }
+    struct line_layout_char *next = &layout->chars[layout->len++];
+    next->offset = offset;
+    next->col = start;
+    next->width = width;
+    layout->complete = c == '\n';
+  }
+}
+
+// The index of the character at offset from the start of the line, which must
+// have been laid out.
+static size_t line_layout_find_offset(
+    struct line_layout *layout, size_t offset) {
+  size_t lo = 0;
+  size_t hi = layout->len;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (layout->chars[mid].offset <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// The index of the character covering col, or the last one laid out if none
+// does.
+static size_t line_layout_find_col(struct line_layout *layout, size_t col) {
+  size_t lo = 0;
+  size_t hi = layout->len;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (layout->chars[mid].col <= col) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// What a window's text looked like when it was last drawn: each row's cells,
+// and what they were worked out from. A row is only drawn again if its line
+// was edited, or was highlighted differently, or if something every row
+// depends on (the window's size, scrolling, 'tabstop' and so on) changed.
+// Whatever's drawn over the text (the cursor, the selection, search matches
+// and so on) is drawn anew each frame.
+//
+// The layout of each row's line is kept too, until the line is edited, so
+// that drawing it, highlighting parts of it and putting the cursor on it all
+// share the work.
+struct window_frame {
+  // Must be first, so the listener callbacks can get at the frame.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+
+  // Where the window is on screen, worked out at the start of each frame
+  // (see editor_layout_windows), so that drawing doesn't have to walk up
+  // the tree of splits for every cell.
+  struct window_geometry {
+    size_t x;
+    size_t y;
+    size_t w;
+    size_t h;
+    // The number of columns taken up by the line numbers (including the
+    // trailing space).
+    size_t numberwidth;
+    // Whether the window's name is shown on its last row.
+    bool plate;
+    // Whether there's a window to the right, so that the last column is
+    // taken up by the line between them.
+    bool separator;
+  } geometry;
+
+  // The number of lines in the buffer, as of the last edit.
+  size_t nlines;
+
+  struct window_frame_key {
+    size_t w;
+    size_t h;
+    size_t top;
+    size_t left;
+    size_t numberwidth;
+    bool number;
+    bool relativenumber;
+    // The line the cursor was on, if the line numbers are relative to it.
+    size_t cursorline;
+    int tabstop;
+    // The generation of the types declared in the buffer, or 0 if they
+    // weren't used.
+    size_t types;
+  } key;
+
+  // key.w cells for each of the key.h rows.
+  struct tb_cell *cells;
+  struct window_frame_row {
+    bool dirty;
+    // The syntax runs the row was drawn with (if any).
+    bool highlighted;
+    uint32_t *runs;
+    size_t nruns;
+    struct line_layout layout;
+  } *rows;
+
+  // The layout of a line that isn't showing, e.g. the one the cursor was
+  // moved to before the window scrolls to it.
+  struct line_layout scratch;
+  size_t scratch_line;
+};
+
+// Marks the rows showing the line pos is on as needing to be drawn and laid
+// out again, and every row below it too if lines were added or removed.
+static void window_frame_edited(struct window_frame *frame, size_t pos) {
+  struct gapbuf *gb = frame->buffer->text;
+  size_t top = frame->key.top;
+  size_t bot = top + frame->key.h;
+  frame->scratch.valid = false;
+
+  // Edits below the window don't matter, so there's no need to look further.
+  size_t line = 0;
+  size_t end = gb->lines->buf[0] + 1;
+  while (end <= pos && line + 1 < gb->lines->len && line < bot) {
+    end += gb->lines->buf[++line] + 1;
+  }
+
+  size_t last = line + 1;
+  if (gb_nlines(gb) != frame->nlines) {
+    frame->nlines = gb_nlines(gb);
+    last = bot;
+  }
+  for (size_t i = max(line, top); i < min(last, bot); ++i) {
+    frame->rows[i - top].dirty = true;
+    frame->rows[i - top].layout.valid = false;
+  }
+}
+
+static void window_frame_inserted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  (void) n;
+  window_frame_edited((struct window_frame*) listener, pos);
+}
+
+static void window_frame_deleted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  (void) n;
+  window_frame_edited((struct window_frame*) listener, pos);
+}
+
+static void window_frame_free_row(struct window_frame_row *row) {
+  free(row->runs);
+  free(row->layout.chars);
+}
+
+static void window_frame_free_rows(struct window_frame *frame) {
+  for (size_t i = 0; i < frame->key.h; ++i) {
+    window_frame_free_row(&frame->rows[i]);
+  }
+  free(frame->rows);
+  free(frame->cells);
+}
+
+void window_frame_free(struct window_frame *frame) {
+  if (!frame) {
+    return;
+  }
+  buffer_remove_listener(frame->buffer, &frame->listener);
+  window_frame_free_rows(frame);
+  free(frame->scratch.chars);
+  free(frame);
+}
+
+static struct window_frame *window_frame_get(struct window *window) {
+  if (!window->frame) {
+    struct window_frame *frame = xmalloc(sizeof(*frame));
+    memset(frame, 0, sizeof(*frame));
+    frame->buffer = window->buffer;
+    frame->nlines = gb_nlines(window->buffer->text);
+    frame->listener.inserted = window_frame_inserted;
+    frame->listener.deleted = window_frame_deleted;
+    buffer_add_listener(window->buffer, &frame->listener);
+    window->frame = frame;
+  }
+  return window->frame;
+}
+
+static struct window_geometry *window_geometry(struct window *window) {
+  return &window->frame->geometry;
+}
+
+static size_t window_numberwidth(struct window *window) {
+  return window_geometry(window)->numberwidth;
+}
+
+static bool window_should_draw_plate(struct window *window) {
+  return window_geometry(window)->plate;
+}
+
+// Works out the geometry of each window in the tree, given where the tree
+// goes on screen.
+static void window_layout(struct window *window, size_t x, size_t y,
+    size_t w, size_t h, bool separator) {
+  size_t point = window->split.point;
+  switch (window->split_type) {
+  case WINDOW_SPLIT_VERTICAL:
+    window_layout(window->split.first, x, y, point, h, true);
+    window_layout(window->split.second, x + point, y, w - point, h, separator);
+    return;
+  case WINDOW_SPLIT_HORIZONTAL:
+    window_layout(window->split.first, x, y, w, point, separator);
+    window_layout(window->split.second, x, y + point, w, h - point, separator);
+    return;
+  case WINDOW_LEAF:
+    break;
+  }
+
+  struct window_geometry *geometry = &window_frame_get(window)->geometry;
+  geometry->x = x;
+  geometry->y = y;
+  geometry->w = w;
+  geometry->h = h;
+  geometry->plate = window->parent != NULL;
+  geometry->separator = separator;
+
   size_t largest;
   if (window->opt.number) {
     largest = gb_nlines(window->buffer->text);
   } else if (window->opt.relativenumber) {
-    largest = window_h(window) / 2;
+    largest = h / 2;
   } else {
-    return 0;
+    geometry->numberwidth = 0;
+    return;
   }
   char buf[10];
   size_t maxwidth = (size_t) snprintf(buf, sizeof(buf), "%zu", largest);
+  geometry->numberwidth = max((size_t) window->opt.numberwidth, maxwidth + 1);
+}
 
-  return max((size_t) window->opt.numberwidth, maxwidth + 1);
+static void editor_layout_windows(struct editor *editor) {
+  struct window *root = window_root(editor->window);
+  window_layout(root, 0, 0, root->w, root->h, false);
 }
 
-static bool window_should_draw_plate(struct window *window) {
-  return window->parent != NULL;
+// Moves the rows that are still showing after the window scrolled to top,
+// leaving the rest to be drawn again. Those reuse the memory of the rows that
+// scrolled out of view.
+static void window_frame_scroll(struct window_frame *frame, size_t top) {
+  size_t w = frame->key.w;
+  size_t h = frame->key.h;
+  bool down = top > frame->key.top;
+  size_t shift = min(down ? top - frame->key.top : frame->key.top - top, h);
+  frame->key.top = top;
+
+  size_t from = down ? shift : 0;
+  size_t to = down ? 0 : shift;
+  size_t gone = down ? 0 : h - shift;
+  size_t fresh = down ? h - shift : 0;
+  struct window_frame_row *rows = xmalloc(sizeof(*rows) * max(shift, 1));
+  memcpy(rows, frame->rows + gone, sizeof(*rows) * shift);
+  memmove(frame->rows + to, frame->rows + from,
+      sizeof(*frame->rows) * (h - shift));
+  memmove(frame->cells + to * w, frame->cells + from * w,
+      sizeof(*frame->cells) * (h - shift) * w);
+  memcpy(frame->rows + fresh, rows, sizeof(*rows) * shift);
+  free(rows);
+  for (size_t i = fresh; i < fresh + shift; ++i) {
+    frame->rows[i].dirty = true;
+    frame->rows[i].layout.valid = false;
+  }
+}
+
+// Gets the window's frame ready for drawing h rows of text, starting over if
+// anything that goes into every row changed since the last one. The rows'
+// layouts are kept unless the number of rows changed.
+static struct window_frame *window_frame_prepare(struct window *window,
+    size_t h, size_t cursorline, struct parse *parse) {
+  struct window_frame *frame = window_frame_get(window);
+
+  // Zeroed first so that it can be compared with memcmp.
+  struct window_frame_key key;
+  memset(&key, 0, sizeof(key));
+  key.w = window_geometry(window)->w;
+  key.h = h;
+  key.top = window->top;
+  key.left = window->left;
+  key.numberwidth = window_numberwidth(window);
+  key.number = window->opt.number;
+  key.relativenumber = window->opt.relativenumber;
+  key.cursorline = window->opt.relativenumber ? cursorline : 0;
+  key.tabstop = window->buffer->opt.tabstop;
+  key.types = parse ? parse_types_generation(parse) : 0;
+
+  if (frame->rows && key.h == frame->key.h) {
+    if (key.top != frame->key.top) {
+      window_frame_scroll(frame, key.top);
+    }
+    if (!memcmp(&key, &frame->key, sizeof(key))) {
+      return frame;
+    }
+    if (key.w != frame->key.w) {
+      free(frame->cells);
+      frame->cells = xmalloc(sizeof(*frame->cells) * max(key.w * key.h, 1));
+    }
+    frame->key = key;
+    for (size_t i = 0; i < key.h; ++i) {
+      frame->rows[i].dirty = true;
+    }
+    return frame;
+  }
+
+  window_frame_free_rows(frame);
+  frame->key = key;
+  frame->cells = xmalloc(sizeof(*frame->cells) * max(key.w * key.h, 1));
+  frame->rows = xmalloc(sizeof(*frame->rows) * max(key.h, 1));
+  memset(frame->rows, 0, sizeof(*frame->rows) * key.h);
+  for (size_t i = 0; i < key.h; ++i) {
+    frame->rows[i].dirty = true;
+  }
+  frame->nlines = gb_nlines(window->buffer->text);
+  return frame;
+}
+
+// Whether the row was drawn with these runs.
+static bool window_frame_row_matches(
+    struct window_frame_row *row, struct syntax_line *tokens) {
+  if (!tokens) {
+    return !row->highlighted;
+  }
+  return row->highlighted && row->nruns == tokens->nruns &&
+      !memcmp(row->runs, tokens->runs, sizeof(*row->runs) * row->nruns);
+}
+
+static void window_frame_row_set(
+    struct window_frame_row *row, struct syntax_line *tokens) {
+  row->dirty = false;
+  row->highlighted = tokens != NULL;
+  row->nruns = tokens ? tokens->nruns : 0;
+  row->runs = xrealloc(row->runs, sizeof(*row->runs) * max(row->nruns, 1));
+  if (row->nruns) {
+    memcpy(row->runs, tokens->runs, sizeof(*row->runs) * row->nruns);
+  }
+}
+
+// The layout of the line starting at line_pos, laid out at least as far as pos
+// and col. The layouts of the lines showing when the window was last drawn
+// are kept until they're edited.
+static struct line_layout *window_line_layout(struct window *window,
+    size_t line, size_t line_pos, size_t pos, size_t col) {
+  struct window_frame *frame = window_frame_get(window);
+  struct line_layout *layout;
+  if (frame->rows && frame->key.top <= line &&
+      line < frame->key.top + frame->key.h) {
+    layout = &frame->rows[line - frame->key.top].layout;
+  } else {
+    if (frame->scratch_line != line) {
+      frame->scratch.valid = false;
+    }
+    frame->scratch_line = line;
+    layout = &frame->scratch;
+  }
+  line_layout_extend(layout, window->buffer->text, line_pos,
+      window->buffer->opt.tabstop, pos, col);
+  return layout;
+}
+
+// Returns the line pos is on, and sets *line_pos to where it starts.
+static size_t line_of(struct gapbuf *gb, size_t pos, size_t *line_pos) {
+  size_t line = 0;
+  size_t start = 0;
+  while (line + 1 < gb->lines->len && start + gb->lines->buf[line] < pos) {
+    start += gb->lines->buf[line++] + 1;
+  }
+  *line_pos = start;
+  return line;
+}
+
+// The number of columns of text the window shows. It can be none at all, when
+// the window is too narrow for even its line numbers.
+static size_t window_text_w(struct window *window) {
+  size_t w = window_geometry(window)->w;
+  size_t numberwidth = window_numberwidth(window);
+  return w > numberwidth ? w - numberwidth : 0;
+}
+
+static size_t window_text_h(struct window *window) {
+  size_t h = window_geometry(window)->h;
+  if (window_should_draw_plate(window)) {
+    --h;
+  }
+  return h;
 }
 
 static void window_scroll(struct window *window, size_t scroll) {
@@ -50,17 +482,15 @@ static void window_scroll(struct window *window, size_t scroll) {
   }
 
   struct gapbuf *gb = window->buffer->text;
-  size_t x, y;
-  gb_pos_to_linecol(gb, window_cursor(window), &y, &x);
+  size_t cursor = window_cursor(window);
+  size_t line_pos;
+  size_t y = line_of(gb, cursor, &line_pos);
 
-  size_t w = window_w(window) - window_numberwidth(window);
-  size_t h = window_h(window);
-  if (window_right(window)) {
+  size_t w = window_text_w(window);
+  size_t h = window_text_h(window);
+  if (window_geometry(window)->separator && w > 0) {
     --w;
   }
-  if (window_should_draw_plate(window)) {
-    --h;
-  }
 
   if (y < window->top) {
     window->top = y;
@@ -68,8 +498,16 @@ static void window_scroll(struct window *window, size_t scroll) {
     window->top = y - h + 1;
   }
 
+  // The cells the cursor's character covers.
+  struct line_layout *layout =
+      window_line_layout(window, y, line_pos, cursor, 0);
+  struct line_layout_char *c =
+      &layout->chars[line_layout_find_offset(layout, cursor - line_pos)];
+  size_t x = c->col;
+  size_t x_end = c->col + c->width - 1;
+
   bool left = x < window->left;
-  bool right = x > window->left + w - 1;
+  bool right = x_end > window->left + w - 1;
   if (left || right) {
     if (!scroll) {
       window->left = x >= w / 2 ? x - w / 2 : 0;
@@ -80,10 +518,10 @@ static void window_scroll(struct window *window, size_t scroll) {
         window->left = window->left >= scroll ? window->left - scroll : 0;
       }
     } else if (right) {
-      if (x - (window->left + w - 1) >= scroll) {
-        window->left = x - w + 1;
+      if (x_end - (window->left + w - 1) >= scroll) {
+        window->left = x_end - w + 1;
       } else {
-        window->left = min(window->left + scroll, gb->lines->buf[y] - 1);
+        window->left = min(window->left + scroll, x);
       }
     }
   }
@@ -91,31 +529,33 @@ static void window_scroll(struct window *window, size_t scroll) {
 
 static bool window_pos_to_xy(
     struct window *window, size_t pos, size_t *x, size_t *y) {
-  size_t line, col;
-  gb_pos_to_linecol(window->buffer->text, pos, &line, &col);
-  int tabstop = window->buffer->opt.tabstop;
-  size_t tabs = 0;
-  for (size_t i = 0; i < col; ++i) {
-    if (gb_getchar(window->buffer->text, pos - (i + 1)) == '\t') {
-      ++tabs;
-    }
+  struct gapbuf *gb = window->buffer->text;
+  size_t line_pos;
+  size_t line = line_of(gb, pos, &line_pos);
+  if (line < window->top || line >= window->top + window_text_h(window)) {
+    return false;
   }
-  col += window_numberwidth(window) + tabs * (tabstop - 1);
-  if (gb_getchar(window->buffer->text, pos) == '\t') {
-    col += tabstop - 1;
+
+  struct line_layout *layout =
+      window_line_layout(window, line, line_pos, pos, 0);
+  struct line_layout_char *c =
+      &layout->chars[line_layout_find_offset(layout, pos - line_pos)];
+  // As in vim, the cursor goes at the end of a tab.
+  size_t cell = c->col;
+  if (gb_getchar(gb, pos) == '\t') {
+    cell += c->width - 1;
   }
 
-  if (window->top <= line && line < window->top + window_h(window) &&
-      window->left <= col && col < window->left + window_w(window)) {
-    *x = col - window->left;
+  if (window->left <= cell && cell < window->left + window_text_w(window)) {
+    *x = window_numberwidth(window) + cell - window->left;
     *y = line - window->top;
     return true;
   }
   return false;
 }
 
-#define W2SX(x) (window_x(window) + x)
-#define W2SY(y) (window_y(window) + y)
+#define W2SX(wx) (window_geometry(window)->x + (wx))
+#define W2SY(wy) (window_geometry(window)->y + (wy))
 #define W2S(x, y) W2SX(x), W2SY(y)
 #define CELL(x, y) (tb_cell_buffer() + (W2SY(y) * (size_t) tb_width() + W2SX(x)))
 #define CELLFGBG(pos, f, b) { \
@@ -126,49 +566,167 @@ static bool window_pos_to_xy(
     cell->bg = b; \
   } \
 }
-#define REGIONFGBG(region, offset, fg, bg) { \
-  for (size_t pos = offset + (region)->start; pos < offset + (region)->end; ++pos) { \
-    CELLFGBG(pos, fg, bg); \
-  } \
+// Colours the cells showing the characters of the line at line_pos that are
+// in the regions, which are sorted and don't overlap. The newline ending the
+// line gets a cell too.
+static void window_draw_line_regions(struct window *window, size_t line,
+    size_t line_pos, struct region *regions, size_t n, tb_color fg,
+    tb_color bg) {
+  size_t numberwidth = window_numberwidth(window);
+  size_t left = window->left;
+  size_t right = left + window_text_w(window);
+  if (right == left) {
+    return;
+  }
+  struct line_layout *layout =
+      window_line_layout(window, line, line_pos, line_pos, right - 1);
+
+  size_t r = 0;
+  for (size_t i = line_layout_find_col(layout, left); i < layout->len; ++i) {
+    struct line_layout_char *c = &layout->chars[i];
+    size_t pos = line_pos + c->offset;
+    if (c->col >= right) {
+      break;
+    }
+    while (r < n && regions[r].end <= pos) {
+      ++r;
+    }
+    if (r == n) {
+      break;
+    }
+    if (regions[r].start > pos) {
+      continue;
+    }
+    for (size_t x = max(c->col, left); x < min(c->col + c->width, right); ++x) {
+      struct tb_cell *cell = CELL(numberwidth + x - left, line - window->top);
+      cell->fg = fg;
+      cell->bg = bg;
+    }
+  }
+}
+
+// Colours the parts of the regions that are on screen. The regions are sorted
+// and don't overlap.
+static void window_draw_regions(struct window *window,
+    struct region *regions, size_t n, tb_color fg, tb_color bg) {
+  struct gapbuf *gb = window->buffer->text;
+  size_t rows = min(gb->lines->len - window->top, window_text_h(window));
+
+  size_t line_pos = gb_linecol_to_pos(gb, window->top, 0);
+  size_t r = 0;
+  for (size_t y = 0; y < rows; ++y) {
+    size_t line = window->top + y;
+    size_t next = line_pos + gb->lines->buf[line] + 1;
+    while (r < n && regions[r].end <= line_pos) {
+      ++r;
+    }
+    if (r == n) {
+      break;
+    }
+    if (regions[r].start < next) {
+      window_draw_line_regions(
+          window, line, line_pos, regions + r, n - r, fg, bg);
+    }
+    line_pos = next;
+  }
 }
 
-// FIXME(ibadawi): avoid re-searching if e.g. we just moved the cursor
 static void window_draw_search_matches(struct window *window,
-                                       char *pattern, bool ignore_case) {
+    char *pattern, int flags, struct deadline *deadline) {
   if (window->split_type != WINDOW_LEAF) {
-    window_draw_search_matches(window->split.first, pattern, ignore_case);
-    window_draw_search_matches(window->split.second, pattern, ignore_case);
+    window_draw_search_matches(window->split.first, pattern, flags, deadline);
+    window_draw_search_matches(window->split.second, pattern, flags, deadline);
     return;
   }
 
-  struct gapbuf *gb = window->buffer->text;
-  size_t h = window_h(window);
-  if (window_should_draw_plate(window)) {
-    --h;
+  struct match_set *set = buffer_match_set(window->buffer, pattern, flags);
+  if (!set) {
+    return;
   }
 
+  struct gapbuf *gb = window->buffer->text;
+  size_t h = window_text_h(window);
+
   size_t top = window->top;
   size_t bot = window->top + min(gb->lines->len - window->top, h) - 1;
 
   size_t start = gb_linecol_to_pos(gb, top, 0);
-  size_t end = gb_linecol_to_pos(gb, bot, gb->lines->buf[bot]);
+  size_t end = gb_linecol_to_pos(gb, bot, gb->lines->buf[bot]) + 1;
 
-  struct buf *text = gb_getstring(gb, start, end - start);
+  struct region *matches;
+  size_t nmatches = match_set_query(set, start, end, deadline, &matches);
+  window_draw_regions(window, matches, nmatches, COLOR_BLACK, COLOR_YELLOW);
+}
 
-  struct search search;
-  int rc = search_init(&search, pattern, ignore_case, text->buf, text->len);
-  if (rc < 0) {
-    buf_free(text);
+// Draws the lines changed by a :s being typed over what's in the window.
+// Newlines put in by the replacement are shown as ^M.
+static void window_draw_substitute_preview(struct window *window) {
+  struct substitute_preview *preview = window->substitute_preview;
+  if (preview->top != window->top) {
     return;
   }
 
-  struct region match;
-  while (search_next_match(&search, &match)) {
-    REGIONFGBG(&match, start, COLOR_BLACK, COLOR_YELLOW);
+  size_t numberwidth = window_numberwidth(window);
+  size_t w = window_geometry(window)->w;
+  size_t h = min(preview->nlines, window_geometry(window)->h);
+  if (window_should_draw_plate(window)) {
+    --h;
   }
+  int tabstop = window->buffer->opt.tabstop;
 
-  buf_free(text);
-  search_deinit(&search);
+  for (size_t y = 0; y < h; ++y) {
+    struct buf *line = preview->lines[y];
+    if (!line) {
+      continue;
+    }
+    struct regionbuf *replaced = preview->replaced[y];
+    for (size_t x = numberwidth; x < w; ++x) {
+      tb_char(W2S(x, y), COLOR_WHITE, COLOR_DEFAULT, ' ');
+    }
+
+    size_t r = 0;
+    size_t col = 0;
+    size_t x = numberwidth;
+    for (size_t i = 0; i < line->len && x < w;) {
+      uint32_t ch;
+      int len = tb_utf8_char_to_unicode(&ch, line->buf + i);
+      len = max(len, 1);
+      while (r < replaced->len && replaced->buf[r].end <= i) {
+        ++r;
+      }
+      bool in_replacement = r < replaced->len && replaced->buf[r].start <= i;
+      tb_color fg = in_replacement ? COLOR_BLACK : COLOR_WHITE;
+      tb_color bg = in_replacement ? COLOR_YELLOW : COLOR_DEFAULT;
+      i += (size_t) len;
+
+      size_t width = 1;
+      if (ch == '\t') {
+        width = (size_t) tabstop;
+      } else if (ch == '\n') {
+        width = 2;
+      } else if (ch != '\r') {
+        width = (size_t) utf8_width(ch);
+      }
+      bool hidden = col < window->left;
+      col += width;
+      if (hidden || ch == '\r') {
+        continue;
+      }
+      if (ch == '\t') {
+        for (int j = 0; j < tabstop && x < w; ++j) {
+          tb_char(W2S(x++, y), fg, bg, ' ');
+        }
+      } else if (ch == '\n') {
+        tb_char(W2S(x++, y), COLOR_BLUE, bg, '^');
+        if (x < w) {
+          tb_char(W2S(x++, y), COLOR_BLUE, bg, 'M');
+        }
+      } else {
+        tb_char(W2S(x, y), fg, bg, ch);
+        x += width;
+      }
+    }
+  }
 }
 
 static void window_get_ruler(struct window *window, char *buf, size_t buflen) {
@@ -176,7 +734,7 @@ static void window_get_ruler(struct window *window, char *buf, size_t buflen) {
   size_t line, col;
   gb_pos_to_linecol(gb, window_cursor(window), &line, &col);
   size_t nlines = gb_nlines(gb);
-  size_t h = window_h(window);
+  size_t h = window_geometry(window)->h;
 
   bool top = window->top == 0;
   bool bot = nlines < window->top + h + 1;
@@ -206,8 +764,8 @@ static void window_draw_plate(struct window *window, struct editor *editor) {
       window->buffer->opt.readonly ? "[RO]" : "");
 
   size_t x = W2SX(0);
-  size_t y = W2SY(window_h(window) - 1);
-  tb_empty(x, y, COLOR_WHITE, window_w(window));
+  size_t y = W2SY(window_geometry(window)->h - 1);
+  tb_empty(x, y, COLOR_WHITE, window_geometry(window)->w);
   tb_string(x, y, COLOR_BLACK, COLOR_WHITE, plate);
 }
 
@@ -218,8 +776,8 @@ static void window_draw_ruler(struct window *window) {
     return;
   }
 
-  size_t w = window_w(window);
-  size_t h = window_h(window) - 1;
+  size_t w = window_geometry(window)->w;
+  size_t h = window_geometry(window)->h - 1;
   int fg = COLOR_BLACK;
   int bg = COLOR_WHITE;
   if (!window->parent) {
@@ -253,7 +811,8 @@ static void window_draw_line_number(struct window *window, size_t line, size_t c
 
 static void window_draw_visual_mode_selection(struct window *window) {
   if (window->visual_mode_selection) {
-    REGIONFGBG(window->visual_mode_selection, 0, COLOR_WHITE, COLOR_GREY);
+    window_draw_regions(window, window->visual_mode_selection, 1,
+        COLOR_WHITE, COLOR_GREY);
   }
 }
 
@@ -264,9 +823,14 @@ static void window_draw_cursorline(struct window *window) {
 
   size_t line, col;
   gb_pos_to_linecol(window->buffer->text, window_cursor(window), &line, &col);
+  size_t h = window_text_h(window);
+  // The cursor can be off screen in a window other than the current one.
+  if (line < window->top || line >= window->top + h) {
+    return;
+  }
 
   size_t numberwidth = window_numberwidth(window);
-  size_t width = window_w(window);
+  size_t width = window_geometry(window)->w;
   for (size_t x = numberwidth; x < width; ++x) {
     CELL(x, line - window->top)->fg |= TB_UNDERLINE;
   }
@@ -289,25 +853,117 @@ static tb_color token_color(enum syntax_token_kind token) {
   }
 }
 
+static bool is_word_char(char c) {
+  return isalnum((unsigned char) c) || c == '_';
+}
+
+// Whether the identifier at pos, in the run that starts at run_start and ends
+// at run_end, is a type the buffer declares. *word_end is set to where the
+// identifier ends, so the answer holds until then.
+static bool is_declared_type(struct parse *parse, struct gapbuf *gb,
+    size_t pos, size_t run_start, size_t run_end, size_t *word_end) {
+  size_t start = pos;
+  while (start > run_start && is_word_char(gb_getchar(gb, start - 1))) {
+    start--;
+  }
+  size_t end = pos;
+  while (end < run_end && is_word_char(gb_getchar(gb, end))) {
+    end++;
+  }
+  *word_end = max(end, pos + 1);
+  char word[64];
+  if (end == start || end - start >= sizeof(word)) {
+    return false;
+  }
+  gb_getstring_into(gb, start, end - start, word);
+  return parse_is_type(parse, word, end - start);
+}
+
+static void window_draw_line(struct window *window, struct parse *parse,
+    size_t line, size_t line_pos, struct syntax_line *tokens) {
+  struct gapbuf *gb = window->buffer->text;
+  size_t numberwidth = window_numberwidth(window);
+  size_t left = window->left;
+  size_t right = left + window_text_w(window);
+  size_t y = line - window->top;
+  if (right == left) {
+    return;
+  }
+  struct line_layout *layout =
+      window_line_layout(window, line, line_pos, line_pos, right - 1);
+
+  size_t run = 0;
+  size_t run_end = line_pos;
+  size_t word_end = line_pos;
+  bool type = false;
+
+  for (size_t i = line_layout_find_col(layout, left); i < layout->len; ++i) {
+    struct line_layout_char *c = &layout->chars[i];
+    size_t pos = line_pos + c->offset;
+    char ch = gb_getchar(gb, pos);
+    if (c->col >= right || ch == '\n') {
+      break;
+    }
+
+    tb_color fg = COLOR_WHITE;
+    tb_color bg = COLOR_DEFAULT;
+
+    if (tokens) {
+      while (run < tokens->nruns && pos >= run_end) {
+        run_end += SYNTAX_RUN_LEN(tokens->runs[run++]);
+      }
+      enum syntax_token_kind kind = SYNTAX_RUN_KIND(tokens->runs[run - 1]);
+      if (parse && kind == SYNTAX_TOKEN_IDENTIFIER) {
+        if (pos >= word_end) {
+          size_t run_start = run_end - SYNTAX_RUN_LEN(tokens->runs[run - 1]);
+          type = is_declared_type(
+              parse, gb, pos, run_start, run_end, &word_end);
+        }
+        if (type) {
+          kind = SYNTAX_TOKEN_TYPE;
+        }
+      }
+      fg = token_color(kind);
+    }
+
+    if (ch == '\r') {
+      continue;
+    }
+    // Tabs, and wide characters cut off by the edge of the window, are drawn
+    // as blanks.
+    size_t start = max(c->col, left);
+    size_t end = min(c->col + c->width, right);
+    if (ch == '\t' || end - start < c->width) {
+      for (size_t x = start; x < end; ++x) {
+        tb_char(W2S(numberwidth + x - left, y), fg, bg, ' ');
+      }
+    } else {
+      tb_char(W2S(numberwidth + start - left, y), fg, bg, gb_utf8(gb, pos));
+    }
+  }
+}
+
 static void window_draw_leaf(struct window *window, struct editor *editor) {
   assert(window->split_type == WINDOW_LEAF);
 
   struct gapbuf *gb = window->buffer->text;
 
-  size_t w = window_w(window) - window_numberwidth(window);
-  size_t h = window_h(window);
-
-  size_t rows = min(gb->lines->len - window->top, h);
-  size_t numberwidth = window_numberwidth(window);
-  int tabstop = window->buffer->opt.tabstop;
+  size_t h = window_geometry(window)->h;
+  size_t texth = window_text_h(window);
+  size_t rows = min(gb->lines->len - window->top, texth);
 
   size_t cursorline, cursorcol;
   gb_pos_to_linecol(window->buffer->text, window_cursor(window),
       &cursorline, &cursorcol);
 
-  struct syntax syntax;
-  struct syntax_token token = {SYNTAX_TOKEN_NONE, 0, 0};
-  bool highlight = syntax_init(&syntax, window->buffer);
+  struct parse *parse = NULL;
+  if (gb_size(gb) <= PARSE_DRAW_MAX_SIZE) {
+    parse = buffer_parse(window->buffer, false);
+  }
+
+  struct window_frame *frame =
+      window_frame_prepare(window, texth, cursorline, parse);
+  size_t w = frame->key.w;
 
   size_t line_pos = 0;
   for (size_t i = 0; i < window->top; ++i) {
@@ -316,53 +972,24 @@ static void window_draw_leaf(struct window *window, struct editor *editor) {
 
   for (size_t y = 0; y < rows; ++y) {
     size_t line = y + window->top;
-    window_draw_line_number(window, line, cursorline);
-
     if (y > 0) {
       line_pos += gb->lines->buf[line - 1] + 1;
     }
 
-    size_t tabs = 0;
-    size_t linelen = gb_utf8len_line(gb, line_pos);
-    size_t cols = (size_t)max(0,
-        min((ssize_t)linelen - (ssize_t)window->left, (ssize_t)w));
-
-    size_t pos = line_pos;
-    for (size_t i = 0; i < window->left; ++i) {
-      pos += gb_utf8len(gb, pos);
+    struct syntax_line *tokens =
+        buffer_syntax_line(window->buffer, line, &editor->redraw);
+    struct window_frame_row *row = &frame->rows[y];
+    struct tb_cell *cells = frame->cells + y * w;
+    if (!row->dirty && window_frame_row_matches(row, tokens)) {
+      memcpy(CELL(0, y), cells, sizeof(*cells) * w);
+      continue;
     }
 
-    for (size_t x = 0; x < cols; ++x) {
-      size_t x_offset = tabs * (tabstop - 1) + numberwidth + x;
-
-      if (x > 0) {
-        pos += gb_utf8len(gb, pos);
-      }
-
-      tb_color fg = COLOR_WHITE;
-      tb_color bg = COLOR_DEFAULT;
-
-      if (highlight) {
-        if (token.kind == SYNTAX_TOKEN_NONE ||
-            !(token.pos <= pos && pos < token.pos + token.len)) {
-          syntax_token_at(&syntax, &token, pos);
-        }
-        fg = token_color(token.kind);
-      }
-
-      char c = gb_getchar(gb, pos);
-      if (c == '\r') {
-        continue;
-      }
-      if (c == '\t') {
-        ++tabs;
-        tb_stringf(W2S(x_offset, y), fg, bg, "%*s", tabstop, "");
-      } else {
-        tb_char(W2S(x_offset, y), fg, bg, gb_utf8(gb, pos));
-      }
-    }
+    window_draw_line_number(window, line, cursorline);
+    window_draw_line(window, parse, line, line_pos, tokens);
+    memcpy(cells, CELL(0, y), sizeof(*cells) * w);
+    window_frame_row_set(row, tokens);
   }
-  syntax_deinit(&syntax);
 
   window_draw_visual_mode_selection(window);
   window_draw_cursorline(window);
@@ -386,9 +1013,14 @@ static void window_draw(struct window *window, struct editor *editor) {
   window_draw(window->split.first, editor);
   window_draw(window->split.second, editor);
   if (window->split_type == WINDOW_SPLIT_VERTICAL) {
+    // The left side starts where its first window does, and ends where its
+    // last one does.
     struct window *left = window->split.first;
-    for (size_t y = 0; y < window_h(left) - 1; ++y) {
-      tb_char(W2S(window_w(left) - 1, y), COLOR_BLACK, COLOR_WHITE, '|');
+    struct window_geometry *first = window_geometry(window_first_leaf(left));
+    struct window_geometry *last = window_geometry(window_last_leaf(left));
+    size_t x = last->x + last->w - 1;
+    for (size_t y = first->y; y + 1 < last->y + last->h; ++y) {
+      tb_char(x, y, COLOR_BLACK, COLOR_WHITE, '|');
     }
   }
 }
@@ -402,21 +1034,27 @@ static void editor_draw_window(struct editor *editor) {
   struct window *window = editor->window;
   struct window *root = window_root(window);
 
+  editor_layout_windows(editor);
   window_scroll(window, (size_t) editor->opt.sidescroll);
   window_draw(root, editor);
 
   if (editor->window->have_incsearch_match) {
-    REGIONFGBG(&editor->window->incsearch_match, 0, COLOR_BLACK, COLOR_WHITE);
+    window_draw_regions(window, &window->incsearch_match, 1,
+        COLOR_BLACK, COLOR_WHITE);
   }
 
   if (editor->opt.hlsearch && editor->highlight_search_matches) {
     struct editor_register *lsp = editor_get_register(editor, '/');
     char *pattern = lsp->buf->buf;
     if (*pattern) {
-      bool ignore_case = editor_ignore_case(editor, pattern);
-      window_draw_search_matches(root, pattern, ignore_case);
+      window_draw_search_matches(root, pattern,
+          editor_search_flags(editor, pattern), &editor->redraw);
     }
   }
+
+  if (editor->window->substitute_preview) {
+    window_draw_substitute_preview(editor->window);
+  }
   CELLFGBG(window_cursor(window), COLOR_BLACK, COLOR_WHITE);
 
   if (editor->opt.ruler &&
@@ -511,6 +1149,22 @@ static void editor_draw_status(struct editor *editor) {
       editor->status_error ? COLOR_RED : COLOR_DEFAULT,
       editor->status->buf);
 
+  struct search_count *count = &editor->search_count;
+  if (count->visible && count->ready && !editor->status_cursor) {
+    char buf[32];
+    search_count_format(count, buf, sizeof(buf));
+    size_t width = strlen(buf) + 1;
+    // Leave room for the ruler, as vim does.
+    if (editor->opt.ruler && !editor->window->parent) {
+      char ruler[32];
+      window_get_ruler(editor->window, ruler, sizeof(ruler));
+      width += strlen(ruler) + 1;
+    }
+    size_t x = editor->width > width ? editor->width - width : 0;
+    tb_string((int) x, (int) editor->height - 1,
+        COLOR_WHITE, COLOR_DEFAULT, buf);
+  }
+
   if (editor->status_cursor) {
     tb_char((int) editor->status_cursor, (int) editor->height - 1,
         COLOR_BLACK, COLOR_WHITE,
@@ -519,8 +1173,19 @@ static void editor_draw_status(struct editor *editor) {
 }
 
 void editor_draw(struct editor *editor) {
+  deadline_init(&editor->redraw, editor->opt.redrawtime);
+  deadline_init(&editor->frame, EDITOR_FRAME_MS);
   tb_clear_buffer();
   editor_draw_window(editor);
+  // Whatever highlighting didn't fit in the frame was left plain, and is
+  // finished off while waiting for input. Say so, unless that would cover up
+  // a message that's already there.
+  if (editor->redraw.missed && !editor->redraw_incomplete &&
+      !editor->status_cursor && !editor->status->len) {
+    editor_status_err(editor,
+        "'redrawtime' exceeded, highlighting cut short");
+  }
+  editor->redraw_incomplete = editor->redraw.missed;
   editor_draw_popup(editor);
   editor_draw_message(editor);
   editor_draw_status(editor);
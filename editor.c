@@ -1,6 +1,7 @@
 #include "editor.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -18,8 +19,12 @@
 #include "buffer.h"
 #include "gap.h"
 #include "mode.h"
+#include "pool.h"
+#include "substitute.h"
+#include "syntax.h"
 #include "tags.h"
 #include "terminal.h"
+#include "trigram.h"
 #include "util.h"
 #include "window.h"
 
@@ -81,6 +86,7 @@ static void register_clipboard_write(struct editor_register *reg, char *text) {
 }
 
 void editor_free(struct editor *editor) {
+  editor_clear_search_count(editor);
   buf_free(editor->message);
   buf_free(editor->status);
   free(editor->pwd);
@@ -96,6 +102,10 @@ void editor_free(struct editor *editor) {
   TAILQ_FOREACH_SAFE(b, &editor->buffers, pointers, tb) {
     buffer_free(b);
   }
+  quickfix_deinit(&editor->quickfix);
+  if (editor->pool) {
+    pool_free(editor->pool);
+  }
   editor_free_options(editor);
   history_deinit(&editor->command_history);
   history_deinit(&editor->search_history);
@@ -117,6 +127,12 @@ struct editor *editor_create_and_open(size_t width, size_t height, char *path) {
   memset(&editor->popup, 0, sizeof(editor->popup));
 
   editor->highlight_search_matches = false;
+  deadline_init(&editor->redraw, 0);
+  editor->redraw_incomplete = false;
+  deadline_init(&editor->frame, EDITOR_FRAME_MS);
+  memset(&editor->search_count, 0, sizeof(editor->search_count));
+  quickfix_init(&editor->quickfix);
+  editor->pool = NULL;
 
   memset(&editor->modes, 0, sizeof(editor->modes));
 #define MODE(name) do { \
@@ -167,6 +183,7 @@ struct editor *editor_create_and_open(size_t width, size_t height, char *path) {
   TAILQ_INIT(&editor->synthetic_events);
 
   editor_init_options(editor);
+  editor_load_syntax(editor);
 
   editor->window = window_create(NULL, editor->width, editor->height - 1);
 
@@ -199,7 +216,7 @@ struct editor_register *editor_get_register(struct editor *editor, char name) {
   return NULL;
 }
 
-static struct buffer *editor_get_buffer_by_path(struct editor* editor, char *name) {
+struct buffer *editor_get_buffer_by_path(struct editor* editor, char *name) {
   struct buffer *b;
   TAILQ_FOREACH(b, &editor->buffers, pointers) {
     if (b->path && !strcmp(b->path, name)) {
@@ -274,6 +291,13 @@ void editor_pop_mode(struct editor *editor) {
   }
 }
 
+void editor_load_syntax(struct editor *editor) {
+  char error[256];
+  if (!syntax_load_path(editor->opt.syntaxpath, error, sizeof(error))) {
+    editor_status_err(editor, "%s", error);
+  }
+}
+
 bool editor_save_buffer(struct editor *editor, char *path) {
   struct buffer *buffer = editor->window->buffer;
   if (!path && !buffer->path) {
@@ -465,6 +489,13 @@ static char *editor_find_in_path_verbatim(struct editor *editor, char *file) {
   return NULL;
 }
 
+struct pool *editor_pool(struct editor *editor) {
+  if (!editor->pool) {
+    editor->pool = pool_create();
+  }
+  return editor->pool;
+}
+
 char *editor_find_in_path(struct editor *editor, char *file) {
   char *path = editor_find_in_path_verbatim(editor, file);
   if (path) {
@@ -635,6 +666,85 @@ void editor_jump_to_end(struct editor *editor) {
   editor_jump_to_line(editor, (int) gb_nlines(gb) - 1);
 }
 
+// Parses a line number like "12", "." or "$", possibly followed (or
+// replaced) by offsets like "+3" or "-", advancing past it. The result is
+// 0-based.
+static bool editor_parse_address(
+    struct editor *editor, char **command, int *line) {
+  struct gapbuf *gb = editor->window->buffer->text;
+  size_t cursor_line, col;
+  gb_pos_to_linecol(gb, window_cursor(editor->window), &cursor_line, &col);
+
+  char *s = *command;
+  if (*s == '.') {
+    *line = (int) cursor_line;
+    s++;
+  } else if (*s == '$') {
+    *line = (int) gb_nlines(gb) - 1;
+    s++;
+  } else if (isdigit((unsigned char) *s)) {
+    *line = (int) strtol(s, &s, 10) - 1;
+  } else if (*s == '+' || *s == '-') {
+    *line = (int) cursor_line;
+  } else {
+    return false;
+  }
+
+  while (*s == '+' || *s == '-') {
+    int sign = *s++ == '+' ? 1 : -1;
+    int offset = isdigit((unsigned char) *s) ? (int) strtol(s, &s, 10) : 1;
+    *line += sign * offset;
+  }
+  *command = s;
+  return true;
+}
+
+char *command_parse_substitute(char *command) {
+  size_t len = 0;
+  while (isalpha((unsigned char) command[len])) {
+    len++;
+  }
+  char delimiter = command[len];
+  if (!len || strncmp(command, "substitute", len) ||
+      !delimiter || isalnum((unsigned char) delimiter) ||
+      isspace((unsigned char) delimiter) ||
+      strchr("\\\"|", delimiter)) {
+    return NULL;
+  }
+  return command + len;
+}
+
+bool editor_parse_range(
+    struct editor *editor, char **command, int *first, int *last) {
+  struct gapbuf *gb = editor->window->buffer->text;
+  size_t line, col;
+  gb_pos_to_linecol(gb, window_cursor(editor->window), &line, &col);
+  *first = *last = (int) line;
+
+  if (**command == '%') {
+    *first = 0;
+    *last = (int) gb_nlines(gb) - 1;
+    (*command)++;
+    return true;
+  }
+  if (!editor_parse_address(editor, command, first)) {
+    return false;
+  }
+  *last = *first;
+  if (**command == ',' || **command == ';') {
+    (*command)++;
+    if (!editor_parse_address(editor, command, last)) {
+      *last = (int) line;
+    }
+  }
+  if (*first > *last) {
+    int tmp = *first;
+    *first = *last;
+    *last = tmp;
+  }
+  return true;
+}
+
 void editor_execute_command(struct editor *editor, char *command) {
   if (!*command) {
     return;
@@ -674,28 +784,39 @@ void editor_execute_command(struct editor *editor, char *command) {
     return;
   }
 
+  struct gapbuf *gb = editor->window->buffer->text;
+  int first, last;
+  bool has_range = editor_parse_range(editor, &command, &first, &last);
+  if (has_range) {
+    if (first < 0 || last >= (int) gb_nlines(gb)) {
+      if (!*command) {
+        // Like vim, jumping past either end just goes to the end.
+        editor_jump_to_line(editor, last);
+      } else {
+        editor_status_err(editor, "Invalid range");
+      }
+      return;
+    }
+    if (!*command) {
+      editor_jump_to_line(editor, last);
+      return;
+    }
+  }
+
+  char *arg = command_parse_substitute(command);
+  if (arg) {
+    editor_substitute(editor, (size_t) first, (size_t) last, arg);
+    return;
+  }
+
   bool force = false;
-  char *arg = NULL;
   struct editor_command *cmd = command_parse(command, &arg, &force);
-  if (cmd) {
-    cmd->action(editor, arg, force);
+  if (cmd && has_range) {
+    editor_status_err(editor, "No range allowed");
     return;
   }
-
-  size_t line, col;
-  gb_pos_to_linecol(editor->window->buffer->text,
-      window_cursor(editor->window), &line, &col);
-  int target;
-  if (strtoi(command, &target)) {
-    target = labs(target);
-    if (*command == '+') {
-      target = (int) line + target;
-    } else if (*command == '-') {
-      target = (int) line - target;
-    } else {
-      target--;
-    }
-    editor_jump_to_line(editor, target);
+  if (cmd) {
+    cmd->action(editor, arg, force);
     return;
   }
 
@@ -707,26 +828,211 @@ static void editor_suspend(struct editor *editor) {
   editor_draw(editor);
 }
 
-static int editor_poll_event(struct editor *editor, struct tb_event *ev) {
+#define EDITOR_BACKGROUND_POLL_MS 20
+
+static bool editor_has_background_work(struct editor *editor) {
+  return editor->search_count.job || editor->quickfix.grep ||
+      editor_trigram_indexing(editor) || editor_syntax_pending(editor) ||
+      editor->redraw_incomplete;
+}
+
+static bool editor_update_background_work(struct editor *editor) {
+  bool changed = editor_update_search_count(editor);
+  changed |= editor_update_quickfix(editor);
+  editor_update_trigram_indexes(editor);
+  changed |= editor_update_syntax(editor);
+  return changed || editor->redraw_incomplete;
+}
+
+static bool editor_pop_event(struct editor *editor, struct tb_event *ev) {
   struct editor_event *top = TAILQ_FIRST(&editor->synthetic_events);
-  if (top) {
-    TAILQ_REMOVE(&editor->synthetic_events, top, pointers);
-    memset(ev, 0, sizeof(*ev));
-    ev->type = top->type;
-    ev->key = top->key;
-    ev->ch = top->ch;
-    free(top);
+  if (!top) {
+    return false;
+  }
+  TAILQ_REMOVE(&editor->synthetic_events, top, pointers);
+  memset(ev, 0, sizeof(*ev));
+  ev->type = top->type;
+  ev->meta = top->meta;
+  ev->key = top->key;
+  ev->ch = top->ch;
+  ev->w = top->w;
+  ev->h = top->h;
+  free(top);
+  return true;
+}
+
+static int editor_poll_event(struct editor *editor, struct tb_event *ev) {
+  // If there's input waiting, the results are shown once it's been handled.
+  if (editor_update_background_work(editor) &&
+      !editor_input_pending(editor)) {
+    editor_draw(editor);
+  }
+
+  if (editor_pop_event(editor, ev)) {
     return ev->type;
   }
+
+  // While there's work going on in the background, wake up every so often to
+  // show its results as they come in.
+  while (editor_has_background_work(editor)) {
+    int type = tb_peek_event(ev, EDITOR_BACKGROUND_POLL_MS);
+    if (type) {
+      return type;
+    }
+    if (editor_update_background_work(editor)) {
+      editor_draw(editor);
+    }
+  }
   return tb_poll_event(ev);
 }
 
+// With bracketed paste on, the terminal wraps pasted text in these (each
+// preceded by an escape), so that it can be told apart from typing. termbox
+// doesn't know them, and hands them over as an escape followed by the rest as
+// characters.
+#define PASTE_START "[200~"
+#define PASTE_END "[201~"
+
+// A read can end partway through an escape sequence, so once a marker has
+// started coming in, give the rest this long to follow.
+#define PASTE_ESCAPE_WAIT_MS 50
+// If a paste stops coming in for this long without its end marker (say the
+// terminal dropped it), it's taken to be over.
+#define PASTE_STALL_MS 1000
+
+// Take the next event, either one that's already waiting or one that comes in
+// within timeout_ms.
+static bool editor_next_event(struct editor *editor, struct tb_event *ev,
+    int timeout_ms) {
+  if (editor_pop_event(editor, ev)) {
+    return true;
+  }
+  return tb_peek_event(ev, timeout_ms) > 0;
+}
+
+// Take the events spelling out s, if that's what comes next. If not, put back
+// what was taken.
+static bool editor_take_chars(struct editor *editor, const char *s,
+    int timeout_ms) {
+  struct tb_event taken[8];
+  size_t n = 0;
+  assert(strlen(s) <= sizeof(taken) / sizeof(*taken));
+  bool matched = true;
+  for (const char *c = s; *c; ++c) {
+    if (!editor_next_event(editor, &taken[n], timeout_ms)) {
+      matched = false;
+      break;
+    }
+    if (taken[n++].ch != (uint32_t) *c) {
+      matched = false;
+      break;
+    }
+  }
+  if (!matched) {
+    while (n > 0) {
+      editor_push_event(editor, &taken[--n]);
+    }
+  }
+  return matched;
+}
+
+static bool editor_key_is_paste_start(struct editor *editor,
+    struct tb_event *ev) {
+  if (ev->type != TB_EVENT_KEY || ev->key != TB_KEY_ESC) {
+    return false;
+  }
+  // An escape with nothing waiting after it is just the key, and is handled
+  // at once unless 'ttimeoutlen' says to wait for the rest of a sequence.
+  if (!editor_take_chars(editor, "[", editor->opt.ttimeoutlen)) {
+    return false;
+  }
+  if (editor_take_chars(editor, PASTE_START + 1, PASTE_ESCAPE_WAIT_MS)) {
+    return true;
+  }
+  struct tb_event bracket = {.type = TB_EVENT_KEY, .ch = '['};
+  editor_push_event(editor, &bracket);
+  return false;
+}
+
+// Append the text typed by ev, if any. Control keys are appended as is, except
+// that enter is a newline; keys with no text (like the arrow keys) are dropped.
+static void editor_append_key(struct buf *text, struct tb_event *ev) {
+  if (ev->ch) {
+    char s[8];
+    int len = tb_utf8_unicode_to_char(s, ev->ch);
+    s[len] = '\0';
+    buf_append(text, s);
+  } else if (ev->key == TB_KEY_ENTER) {
+    buf_append_char(text, '\n');
+  } else if (ev->key > 0 && ev->key < 0x80) {
+    buf_append_char(text, (char) ev->key);
+  }
+}
+
+// Take everything up to the end of a paste, or as much as came in before it
+// stalled.
+static struct buf *editor_read_paste(struct editor *editor) {
+  struct buf *text = buf_create(1024);
+  struct tb_event ev;
+  uint16_t prev = 0;
+  while (editor_next_event(editor, &ev, PASTE_STALL_MS)) {
+    if (ev.type != TB_EVENT_KEY) {
+      continue;
+    }
+    if (ev.key == TB_KEY_ESC &&
+        editor_take_chars(editor, PASTE_END, PASTE_ESCAPE_WAIT_MS)) {
+      break;
+    }
+    // Terminals send pasted line breaks as carriage returns, but some text
+    // has both; don't make that two lines.
+    if (!(ev.key == TB_KEY_CTRL_J && prev == TB_KEY_ENTER)) {
+      editor_append_key(text, &ev);
+    }
+    prev = ev.ch ? 0 : ev.key;
+  }
+  return text;
+}
+
+static void editor_paste(struct editor *editor, struct buf *text) {
+  if (editor->mode->kind == EDITING_MODE_insert) {
+    insert_mode_paste(editor, text);
+    return;
+  }
+
+  // Elsewhere, the text is handled as if it had been typed.
+  struct editor_event *last = NULL;
+  for (size_t i = 0; i < text->len; ++i) {
+    struct editor_event *event = xmalloc(sizeof(*event));
+    memset(event, 0, sizeof(*event));
+    event->type = TB_EVENT_KEY;
+    char ch = text->buf[i];
+    if (ch == '\n') {
+      event->key = TB_KEY_ENTER;
+    } else if (ch == ' ') {
+      event->key = TB_KEY_SPACE;
+    } else if ((unsigned char) ch < 0x20 || ch == 0x7f) {
+      event->key = (uint16_t) ch;
+    } else {
+      i += (size_t) tb_utf8_char_to_unicode(&event->ch, text->buf + i) - 1;
+    }
+    if (last) {
+      TAILQ_INSERT_AFTER(&editor->synthetic_events, last, event, pointers);
+    } else {
+      TAILQ_INSERT_HEAD(&editor->synthetic_events, event, pointers);
+    }
+    last = event;
+  }
+  buf_free(text);
+}
+
 bool editor_waitkey(struct editor *editor, struct tb_event *ev) {
   if (editor_poll_event(editor, ev) < 0) {
     return false;
   }
   if (ev->type == TB_EVENT_KEY && ev->key == TB_KEY_CTRL_Z) {
     editor_suspend(editor);
+  } else if (editor_key_is_paste_start(editor, ev)) {
+    editor_paste(editor, editor_read_paste(editor));
   } else if (ev->type == TB_EVENT_RESIZE) {
     editor->width = (size_t) ev->w;
     editor->height = (size_t) ev->h;
@@ -743,6 +1049,23 @@ bool editor_waitkey(struct editor *editor, struct tb_event *ev) {
   return editor_waitkey(editor, ev);
 }
 
+bool editor_input_pending(struct editor *editor) {
+  if (!TAILQ_EMPTY(&editor->synthetic_events)) {
+    return true;
+  }
+  // There's no way to peek without taking the event, so put it back.
+  struct tb_event ev;
+  if (tb_peek_event(&ev, 0) > 0) {
+    editor_push_event(editor, &ev);
+    return true;
+  }
+  return false;
+}
+
+bool editor_should_draw(struct editor *editor) {
+  return !editor_input_pending(editor) || deadline_passed(&editor->frame);
+}
+
 char editor_getchar(struct editor *editor) {
   struct tb_event ev;
   editor_waitkey(editor, &ev);
@@ -757,22 +1080,48 @@ void editor_handle_key_press(struct editor *editor, struct tb_event *ev) {
   editor->mode->key_pressed(editor, ev);
 }
 
-void editor_push_event(struct editor *editor, struct tb_event *ev) {
+static struct editor_event *editor_event_create(struct tb_event *ev) {
   struct editor_event *event = xmalloc(sizeof(*event));
   memset(event, 0, sizeof(*event));
   event->type = ev->type;
+  event->meta = ev->meta;
   event->key = ev->key;
   event->ch = ev->ch;
+  event->w = ev->w;
+  event->h = ev->h;
+  return event;
+}
+
+void editor_push_event(struct editor *editor, struct tb_event *ev) {
+  struct editor_event *event = editor_event_create(ev);
   TAILQ_INSERT_HEAD(&editor->synthetic_events, event, pointers);
 }
 
+bool editor_interrupted(struct editor *editor) {
+  // Take in everything typed so far, keeping it to be handled later.
+  struct tb_event ev;
+  struct editor_event *event;
+  while (tb_peek_event(&ev, 0) > 0) {
+    event = editor_event_create(&ev);
+    TAILQ_INSERT_TAIL(&editor->synthetic_events, event, pointers);
+  }
+
+  TAILQ_FOREACH(event, &editor->synthetic_events, pointers) {
+    if (event->type == TB_EVENT_KEY && event->key == TB_KEY_CTRL_C) {
+      TAILQ_REMOVE(&editor->synthetic_events, event, pointers);
+      free(event);
+      return true;
+    }
+  }
+  return false;
+}
+
 void editor_send_keys(struct editor *editor, const char *keys) {
   struct editor_event *last = NULL;
   for (const char *k = keys; *k; ++k) {
     struct editor_event *ev = xmalloc(sizeof(*ev));
+    memset(ev, 0, sizeof(*ev));
     ev->type = TB_EVENT_KEY;
-    ev->key = 0;
-    ev->ch = 0;
     switch (*k) {
     case '<': {
       char key[10];
@@ -797,6 +1146,8 @@ void editor_send_keys(struct editor *editor, const char *keys) {
         ev->key = TB_KEY_CTRL_H;
       } else if (!strcmp("C-l", key)) {
         ev->key = TB_KEY_CTRL_L;
+      } else if (!strcmp("C-c", key)) {
+        ev->key = TB_KEY_CTRL_C;
       } else {
         debug("BUG: editor_send_keys got <%s>\n", key);
         exit(1);
@@ -835,6 +1186,7 @@ void editor_status_msg(struct editor *editor, const char *format, ...) {
   if (editor->status_silence) {
     return;
   }
+  editor_clear_search_count(editor);
   va_list args;
   va_start(args, format);
   buf_vprintf(editor->status, format, args);
@@ -846,6 +1198,7 @@ void editor_status_err(struct editor *editor, const char *format, ...) {
   if (editor->status_silence) {
     return;
   }
+  editor_clear_search_count(editor);
   va_list args;
   va_start(args, format);
   buf_vprintf(editor->status, format, args);
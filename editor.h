@@ -10,11 +10,17 @@
 #include "history.h"
 #include "mode.h"
 #include "options.h"
+#include "quickfix.h"
+#include "search_count.h"
+#include "util.h"
 
 struct editor_event {
   uint8_t type;
+  uint8_t meta;
   uint16_t key;
   uint32_t ch;
+  int32_t w;
+  int32_t h;
 
   TAILQ_ENTRY(editor_event) pointers;
 };
@@ -81,6 +87,25 @@ struct editor {
 
   bool highlight_search_matches;
 
+  // The time limit on drawing the current frame ('redrawtime'). If the last
+  // frame ran out of time, the highlighting it skipped is picked up again
+  // while waiting for input.
+  struct deadline redraw;
+  bool redraw_incomplete;
+  // Passes once the next frame is due, so that frames can be skipped while
+  // keys come in faster than they can be drawn.
+  struct deadline frame;
+
+  // The match count shown after searching.
+  struct search_count search_count;
+
+  // The quickfix list, e.g. filled in by :vimgrep.
+  struct quickfix quickfix;
+
+  // Threads for work that can be spread over all the cores (or NULL if
+  // nothing has needed them yet).
+  struct pool *pool;
+
   // Temporary input state.
   // TODO(isbadawi): This feels like a kludge but I don't know...
   unsigned int count;
@@ -106,6 +131,7 @@ struct editor *editor_create_and_open(size_t width, size_t height, char *path);
 void editor_free(struct editor *editor);
 
 void editor_open(struct editor *editor, char *path);
+struct buffer *editor_get_buffer_by_path(struct editor *editor, char *path);
 
 void editor_set_window(struct editor *editor, struct window *window);
 
@@ -113,7 +139,18 @@ void editor_push_mode(struct editor *editor, struct editing_mode *mode);
 void editor_pop_mode(struct editor *editor);
 
 bool editor_save_buffer(struct editor *editor, char *path);
+// Loads the syntax files in 'syntaxpath', so that buffers opened from then on
+// can be detected as their filetypes. Done at startup and whenever the option
+// is set.
+void editor_load_syntax(struct editor *editor);
+// Frames are drawn at most this often while there's input waiting.
+#define EDITOR_FRAME_MS 16
+
 void editor_draw(struct editor *editor);
+// Whether the screen should be drawn after handling a key. It isn't if more
+// input is waiting to be handled, e.g. because a key is being held down,
+// unless the last frame was drawn more than EDITOR_FRAME_MS ago.
+bool editor_should_draw(struct editor *editor);
 
 void editor_jump_to_line(struct editor *editor, int line);
 void editor_jump_to_end(struct editor *editor);
@@ -126,6 +163,11 @@ struct editor_register *editor_get_register(struct editor *editor, char name);
 
 struct tb_event;
 bool editor_waitkey(struct editor *editor, struct tb_event *ev);
+// Returns true if there's a key press (or other event) waiting to be handled.
+bool editor_input_pending(struct editor *editor);
+// Returns true (once) if Ctrl-C has been pressed, so that something slow can
+// stop early. Other keys pressed in the meantime are kept to be handled next.
+bool editor_interrupted(struct editor *editor);
 char editor_getchar(struct editor *editor);
 void editor_handle_key_press(struct editor *editor, struct tb_event *ev);
 
@@ -145,6 +187,8 @@ bool editor_try_modify(struct editor *editor);
 
 char *editor_find_in_path(struct editor *editor, char *file);
 
+struct pool *editor_pool(struct editor *editor);
+
 struct editor_command {
   const char *name;
   const char *shortname;
@@ -155,8 +199,17 @@ struct editor_command {
 };
 void register_editor_command(struct editor_command *command);
 struct editor_command *command_parse(char *command, char **arg, bool *force);
+// If the command is a :s (or :substitute, or any abbreviation in between),
+// returns the rest of it starting at the pattern delimiter.
+char *command_parse_substitute(char *command);
 char **commands_get_sorted(int *len);
 
+// Parses the line range at the start of a command (e.g. "%" or ".,$+1"),
+// advancing past it. Returns false if there isn't one. first and last are
+// 0-based, and default to the cursor line.
+bool editor_parse_range(
+    struct editor *editor, char **command, int *first, int *last);
+
 void editor_execute_command(struct editor *editor, char *command);
 
 #define EDITOR_COMMAND_WITH_COMPLETION(name, shortname, completion) \
@@ -1,6 +1,7 @@
 #include "gap.h"
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -12,6 +13,21 @@
 
 #define GAPSIZE 1024
 
+// The memory of a gap buffer, once it's been shared with snapshots. It's
+// freed by whichever of them lets go of it last.
+struct gb_storage {
+  atomic_size_t refs;
+  char *buf;
+};
+
+static void gb_storage_release(struct gb_storage *storage) {
+  if (atomic_fetch_sub(&storage->refs, 1) > 1) {
+    return;
+  }
+  free(storage->buf);
+  free(storage);
+}
+
 struct gapbuf *gb_create(void) {
   struct gapbuf *gb = xmalloc(sizeof(*gb));
 
@@ -23,6 +39,7 @@ struct gapbuf *gb_create(void) {
 
   gb->lines = intbuf_create(10);
   intbuf_add(gb->lines, 0);
+  gb->shared = NULL;
   return gb;
 }
 
@@ -45,14 +62,14 @@ static struct gapbuf *gb_load(FILE *fp, size_t filesize) {
   }
 
   gb->lines = intbuf_create(10);
-  ssize_t last = -1;
-  for (ssize_t i = 0; (size_t) i < filesize; ++i) {
-    if (gb->gapend[i] == '\n') {
-      unsigned int len = (unsigned int) (i - last) - 1;
-      intbuf_add(gb->lines, len);
-      last = (ssize_t) i;
-    }
+  char *line = gb->gapend;
+  char *end = gb->gapend + filesize;
+  char *newline;
+  while ((newline = memchr(line, '\n', (size_t) (end - line)))) {
+    intbuf_add(gb->lines, (unsigned int) (newline - line));
+    line = newline + 1;
   }
+  gb->shared = NULL;
 
   return gb;
 }
@@ -76,7 +93,11 @@ struct gapbuf *gb_fromstring(struct buf *buf) {
 }
 
 void gb_free(struct gapbuf *gb) {
-  free(gb->bufstart);
+  if (gb->shared) {
+    gb_storage_release(gb->shared);
+  } else {
+    free(gb->bufstart);
+  }
   intbuf_free(gb->lines);
   free(gb);
 }
@@ -104,6 +125,17 @@ char gb_getchar(struct gapbuf *gb, size_t pos) {
   return gb->bufstart[gb_index(gb, pos)];
 }
 
+const char *gb_span(struct gapbuf *gb, size_t pos, size_t *n) {
+  size_t before = (size_t) (gb->gapstart - gb->bufstart);
+  if (pos < before) {
+    *n = before - pos;
+    return gb->bufstart + pos;
+  }
+  char *start = gb->gapend + (pos - before);
+  *n = (size_t) (gb->bufend - start);
+  return start;
+}
+
 int gb_utf8len(struct gapbuf *gb, size_t pos) {
   return tb_utf8_char_length(gb_getchar(gb, pos));
 }
@@ -150,17 +182,53 @@ struct buf *gb_getline(struct gapbuf *gb, size_t pos) {
   return gb_getstring(gb, pos - column, gb->lines->buf[line]);
 }
 
+// Stops sharing the memory with snapshots, copying it if any are left.
+static void gb_unshare(struct gapbuf *gb) {
+  struct gb_storage *storage = gb->shared;
+  if (!storage) {
+    return;
+  }
+  gb->shared = NULL;
+  if (atomic_load(&storage->refs) == 1) {
+    free(storage);
+    return;
+  }
+
+  ptrdiff_t leftsize = gb->gapstart - gb->bufstart;
+  ptrdiff_t gapsize = gb->gapend - gb->gapstart;
+  ptrdiff_t rightsize = gb->bufend - gb->gapend;
+  char *buf = xmalloc((size_t) (gb->bufend - gb->bufstart));
+  memcpy(buf, gb->bufstart, (size_t) leftsize);
+  memcpy(buf + leftsize + gapsize, gb->gapend, (size_t) rightsize);
+  gb->bufstart = buf;
+  gb->gapstart = buf + leftsize;
+  gb->gapend = gb->gapstart + gapsize;
+  gb->bufend = gb->gapend + rightsize;
+  gb_storage_release(storage);
+}
+
+// To be called before writing to the memory from start to end.
+static void gb_will_write(struct gapbuf *gb, char *start, char *end) {
+  if (gb->shared &&
+      (start < gb->safestart || end > gb->safeend ||
+       atomic_load(&gb->shared->refs) == 1)) {
+    gb_unshare(gb);
+  }
+}
+
 // Moves the gap so that gb->bufstart + pos == gb->gapstart.
 void gb_mvgap(struct gapbuf *gb, size_t pos) {
   char *point = gb->bufstart + gb_index(gb, pos);
-  if (gb->gapend <= point) {
+  if (gb->gapend < point) {
     size_t n = (size_t)(point - gb->gapend);
-    memcpy(gb->gapstart, gb->gapend, n);
+    gb_will_write(gb, gb->gapstart, gb->gapstart + n);
+    memmove(gb->gapstart, gb->gapend, n);
     gb->gapstart += n;
     gb->gapend += n;
   } else if (point < gb->gapstart) {
     size_t n = (size_t)(gb->gapstart - point);
-    memcpy(gb->gapend - n, point, n);
+    gb_will_write(gb, gb->gapend - n, gb->gapend);
+    memmove(gb->gapend - n, gb->gapstart - n, n);
     gb->gapstart -= n;
     gb->gapend -= n;
   }
@@ -177,6 +245,7 @@ static void gb_growgap(struct gapbuf *gb, size_t n) {
   while (newgapsize < 2*n) {
     newgapsize += GAPSIZE;
   }
+  gb_unshare(gb);
   // Pointers will be obsoleted so remember offsets...
   ptrdiff_t leftsize = gb->gapstart - gb->bufstart;
   ptrdiff_t rightsize = gb->bufend - gb->gapend;
@@ -199,6 +268,7 @@ void gb_putchar(struct gapbuf *gb, char c, size_t pos) {
 void gb_putstring(struct gapbuf *gb, char *buf, size_t n, size_t pos) {
   gb_growgap(gb, n);
   gb_mvgap(gb, pos);
+  gb_will_write(gb, gb->gapstart, gb->gapstart + n);
   memcpy(gb->gapstart, buf, n);
 
   size_t line, col;
@@ -245,21 +315,110 @@ void gb_del(struct gapbuf *gb, size_t n, size_t pos) {
 
   // Empty files are tricky for us, so insert a newline if needed...
   if (!gb_size(gb)) {
+    gb_will_write(gb, gb->gapstart, gb->gapstart + 1);
     *(gb->gapstart++) = '\n';
     intbuf_add(gb->lines, 0);
   }
 }
 
+struct gb_snapshot *gb_snapshot(struct gapbuf *gb) {
+  if (gb->shared && atomic_load(&gb->shared->refs) == 1) {
+    gb_unshare(gb);
+  }
+  if (!gb->shared) {
+    gb->shared = xmalloc(sizeof(*gb->shared));
+    atomic_init(&gb->shared->refs, 1);
+    gb->shared->buf = gb->bufstart;
+    gb->safestart = gb->gapstart;
+    gb->safeend = gb->gapend;
+  } else {
+    // Earlier snapshots may still be looking at what's outside the old gap.
+    gb->safestart = max(gb->safestart, gb->gapstart);
+    gb->safeend = max(gb->safestart, min(gb->safeend, gb->gapend));
+  }
+  atomic_fetch_add(&gb->shared->refs, 1);
+
+  struct gb_snapshot *snap = xmalloc(sizeof(*snap));
+  snap->storage = gb->shared;
+  snap->before = gb->bufstart;
+  snap->nbefore = (size_t) (gb->gapstart - gb->bufstart);
+  snap->after = gb->gapend;
+  snap->nafter = (size_t) (gb->bufend - gb->gapend);
+  return snap;
+}
+
+void gb_snapshot_free(struct gb_snapshot *snap) {
+  gb_storage_release(snap->storage);
+  free(snap);
+}
+
+size_t gb_snapshot_size(struct gb_snapshot *snap) {
+  return snap->nbefore + snap->nafter;
+}
+
+const char *gb_snapshot_span(struct gb_snapshot *snap, size_t pos, size_t *n) {
+  if (pos < snap->nbefore) {
+    *n = snap->nbefore - pos;
+    return snap->before + pos;
+  }
+  *n = snap->nbefore + snap->nafter - pos;
+  return snap->after + (pos - snap->nbefore);
+}
+
+void gb_snapshot_getstring_into(
+    struct gb_snapshot *snap, size_t pos, size_t n, char *buf) {
+  size_t copied = 0;
+  while (copied < n) {
+    size_t len;
+    const char *span = gb_snapshot_span(snap, pos + copied, &len);
+    len = min(len, n - copied);
+    memcpy(buf + copied, span, len);
+    copied += len;
+  }
+  buf[n] = '\0';
+}
+
 size_t gb_indexof(struct gapbuf *gb, char c, size_t start) {
   size_t size = gb_size(gb);
-  for (size_t i = start; i < size; ++i) {
-    if (gb_getchar(gb, i) == c) {
-      return i;
+  while (start < size) {
+    size_t n;
+    const char *s = gb_span(gb, start, &n);
+    const char *found = memchr(s, c, n);
+    if (found) {
+      return start + (size_t) (found - s);
     }
+    start += n;
   }
   return size;
 }
 
+size_t gb_findstring(
+    struct gapbuf *gb, const char *s, size_t n, size_t start, size_t end) {
+  size_t pos = start;
+  while (pos < end && end - pos >= n) {
+    size_t len;
+    const char *span = gb_span(gb, pos, &len);
+    len = min(len, end - pos);
+    const char *found = memmem(span, len, s, n);
+    if (found) {
+      return pos + (size_t) (found - span);
+    }
+    // The span ends at the gap, so look for s straddling it.
+    size_t next = pos + len;
+    for (size_t i = next - min(len, n - 1); i < next && i + n <= end; ++i) {
+      size_t j = 0;
+      while (j < n && gb_getchar(gb, i + j) == s[j]) {
+        j++;
+      }
+      if (j == n) {
+        return i;
+      }
+    }
+    pos = next;
+  }
+  return n ? end : start;
+}
+
 ssize_t gb_lastindexof(struct gapbuf *gb, char c, size_t start) {
   for (ssize_t i = (ssize_t) start; i >= 0; --i) {
     if (gb_getchar(gb, (size_t) i) == c) {
@@ -5,6 +5,7 @@
 #include <stdio.h>
 
 struct buf;
+struct gb_storage;
 
 // A "gap buffer" or "split buffer". It's a big buffer that internally
 // is separated into two buffers with a gap in the middle -- this allows
@@ -21,6 +22,13 @@ struct gapbuf {
 
   // An array of line lengths, with one element per line.
   struct intbuf *lines;
+
+  // Set if the memory is shared with snapshots (see below), in which case
+  // only the part of it from safestart to safeend can be written to without
+  // the buffer first moving to a copy of its own.
+  struct gb_storage *shared;
+  char *safestart;
+  char *safeend;
 };
 
 // The gap is just an implementation detail. In what follows, "the buffer"
@@ -47,6 +55,11 @@ void gb_save(struct gapbuf *gb, FILE *fp);
 // Returns the character at offset pos from the start of the buffer.
 char gb_getchar(struct gapbuf *gb, size_t pos);
 
+// Returns a pointer to the character at offset pos, and sets *n to the number
+// of characters from there on that are contiguous in memory (i.e. up to the
+// gap or the end of the buffer).
+const char *gb_span(struct gapbuf *gb, size_t pos, size_t *n);
+
 // Returns the unicode codepoint at offset pos from the start of the buffer.
 uint32_t gb_utf8(struct gapbuf *gb, size_t pos);
 // Returns the utf8 length of the character at offset pos from the start of the buffer.
@@ -81,6 +94,10 @@ void gb_del(struct gapbuf *gb, size_t n, size_t pos);
 // Return the offset of the first occurrence of c in the buffer, starting at
 // offset start, or gb_size(gb) if c is not found.
 size_t gb_indexof(struct gapbuf *gb, char c, size_t start);
+// Return the offset of the first occurrence of the n characters of s that
+// lies entirely between offsets start and end, or end if there isn't one.
+size_t gb_findstring(
+    struct gapbuf *gb, const char *s, size_t n, size_t start, size_t end);
 // Return the offset of the last occurrence of c in the buffer, starting at
 // offset start, or -1 if c is not found.
 ssize_t gb_lastindexof(struct gapbuf *gb, char c, size_t start);
@@ -89,3 +106,26 @@ ssize_t gb_lastindexof(struct gapbuf *gb, char c, size_t start);
 void gb_pos_to_linecol(struct gapbuf *gb, size_t pos, size_t *line, size_t *offset);
 // Vice versa.
 size_t gb_linecol_to_pos(struct gapbuf *gb, size_t line, size_t offset);
+
+// The text of a gap buffer as it was at some point, which other threads can
+// read while the buffer carries on being edited. Taking one copies nothing:
+// the memory is shared, and the buffer only makes a copy of its own if an
+// edit would write over text that a snapshot still around can see. Typing
+// only ever writes into the gap, so that's rare.
+struct gb_snapshot {
+  struct gb_storage *storage;
+  const char *before;
+  size_t nbefore;
+  const char *after;
+  size_t nafter;
+};
+
+struct gb_snapshot *gb_snapshot(struct gapbuf *gb);
+// Can be called from any thread.
+void gb_snapshot_free(struct gb_snapshot *snap);
+
+size_t gb_snapshot_size(struct gb_snapshot *snap);
+// Like gb_span and gb_getstring_into, but for the snapshot's text.
+const char *gb_snapshot_span(struct gb_snapshot *snap, size_t pos, size_t *n);
+void gb_snapshot_getstring_into(
+    struct gb_snapshot *snap, size_t pos, size_t n, char *buf);
@@ -235,6 +235,14 @@ static void editor_next_completion(struct editor *editor) {
   editor_select_completion(editor);
 }
 
+void insert_mode_paste(struct editor *editor, struct buf *text) {
+  // Pasted text is inserted as is, without autoindent or completion, as a
+  // single edit.
+  editor_exit_completion(editor);
+  buffer_do_insert(editor->window->buffer, text,
+      window_cursor(editor->window));
+}
+
 void insert_mode_key_pressed(struct editor* editor, struct tb_event* ev) {
   struct buffer *buffer = editor->window->buffer;
   size_t cursor = window_cursor(editor->window);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A word the tokenizer gives its own kind of token. The tables of these are
+// generated at build time from the files in syntax/ by tools/genkeywords.c,
+// as perfect hash tables: each word is in the slot its hash picks, so looking
+// a word up takes a single comparison.
+struct keyword {
+  const char *word;
+  size_t len;
+  // An enum syntax_token_kind (the tables are generated without syntax.h).
+  int kind;
+};
+
+// FNV-1a, with the seed the generator picked so that the words don't collide.
+static inline uint32_t keyword_hash(const char *s, size_t len, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= (unsigned char) s[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
@@ -105,7 +105,9 @@ int main(int argc, char *argv[]) {
   struct tb_event ev;
   while (editor_waitkey(editor, &ev)) {
     editor_handle_key_press(editor, &ev);
-    editor_draw(editor);
+    if (editor_should_draw(editor)) {
+      editor_draw(editor);
+    }
   }
 
   return 0;
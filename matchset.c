@@ -0,0 +1,262 @@
+#include "matchset.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "gap.h"
+#include "util.h"
+
+// How many lines around an edit are searched again, in addition to the edited
+// lines themselves.
+#define MATCH_SET_CONTEXT_LINES 1
+
+// How much text is searched between checks of the deadline (rounded up to
+// the end of a line).
+#define MATCH_SET_CHUNK_SIZE (1 << 16)
+
+// Both helpers below rely on the regions being sorted such that their starts
+// and their ends are both nondecreasing, which is the case for the searched
+// ranges (which are disjoint) and for the matches (which don't overlap).
+
+// Returns the index of the first region that ends after pos.
+static size_t regions_first_ending_after(struct regionbuf *buf, size_t pos) {
+  size_t lo = 0;
+  size_t hi = buf->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (buf->buf[mid].end <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Returns the index of the first region that starts at or after pos.
+static size_t regions_first_starting_from(struct regionbuf *buf, size_t pos) {
+  size_t lo = 0;
+  size_t hi = buf->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (buf->buf[mid].start < pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static void regions_after_insert(struct regionbuf *buf, size_t pos, size_t n) {
+  for (size_t i = regions_first_ending_after(buf, pos); i < buf->len; ++i) {
+    struct region *region = &buf->buf[i];
+    if (region->start >= pos) {
+      region->start += n;
+    }
+    region->end += n;
+  }
+}
+
+static size_t pos_after_delete(size_t x, size_t pos, size_t n) {
+  if (x <= pos) {
+    return x;
+  }
+  return x >= pos + n ? x - n : pos;
+}
+
+static void regions_after_delete(struct regionbuf *buf, size_t pos, size_t n) {
+  for (size_t i = regions_first_ending_after(buf, pos); i < buf->len; ++i) {
+    struct region *region = &buf->buf[i];
+    region->start = pos_after_delete(region->start, pos, n);
+    region->end = pos_after_delete(region->end, pos, n);
+  }
+}
+
+// Removes [start, end) from a list of disjoint ranges.
+static void ranges_subtract(struct regionbuf *buf, size_t start, size_t end) {
+  size_t i = regions_first_ending_after(buf, start);
+  while (i < buf->len && buf->buf[i].start < end) {
+    struct region *range = &buf->buf[i];
+    if (range->start < start && range->end > end) {
+      struct region tail = {end, range->end};
+      range->end = start;
+      regionbuf_insert(buf, &tail, i + 1);
+      return;
+    }
+    if (range->start < start) {
+      range->end = start;
+      i++;
+    } else if (range->end > end) {
+      range->start = end;
+      return;
+    } else {
+      regionbuf_remove(buf, i, 1);
+    }
+  }
+}
+
+// Adds [start, end) to a list of disjoint ranges, which must not overlap it.
+static void ranges_add(struct regionbuf *buf, size_t start, size_t end) {
+  size_t i = regions_first_starting_from(buf, start);
+  bool joins_prev = i > 0 && buf->buf[i - 1].end == start;
+  bool joins_next = i < buf->len && buf->buf[i].start == end;
+  if (joins_prev && joins_next) {
+    buf->buf[i - 1].end = buf->buf[i].end;
+    regionbuf_remove(buf, i, 1);
+  } else if (joins_prev) {
+    buf->buf[i - 1].end = end;
+  } else if (joins_next) {
+    buf->buf[i].start = start;
+  } else {
+    struct region range = {start, end};
+    regionbuf_insert(buf, &range, i);
+  }
+}
+
+static size_t line_start(struct gapbuf *gb, size_t pos) {
+  return pos ? (size_t) (gb_lastindexof(gb, '\n', pos - 1) + 1) : 0;
+}
+
+static size_t next_line_start(struct gapbuf *gb, size_t pos) {
+  return min(gb_indexof(gb, '\n', pos) + 1, gb_size(gb));
+}
+
+// Forgets what is known about the lines from the one containing from to the
+// one containing to, plus some context around them.
+static void match_set_invalidate(struct match_set *set, size_t from, size_t to) {
+  struct gapbuf *gb = set->buffer->text;
+  size_t size = gb_size(gb);
+
+  size_t start = line_start(gb, min(from, size - 1));
+  size_t end = next_line_start(gb, min(to, size - 1));
+  for (int i = 0; i < MATCH_SET_CONTEXT_LINES; ++i) {
+    if (start > 0) {
+      start = line_start(gb, start - 1);
+    }
+    end = next_line_start(gb, end);
+  }
+
+  ranges_subtract(set->searched, start, end);
+
+  struct regionbuf *matches = set->matches;
+  size_t first = min(regions_first_ending_after(matches, start),
+                     regions_first_starting_from(matches, start));
+  size_t last = regions_first_starting_from(matches, end);
+  if (last > first) {
+    regionbuf_remove(matches, first, last - first);
+  }
+}
+
+static void match_set_inserted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct match_set *set = (struct match_set*) listener;
+  regions_after_insert(set->searched, pos, n);
+  regions_after_insert(set->matches, pos, n);
+  match_set_invalidate(set, pos, pos + n);
+}
+
+static void match_set_deleted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct match_set *set = (struct match_set*) listener;
+  regions_after_delete(set->searched, pos, n);
+  regions_after_delete(set->matches, pos, n);
+  match_set_invalidate(set, pos, pos);
+}
+
+struct match_set *buffer_match_set(
+    struct buffer *buffer, char *pattern, int flags) {
+  struct match_set *set = buffer->matches;
+  if (set && set->flags == flags && !strcmp(set->pattern, pattern)) {
+    return set;
+  }
+
+  if (set) {
+    match_set_free(set);
+    buffer->matches = NULL;
+  }
+
+  set = xmalloc(sizeof(*set));
+  if (search_init(&set->search, pattern, flags, NULL, 0)) {
+    free(set);
+    return NULL;
+  }
+
+  set->listener.inserted = match_set_inserted;
+  set->listener.deleted = match_set_deleted;
+  set->buffer = buffer;
+  set->pattern = xstrdup(pattern);
+  set->flags = flags;
+  set->searched = regionbuf_create(8);
+  set->matches = regionbuf_create(64);
+
+  buffer_add_listener(buffer, &set->listener);
+  buffer->matches = set;
+  return set;
+}
+
+void match_set_free(struct match_set *set) {
+  buffer_remove_listener(set->buffer, &set->listener);
+  search_deinit(&set->search);
+  free(set->pattern);
+  regionbuf_free(set->searched);
+  regionbuf_free(set->matches);
+  free(set);
+}
+
+static void match_set_search(struct match_set *set, size_t start, size_t end) {
+  struct buf *text = gb_getstring(set->buffer->text, start, end - start);
+  struct search *search = &set->search;
+  search_set_text(search, text->buf, text->len);
+  // If pcre2 gave up on the pattern, the rest of this range just won't be
+  // highlighted.
+  search->error = 0;
+
+  struct regionbuf *found = regionbuf_create(16);
+  struct region match;
+  while (search_next_match(search, &match)) {
+    match.start += start;
+    match.end += start;
+    regionbuf_add(found, &match);
+  }
+  buf_free(text);
+
+  size_t i = regions_first_starting_from(set->matches, start);
+  regionbuf_insert_n(set->matches, found->buf, found->len, i);
+  regionbuf_free(found);
+
+  ranges_add(set->searched, start, end);
+}
+
+size_t match_set_query(struct match_set *set, size_t start, size_t end,
+    struct deadline *deadline, struct region **matches) {
+  struct gapbuf *gb = set->buffer->text;
+  struct regionbuf *searched = set->searched;
+  size_t pos = start;
+  size_t i = regions_first_ending_after(searched, pos);
+  while (pos < end) {
+    struct region *next = i < searched->len ? &searched->buf[i] : NULL;
+    if (next && next->start <= pos) {
+      pos = next->end;
+      i++;
+      continue;
+    }
+
+    if (deadline_passed(deadline)) {
+      break;
+    }
+    size_t gap_end = next ? min(next->start, end) : end;
+    if (gap_end - pos > MATCH_SET_CHUNK_SIZE) {
+      gap_end = min(gap_end, next_line_start(gb, pos + MATCH_SET_CHUNK_SIZE));
+    }
+    match_set_search(set, pos, gap_end);
+    pos = gap_end;
+    i = regions_first_ending_after(searched, pos);
+  }
+
+  size_t first = regions_first_ending_after(set->matches, start);
+  size_t last = regions_first_starting_from(set->matches, end);
+  *matches = set->matches->buf + first;
+  return last > first ? last - first : 0;
+}
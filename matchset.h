@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "buffer.h"
+#include "search.h"
+
+// The matches of a pattern in a buffer. Rather than searching the whole text
+// up front, ranges are searched as they are asked for (e.g. as they scroll
+// into view), and the results are kept up to date as the buffer is edited:
+// an edit only causes the lines around it to be searched again.
+struct match_set {
+  // Must be first, so the listener callbacks can get at the match set.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+
+  char *pattern;
+  // A combination of enum search_flags.
+  int flags;
+  struct search search;
+
+  // The ranges of the text which have been searched, sorted and disjoint.
+  // Each range starts at the beginning of a line and ends after a newline.
+  struct regionbuf *searched;
+  // The matches found in the searched ranges, sorted.
+  struct regionbuf *matches;
+};
+
+// Returns the match set for the given pattern in the buffer, replacing the
+// buffer's previous match set if it was for a different pattern.
+// Returns NULL if the pattern is not a valid regex.
+struct match_set *buffer_match_set(
+    struct buffer *buffer, char *pattern, int flags);
+
+void match_set_free(struct match_set *set);
+
+// Sets *matches to the matches overlapping [start, end), and returns how many
+// there are, searching whatever part of the range hasn't been searched yet.
+// start must be the beginning of a line, and end must be just past a newline
+// (or the end of the buffer). The returned pointer is only valid until the
+// next call or edit.
+//
+// If the deadline passes, the rest of the range is left for a later call,
+// and only the matches in the part searched so far are returned.
+size_t match_set_query(struct match_set *set, size_t start, size_t end,
+    struct deadline *deadline, struct region **matches);
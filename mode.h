@@ -3,8 +3,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "search.h"
 #include "util.h"
 
+struct buf;
 struct editor;
 struct tb_event;
 
@@ -44,6 +46,8 @@ struct insert_mode {
   struct history_entry *completion;
   struct history *completions;
 };
+// Insert text pasted into the terminal all at once.
+void insert_mode_paste(struct editor *editor, struct buf *text);
 
 struct visual_mode {
   struct editing_mode mode;
@@ -75,6 +79,9 @@ struct cmdline_mode {
     COMPLETION_PATHS,
   } completion_kind;
   char prompt;
+
+  // Left over from the last search, with 'incsearch'.
+  struct incsearch incsearch;
 };
 
 void editor_load_completions(struct editor *editor,
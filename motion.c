@@ -10,6 +10,7 @@
 #include "buffer.h"
 #include "editor.h"
 #include "gap.h"
+#include "parse.h"
 #include "search.h"
 #include "window.h"
 #include "util.h"
@@ -300,6 +301,8 @@ static size_t search_cycle(struct motion_context ctx,
                            enum search_direction direction) {
   struct region match;
   if (editor_search(ctx.editor, NULL, ctx.pos, direction, &match)) {
+    struct editor_register *lsp = editor_get_register(ctx.editor, '/');
+    editor_count_matches(ctx.editor, lsp->buf->buf, match.start);
     return match.start;
   }
   return ctx.pos;
@@ -321,6 +324,9 @@ static size_t word_under_cursor(struct motion_context ctx, size_t start,
   history_add_item(&ctx.editor->search_history, pattern->buf);
   struct region match;
   bool found = editor_search(ctx.editor, pattern->buf, start, direction, &match);
+  if (found) {
+    editor_count_matches(ctx.editor, pattern->buf, match.start);
+  }
   buf_free(word);
   buf_free(pattern);
   return found ? match.start : ctx.pos;
@@ -337,6 +343,14 @@ static size_t word_under_cursor_prev(struct motion_context ctx) {
 
 static size_t matching_paren(struct motion_context ctx) {
   struct gapbuf *gb = ctx.window->buffer->text;
+  // In C, skip over the brackets in comments, strings and so on.
+  struct parse *parse = buffer_parse_lazy(ctx.window->buffer);
+  if (parse) {
+    size_t bracket, match;
+    return parse_match_bracket(parse, ctx.pos, &bracket, &match) ?
+        match : ctx.pos;
+  }
+
   char a = '\0';
   size_t start;
   for (start = ctx.pos; !is_line_end(gb, start); ++start) {
@@ -369,6 +383,49 @@ static size_t matching_paren(struct motion_context ctx) {
   return gb_getchar(gb, end) == b ? end : ctx.pos;
 }
 
+static bool is_section_start(struct motion_context ctx) {
+  struct gapbuf *gb = ctx.window->buffer->text;
+  return is_line_start(gb, ctx.pos) && gb_getchar(gb, ctx.pos) == '{';
+}
+
+static bool is_section_end(struct motion_context ctx) {
+  struct gapbuf *gb = ctx.window->buffer->text;
+  return is_line_start(gb, ctx.pos) && gb_getchar(gb, ctx.pos) == '}';
+}
+
+// In C, a section is a top-level block, wherever its braces are. Otherwise,
+// as in vim, it's a '{' or '}' at the start of a line. With no more sections,
+// these go to the start or end of the buffer.
+static size_t section(struct motion_context ctx, bool forwards, bool closing) {
+  struct parse *parse = buffer_parse_lazy(ctx.window->buffer);
+  if (parse) {
+    size_t brace;
+    if (parse_find_block(parse, ctx.pos, forwards, closing, &brace)) {
+      return brace;
+    }
+    return forwards ? gb_size(ctx.window->buffer->text) - 1 : 0;
+  }
+  bool (*pred)(struct motion_context) =
+      closing ? is_section_end : is_section_start;
+  return forwards ? next_until(ctx, pred) : prev_until(ctx, pred);
+}
+
+static size_t section_start_backward(struct motion_context ctx) {
+  return section(ctx, false, false);
+}
+
+static size_t section_start_forward(struct motion_context ctx) {
+  return section(ctx, true, false);
+}
+
+static size_t section_end_backward(struct motion_context ctx) {
+  return section(ctx, false, true);
+}
+
+static size_t section_end_forward(struct motion_context ctx) {
+  return section(ctx, true, true);
+}
+
 #define LINEWISE true, false
 #define EXCLUSIVE false, true
 #define INCLUSIVE false, false
@@ -414,6 +471,18 @@ static struct motion g_motion_table[] = {
   {-1, NULL, false, false, false}
 };
 
+static struct motion left_bracket_motion_table[] = {
+  {'[', section_start_backward, EXCLUSIVE, REPEAT},
+  {']', section_end_backward, EXCLUSIVE, REPEAT},
+  {-1, NULL, false, false, false}
+};
+
+static struct motion right_bracket_motion_table[] = {
+  {']', section_start_forward, EXCLUSIVE, REPEAT},
+  {'[', section_end_forward, EXCLUSIVE, REPEAT},
+  {-1, NULL, false, false, false}
+};
+
 static struct motion *motion_find(struct motion *table, char name) {
   for (int i = 0; table[i].name != -1; ++i) {
     if (table[i].name == name) {
@@ -425,8 +494,12 @@ static struct motion *motion_find(struct motion *table, char name) {
 
 struct motion *motion_get(struct editor *editor, struct tb_event *ev) {
   struct motion *table = motion_table;
-  if (ev->ch == 'g') {
-    table = g_motion_table;
+  switch (ev->ch) {
+  case 'g': table = g_motion_table; break;
+  case '[': table = left_bracket_motion_table; break;
+  case ']': table = right_bracket_motion_table; break;
+  }
+  if (table != motion_table) {
     editor_waitkey(editor, ev);
   }
   return motion_find(table, (char) ev->ch);
@@ -102,6 +102,15 @@ void normal_mode_key_pressed(struct editor* editor, struct tb_event* ev) {
     return;
   case TB_KEY_ENTER: {
     struct buffer *buffer = editor->window->buffer;
+    if (buffer == editor->quickfix.buffer) {
+      size_t line, column;
+      gb_pos_to_linecol(
+          buffer->text, window_cursor(editor->window), &line, &column);
+      if (line < editor->quickfix.len) {
+        editor_jump_to_quickfix(editor, line);
+      }
+      return;
+    }
     if (!buffer->directory) {
       return;
     }
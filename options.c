@@ -439,6 +439,10 @@ static void editor_command_set_impl(
       break;
     }
   }
+
+  if (!strcmp(info->name, "syntaxpath")) {
+    editor_load_syntax(editor);
+  }
 }
 
 EDITOR_COMMAND_WITH_COMPLETION(setglobal, setg, COMPLETION_OPTIONS) {
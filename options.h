@@ -28,14 +28,21 @@ typedef char* string;
   OPTION(history, int, 50) \
   OPTION(hlsearch, bool, false) \
   OPTION(ignorecase, bool, false) \
+  OPTION(inccommand, string, "") \
   OPTION(incsearch, bool, false) \
   OPTION(path, string, ".,/usr/include,,") \
+  OPTION(redrawtime, int, 100) \
   OPTION(ruler, bool, false) \
+  OPTION(shortmess, string, "") \
   OPTION(showmode, bool, true) \
   OPTION(sidescroll, int, 0) \
   OPTION(smartcase, bool, false) \
   OPTION(splitbelow, bool, false) \
   OPTION(splitright, bool, false) \
+  OPTION(syntaxpath, string, "~/.badavi/syntax," BADAVI_SYNTAX_DIR) \
+  OPTION(trigramindex, bool, false) \
+  OPTION(ttimeoutlen, int, 0) \
+  OPTION(unicodeclasses, bool, false) \
 
 struct editor;
 struct window;
@@ -0,0 +1,950 @@
+#include "parse.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "gap.h"
+#include "keywords.h"
+#include "syntax.h"
+#include "util.h"
+
+// How far past a typedef its name is looked for, and how far before or after
+// a block the name of its declaration is.
+#define PARSE_DECLARATION_MAX (1 << 12)
+
+// The fewest lines tokenized at a time when a lookup has to go further down
+// the buffer than has been tokenized.
+#define PARSE_TOKENIZE_AHEAD 1024
+
+struct parse_line {
+  // The brackets outside comments, strings and so on, and their offsets in the
+  // line.
+  char *brackets;
+  unsigned int *offsets;
+  size_t nbrackets;
+  // The offset of "typedef" in the line, or -1.
+  ssize_t typedef_offset;
+};
+
+struct parse {
+  // Must be first, so the listener callbacks can get at the parse.
+  struct syntax_listener listener;
+  struct buffer *buffer;
+
+  // What was read from each line the last time the syntax cache tokenized it.
+  struct parse_line *lines;
+  size_t nlines;
+  size_t cap;
+
+  // Whether the blocks and the types need working out again.
+  bool stale_blocks;
+  bool stale_types;
+  // The top-level blocks are worked out a line at a time, and only as far
+  // down as a lookup needs them: so far, from the first blocks_scanned lines.
+  // depth braces are open at the end of those, the first of them at open.
+  struct parse_block *blocks;
+  size_t nblocks;
+  size_t blockscap;
+  size_t blocks_scanned;
+  size_t depth;
+  struct parse_block open;
+  // How many lines from the top the syntax cache had up to date, the last
+  // time this asked it to tokenize some. Only good for one lookup, since an
+  // edit can change it.
+  size_t tokenized;
+
+  // The names typedefs declare, in a hash table with empty slots left NULL.
+  struct keyword *types;
+  size_t typesmask;
+  // The lines each typedef spans, so that an edit to one is noticed.
+  struct parse_span {
+    size_t first;
+    size_t last;
+  } *typedefs;
+  size_t ntypedefs;
+  size_t typedefscap;
+  // Incremented whenever the types are worked out again.
+  size_t types_generation;
+};
+
+static bool is_word_char(char c) {
+  return isalnum((unsigned char) c) || c == '_';
+}
+
+static bool is_bracket(char c) {
+  switch (c) {
+  case '(': case ')': case '[': case ']': case '{': case '}':
+    return true;
+  default:
+    return false;
+  }
+}
+
+static bool has_braces(struct parse_line *line) {
+  for (size_t i = 0; i < line->nbrackets; ++i) {
+    if (line->brackets[i] == '{' || line->brackets[i] == '}') {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void parse_lines_init(struct parse_line *lines, size_t n) {
+  memset(lines, 0, n * sizeof(*lines));
+  for (size_t i = 0; i < n; ++i) {
+    lines[i].typedef_offset = -1;
+  }
+}
+
+// Moves a line number along for lines removed or added after the given line.
+// A line that was removed ends up on that one.
+static size_t parse_move_line(
+    size_t i, size_t line, size_t removed, size_t added) {
+  if (i <= line) {
+    return i;
+  }
+  if (i <= line + removed) {
+    return line;
+  }
+  return i - removed + added;
+}
+
+static void parse_moved(struct syntax_listener *listener,
+    size_t line, size_t removed, size_t added) {
+  struct parse *parse = (struct parse*) listener;
+  size_t nlines = parse->nlines - removed + added;
+  if (removed) {
+    for (size_t i = line + 1; i <= line + removed; ++i) {
+      struct parse_line *l = &parse->lines[i];
+      if (i < parse->blocks_scanned && has_braces(l)) {
+        parse->stale_blocks = true;
+      }
+      if (l->typedef_offset >= 0) {
+        parse->stale_types = true;
+      }
+      free(l->brackets);
+      free(l->offsets);
+    }
+    memmove(&parse->lines[line + 1], &parse->lines[line + 1 + removed],
+        (parse->nlines - line - 1 - removed) * sizeof(*parse->lines));
+  } else {
+    if (nlines > parse->cap) {
+      parse->cap = max(nlines, parse->cap * 2);
+      parse->lines = xrealloc(parse->lines, parse->cap * sizeof(*parse->lines));
+    }
+    memmove(&parse->lines[line + 1 + added], &parse->lines[line + 1],
+        (parse->nlines - line - 1) * sizeof(*parse->lines));
+    parse_lines_init(&parse->lines[line + 1], added);
+  }
+  parse->nlines = nlines;
+
+  // The blocks and the typedefs' spans refer to lines by number, and are
+  // cheaper to move along than work out again. A brace on a removed line was
+  // noticed above, and the edited line gets read again once it's tokenized.
+  for (size_t i = 0; i < parse->nblocks; ++i) {
+    struct parse_block *block = &parse->blocks[i];
+    block->open_line = parse_move_line(block->open_line, line, removed, added);
+    block->close_line =
+        parse_move_line(block->close_line, line, removed, added);
+  }
+  parse->open.open_line =
+      parse_move_line(parse->open.open_line, line, removed, added);
+  if (parse->blocks_scanned > line + removed) {
+    parse->blocks_scanned = parse->blocks_scanned - removed + added;
+  } else if (parse->blocks_scanned > line) {
+    parse->blocks_scanned = line + 1;
+  }
+  for (size_t i = 0; i < parse->ntypedefs; ++i) {
+    struct parse_span *span = &parse->typedefs[i];
+    if (span->first > line + removed) {
+      span->first = span->first - removed + added;
+      span->last = span->last - removed + added;
+    } else if (span->last >= line) {
+      parse->stale_types = true;
+    }
+  }
+}
+
+static void parse_free_types(struct parse *parse) {
+  if (parse->types) {
+    for (size_t i = 0; i <= parse->typesmask; ++i) {
+      free((char*) parse->types[i].word);
+    }
+    free(parse->types);
+    parse->types = NULL;
+  }
+  parse->ntypedefs = 0;
+}
+
+void parse_free(struct parse *parse) {
+  if (!parse) {
+    return;
+  }
+  syntax_remove_listener(&parse->listener);
+  parse->buffer->parse = NULL;
+  for (size_t i = 0; i < parse->nlines; ++i) {
+    free(parse->lines[i].brackets);
+    free(parse->lines[i].offsets);
+  }
+  free(parse->lines);
+  free(parse->blocks);
+  parse_free_types(parse);
+  free(parse->typedefs);
+  free(parse);
+}
+
+// Whether the line has the same braces, at the same indices among its
+// brackets, so that the blocks referring to them still hold.
+static bool same_braces(struct parse_line *a, char *brackets, size_t n) {
+  size_t i = 0, j = 0;
+  for (;;) {
+    while (i < a->nbrackets && a->brackets[i] != '{' && a->brackets[i] != '}') {
+      i++;
+    }
+    while (j < n && brackets[j] != '{' && brackets[j] != '}') {
+      j++;
+    }
+    if (i == a->nbrackets || j == n) {
+      return i == a->nbrackets && j == n;
+    }
+    if (i != j || a->brackets[i++] != brackets[j++]) {
+      return false;
+    }
+  }
+}
+
+static bool parse_in_typedef(struct parse *parse, size_t line) {
+  for (size_t i = 0; i < parse->ntypedefs; ++i) {
+    if (parse->typedefs[i].first <= line && line <= parse->typedefs[i].last) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads the brackets and typedef on the line starting at start out of the
+// tokens the syntax cache just read from it.
+static void parse_tokenized(struct syntax_listener *listener,
+    size_t i, size_t start, struct syntax_line *tokens) {
+  struct parse *parse = (struct parse*) listener;
+  struct gapbuf *gb = parse->buffer->text;
+  struct parse_line *line = &parse->lines[i];
+
+  size_t n = 0;
+  size_t cap = 0;
+  char *brackets = NULL;
+  unsigned int *offsets = NULL;
+  ssize_t typedef_offset = -1;
+  size_t pos = start;
+  for (size_t r = 0; r < tokens->nruns; ++r) {
+    enum syntax_token_kind kind = SYNTAX_RUN_KIND(tokens->runs[r]);
+    size_t len = SYNTAX_RUN_LEN(tokens->runs[r]);
+    if (kind == SYNTAX_TOKEN_PUNCTUATION) {
+      for (size_t j = pos; j < pos + len; ++j) {
+        char c = gb_getchar(gb, j);
+        if (!is_bracket(c)) {
+          continue;
+        }
+        if (n == cap) {
+          cap = max(4, cap * 2);
+          brackets = xrealloc(brackets, cap * sizeof(*brackets));
+          offsets = xrealloc(offsets, cap * sizeof(*offsets));
+        }
+        brackets[n] = c;
+        offsets[n] = (unsigned int) (j - start);
+        n++;
+      }
+    } else if (kind == SYNTAX_TOKEN_TYPE && len == 7 &&
+        gb_getchar(gb, pos) == 't') {
+      char word[8];
+      gb_getstring_into(gb, pos, len, word);
+      if (!strcmp(word, "typedef") && typedef_offset < 0) {
+        typedef_offset = (ssize_t) (pos - start);
+      }
+    }
+    pos += len;
+  }
+
+  if (i < parse->blocks_scanned && !same_braces(line, brackets, n)) {
+    parse->stale_blocks = true;
+  }
+  if (!parse->stale_types) {
+    parse->stale_types = typedef_offset >= 0 || line->typedef_offset >= 0 ||
+        parse_in_typedef(parse, i);
+  }
+  free(line->brackets);
+  free(line->offsets);
+  line->brackets = brackets;
+  line->offsets = offsets;
+  line->nbrackets = n;
+  line->typedef_offset = typedef_offset;
+}
+
+// Reads the words and punctuation outside comments, strings and so on from
+// the tokens the syntax cache has for each line, stopping at a line it
+// doesn't have them for.
+struct parse_reader {
+  struct parse *parse;
+  size_t line;
+  // Where the line starts, and its tokens.
+  size_t start;
+  struct syntax_line *tokens;
+  // The run being read, where it starts, and the next character to read.
+  size_t run;
+  size_t runpos;
+  size_t pos;
+};
+
+struct parse_token {
+  size_t pos;
+  size_t len;
+  // The character, for punctuation, or '\0' for a word.
+  char c;
+};
+
+// Starts reading at pos, on the given line, which starts at start.
+static void parse_reader_init(struct parse_reader *reader,
+    struct parse *parse, size_t line, size_t start, size_t pos) {
+  reader->parse = parse;
+  reader->line = line;
+  reader->start = start;
+  reader->tokens = buffer_syntax_cached_line(parse->buffer, line);
+  reader->run = 0;
+  reader->runpos = start;
+  reader->pos = pos;
+  while (reader->tokens && reader->run < reader->tokens->nruns &&
+         reader->runpos + SYNTAX_RUN_LEN(reader->tokens->runs[reader->run]) <=
+             pos) {
+    reader->runpos += SYNTAX_RUN_LEN(reader->tokens->runs[reader->run++]);
+  }
+}
+
+static bool is_code(enum syntax_token_kind kind) {
+  switch (kind) {
+  case SYNTAX_TOKEN_IDENTIFIER:
+  case SYNTAX_TOKEN_LITERAL_NUMBER:
+  case SYNTAX_TOKEN_PUNCTUATION:
+  case SYNTAX_TOKEN_STATEMENT:
+  case SYNTAX_TOKEN_TYPE:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Reads the next word or punctuation character. Returns false at the end of
+// the tokens.
+static bool parse_read_token(
+    struct parse_reader *reader, struct parse_token *token) {
+  struct gapbuf *gb = reader->parse->buffer->text;
+  while (reader->tokens) {
+    if (reader->run == reader->tokens->nruns) {
+      if (reader->line + 1 >= reader->parse->nlines) {
+        return false;
+      }
+      reader->start += gb->lines->buf[reader->line++] + 1;
+      reader->tokens =
+          buffer_syntax_cached_line(reader->parse->buffer, reader->line);
+      reader->run = 0;
+      reader->runpos = reader->pos = reader->start;
+      continue;
+    }
+
+    uint32_t run = reader->tokens->runs[reader->run];
+    size_t end = reader->runpos + SYNTAX_RUN_LEN(run);
+    if (reader->pos == end || !is_code(SYNTAX_RUN_KIND(run))) {
+      reader->run++;
+      reader->runpos = reader->pos = end;
+      continue;
+    }
+    // Whitespace is tokenized along with identifiers.
+    char c = gb_getchar(gb, reader->pos);
+    token->pos = reader->pos++;
+    token->len = 1;
+    token->c = c;
+    if (SYNTAX_RUN_KIND(run) == SYNTAX_TOKEN_PUNCTUATION) {
+      return true;
+    }
+    if (is_word_char(c)) {
+      while (reader->pos < end && is_word_char(gb_getchar(gb, reader->pos))) {
+        reader->pos++;
+      }
+      token->len = reader->pos - token->pos;
+      token->c = '\0';
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns the name the typedef being read declares (or NULL), leaving the
+// reader on the line it ends on.
+static struct buf *parse_typedef_name(struct parse_reader *reader) {
+  size_t stop = reader->pos + PARSE_DECLARATION_MAX;
+  int braces = 0, parens = 0, squares = 0;
+  struct parse_token name = {0, 0, '\0'};
+  // Whether the declarator is in parentheses, as in typedef int (*f)(void),
+  // and whether its name was found.
+  bool pointer = false, found = false;
+  // Whether the last token opened the outermost parentheses.
+  bool opened = false;
+  struct parse_token token;
+  while (parse_read_token(reader, &token) && token.pos < stop) {
+    char c = token.c;
+    if (!c) {
+      if (!found && !braces && !squares && (!parens || pointer)) {
+        name = token;
+        found = pointer;
+      }
+      opened = false;
+      continue;
+    }
+    if (opened && c == '*') {
+      pointer = true;
+    }
+    opened = false;
+    if (c == '{') {
+      braces++;
+    } else if (c == '}') {
+      braces--;
+    } else if (braces) {
+      // Only the outside of a struct's body matters.
+    } else if (c == '[') {
+      squares++;
+    } else if (c == ']') {
+      squares--;
+    } else if (c == '(') {
+      opened = !parens++;
+    } else if (c == ')') {
+      parens--;
+    } else if (c == ';') {
+      struct gapbuf *gb = reader->parse->buffer->text;
+      return name.len ? gb_getstring(gb, name.pos, name.len) : NULL;
+    }
+  }
+  return NULL;
+}
+
+static void parse_add_type(struct parse *parse, struct buf *name) {
+  size_t slot = keyword_hash(name->buf, name->len, 0) & parse->typesmask;
+  while (parse->types[slot].word) {
+    if (!strcmp(parse->types[slot].word, name->buf)) {
+      return;
+    }
+    slot = (slot + 1) & parse->typesmask;
+  }
+  parse->types[slot].word = xstrdup(name->buf);
+  parse->types[slot].len = name->len;
+  parse->types[slot].kind = SYNTAX_TOKEN_TYPE;
+}
+
+static void parse_build_types(struct parse *parse) {
+  parse_free_types(parse);
+  size_t ntypedefs = 0;
+  for (size_t i = 0; i < parse->nlines; ++i) {
+    ntypedefs += parse->lines[i].typedef_offset >= 0;
+  }
+  size_t size = 16;
+  while (size < 2 * ntypedefs) {
+    size *= 2;
+  }
+  parse->typesmask = size - 1;
+  parse->types = xmalloc(size * sizeof(*parse->types));
+  memset(parse->types, 0, size * sizeof(*parse->types));
+  if (ntypedefs > parse->typedefscap) {
+    parse->typedefscap = ntypedefs;
+    parse->typedefs = xrealloc(parse->typedefs,
+        parse->typedefscap * sizeof(*parse->typedefs));
+  }
+
+  struct gapbuf *gb = parse->buffer->text;
+  size_t pos = 0;
+  for (size_t i = 0; i < parse->nlines; ++i) {
+    ssize_t offset = parse->lines[i].typedef_offset;
+    if (offset >= 0) {
+      struct parse_reader reader;
+      parse_reader_init(&reader, parse, i, pos,
+          pos + (size_t) offset + strlen("typedef"));
+      struct buf *name = parse_typedef_name(&reader);
+      if (name) {
+        parse_add_type(parse, name);
+        buf_free(name);
+      }
+      struct parse_span *span = &parse->typedefs[parse->ntypedefs++];
+      span->first = i;
+      span->last = reader.line;
+    }
+    pos += gb->lines->buf[i] + 1;
+  }
+}
+
+static void parse_add_block(struct parse *parse, struct parse_block *block) {
+  if (parse->nblocks == parse->blockscap) {
+    parse->blockscap = max(16, parse->blockscap * 2);
+    parse->blocks = xrealloc(
+        parse->blocks, parse->blockscap * sizeof(*parse->blocks));
+  }
+  parse->blocks[parse->nblocks++] = *block;
+}
+
+// Makes sure the given line has been read from up to date tokens, along with
+// those before it. from is where the lookup started: the further it's gone
+// from there, the more is tokenized at once.
+static void parse_tokenize_to(struct parse *parse, size_t line, size_t from) {
+  if (line < parse->tokenized) {
+    return;
+  }
+  size_t ahead = max(PARSE_TOKENIZE_AHEAD, line - min(line, from));
+  parse->tokenized = buffer_syntax_tokenize_to(
+      parse->buffer, min(line + ahead, parse->nlines - 1));
+}
+
+// Starts a lookup, making sure the lines through the given one, and those the
+// blocks were worked out from, are up to date. Those are tokenized exactly,
+// since an edit only has what changed tokenized again.
+static void parse_lookup_start(struct parse *parse, size_t line) {
+  line = max(line, parse->blocks_scanned ? parse->blocks_scanned - 1 : 0);
+  parse->tokenized = buffer_syntax_tokenize_to(parse->buffer, line);
+  if (parse->stale_blocks) {
+    parse->nblocks = 0;
+    parse->blocks_scanned = 0;
+    parse->depth = 0;
+    parse->stale_blocks = false;
+  }
+}
+
+// Works out the blocks from one more line. A block still open at the end of
+// the buffer ends there.
+static void parse_scan_line(struct parse *parse, size_t from) {
+  size_t i = parse->blocks_scanned;
+  parse_tokenize_to(parse, i, from);
+  struct parse_line *line = &parse->lines[i];
+  struct parse_block *block = &parse->open;
+  for (size_t j = 0; j < line->nbrackets; ++j) {
+    char c = line->brackets[j];
+    if (c == '{' && parse->depth++ == 0) {
+      block->open_line = i;
+      block->open_index = j;
+    } else if (c == '}' && parse->depth > 0 && --parse->depth == 0) {
+      block->close_line = i;
+      block->close_index = j;
+      parse_add_block(parse, block);
+    }
+  }
+  parse->blocks_scanned++;
+  if (parse->blocks_scanned == parse->nlines && parse->depth > 0) {
+    block->close_line = parse->nlines;
+    block->close_index = 0;
+    parse_add_block(parse, block);
+  }
+}
+
+// Works out the blocks through the given line.
+static void parse_scan_to(struct parse *parse, size_t line) {
+  size_t from = parse->blocks_scanned;
+  while (parse->blocks_scanned <= line &&
+         parse->blocks_scanned < parse->nlines) {
+    parse_scan_line(parse, from);
+  }
+}
+
+struct parse *buffer_parse_lazy(struct buffer *buffer) {
+  struct parse *parse = buffer->parse;
+  if (strcmp(buffer->opt.filetype, "c")) {
+    parse_free(parse);
+    return NULL;
+  }
+  // The syntax cache starts over if the filetype changes, and so does this.
+  if (parse && !parse->listener.cache) {
+    parse_free(parse);
+    parse = NULL;
+  }
+  if (!parse) {
+    parse = xmalloc(sizeof(*parse));
+    memset(parse, 0, sizeof(*parse));
+    parse->buffer = buffer;
+    parse->nlines = gb_nlines(buffer->text);
+    parse->cap = parse->nlines;
+    parse->lines = xmalloc(parse->cap * sizeof(*parse->lines));
+    parse_lines_init(parse->lines, parse->nlines);
+    parse->stale_blocks = true;
+    parse->stale_types = true;
+    parse->listener.moved = parse_moved;
+    parse->listener.tokenized = parse_tokenized;
+    buffer->parse = parse;
+    if (!buffer_syntax_add_listener(buffer, &parse->listener)) {
+      parse_free(parse);
+      return NULL;
+    }
+  }
+  return parse;
+}
+
+struct parse *buffer_parse(struct buffer *buffer, bool wait) {
+  struct parse *parse = buffer_parse_lazy(buffer);
+  if (!parse) {
+    return NULL;
+  }
+  if (wait) {
+    buffer_syntax_tokenize(buffer);
+    parse_lookup_start(parse, parse->nlines - 1);
+    parse_scan_to(parse, parse->nlines - 1);
+  } else {
+    buffer_syntax_request(buffer);
+  }
+  if (parse->stale_types) {
+    parse_build_types(parse);
+    parse->stale_types = false;
+    parse->types_generation++;
+  }
+  return parse;
+}
+
+// The offset of the start of the given line.
+static size_t parse_line_pos(struct parse *parse, size_t line) {
+  unsigned int *lens = parse->buffer->text->lines->buf;
+  size_t pos = 0;
+  for (size_t i = 0; i < line; ++i) {
+    pos += lens[i] + 1;
+  }
+  return pos;
+}
+
+// The line pos is on, and the offset of its start.
+static size_t parse_line_at(struct parse *parse, size_t pos, size_t *start) {
+  unsigned int *lens = parse->buffer->text->lines->buf;
+  size_t line = 0;
+  *start = 0;
+  while (line + 1 < parse->nlines && *start + lens[line] < pos) {
+    *start += lens[line++] + 1;
+  }
+  return line;
+}
+
+static size_t parse_bracket_pos(
+    struct parse *parse, size_t line, size_t index) {
+  return parse_line_pos(parse, line) + parse->lines[line].offsets[index];
+}
+
+// Finds the top-level block whose opening (or closing) brace is the given
+// bracket, or returns NULL.
+static struct parse_block *parse_block_at(
+    struct parse *parse, size_t line, size_t index, bool closing) {
+  size_t lo = 0, hi = parse->nblocks;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    struct parse_block *block = &parse->blocks[mid];
+    size_t l = closing ? block->close_line : block->open_line;
+    size_t i = closing ? block->close_index : block->open_index;
+    if (l == line && i == index) {
+      return block;
+    }
+    if (l < line || (l == line && i < index)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+bool parse_match_bracket(
+    struct parse *parse, size_t pos, size_t *bracket, size_t *match) {
+  size_t start;
+  size_t line = parse_line_at(parse, pos, &start);
+  parse_lookup_start(parse, line);
+  struct parse_line *l = &parse->lines[line];
+  size_t index = 0;
+  while (index < l->nbrackets && start + l->offsets[index] < pos) {
+    index++;
+  }
+  if (index == l->nbrackets) {
+    return false;
+  }
+  *bracket = start + l->offsets[index];
+
+  char a = l->brackets[index];
+  char b = *(strchr("()([][{}{", a) + 1);
+  bool forwards = strchr("([{", a) != NULL;
+
+  if (a == '{' || a == '}') {
+    // A top-level block's braces are paired up once it's been read through,
+    // which only takes going as far as it goes.
+    parse_scan_to(parse, line);
+    if (a == '{' && parse->depth > 0 && parse->open.open_line == line &&
+        parse->open.open_index == index) {
+      size_t from = parse->blocks_scanned;
+      while (parse->depth > 0 && parse->blocks_scanned < parse->nlines) {
+        parse_scan_line(parse, from);
+      }
+    }
+    struct parse_block *block = parse_block_at(parse, line, index, a == '}');
+    if (block) {
+      if (block->close_line == parse->nlines) {
+        return false;
+      }
+      *match = forwards ?
+          parse_bracket_pos(parse, block->close_line, block->close_index) :
+          parse_bracket_pos(parse, block->open_line, block->open_index);
+      return true;
+    }
+  }
+
+  // Count the brackets of the same kind from there, a line at a time.
+  unsigned int *lens = parse->buffer->text->lines->buf;
+  size_t from = line;
+  size_t nested = 0;
+  size_t i = index;
+  for (;;) {
+    if (forwards) {
+      while (++i >= l->nbrackets) {
+        if (line + 1 >= parse->nlines) {
+          return false;
+        }
+        start += lens[line] + 1;
+        parse_tokenize_to(parse, ++line, from);
+        l = &parse->lines[line];
+        i = (size_t) -1;
+      }
+    } else {
+      while (i-- == 0) {
+        if (line == 0) {
+          return false;
+        }
+        l = &parse->lines[--line];
+        start -= lens[line] + 1;
+        i = l->nbrackets;
+      }
+    }
+    if (l->brackets[i] == a) {
+      nested++;
+    } else if (l->brackets[i] == b && !nested--) {
+      *match = start + l->offsets[i];
+      return true;
+    }
+  }
+}
+
+// The number of blocks worked out so far, counting the one still open at the
+// end of the lines read if its opening brace is wanted.
+static size_t parse_known_blocks(struct parse *parse, bool closing) {
+  bool open = !closing && parse->depth > 0 &&
+      parse->blocks_scanned < parse->nlines;
+  return parse->nblocks + open;
+}
+
+static struct parse_block *parse_known_block(struct parse *parse, size_t i) {
+  return i < parse->nblocks ? &parse->blocks[i] : &parse->open;
+}
+
+bool parse_find_block(struct parse *parse, size_t pos, bool forwards,
+    bool closing, size_t *brace) {
+  size_t start;
+  size_t line = parse_line_at(parse, pos, &start);
+  size_t offset = pos - start;
+  parse_lookup_start(parse, line);
+  parse_scan_to(parse, line);
+
+  // The first block whose brace is after pos. Going forwards, the lines after
+  // pos are read until there is one.
+  size_t from = parse->blocks_scanned;
+  size_t n, lo;
+  for (;;) {
+    n = parse_known_blocks(parse, closing);
+    lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      struct parse_block *block = parse_known_block(parse, mid);
+      size_t l = closing ? block->close_line : block->open_line;
+      size_t i = closing ? block->close_index : block->open_index;
+      bool after = l > line || (l == line && l < parse->nlines &&
+          parse->lines[l].offsets[i] > offset);
+      if (after) {
+        hi = mid;
+      } else {
+        lo = mid + 1;
+      }
+    }
+    if (!forwards || lo < n || parse->blocks_scanned == parse->nlines) {
+      break;
+    }
+    parse_scan_line(parse, from);
+  }
+
+  size_t found = lo;
+  if (!forwards) {
+    // The last one whose brace is before pos.
+    while (found > 0) {
+      struct parse_block *block = parse_known_block(parse, found - 1);
+      size_t l = closing ? block->close_line : block->open_line;
+      size_t i = closing ? block->close_index : block->open_index;
+      if (l < line || parse->lines[l].offsets[i] < offset) {
+        break;
+      }
+      found--;
+    }
+    if (found == 0) {
+      return false;
+    }
+    found--;
+  }
+  if (found == n) {
+    return false;
+  }
+
+  struct parse_block *block = parse_known_block(parse, found);
+  if (closing) {
+    if (block->close_line == parse->nlines) {
+      return false;
+    }
+    *brace = parse_bracket_pos(parse, block->close_line, block->close_index);
+  } else {
+    *brace = parse_block_pos(parse, block);
+  }
+  return true;
+}
+
+size_t parse_nblocks(struct parse *parse) {
+  return parse->nblocks;
+}
+
+struct parse_block *parse_get_block(struct parse *parse, size_t i) {
+  return &parse->blocks[i];
+}
+
+size_t parse_block_pos(struct parse *parse, struct parse_block *block) {
+  return parse_bracket_pos(parse, block->open_line, block->open_index);
+}
+
+// Returns the word right before the given token (or NULL), and sets *pos to
+// where it is.
+static struct buf *parse_word_before(struct parse *parse,
+    struct parse_token *tokens, size_t i, size_t *pos) {
+  if (i == 0 || tokens[i - 1].c) {
+    return NULL;
+  }
+  struct parse_token *word = &tokens[i - 1];
+  struct gapbuf *gb = parse->buffer->text;
+  if (isdigit((unsigned char) gb_getchar(gb, word->pos))) {
+    return NULL;
+  }
+  *pos = word->pos;
+  return gb_getstring(gb, word->pos, word->len);
+}
+
+// Skips back over a bracketed part ending with the given token, e.g. the
+// parameters of a function, leaving *i on the opening bracket. Returns false
+// if it isn't found.
+static bool skip_brackets_back(
+    struct parse_token *tokens, size_t *i, char open, char close) {
+  int nested = 0;
+  for (size_t j = *i + 1; j-- > 0;) {
+    if (tokens[j].c == close) {
+      nested++;
+    } else if (tokens[j].c == open && --nested == 0) {
+      *i = j;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Works out parse_block_name from the tokens before the block's brace.
+static struct buf *parse_declared_name(struct parse *parse,
+    struct parse_block *block, struct parse_token *tokens, size_t n,
+    size_t *pos) {
+  if (n == 0) {
+    return NULL;
+  }
+  size_t i = n - 1;
+  if (tokens[i].c == ')') {
+    // A function: the name is right before the parameters.
+    if (!skip_brackets_back(tokens, &i, '(', ')')) {
+      return NULL;
+    }
+    return parse_word_before(parse, tokens, i, pos);
+  }
+  if (tokens[i].c == '=') {
+    // An initializer, maybe for an array.
+    while (i > 0 && tokens[i - 1].c == ']') {
+      --i;
+      if (!skip_brackets_back(tokens, &i, '[', ']')) {
+        return NULL;
+      }
+    }
+    return parse_word_before(parse, tokens, i, pos);
+  }
+
+  struct buf *name = parse_word_before(parse, tokens, n, pos);
+  if (!name || (strcmp(name->buf, "struct") && strcmp(name->buf, "union") &&
+                strcmp(name->buf, "enum"))) {
+    return name;
+  }
+  // An anonymous struct, so go by what's declared with it: the name after
+  // the closing brace.
+  buf_free(name);
+  if (block->close_line == parse->nlines) {
+    return NULL;
+  }
+  size_t start = parse_line_pos(parse, block->close_line);
+  struct parse_reader reader;
+  parse_reader_init(&reader, parse, block->close_line, start,
+      start + parse->lines[block->close_line].offsets[block->close_index] + 1);
+  struct parse_token token;
+  if (!parse_read_token(&reader, &token) || token.c) {
+    return NULL;
+  }
+  *pos = token.pos;
+  return gb_getstring(parse->buffer->text, token.pos, token.len);
+}
+
+struct buf *parse_block_name(
+    struct parse *parse, struct parse_block *block, size_t *pos) {
+  unsigned int *lens = parse->buffer->text->lines->buf;
+  size_t brace = parse_block_pos(parse, block);
+  size_t line = block->open_line;
+  size_t start = brace - parse->lines[line].offsets[block->open_index];
+  while (line > 0 &&
+         brace - start + lens[line - 1] + 1 <= PARSE_DECLARATION_MAX) {
+    start -= lens[--line] + 1;
+  }
+
+  struct parse_token *tokens = NULL;
+  size_t n = 0, cap = 0;
+  struct parse_reader reader;
+  parse_reader_init(&reader, parse, line, start, start);
+  struct parse_token token;
+  while (parse_read_token(&reader, &token) && token.pos < brace) {
+    if (n == cap) {
+      cap = max(16, cap * 2);
+      tokens = xrealloc(tokens, cap * sizeof(*tokens));
+    }
+    tokens[n++] = token;
+  }
+  struct buf *name = parse_declared_name(parse, block, tokens, n, pos);
+  free(tokens);
+  return name;
+}
+
+bool parse_is_type(struct parse *parse, const char *word, size_t len) {
+  if (!parse->types) {
+    return false;
+  }
+  for (size_t i = keyword_hash(word, len, 0) & parse->typesmask;
+       parse->types[i].word; i = (i + 1) & parse->typesmask) {
+    struct keyword *type = &parse->types[i];
+    if (type->len == len && !memcmp(type->word, word, len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t parse_types_generation(struct parse *parse) {
+  return parse->types_generation;
+}
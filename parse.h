@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct buf;
+struct buffer;
+
+// The structure of a C buffer, worked out from its tokens: where its brackets
+// are (leaving out those in comments, strings and so on) and how they pair up,
+// the top-level blocks (function bodies, struct definitions, initializers and
+// so on), and the names its typedefs declare.
+//
+// It's worked out from the tokens in the buffer's syntax cache, which tells
+// it about the lines it tokenizes again after an edit. The blocks and
+// typedefs are only worked out again if a brace or a typedef changed.
+struct parse;
+
+// A top-level block. Each brace is given by the line it's on and its index
+// among that line's brackets. close_line is the number of lines in the buffer
+// if the block never closes.
+struct parse_block {
+  size_t open_line;
+  size_t open_index;
+  size_t close_line;
+  size_t close_index;
+};
+
+// Buffers bigger than this aren't parsed just to draw them, so that they
+// aren't tokenized all the way through in the background for it.
+#define PARSE_DRAW_MAX_SIZE (1 << 20)
+
+// Returns the buffer's structure, or NULL if the buffer isn't C. If wait is
+// set, the whole buffer is tokenized first so that the structure is up to
+// date. Otherwise, whatever isn't tokenized yet is left to the background,
+// and only the types are brought up to date with what is, as for drawing.
+struct parse *buffer_parse(struct buffer *buffer, bool wait);
+// Returns the buffer's structure without tokenizing anything, for the
+// motions: parse_match_bracket and parse_find_block tokenize only as far
+// down the buffer as they need to look.
+struct parse *buffer_parse_lazy(struct buffer *buffer);
+void parse_free(struct parse *parse);
+
+// Finds the first bracket at or after pos on its line, and the bracket
+// matching it, as for the % motion. Returns false if there isn't one, or it
+// isn't matched.
+bool parse_match_bracket(
+    struct parse *parse, size_t pos, size_t *bracket, size_t *match);
+
+// Finds the first top-level block whose opening (or closing) brace is after
+// pos, or the last one whose brace is before it, as for the ]] and [[ motions
+// (or ][ and []). Returns false if there isn't one.
+bool parse_find_block(struct parse *parse, size_t pos, bool forwards,
+    bool closing, size_t *brace);
+
+size_t parse_nblocks(struct parse *parse);
+struct parse_block *parse_get_block(struct parse *parse, size_t i);
+// The offset of the block's opening brace.
+size_t parse_block_pos(struct parse *parse, struct parse_block *block);
+// The name the declaration the block belongs to declares: the function, the
+// struct, union or enum (or the type a typedef gives it), or the variable
+// being initialized, and sets *pos to where the name is. Returns NULL if it
+// can't be worked out.
+struct buf *parse_block_name(
+    struct parse *parse, struct parse_block *block, size_t *pos);
+
+// Whether the word is a type the buffer declares with typedef.
+bool parse_is_type(struct parse *parse, const char *word, size_t len);
+// Changes whenever the types might have, so that whatever was drawn with them
+// can tell it needs drawing again.
+size_t parse_types_generation(struct parse *parse);
@@ -0,0 +1,204 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/queue.h>
+
+#include "util.h"
+
+struct pool_job {
+  void (*run)(void*);
+  void *arg;
+  TAILQ_ENTRY(pool_job) pointers;
+};
+
+struct pool {
+  pthread_t *threads;
+  size_t nthreads;
+
+  pthread_mutex_t lock;
+  // Signalled when a job is queued, or when the pool is being freed.
+  pthread_cond_t queued;
+
+  TAILQ_HEAD(job_list, pool_job) jobs;
+  bool stopping;
+};
+
+static void *pool_thread(void *arg) {
+  struct pool *pool = arg;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (TAILQ_EMPTY(&pool->jobs) && !pool->stopping) {
+      pthread_cond_wait(&pool->queued, &pool->lock);
+    }
+    struct pool_job *job = TAILQ_FIRST(&pool->jobs);
+    if (!job) {
+      break;
+    }
+    TAILQ_REMOVE(&pool->jobs, job, pointers);
+    pthread_mutex_unlock(&pool->lock);
+
+    job->run(job->arg);
+    free(job);
+
+    pthread_mutex_lock(&pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+struct pool *pool_create(void) {
+  struct pool *pool = xmalloc(sizeof(*pool));
+  long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t nthreads = ncpus > 0 ? (size_t) ncpus : 1;
+  pool->threads = xmalloc(nthreads * sizeof(*pool->threads));
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->queued, NULL);
+  TAILQ_INIT(&pool->jobs);
+  pool->stopping = false;
+
+  // Make do with the threads that could be started, if any.
+  pool->nthreads = 0;
+  while (pool->nthreads < nthreads &&
+         !pthread_create(&pool->threads[pool->nthreads], NULL, pool_thread,
+             pool)) {
+    pool->nthreads++;
+  }
+  return pool;
+}
+
+void pool_free(struct pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (size_t i = 0; i < pool->nthreads; ++i) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->queued);
+  free(pool->threads);
+  free(pool);
+}
+
+size_t pool_size(struct pool *pool) {
+  return pool->nthreads;
+}
+
+void pool_submit(struct pool *pool, void (*run)(void*), void *arg) {
+  if (!pool->nthreads) {
+    run(arg);
+    return;
+  }
+  struct pool_job *job = xmalloc(sizeof(*job));
+  job->run = run;
+  job->arg = arg;
+
+  pthread_mutex_lock(&pool->lock);
+  TAILQ_INSERT_TAIL(&pool->jobs, job, pointers);
+  pthread_cond_signal(&pool->queued);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+size_t pool_split_lines(const char *text, size_t start, size_t end,
+    size_t size, struct region **chunks) {
+  size_t cap = (end - start) / size + 1;
+  *chunks = xmalloc(cap * sizeof(**chunks));
+  size_t n = 0;
+  while (start < end) {
+    size_t chunk_end = min(start + size, end);
+    if (chunk_end < end) {
+      const char *newline = memchr(text + chunk_end, '\n', end - chunk_end);
+      chunk_end = newline ? (size_t) (newline - text) + 1 : end;
+    }
+    if (n == cap) {
+      cap *= 2;
+      *chunks = xrealloc(*chunks, cap * sizeof(**chunks));
+    }
+    region_set(&(*chunks)[n++], start, chunk_end);
+    start = chunk_end;
+  }
+  return n;
+}
+
+// Whoever lets go of it last frees it, so the thread that started the work
+// doesn't have to wait for helpers that haven't even started yet.
+struct pool_chunks {
+  atomic_int refs;
+  void (*work)(void *arg, struct pool_chunks *chunks, bool caller);
+  void *arg;
+  size_t n;
+  // The next chunk to be taken.
+  atomic_size_t next;
+
+  pthread_mutex_t lock;
+  // Signalled when the last chunk is done.
+  pthread_cond_t done;
+  size_t ndone;
+};
+
+static void pool_chunks_release(struct pool_chunks *chunks) {
+  if (atomic_fetch_sub(&chunks->refs, 1) > 1) {
+    return;
+  }
+  pthread_mutex_destroy(&chunks->lock);
+  pthread_cond_destroy(&chunks->done);
+  free(chunks);
+}
+
+static void pool_chunks_help(void *arg) {
+  struct pool_chunks *chunks = arg;
+  chunks->work(chunks->arg, chunks, false);
+  pool_chunks_release(chunks);
+}
+
+void pool_run_chunks(struct pool *pool, size_t n,
+    void (*work)(void *arg, struct pool_chunks *chunks, bool caller),
+    void *arg) {
+  struct pool_chunks *chunks = xmalloc(sizeof(*chunks));
+  atomic_init(&chunks->refs, 1);
+  chunks->work = work;
+  chunks->arg = arg;
+  chunks->n = n;
+  atomic_init(&chunks->next, 0);
+  pthread_mutex_init(&chunks->lock, NULL);
+  pthread_cond_init(&chunks->done, NULL);
+  chunks->ndone = 0;
+
+  if (n > 1) {
+    size_t helpers = min(n - 1, pool_size(pool));
+    atomic_fetch_add(&chunks->refs, (int) helpers);
+    for (size_t i = 0; i < helpers; ++i) {
+      pool_submit(pool, pool_chunks_help, chunks);
+    }
+  }
+
+  work(arg, chunks, true);
+  pthread_mutex_lock(&chunks->lock);
+  while (chunks->ndone < chunks->n) {
+    pthread_cond_wait(&chunks->done, &chunks->lock);
+  }
+  pthread_mutex_unlock(&chunks->lock);
+  pool_chunks_release(chunks);
+}
+
+bool pool_chunks_next(struct pool_chunks *chunks, size_t *i) {
+  *i = atomic_fetch_add(&chunks->next, 1);
+  return *i < chunks->n;
+}
+
+void pool_chunks_done(struct pool_chunks *chunks) {
+  pthread_mutex_lock(&chunks->lock);
+  if (++chunks->ndone == chunks->n) {
+    pthread_cond_signal(&chunks->done);
+  }
+  pthread_mutex_unlock(&chunks->lock);
+}
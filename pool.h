@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct region;
+
+// A set of threads which run the jobs given to them, to spread work that can
+// be split up (like searching many files) over all the cores.
+struct pool;
+
+// Creates a pool with one thread per online CPU (or as many as could be
+// started). With none at all, jobs are run as they're submitted.
+struct pool *pool_create(void);
+// Waits for the jobs already submitted to finish, then frees the pool.
+void pool_free(struct pool *pool);
+
+size_t pool_size(struct pool *pool);
+
+// Queues run(arg) to be called on one of the pool's threads. Jobs are
+// started in the order they were submitted.
+void pool_submit(struct pool *pool, void (*run)(void*), void *arg);
+
+// Splits start to end of the text into chunks of about size bytes, each
+// ending at a line's end, and returns how many there are.
+size_t pool_split_lines(const char *text, size_t start, size_t end,
+    size_t size, struct region **chunks);
+
+// Work on a number of chunks, shared by the thread that started it and the
+// pool's threads helping out: each thread takes the next chunk nobody has
+// started on until there are none left.
+struct pool_chunks;
+
+// Calls work(arg, chunks, true) on this thread, and work(arg, chunks, false)
+// on as many of the pool's threads as can help with the n chunks, and
+// returns once they've all been worked on. A helper might only get started
+// after that, so work must only touch arg between taking a chunk and saying
+// it's done.
+void pool_run_chunks(struct pool *pool, size_t n,
+    void (*work)(void *arg, struct pool_chunks *chunks, bool caller),
+    void *arg);
+// Takes the next chunk to work on, returning false if there are none left.
+bool pool_chunks_next(struct pool_chunks *chunks, size_t *i);
+// Says the chunk last taken is done.
+void pool_chunks_done(struct pool_chunks *chunks);
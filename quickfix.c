@@ -0,0 +1,749 @@
+#include "quickfix.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <fts.h>
+#include <glob.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "parse.h"
+#include "pool.h"
+#include "search.h"
+#include "trigram.h"
+#include "util.h"
+#include "window.h"
+
+// Lines longer than this are cut off in the quickfix list.
+#define QUICKFIX_MAX_TEXT 200
+
+// The height of the window opened by :copen.
+#define QUICKFIX_WINDOW_HEIGHT 10
+
+void quickfix_init(struct quickfix *quickfix) {
+  memset(quickfix, 0, sizeof(*quickfix));
+}
+
+static void quickfix_entry_free(struct quickfix_entry *entry) {
+  free(entry->path);
+  free(entry->text);
+}
+
+static void quickfix_add(struct quickfix *quickfix,
+    struct quickfix_entry *entries, size_t n) {
+  if (quickfix->len + n > quickfix->cap) {
+    quickfix->cap = max(quickfix->len + n, quickfix->cap * 2);
+    quickfix->entries = xrealloc(
+        quickfix->entries, quickfix->cap * sizeof(*quickfix->entries));
+  }
+  memcpy(quickfix->entries + quickfix->len, entries, n * sizeof(*entries));
+  quickfix->len += n;
+}
+
+// A :vimgrep in progress. The files are found by a job on the editor's
+// thread pool, which starts a job for each file to search it as it goes. The
+// results are added to the quickfix list in order as the files are done.
+struct grep {
+  char *pattern;
+  // A combination of enum search_flags.
+  int flags;
+  // Whether to find every match rather than the first one on each line.
+  bool all_matches;
+  // Whether to jump to the first match once it's found.
+  bool jump;
+  struct pool *pool;
+
+  // The files to search, as given to :vimgrep, and for each, where it's
+  // found in 'path' (or NULL), in case it doesn't name any files as it is.
+  struct grep_arg {
+    char *files;
+    char *found;
+  } *args;
+  size_t nargs;
+
+  // The buffers with a path, whose text is searched instead of the file's,
+  // since it may have unsaved changes.
+  struct grep_loaded {
+    char *path;
+    struct gb_snapshot *text;
+    // Where matches might be in the text, going by the buffer's trigram
+    // index (or NULL).
+    struct regionbuf *ranges;
+  } *loaded;
+  size_t nloaded;
+
+  // Guards the list of files, which grows as they're found.
+  pthread_mutex_t lock;
+  struct grep_file {
+    struct grep *grep;
+    char *path;
+    // The buffer with this path, if it's loaded. Otherwise the file is read
+    // from disk.
+    struct grep_loaded *loaded;
+
+    struct quickfix_entry *entries;
+    size_t len;
+    size_t cap;
+    atomic_bool done;
+  } **files;
+  size_t nfiles;
+  size_t cap;
+  // Set once every file has been found.
+  bool found;
+
+  // The first file whose results haven't been added to the list yet.
+  size_t next;
+
+  atomic_bool cancelled;
+  // One reference for the editor, one for finding the files, and one for each
+  // file not yet searched.
+  atomic_size_t refs;
+};
+
+static void grep_release(struct grep *grep) {
+  if (atomic_fetch_sub(&grep->refs, 1) > 1) {
+    return;
+  }
+  for (size_t i = 0; i < grep->nfiles; ++i) {
+    struct grep_file *file = grep->files[i];
+    free(file->path);
+    for (size_t j = 0; j < file->len; ++j) {
+      quickfix_entry_free(&file->entries[j]);
+    }
+    free(file->entries);
+    free(file);
+  }
+  for (size_t i = 0; i < grep->nargs; ++i) {
+    free(grep->args[i].files);
+    free(grep->args[i].found);
+  }
+  for (size_t i = 0; i < grep->nloaded; ++i) {
+    struct grep_loaded *loaded = &grep->loaded[i];
+    free(loaded->path);
+    gb_snapshot_free(loaded->text);
+    if (loaded->ranges) {
+      regionbuf_free(loaded->ranges);
+    }
+  }
+  pthread_mutex_destroy(&grep->lock);
+  free(grep->args);
+  free(grep->loaded);
+  free(grep->files);
+  free(grep->pattern);
+  free(grep);
+}
+
+static void grep_file_add_match(struct grep_file *file,
+    size_t line, size_t column, char *text, size_t len) {
+  while (len && isspace((unsigned char) *text)) {
+    text++;
+    len--;
+  }
+  len = min(len, QUICKFIX_MAX_TEXT);
+
+  if (file->len == file->cap) {
+    file->cap = max(8, file->cap * 2);
+    file->entries = xrealloc(file->entries, file->cap * sizeof(*file->entries));
+  }
+  struct quickfix_entry *entry = &file->entries[file->len++];
+  entry->path = xstrdup(file->path);
+  entry->line = line;
+  entry->column = column;
+  entry->text = xmalloc(len + 1);
+  memcpy(entry->text, text, len);
+  entry->text[len] = '\0';
+}
+
+static bool grep_cancelled(void *grep) {
+  return atomic_load(&((struct grep*) grep)->cancelled);
+}
+
+static void grep_file_search(struct grep_file *file, char *text, size_t len,
+    struct regionbuf *ranges) {
+  struct grep *grep = file->grep;
+  struct search search;
+  if (search_init(&search, grep->pattern, grep->flags, text, len)) {
+    return;
+  }
+  if (ranges) {
+    search.ranges = regionbuf_create(max(1, ranges->len));
+    regionbuf_insert_n(search.ranges, ranges->buf, ranges->len, 0);
+  }
+  search.interrupted = grep_cancelled;
+  search.interrupted_arg = grep;
+
+  size_t line = 1;
+  size_t line_start = 0;
+  struct region match;
+  while (!atomic_load(&grep->cancelled) &&
+         search_next_match(&search, &match)) {
+    char *nl;
+    while ((nl = memchr(text + line_start, '\n', match.start - line_start))) {
+      line++;
+      line_start = (size_t) (nl - text) + 1;
+    }
+    nl = memchr(text + line_start, '\n', len - line_start);
+    size_t line_end = nl ? (size_t) (nl - text) : len;
+
+    grep_file_add_match(file, line, match.start - line_start + 1,
+        text + line_start, line_end - line_start);
+
+    if (!grep->all_matches) {
+      if (line_end == len) {
+        break;
+      }
+      search.start = max(search.start, line_end + 1);
+    }
+  }
+  search_deinit(&search);
+}
+
+static void grep_file_run(void *arg) {
+  struct grep_file *file = arg;
+  struct grep *grep = file->grep;
+
+  if (atomic_load(&grep->cancelled)) {
+    goto done;
+  }
+
+  struct grep_loaded *loaded = file->loaded;
+  if (loaded) {
+    size_t size = gb_snapshot_size(loaded->text);
+    size_t n;
+    const char *span = gb_snapshot_span(loaded->text, 0, &n);
+    if (n == size) {
+      grep_file_search(file, (char*) span, size, loaded->ranges);
+    } else {
+      char *text = xmalloc(size + 1);
+      gb_snapshot_getstring_into(loaded->text, 0, size, text);
+      grep_file_search(file, text, size, loaded->ranges);
+      free(text);
+    }
+    goto done;
+  }
+
+  int fd = open(file->path, O_RDONLY);
+  if (fd < 0) {
+    goto done;
+  }
+  struct stat info;
+  if (fstat(fd, &info) < 0 || !S_ISREG(info.st_mode) || !info.st_size) {
+    close(fd);
+    goto done;
+  }
+  size_t size = (size_t) info.st_size;
+  void *text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text != MAP_FAILED) {
+    grep_file_search(file, text, size, NULL);
+    munmap(text, size);
+  }
+
+done:
+  atomic_store(&file->done, true);
+  grep_release(grep);
+}
+
+// Adds a file to the list, and starts searching it.
+static void grep_add_file(struct grep *grep, const char *path) {
+  char *abs = abspath(path);
+  struct grep_loaded *loaded = NULL;
+  for (size_t i = 0; i < grep->nloaded; ++i) {
+    if (!strcmp(grep->loaded[i].path, abs)) {
+      loaded = &grep->loaded[i];
+      break;
+    }
+  }
+  struct stat info;
+  if (!loaded && (stat(abs, &info) < 0 || !S_ISREG(info.st_mode))) {
+    free(abs);
+    return;
+  }
+
+  struct grep_file *file = xmalloc(sizeof(*file));
+  memset(file, 0, sizeof(*file));
+  file->grep = grep;
+  file->path = abs;
+  file->loaded = loaded;
+  atomic_init(&file->done, false);
+
+  pthread_mutex_lock(&grep->lock);
+  if (grep->nfiles == grep->cap) {
+    grep->cap = max(16, grep->cap * 2);
+    grep->files = xrealloc(grep->files, grep->cap * sizeof(*grep->files));
+  }
+  grep->files[grep->nfiles++] = file;
+  pthread_mutex_unlock(&grep->lock);
+
+  atomic_fetch_add(&grep->refs, 1);
+  pool_submit(grep->pool, grep_file_run, file);
+}
+
+// Whether path, or any part of it after a slash, matches pattern. This is how
+// "dir/**/pattern" matches files at any depth under dir.
+static bool grep_tree_matches(const char *pattern, const char *path) {
+  if (!*pattern) {
+    return true;
+  }
+  for (const char *p = path; p; p = strchr(p, '/')) {
+    if (*p == '/') {
+      p++;
+    }
+    if (!fnmatch(pattern, p, FNM_PATHNAME | FNM_PERIOD)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Adds the files matching a pattern like "src/**/*.c". The part before the **
+// is taken as a directory, which is walked recursively, skipping hidden
+// files and directories.
+static void grep_add_tree(struct grep *grep, char *pattern) {
+  char *stars = strstr(pattern, "**");
+  char root[PATH_MAX];
+  size_t rootlen = min((size_t) (stars - pattern), sizeof(root) - 1);
+  memcpy(root, pattern, rootlen);
+  root[rootlen] = '\0';
+  while (rootlen > 1 && root[rootlen - 1] == '/') {
+    root[--rootlen] = '\0';
+  }
+  if (!rootlen) {
+    strcpy(root, ".");
+  }
+
+  char *rest = stars + 2;
+  if (*rest == '/') {
+    rest++;
+  }
+
+  char *paths[] = {root, NULL};
+  FTS *fts = fts_open(paths, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+  if (!fts) {
+    return;
+  }
+  FTSENT *entry;
+  while (!atomic_load(&grep->cancelled) && (entry = fts_read(fts))) {
+    if (entry->fts_level > 0 && entry->fts_name[0] == '.') {
+      if (entry->fts_info == FTS_D) {
+        fts_set(fts, entry, FTS_SKIP);
+      }
+      continue;
+    }
+    if (entry->fts_info != FTS_F) {
+      continue;
+    }
+    const char *rel = entry->fts_path + strlen(root);
+    if (*rel == '/') {
+      rel++;
+    }
+    if (grep_tree_matches(rest, rel)) {
+      grep_add_file(grep, entry->fts_path);
+    }
+  }
+  fts_close(fts);
+}
+
+static void grep_add_files(struct grep *grep, struct grep_arg *arg) {
+  if (!arg->files) {
+    grep_add_file(grep, arg->found);
+    return;
+  }
+  if (strstr(arg->files, "**")) {
+    grep_add_tree(grep, arg->files);
+    return;
+  }
+
+  glob_t matches;
+  if (!glob(arg->files, GLOB_TILDE | GLOB_BRACE, NULL, &matches)) {
+    for (size_t i = 0; i < matches.gl_pathc; ++i) {
+      grep_add_file(grep, matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return;
+  }
+
+  if (arg->found) {
+    grep_add_file(grep, arg->found);
+  }
+}
+
+// Adds one of :vimgrep's arguments, working out what needs the editor
+// (rather than the file system) now: what % is, and where the name is found
+// in 'path'.
+static void grep_add_arg(struct editor *editor, struct grep *grep,
+    char *files) {
+  bool current = !strcmp(files, "%");
+  char *path = editor->window->buffer->path;
+  if (current && !path) {
+    return;
+  }
+  grep->args = xrealloc(grep->args, (grep->nargs + 1) * sizeof(*grep->args));
+  struct grep_arg *arg = &grep->args[grep->nargs++];
+  arg->files = current ? NULL : xstrdup(files);
+  arg->found = NULL;
+  if (current) {
+    arg->found = xstrdup(path);
+  } else if (!strstr(files, "**")) {
+    arg->found = editor_find_in_path(editor, files);
+  }
+}
+
+// Takes snapshots of the buffers with a path, to search instead of the files.
+static void grep_add_loaded(struct editor *editor, struct grep *grep) {
+  struct buffer *buffer;
+  TAILQ_FOREACH(buffer, &editor->buffers, pointers) {
+    if (!buffer->path) {
+      continue;
+    }
+    grep->loaded = xrealloc(
+        grep->loaded, (grep->nloaded + 1) * sizeof(*grep->loaded));
+    struct grep_loaded *loaded = &grep->loaded[grep->nloaded++];
+    loaded->path = xstrdup(buffer->path);
+    loaded->text = gb_snapshot(buffer->text);
+    loaded->ranges = buffer_search_candidates(
+        buffer, grep->pattern, grep->flags & SEARCH_IGNORE_CASE);
+  }
+}
+
+// Finds the files to search, walking whole trees for "**", so that the
+// editor doesn't have to wait for the file system.
+static void grep_find_files_run(void *arg) {
+  struct grep *grep = arg;
+  for (size_t i = 0; i < grep->nargs && !atomic_load(&grep->cancelled); ++i) {
+    grep_add_files(grep, &grep->args[i]);
+  }
+  pthread_mutex_lock(&grep->lock);
+  grep->found = true;
+  pthread_mutex_unlock(&grep->lock);
+  grep_release(grep);
+}
+
+static void editor_cancel_grep(struct editor *editor) {
+  struct grep *grep = editor->quickfix.grep;
+  if (grep) {
+    atomic_store(&grep->cancelled, true);
+    grep_release(grep);
+    editor->quickfix.grep = NULL;
+  }
+}
+
+static void quickfix_clear(struct quickfix *quickfix) {
+  for (size_t i = 0; i < quickfix->len; ++i) {
+    quickfix_entry_free(&quickfix->entries[i]);
+  }
+  quickfix->len = 0;
+  quickfix->current = 0;
+
+  struct buffer *buffer = quickfix->buffer;
+  if (buffer) {
+    size_t size = gb_size(buffer->text);
+    if (size > 1) {
+      buffer_do_delete(buffer, size - 1, 0);
+    }
+    buffer->opt.modified = false;
+  }
+}
+
+void quickfix_deinit(struct quickfix *quickfix) {
+  if (quickfix->grep) {
+    atomic_store(&quickfix->grep->cancelled, true);
+    grep_release(quickfix->grep);
+  }
+  quickfix_clear(quickfix);
+  free(quickfix->entries);
+  if (quickfix->buffer) {
+    buffer_free(quickfix->buffer);
+  }
+}
+
+// Adds lines to the quickfix buffer for the entries from index start on.
+static void quickfix_buffer_append(struct editor *editor, size_t start) {
+  struct quickfix *quickfix = &editor->quickfix;
+  struct buffer *buffer = quickfix->buffer;
+  if (!buffer || start == quickfix->len) {
+    return;
+  }
+
+  struct buf *lines = buf_create(1);
+  for (size_t i = start; i < quickfix->len; ++i) {
+    struct quickfix_entry *entry = &quickfix->entries[i];
+    buf_appendf(lines, "%s%s|%zu col %zu| %s", i ? "\n" : "",
+        editor_relpath(editor, entry->path),
+        entry->line, entry->column, entry->text);
+  }
+  buffer_do_insert(buffer, lines, gb_size(buffer->text) - 1);
+  buffer->opt.modified = false;
+}
+
+void editor_jump_to_quickfix(struct editor *editor, size_t index) {
+  struct quickfix *quickfix = &editor->quickfix;
+  assert(index < quickfix->len);
+  struct quickfix_entry *entry = &quickfix->entries[index];
+  quickfix->current = index;
+
+  // Jump from the quickfix window into the window it was opened from.
+  if (quickfix->buffer && editor->window->buffer == quickfix->buffer) {
+    struct window *above = window_up(editor->window);
+    if (above) {
+      editor_set_window(editor, above);
+    }
+  }
+
+  char *path = editor->window->buffer->path;
+  if (!path || strcmp(path, entry->path)) {
+    editor_open(editor, entry->path);
+  }
+
+  struct gapbuf *gb = editor->window->buffer->text;
+  size_t line = min(entry->line - 1, gb_nlines(gb) - 1);
+  size_t column = min(entry->column - 1, (size_t) gb->lines->buf[line]);
+  window_set_cursor(editor->window, gb_linecol_to_pos(gb, line, column));
+  window_center_cursor(editor->window);
+
+  editor_status_msg(editor, "(%zu of %zu): %s",
+      index + 1, quickfix->len, entry->text);
+}
+
+bool editor_update_quickfix(struct editor *editor) {
+  struct quickfix *quickfix = &editor->quickfix;
+  struct grep *grep = quickfix->grep;
+  if (!grep) {
+    return false;
+  }
+
+  size_t start = quickfix->len;
+  pthread_mutex_lock(&grep->lock);
+  while (grep->next < grep->nfiles &&
+         atomic_load(&grep->files[grep->next]->done)) {
+    struct grep_file *file = grep->files[grep->next++];
+    quickfix_add(quickfix, file->entries, file->len);
+    free(file->entries);
+    file->entries = NULL;
+    file->len = file->cap = 0;
+  }
+  bool searched = grep->found && grep->next == grep->nfiles;
+  pthread_mutex_unlock(&grep->lock);
+  bool changed = quickfix->len > start;
+  quickfix_buffer_append(editor, start);
+
+  if (grep->jump && !start && quickfix->len) {
+    editor_jump_to_quickfix(editor, 0);
+  }
+
+  if (!searched) {
+    return changed;
+  }
+
+  if (!quickfix->len) {
+    editor_status_err(editor, "No match: %s", grep->pattern);
+  } else if (!grep->jump) {
+    editor_status_msg(editor, "%zu matches", quickfix->len);
+  } else {
+    editor_status_msg(editor, "(%zu of %zu): %s", quickfix->current + 1,
+        quickfix->len, quickfix->entries[quickfix->current].text);
+  }
+  grep_release(grep);
+  quickfix->grep = NULL;
+  return true;
+}
+
+// Splits off the pattern from ":vimgrep /pattern/[g][j] files", returning the
+// rest of the arguments (or NULL if the pattern isn't terminated). Like vim,
+// any non-identifier character can be used as the delimiter, and without a
+// delimiter the pattern extends to the first space.
+static char *grep_parse_pattern(struct grep *grep, char *arg) {
+  grep->jump = true;
+
+  char delim = *arg;
+  if (isalnum((unsigned char) delim) || delim == '_') {
+    char *end = strchr(arg, ' ');
+    grep->pattern = end ? strndup(arg, (size_t) (end - arg)) : xstrdup(arg);
+    return end ? end : arg + strlen(arg);
+  }
+
+  char *end = arg + 1;
+  while (*end && *end != delim) {
+    if (*end == '\\' && end[1]) {
+      end++;
+    }
+    end++;
+  }
+  if (!*end) {
+    return NULL;
+  }
+  grep->pattern = strndup(arg + 1, (size_t) (end - arg - 1));
+  for (end++; *end && *end != ' '; ++end) {
+    if (*end == 'g') {
+      grep->all_matches = true;
+    } else if (*end == 'j') {
+      grep->jump = false;
+    }
+  }
+  return end;
+}
+
+EDITOR_COMMAND(vimgrep, vim) {
+  if (!arg) {
+    editor_status_err(editor, "Argument required");
+    return;
+  }
+
+  struct grep *grep = xmalloc(sizeof(*grep));
+  memset(grep, 0, sizeof(*grep));
+  atomic_init(&grep->cancelled, false);
+
+  char *files = grep_parse_pattern(grep, arg);
+  if (!files || !*grep->pattern) {
+    editor_status_err(editor, "Invalid search pattern");
+    free(grep->pattern);
+    free(grep);
+    return;
+  }
+
+  grep->flags = editor_search_flags(editor, grep->pattern);
+  struct search search;
+  int rc = search_init(&search, grep->pattern, grep->flags, NULL, 0);
+  if (rc) {
+    char error[48];
+    search_get_error(rc, error, sizeof(error));
+    editor_status_err(editor, "Bad regex \"%s\": %s", grep->pattern, error);
+    free(grep->pattern);
+    free(grep);
+    return;
+  }
+  search_deinit(&search);
+
+  files = xstrdup(files);
+  char *file;
+  char *rest = files;
+  while ((file = strsep(&rest, " "))) {
+    if (*file) {
+      grep_add_arg(editor, grep, file);
+    }
+  }
+  free(files);
+  grep_add_loaded(editor, grep);
+
+  editor_cancel_grep(editor);
+  quickfix_clear(&editor->quickfix);
+  editor->quickfix.grep = grep;
+
+  pthread_mutex_init(&grep->lock, NULL);
+  atomic_init(&grep->refs, 2);
+  grep->pool = editor_pool(editor);
+  pool_submit(grep->pool, grep_find_files_run, grep);
+  editor_update_quickfix(editor);
+}
+
+EDITOR_COMMAND(cnext, cn) {
+  struct quickfix *quickfix = &editor->quickfix;
+  if (!quickfix->len) {
+    editor_status_err(editor, "No Errors");
+  } else if (quickfix->current + 1 >= quickfix->len) {
+    editor_status_err(editor, "No more items");
+  } else {
+    editor_jump_to_quickfix(editor, quickfix->current + 1);
+  }
+}
+
+EDITOR_COMMAND(cprevious, cp) {
+  struct quickfix *quickfix = &editor->quickfix;
+  if (!quickfix->len) {
+    editor_status_err(editor, "No Errors");
+  } else if (!quickfix->current) {
+    editor_status_err(editor, "No more items");
+  } else {
+    editor_jump_to_quickfix(editor, quickfix->current - 1);
+  }
+}
+
+EDITOR_COMMAND(copen, cope) {
+  struct quickfix *quickfix = &editor->quickfix;
+  if (!quickfix->buffer) {
+    quickfix->buffer = buffer_create(NULL);
+    quickfix->buffer->opt.modifiable = false;
+    quickfix_buffer_append(editor, 0);
+  }
+
+  if (editor->window->buffer == quickfix->buffer) {
+    return;
+  }
+
+  editor_set_window(editor, window_split(editor->window, WINDOW_SPLIT_BELOW));
+  window_set_buffer(editor->window, quickfix->buffer);
+  size_t h = window_h(editor->window);
+  if (h > QUICKFIX_WINDOW_HEIGHT) {
+    window_resize(editor->window, 0, (int) QUICKFIX_WINDOW_HEIGHT - (int) h);
+  }
+
+  if (quickfix->len) {
+    struct gapbuf *gb = quickfix->buffer->text;
+    window_set_cursor(editor->window,
+        gb_linecol_to_pos(gb, quickfix->current, 0));
+  }
+}
+
+// Fills the quickfix list with the top-level declarations in a C buffer: its
+// functions, structs, unions, enums and initialized variables.
+EDITOR_COMMAND(outline, outl) {
+  struct buffer *buffer = editor->window->buffer;
+  if (!buffer->path) {
+    editor_status_err(editor, "No file name");
+    return;
+  }
+  struct parse *parse = buffer_parse(buffer, true);
+  if (!parse) {
+    editor_status_err(editor, "Not a C file");
+    return;
+  }
+
+  editor_cancel_grep(editor);
+  quickfix_clear(&editor->quickfix);
+  struct gapbuf *gb = buffer->text;
+  for (size_t i = 0; i < parse_nblocks(parse); ++i) {
+    size_t pos;
+    struct buf *name = parse_block_name(parse, parse_get_block(parse, i), &pos);
+    if (!name) {
+      continue;
+    }
+    buf_free(name);
+
+    size_t line, column;
+    gb_pos_to_linecol(gb, pos, &line, &column);
+    size_t start = pos;
+    while (start > 0 && gb_getchar(gb, start - 1) != '\n') {
+      start--;
+    }
+    size_t len = gb->lines->buf[line];
+    while (len && isspace((unsigned char) gb_getchar(gb, start))) {
+      start++;
+      len--;
+    }
+    struct buf *text = gb_getstring(gb, start, min(len, QUICKFIX_MAX_TEXT));
+    struct quickfix_entry entry = {
+        abspath(buffer->path), line + 1, column + 1, xstrdup(text->buf)};
+    buf_free(text);
+    quickfix_add(&editor->quickfix, &entry, 1);
+  }
+  quickfix_buffer_append(editor, 0);
+
+  if (!editor->quickfix.len) {
+    editor_status_err(editor, "No declarations");
+  } else {
+    editor_status_msg(editor, "%zu declarations", editor->quickfix.len);
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct buffer;
+struct editor;
+struct grep;
+
+struct quickfix_entry {
+  // The absolute path of the file.
+  char *path;
+  // 1-based, like they're displayed.
+  size_t line;
+  size_t column;
+  // The contents of the line.
+  char *text;
+};
+
+// A list of locations to step through, e.g. the results of :vimgrep.
+struct quickfix {
+  struct quickfix_entry *entries;
+  size_t len;
+  size_t cap;
+
+  // The index of the entry last jumped to.
+  size_t current;
+
+  // The :vimgrep filling in the list while it's still running (or NULL).
+  // Entries are added as the files are searched.
+  struct grep *grep;
+
+  // The buffer listing the entries, created by :copen (or NULL).
+  struct buffer *buffer;
+};
+
+void quickfix_init(struct quickfix *quickfix);
+void quickfix_deinit(struct quickfix *quickfix);
+
+// Adds the results of a running :vimgrep to the quickfix list as they come
+// in. Returns true if anything changed.
+bool editor_update_quickfix(struct editor *editor);
+
+// Jumps to the entry at the given index.
+void editor_jump_to_quickfix(struct editor *editor, size_t index);
@@ -2,15 +2,21 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "buf.h"
 #include "buffer.h"
 #include "editor.h"
 #include "gap.h"
+#include "pool.h"
+#include "trigram.h"
+#include "utf8.h"
 #include "util.h"
 #include "window.h"
 
@@ -30,51 +36,323 @@ bool editor_ignore_case(struct editor *editor, char *pattern) {
   return true;
 }
 
-int search_init(struct search *search, char *pattern, bool ignore_case,
+int editor_search_flags(struct editor *editor, char *pattern) {
+  int flags = 0;
+  if (editor_ignore_case(editor, pattern)) {
+    flags |= SEARCH_IGNORE_CASE;
+  }
+  if (editor->opt.unicodeclasses) {
+    flags |= SEARCH_UCP;
+  }
+  return flags;
+}
+
+#define WORD_START "[[:<:]]"
+#define WORD_END "[[:>:]]"
+
+struct search_literal {
+  unsigned char *str;
+  size_t len;
+  bool ignore_case;
+  // Whether matches must be whole words, for patterns of the form
+  // [[:<:]]foo[[:>:]] (as used by * and #).
+  bool words;
+  // How far to move ahead when the text under the last character of the
+  // pattern is a given byte (Horspool's bad character rule).
+  size_t shift[256];
+};
+
+static unsigned char ascii_tolower(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? (unsigned char) (c - 'A' + 'a') : c;
+}
+
+static unsigned char ascii_toupper(unsigned char c) {
+  return c >= 'a' && c <= 'z' ? (unsigned char) (c - 'a' + 'A') : c;
+}
+
+static bool is_word_char(unsigned char c) {
+  return isalnum(c) || c == '_';
+}
+
+static bool is_literal(char *s, size_t len, bool ignore_case) {
+  if (!len) {
+    return false;
+  }
+  for (size_t i = 0; i < len; ++i) {
+    // Case folding is only done for ASCII, leave anything else to pcre2.
+    // (pcre2 would also match k and s to the Kelvin sign and the long s,
+    // which this doesn't bother with.)
+    if (strchr("\\^$.[]|()?*+{}", s[i]) || (ignore_case && s[i] & 0x80)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static struct search_literal *search_literal_create(
+    char *pattern, int flags) {
+  bool ignore_case = flags & SEARCH_IGNORE_CASE;
+  size_t len = strlen(pattern);
+  bool words = false;
+  size_t start_len = strlen(WORD_START);
+  size_t end_len = strlen(WORD_END);
+  if (len > start_len + end_len &&
+      !strncmp(pattern, WORD_START, start_len) &&
+      !strcmp(pattern + len - end_len, WORD_END)) {
+    // With Unicode classes, what counts as a word character is up to pcre2.
+    if (flags & SEARCH_UCP) {
+      return NULL;
+    }
+    words = true;
+    pattern += start_len;
+    len -= start_len + end_len;
+  }
+
+  if (!is_literal(pattern, len, ignore_case)) {
+    return NULL;
+  }
+
+  struct search_literal *literal = xmalloc(sizeof(*literal));
+  literal->str = xmalloc(len);
+  literal->len = len;
+  literal->ignore_case = ignore_case;
+  literal->words = words;
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char) pattern[i];
+    literal->str[i] = ignore_case ? ascii_tolower(c) : c;
+  }
+
+  for (size_t i = 0; i < 256; ++i) {
+    literal->shift[i] = len;
+  }
+  for (size_t i = 0; i + 1 < len; ++i) {
+    unsigned char c = literal->str[i];
+    literal->shift[c] = len - 1 - i;
+    if (ignore_case) {
+      literal->shift[ascii_toupper(c)] = len - 1 - i;
+    }
+  }
+  return literal;
+}
+
+static void search_literal_free(struct search_literal *literal) {
+  if (literal) {
+    free(literal->str);
+    free(literal);
+  }
+}
+
+// Returns the first occurrence of the literal in s[0, n), or NULL.
+static unsigned char *search_literal_find(
+    struct search_literal *literal, unsigned char *s, size_t n) {
+  size_t m = literal->len;
+  if (n < m) {
+    return NULL;
+  }
+  if (!literal->ignore_case) {
+    // glibc implements this with the Two-Way algorithm, with vectorized
+    // first character scans for short needles.
+    return memmem(s, n, literal->str, m);
+  }
+
+  unsigned char first = literal->str[0];
+  bool prefilter = ascii_toupper(first) == first;
+  unsigned char *last = s + n - m;
+  unsigned char *p = s;
+  while (p <= last) {
+    // The first character of the pattern has only one case, so memchr can
+    // skip over stretches of text that can't possibly match.
+    if (prefilter) {
+      p = memchr(p, first, (size_t) (last - p) + 1);
+      if (!p) {
+        return NULL;
+      }
+    }
+    size_t i = m;
+    while (i > 0 && ascii_tolower(p[i - 1]) == literal->str[i - 1]) {
+      --i;
+    }
+    if (!i) {
+      return p;
+    }
+    p += literal->shift[p[m - 1]];
+  }
+  return NULL;
+}
+
+static bool search_literal_next_match(struct search *search, size_t limit,
+    struct region *match) {
+  struct search_literal *literal = search->literal;
+  size_t pos = search->start;
+  while (pos <= limit && pos < search->len) {
+    size_t end = min(search->len, limit + literal->len);
+    unsigned char *found = search_literal_find(
+        literal, search->str + pos, end - pos);
+    if (!found) {
+      return false;
+    }
+
+    size_t start = (size_t) (found - search->str);
+    size_t stop = start + literal->len;
+    // [[:<:]] is a word boundary followed by a word character, and [[:>:]] a
+    // word boundary preceded by one.
+    if (literal->words && (
+        !is_word_char(search->str[start]) ||
+        (start > 0 && is_word_char(search->str[start - 1])) ||
+        !is_word_char(search->str[stop - 1]) ||
+        (stop < search->len && is_word_char(search->str[stop])))) {
+      pos = start + 1;
+      continue;
+    }
+
+    region_set(match, start, stop);
+    search->start = stop;
+    return true;
+  }
+  return false;
+}
+
+// How much work pcre2 may do looking for a match at any one position, so that
+// a pattern like (a*)*b fails with an error after a fraction of a second
+// instead of freezing the editor. The match limit caps the number of steps
+// (pcre2's default is 10000000), the depth limit how far it can backtrack,
+// and the heap limit how much memory that can take.
+#define SEARCH_MATCH_LIMIT 5000000
+#define SEARCH_DEPTH_LIMIT 1000000
+#define SEARCH_HEAP_LIMIT_KB (128 * 1024)
+
+// How much text is searched between calls to search->interrupted.
+#define SEARCH_INTERRUPT_CHUNK_SIZE (1 << 18)
+
+static bool is_continuation(unsigned char c) {
+  return (c & 0xc0) == 0x80;
+}
+
+// Sets search->utf, going by the flags if they say whether the text is valid
+// UTF-8 and checking it otherwise.
+static void search_check_text(struct search *search, int flags) {
+  uint32_t options = 0;
+  if (search->regex) {
+    pcre2_pattern_info(search->regex, PCRE2_INFO_ARGOPTIONS, &options);
+  }
+  if (!(options & PCRE2_UTF)) {
+    search->utf = false;
+  } else if (flags & (SEARCH_VALID_UTF8 | SEARCH_INVALID_UTF8)) {
+    search->utf = flags & SEARCH_VALID_UTF8;
+  } else {
+    search->utf = utf8_valid(search->str, search->len);
+  }
+}
+
+int search_init(struct search *search, char *pattern, int flags,
     char *str, size_t len) {
   memset(search, 0, sizeof(*search));
 
-  int flags = PCRE2_MULTILINE;
-  if (ignore_case) {
-    flags |= PCRE2_CASELESS;
+  search->str = (unsigned char*)str;
+  search->len = len;
+  search->start = 0;
+
+  search->literal = search_literal_create(pattern, flags);
+  if (search->literal) {
+    return 0;
+  }
+
+  uint32_t options = PCRE2_MULTILINE | PCRE2_USE_OFFSET_LIMIT;
+  if (flags & SEARCH_IGNORE_CASE) {
+    options |= PCRE2_CASELESS;
+  }
+  uint32_t utf_options = PCRE2_UTF;
+  if (flags & SEARCH_UCP) {
+    utf_options |= PCRE2_UCP;
   }
   int errorcode = 0;
   PCRE2_SIZE erroroffset = 0;
+  bool utf_pattern = utf8_valid((unsigned char*) pattern, strlen(pattern));
   search->regex = pcre2_compile(
       (unsigned char*) pattern, PCRE2_ZERO_TERMINATED,
-      flags, &errorcode, &erroroffset, NULL);
+      options | (utf_pattern ? utf_options : 0),
+      &errorcode, &erroroffset, NULL);
   if (!search->regex) {
     assert(errorcode != 0);
     return errorcode;
   }
+  if (utf_pattern) {
+    // This fails for patterns like \x{100} that can't match a single byte,
+    // which then just can't be used on text that isn't UTF-8: pcre2 will
+    // give an error if it comes across any.
+    int byte_errorcode;
+    search->byte_regex = pcre2_compile(
+        (unsigned char*) pattern, PCRE2_ZERO_TERMINATED,
+        options, &byte_errorcode, &erroroffset, NULL);
+  }
+  search_check_text(search, flags);
   search->groups = pcre2_match_data_create_from_pattern(search->regex, NULL);
-
-  search->str = (unsigned char*)str;
-  search->len = len;
-  search->start = 0;
+  search->context = pcre2_match_context_create(NULL);
+  pcre2_set_match_limit(search->context, SEARCH_MATCH_LIMIT);
+  pcre2_set_depth_limit(search->context, SEARCH_DEPTH_LIMIT);
+  pcre2_set_heap_limit(search->context, SEARCH_HEAP_LIMIT_KB);
   return 0;
 }
 
 void search_deinit(struct search *search) {
+  if (search->ranges) {
+    regionbuf_free(search->ranges);
+  }
+  search_literal_free(search->literal);
   pcre2_code_free(search->regex);
+  pcre2_code_free(search->byte_regex);
   pcre2_match_data_free(search->groups);
+  pcre2_match_context_free(search->context);
 }
 
 void search_get_error(int error, char *buf, size_t buflen) {
+  if (error == SEARCH_INTERRUPTED) {
+    snprintf(buf, buflen, "interrupted");
+    return;
+  }
   pcre2_get_error_message(error, (unsigned char*)buf, buflen);
 }
 
+void search_set_text(struct search *search, char *str, size_t len) {
+  search->str = (unsigned char*) str;
+  search->len = len;
+  search->start = 0;
+  search_check_text(search, 0);
+}
+
 bool search_next_match(struct search *search, struct region *match) {
+  return search_next_match_before(search, search->len, match);
+}
+
+static bool search_next_match_anywhere(
+    struct search *search, size_t limit, struct region *match) {
+  if (search->literal) {
+    return search_literal_next_match(search, limit, match);
+  }
+
+  pcre2_code *regex = search->regex;
+  uint32_t flags = 0;
+  if (search->utf) {
+    // A match can only start at the start of a character.
+    while (search->start < search->len &&
+           is_continuation(search->str[search->start])) {
+      search->start++;
+    }
+    flags |= PCRE2_NO_UTF_CHECK;
+  } else if (search->byte_regex) {
+    regex = search->byte_regex;
+  }
+
   // In multiline mode, pcre2 assumes the string is at the beginning of a
   // line unless told otherwise. This affects patterns that use ^.
-  int flags = 0;
   if (search->start > 0 && search->str[search->start - 1] != '\n') {
     flags |= PCRE2_NOTBOL;
   }
 
+  pcre2_set_offset_limit(search->context, limit);
   int rc = pcre2_match(
-      search->regex, search->str, search->len,
-      search->start, flags, search->groups, NULL);
+      regex, search->str, search->len,
+      search->start, flags, search->groups, search->context);
 
   if (rc > 0) {
     PCRE2_SIZE *offsets = pcre2_get_ovector_pointer(search->groups);
@@ -82,9 +360,266 @@ bool search_next_match(struct search *search, struct region *match) {
     search->start += max(1, offsets[1] - search->start);
     return true;
   }
+  if (rc != PCRE2_ERROR_NOMATCH) {
+    search->error = rc;
+  }
+  return false;
+}
+
+static bool search_next_match_in_ranges(
+    struct search *search, size_t limit, struct region *match) {
+  struct regionbuf *ranges = search->ranges;
+  if (!ranges) {
+    return search_next_match_anywhere(search, limit, match);
+  }
+
+  // Find the first range that doesn't end before the search starts.
+  size_t lo = 0, hi = ranges->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ranges->buf[mid].end <= search->start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (size_t i = lo; i < ranges->len; ++i) {
+    struct region *range = &ranges->buf[i];
+    if (range->start > limit) {
+      return false;
+    }
+    search->start = max(search->start, range->start);
+    size_t stop = min(limit, range->end - 1);
+    if (search_next_match_anywhere(search, stop, match)) {
+      return true;
+    }
+    if (stop == limit) {
+      return false;
+    }
+    search->start = range->end;
+  }
   return false;
 }
 
+bool search_next_match_before(
+    struct search *search, size_t limit, struct region *match) {
+  if (search->error) {
+    return false;
+  }
+  if (!search->interrupted) {
+    return search_next_match_in_ranges(search, limit, match);
+  }
+
+  for (;;) {
+    size_t chunk_limit = limit;
+    if (search->start < limit &&
+        limit - search->start > SEARCH_INTERRUPT_CHUNK_SIZE) {
+      chunk_limit = search->start + SEARCH_INTERRUPT_CHUNK_SIZE;
+    }
+    if (search_next_match_in_ranges(search, chunk_limit, match)) {
+      return true;
+    }
+    if (search->error || chunk_limit >= limit) {
+      return false;
+    }
+    search->start = max(search->start, chunk_limit + 1);
+    if (search->interrupted(search->interrupted_arg)) {
+      search->error = SEARCH_INTERRUPTED;
+      return false;
+    }
+  }
+}
+
+bool search_get_group(struct search *search, int n, struct region *group) {
+  if (search->literal ||
+      (uint32_t) n >= pcre2_get_ovector_count(search->groups)) {
+    return false;
+  }
+  PCRE2_SIZE *offsets = pcre2_get_ovector_pointer(search->groups);
+  if (offsets[2 * n] == PCRE2_UNSET) {
+    return false;
+  }
+  region_set(group, offsets[2 * n], offsets[2 * n + 1]);
+  return true;
+}
+
+static bool search_interrupted(void *editor) {
+  return editor_interrupted(editor);
+}
+
+static void editor_search_error(
+    struct editor *editor, char *pattern, int error) {
+  if (error == SEARCH_INTERRUPTED) {
+    editor_status_err(editor, "Interrupted");
+    return;
+  }
+  char message[48];
+  search_get_error(error, message, sizeof(message));
+  editor_status_err(editor, "Search for \"%s\" gave up: %s", pattern, message);
+}
+
+// How much text each thread takes at a time when a forward search is spread
+// over the editor's pool. Matches that start in a chunk can run on past its
+// end, since every thread searches the whole text (with an offset limit), so
+// patterns that match across lines work too.
+#define SEARCH_PARALLEL_CHUNK_SIZE (1 << 22)
+
+// The first match starting in one chunk of the text.
+struct search_chunk {
+  bool found;
+  struct region match;
+  // Set if pcre2 gave up on the pattern partway through the chunk.
+  int error;
+};
+
+// A forward search shared by the editor and the pool threads helping out, in
+// the same way as the search for a :s's matches. A thread stops taking chunks
+// once a match has been found in an earlier one.
+struct search_job {
+  char *pattern;
+  int flags;
+  char *text;
+  size_t len;
+  // Copied for each thread's search (or NULL).
+  struct regionbuf *ranges;
+  struct editor *editor;
+
+  // The lines in each chunk, and what was found in them.
+  struct region *lines;
+  struct search_chunk *chunks;
+  size_t nchunks;
+  // The first chunk with a match (or an error) in it, or nchunks. Searching
+  // the chunks after it is wasted work, so it's abandoned.
+  atomic_size_t first;
+  // Set if the editor was interrupted.
+  atomic_bool cancelled;
+};
+
+// The search->interrupted_arg of a thread working on a search_job.
+struct search_worker {
+  struct search_job *job;
+  // The chunk being searched.
+  size_t chunk;
+  // Only set for the editor's thread, which also keeps an eye out for Ctrl-C.
+  struct editor *editor;
+};
+
+static bool search_worker_interrupted(void *arg) {
+  struct search_worker *worker = arg;
+  struct search_job *job = worker->job;
+  if (worker->editor && editor_interrupted(worker->editor)) {
+    atomic_store(&job->cancelled, true);
+  }
+  return atomic_load(&job->cancelled) ||
+      atomic_load(&job->first) < worker->chunk;
+}
+
+static void search_job_found(struct search_job *job, size_t i) {
+  size_t first = atomic_load(&job->first);
+  while (i < first &&
+         !atomic_compare_exchange_weak(&job->first, &first, i)) {}
+}
+
+static void search_job_work(
+    void *arg, struct pool_chunks *chunks, bool caller) {
+  struct search_job *job = arg;
+  struct search search;
+  bool compiled = false;
+  struct search_worker worker = {job, 0, NULL};
+
+  size_t i;
+  while (pool_chunks_next(chunks, &i)) {
+    struct search_chunk *chunk = &job->chunks[i];
+    if (i < atomic_load(&job->first) && !atomic_load(&job->cancelled)) {
+      if (!compiled) {
+        // The pattern was checked before the job was started.
+        int rc = search_init(
+            &search, job->pattern, job->flags, job->text, job->len);
+        assert(!rc);
+        if (job->ranges) {
+          search.ranges = regionbuf_create(max(1, job->ranges->len));
+          regionbuf_insert_n(
+              search.ranges, job->ranges->buf, job->ranges->len, 0);
+        }
+        worker.editor = caller ? job->editor : NULL;
+        search.interrupted = search_worker_interrupted;
+        search.interrupted_arg = &worker;
+        compiled = true;
+      }
+      worker.chunk = i;
+      search.start = job->lines[i].start;
+      search.error = 0;
+      chunk->found = search_next_match_before(
+          &search, job->lines[i].end - 1, &chunk->match);
+      if (search.error != SEARCH_INTERRUPTED) {
+        chunk->error = search.error;
+      }
+      if (chunk->found || chunk->error) {
+        search_job_found(job, i);
+      }
+    }
+    pool_chunks_done(chunks);
+  }
+
+  if (compiled) {
+    search_deinit(&search);
+  }
+}
+
+// Finds the first match starting in [start, end) of the search's text, with
+// the chunks of it searched in parallel on the editor's pool.
+static bool search_parallel(struct editor *editor, struct search *search,
+    char *pattern, int flags, size_t start, size_t end, struct region *match) {
+  struct search_job job;
+  job.pattern = pattern;
+  job.flags = flags;
+  job.text = (char*) search->str;
+  job.len = search->len;
+  job.ranges = search->ranges;
+  job.editor = editor;
+  job.nchunks = pool_split_lines(
+      job.text, start, end, SEARCH_PARALLEL_CHUNK_SIZE, &job.lines);
+  job.chunks = xmalloc(max(1, job.nchunks) * sizeof(*job.chunks));
+  memset(job.chunks, 0, job.nchunks * sizeof(*job.chunks));
+  atomic_init(&job.first, job.nchunks);
+  atomic_init(&job.cancelled, false);
+  pool_run_chunks(editor_pool(editor), job.nchunks, search_job_work, &job);
+
+  bool found = false;
+  size_t first = atomic_load(&job.first);
+  if (atomic_load(&job.cancelled)) {
+    search->error = SEARCH_INTERRUPTED;
+  } else if (first < job.nchunks) {
+    struct search_chunk *chunk = &job.chunks[first];
+    found = chunk->found;
+    *match = chunk->match;
+    search->error = chunk->error;
+  }
+  free(job.lines);
+  free(job.chunks);
+  return found;
+}
+
+// Finds the first match starting in [start, end). Most searches find one
+// not far from the cursor, so the text right after start is searched on
+// this thread, and the rest is only spread over the pool if that fails.
+static bool search_forwards(struct editor *editor, struct search *search,
+    char *pattern, int flags, size_t start, size_t end, struct region *match) {
+  if (start >= end) {
+    return false;
+  }
+  size_t near = min(end, start + SEARCH_PARALLEL_CHUNK_SIZE);
+  search->start = start;
+  if (search_next_match_before(search, near - 1, match)) {
+    return true;
+  }
+  if (search->error || near == end) {
+    return false;
+  }
+  return search_parallel(editor, search, pattern, flags, near, end, match);
+}
+
 bool editor_search(struct editor *editor, char *pattern,
     size_t start, enum search_direction direction, struct region *match) {
   if (!pattern) {
@@ -97,13 +632,15 @@ bool editor_search(struct editor *editor, char *pattern,
     }
   }
 
-  struct gapbuf *gb = editor->window->buffer->text;
+  struct buffer *buffer = editor->window->buffer;
+  int flags = editor_search_flags(editor, pattern);
+  flags |= buffer_is_utf8(buffer) ? SEARCH_VALID_UTF8 : SEARCH_INVALID_UTF8;
+  struct gapbuf *gb = buffer->text;
   // Move the gap so the searched region is contiguous.
   gb_mvgap(gb, 0);
-  bool ignore_case = editor_ignore_case(editor, pattern);
 
   struct search search;
-  int rc = search_init(&search, pattern, ignore_case, gb->gapend, gb_size(gb));
+  int rc = search_init(&search, pattern, flags, gb->gapend, gb_size(gb));
 
   if (rc) {
     char error[48];
@@ -111,20 +648,32 @@ bool editor_search(struct editor *editor, char *pattern,
     editor_status_err(editor, "Bad regex \"%s\": %s", pattern, error);
     return false;
   }
+  search.ranges = buffer_search_candidates(
+      buffer, pattern, flags & SEARCH_IGNORE_CASE);
+  search.interrupted = search_interrupted;
+  search.interrupted_arg = editor;
 
 #define return search_deinit(&search); return
+#define GIVE_UP_ON_ERROR() \
+  if (search.error) { \
+    editor_search_error(editor, pattern, search.error); \
+    return false; \
+  }
 
   if (direction == SEARCH_FORWARDS) {
-    search.start = start + 1;
-    if (search_next_match(&search, match)) {
+    if (search_forwards(editor, &search, pattern, flags,
+                        start + 1, search.len, match)) {
       return true;
     }
+    GIVE_UP_ON_ERROR();
 
+    // Nothing starts after the cursor, so only the text up to it is left.
     editor_status_msg(editor, "search hit BOTTOM, continuing at TOP");
-    search.start = 0;
-    if (search_next_match(&search, match)) {
+    if (search_forwards(editor, &search, pattern, flags,
+                        0, min(start + 1, search.len), match)) {
       return true;
     }
+    GIVE_UP_ON_ERROR();
 
     editor_status_err(editor, "Pattern not found: \"%s\"", pattern);
     return false;
@@ -133,6 +682,7 @@ bool editor_search(struct editor *editor, char *pattern,
   assert(direction == SEARCH_BACKWARDS);
 
   if (!search_next_match(&search, match)) {
+    GIVE_UP_ON_ERROR();
     editor_status_err(editor, "Pattern not found: \"%s\"", pattern);
     return false;
   }
@@ -140,6 +690,7 @@ bool editor_search(struct editor *editor, char *pattern,
   if (match->start >= start) {
     editor_status_msg(editor, "search hit TOP, continuing at BOTTOM");
     while (search_next_match(&search, match)) {}
+    GIVE_UP_ON_ERROR();
     return true;
   }
 
@@ -147,20 +698,174 @@ bool editor_search(struct editor *editor, char *pattern,
   while (match->start < start) {
     prev = *match;
     if (!search_next_match(&search, match)) {
+      GIVE_UP_ON_ERROR();
       return true;
     }
   }
   *match = prev;
   return true;
+#undef GIVE_UP_ON_ERROR
 #undef return
 }
 
-void editor_jump_to_match(struct editor *editor, char *pattern,
+// How long an incremental search may run before giving up.
+#define INCSEARCH_TIMEOUT_MS 500
+// How much text is searched between checks for key presses or timeout.
+#define INCSEARCH_CHUNK_SIZE (1 << 18)
+
+void incsearch_init(struct incsearch *incsearch) {
+  incsearch->pattern = NULL;
+  incsearch->ignore_case = false;
+  incsearch->literal = false;
+  incsearch->searched = 0;
+  incsearch->wrapped = false;
+  incsearch->done = false;
+}
+
+void incsearch_deinit(struct incsearch *incsearch) {
+  free(incsearch->pattern);
+  incsearch_init(incsearch);
+}
+
+static bool incsearch_interrupted(
+    struct editor *editor, struct timespec *started) {
+  return editor_input_pending(editor) ||
+      elapsed_ms(started) > INCSEARCH_TIMEOUT_MS;
+}
+
+static enum incsearch_result incsearch_forwards(
+    struct editor *editor, struct incsearch *incsearch, struct search *search,
+    size_t start, struct timespec *started, struct region *match) {
+  while (!incsearch->done) {
+    // Matches are looked for after the cursor, then from the top up to it.
+    size_t end = incsearch->wrapped ? start : search->len;
+    if (incsearch->searched > end) {
+      if (incsearch->wrapped) {
+        incsearch->done = true;
+        break;
+      }
+      incsearch->wrapped = true;
+      incsearch->searched = 0;
+      continue;
+    }
+
+    size_t limit = min(incsearch->searched + INCSEARCH_CHUNK_SIZE, end);
+    search->start = incsearch->searched;
+    if (search_next_match_before(search, limit, match)) {
+      incsearch->searched = match->start;
+      return INCSEARCH_FOUND;
+    }
+    // pcre2 gave up on the pattern, so don't try any further.
+    if (search->error) {
+      incsearch->done = true;
+      break;
+    }
+    incsearch->searched = limit + 1;
+
+    if (incsearch_interrupted(editor, started)) {
+      return INCSEARCH_INTERRUPTED;
+    }
+  }
+  return INCSEARCH_NOT_FOUND;
+}
+
+static enum incsearch_result incsearch_backwards(
+    struct editor *editor, struct search *search,
+    size_t start, struct timespec *started, struct region *match) {
+  // The last match before the cursor, or failing that, the last match.
+  struct region before, last;
+  bool have_before = false, have_last = false;
+
+  size_t limit;
+  for (size_t pos = 0; pos <= search->len; pos = limit + 1) {
+    limit = min(pos + INCSEARCH_CHUNK_SIZE, search->len);
+    struct region next;
+    while (search_next_match_before(search, limit, &next)) {
+      if (next.start < start) {
+        before = next;
+        have_before = true;
+      } else if (have_before) {
+        *match = before;
+        return INCSEARCH_FOUND;
+      }
+      last = next;
+      have_last = true;
+    }
+    if (search->error) {
+      return INCSEARCH_NOT_FOUND;
+    }
+    search->start = max(search->start, limit + 1);
+
+    if (incsearch_interrupted(editor, started)) {
+      return INCSEARCH_INTERRUPTED;
+    }
+  }
+
+  if (!have_last) {
+    return INCSEARCH_NOT_FOUND;
+  }
+  *match = have_before ? before : last;
+  return INCSEARCH_FOUND;
+}
+
+enum incsearch_result editor_incsearch(
+    struct editor *editor, struct incsearch *incsearch, char *pattern,
+    size_t start, enum search_direction direction, struct region *match) {
+  // Don't bother if there's another key coming that'll change the pattern.
+  if (editor_input_pending(editor)) {
+    return INCSEARCH_INTERRUPTED;
+  }
+
+  struct timespec started;
+  clock_now(&started);
+
+  struct buffer *buffer = editor->window->buffer;
+  int flags = editor_search_flags(editor, pattern);
+  flags |= buffer_is_utf8(buffer) ? SEARCH_VALID_UTF8 : SEARCH_INVALID_UTF8;
+  bool ignore_case = flags & SEARCH_IGNORE_CASE;
+  struct gapbuf *gb = buffer->text;
+  gb_mvgap(gb, 0);
+
+  struct search search;
+  if (search_init(&search, pattern, flags, gb->gapend, gb_size(gb))) {
+    incsearch_deinit(incsearch);
+    return INCSEARCH_NOT_FOUND;
+  }
+  search.ranges = buffer_search_candidates(buffer, pattern, ignore_case);
+
+  bool literal = search.literal && !search.literal->words;
+  bool resume = direction == SEARCH_FORWARDS &&
+      incsearch->pattern && incsearch->literal && literal &&
+      (incsearch->ignore_case || !ignore_case) &&
+      !strncmp(pattern, incsearch->pattern, strlen(incsearch->pattern));
+  if (!resume) {
+    incsearch->searched = start + 1;
+    incsearch->wrapped = false;
+    incsearch->done = false;
+  }
+  free(incsearch->pattern);
+  incsearch->pattern = xstrdup(pattern);
+  incsearch->ignore_case = ignore_case;
+  incsearch->literal = literal;
+
+  enum incsearch_result result;
+  if (direction == SEARCH_FORWARDS) {
+    result = incsearch_forwards(
+        editor, incsearch, &search, start, &started, match);
+  } else {
+    result = incsearch_backwards(editor, &search, start, &started, match);
+  }
+  search_deinit(&search);
+  return result;
+}
+
+bool editor_jump_to_match(struct editor *editor, char *pattern,
                           size_t start, enum search_direction direction) {
   struct region match;
   if (editor_search(editor, pattern, start, direction, &match)) {
     window_set_cursor(editor->window, match.start);
-  } else {
-    window_set_cursor(editor->window, window_cursor(editor->window));
+    return true;
   }
+  window_set_cursor(editor->window, window_cursor(editor->window));
+  return false;
 }
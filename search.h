@@ -14,19 +14,72 @@ enum search_direction {
   SEARCH_BACKWARDS
 };
 
+enum search_flags {
+  SEARCH_IGNORE_CASE = 1 << 0,
+  // \w, \d, \b, [[:alpha:]] and so on go by Unicode properties instead of
+  // only matching ASCII characters ('unicodeclasses').
+  SEARCH_UCP = 1 << 1,
+  // What the caller knows about whether the text is valid UTF-8. If it's
+  // neither, the search checks the text itself.
+  SEARCH_VALID_UTF8 = 1 << 2,
+  SEARCH_INVALID_UTF8 = 1 << 3,
+};
+
+struct search_literal;
+
 struct search {
+  // Set instead of regex if the pattern has no regex syntax in it (e.g. it's
+  // just an identifier), in which case it's searched for directly.
+  struct search_literal *literal;
+  // Compiled with PCRE2_UTF (unless the pattern itself isn't valid UTF-8).
   pcre2_code *regex;
+  // The same pattern compiled without PCRE2_UTF, for text that isn't valid
+  // UTF-8 (e.g. a binary file), which is then matched byte by byte. NULL if
+  // regex is already that, or if the pattern only makes sense as UTF-8.
+  pcre2_code *byte_regex;
   pcre2_match_data *groups;
+  pcre2_match_context *context;
   unsigned char *str;
   size_t len;
   size_t start;
+  // Whether str is being matched as UTF-8. It's checked once up front, so
+  // that pcre2 can be told not to check it again on every call.
+  bool utf;
+  // If set, only matches starting in these ranges (sorted and disjoint) are
+  // looked for, e.g. the candidates from the buffer's trigram index. The
+  // search owns them.
+  struct regionbuf *ranges;
+
+  // If set, called every so often during a long search. If it returns true,
+  // the search stops with SEARCH_INTERRUPTED.
+  bool (*interrupted)(void *arg);
+  void *interrupted_arg;
+  // Set if a search stopped before it could look at all of the text, either
+  // because it was interrupted or because pcre2 gave up on a pathological
+  // pattern (e.g. with PCRE2_ERROR_MATCHLIMIT).
+  int error;
 };
 
-int search_init(struct search *search, char *pattern, bool ignore_case,
+// Not a pcre2 error code.
+#define SEARCH_INTERRUPTED (-1000)
+
+// flags is a combination of enum search_flags.
+int search_init(struct search *search, char *pattern, int flags,
     char *str, size_t len);
+// Starts the search over on different text, which is checked for UTF-8.
+void search_set_text(struct search *search, char *str, size_t len);
+// Gets the message for an error from search_init, or for search->error.
 void search_get_error(int error, char *buf, size_t buflen);
 void search_deinit(struct search *search);
 bool search_next_match(struct search *search, struct region *match);
+// Like search_next_match, but only finds a match if it starts at or before
+// limit. This allows going through a huge string a piece at a time.
+bool search_next_match_before(
+    struct search *search, size_t limit, struct region *match);
+// Gets the text matched by the nth capture group in the last match. Returns
+// false if the group didn't take part in the match. Group 0 (the whole match)
+// is only available for regexes.
+bool search_get_group(struct search *search, int n, struct region *group);
 
 // Search for the given pattern in the currently opened buffer, returning the
 // first match. If pattern is NULL, will instead search for the pattern stored
@@ -35,7 +88,44 @@ bool editor_search(
     struct editor *editor, char *pattern,
     size_t start, enum search_direction direction, struct region *match);
 
+// What's left over from the last search done while typing a pattern with
+// 'incsearch', so that the next search can pick up from there.
+struct incsearch {
+  char *pattern;
+  bool ignore_case;
+  // Whether the pattern was searched for literally. If so, any match of a
+  // pattern that extends it is also a match of it, so the search for the
+  // longer pattern can skip the text already ruled out.
+  bool literal;
+  // No match starts between the start of the search and here...
+  size_t searched;
+  // ...having continued from the top after hitting the bottom.
+  bool wrapped;
+  // Whether the whole buffer has been searched.
+  bool done;
+};
+
+enum incsearch_result {
+  INCSEARCH_FOUND,
+  INCSEARCH_NOT_FOUND,
+  // A key was pressed or the search took too long.
+  INCSEARCH_INTERRUPTED,
+};
+
+void incsearch_init(struct incsearch *incsearch);
+void incsearch_deinit(struct incsearch *incsearch);
+
+// Like editor_search, but gives up as soon as a key is pressed, or after a
+// while. Searching forwards for a pattern which extends the last one resumes
+// from where the last search left off instead of starting over.
+enum incsearch_result editor_incsearch(
+    struct editor *editor, struct incsearch *incsearch, char *pattern,
+    size_t start, enum search_direction direction, struct region *match);
+
 bool editor_ignore_case(struct editor *editor, char *pattern);
+// The flags for searching for the pattern per the editor's options
+// ('ignorecase', 'smartcase' and 'unicodeclasses').
+int editor_search_flags(struct editor *editor, char *pattern);
 
-void editor_jump_to_match(struct editor *editor, char *pattern,
+bool editor_jump_to_match(struct editor *editor, char *pattern,
                           size_t start, enum search_direction direction);
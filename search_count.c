@@ -0,0 +1,229 @@
+#include "search_count.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "pool.h"
+#include "search.h"
+#include "trigram.h"
+#include "utf8.h"
+#include "util.h"
+#include "window.h"
+
+// How long counting may run before giving up.
+#define SEARCH_COUNT_TIMEOUT_MS 1000
+// How much text is searched between checks for cancellation or timeout.
+#define SEARCH_COUNT_CHUNK_SIZE (1 << 20)
+
+// The state shared with the pool thread doing the counting. The thread only
+// reads the inputs and writes the outputs, and the editor only reads the
+// outputs once done is set. Whoever lets go of it last frees it, so that
+// cancelling never has to wait for the thread to notice.
+struct search_count_job {
+  atomic_int refs;
+  atomic_bool cancelled;
+  atomic_bool done;
+
+  char *pattern;
+  int flags;
+  // Taken with the gap at the start, so the text is all in one piece.
+  struct gb_snapshot *text;
+  // Where matches might be, going by the buffer's trigram index (or NULL).
+  struct regionbuf *ranges;
+  size_t cursor;
+
+  bool error;
+  size_t current;
+  size_t total;
+  bool limited;
+  bool timed_out;
+};
+
+static void search_count_job_release(struct search_count_job *job) {
+  if (atomic_fetch_sub(&job->refs, 1) > 1) {
+    return;
+  }
+  free(job->pattern);
+  gb_snapshot_free(job->text);
+  if (job->ranges) {
+    regionbuf_free(job->ranges);
+  }
+  free(job);
+}
+
+static bool search_count_cancelled(void *job) {
+  return atomic_load(&((struct search_count_job*) job)->cancelled);
+}
+
+static void search_count_job_count(struct search_count_job *job) {
+  size_t len;
+  const char *text = gb_snapshot_span(job->text, 0, &len);
+  struct search search;
+  if (search_init(&search, job->pattern, job->flags, (char*) text, len)) {
+    job->error = true;
+    return;
+  }
+  search.ranges = job->ranges;
+  job->ranges = NULL;
+  search.interrupted = search_count_cancelled;
+  search.interrupted_arg = job;
+
+  struct timespec start;
+  clock_now(&start);
+
+  size_t chunk_start = 0;
+  while (chunk_start < search.len) {
+    size_t limit = min(chunk_start + SEARCH_COUNT_CHUNK_SIZE, search.len);
+    struct region match;
+    while (search_next_match_before(&search, limit, &match)) {
+      if (job->total == SEARCH_COUNT_LIMIT) {
+        job->limited = true;
+        if (match.start <= job->cursor) {
+          job->current = SEARCH_COUNT_LIMIT + 1;
+        }
+        goto out;
+      }
+      job->total++;
+      if (match.start <= job->cursor) {
+        job->current = job->total;
+      }
+    }
+
+    // If pcre2 gave up on the pattern, the total can't be known.
+    if (search.error && search.error != SEARCH_INTERRUPTED) {
+      job->timed_out = true;
+      goto out;
+    }
+    if (atomic_load(&job->cancelled)) {
+      goto out;
+    }
+    if (elapsed_ms(&start) > SEARCH_COUNT_TIMEOUT_MS) {
+      job->timed_out = true;
+      goto out;
+    }
+
+    chunk_start = limit + 1;
+    search.start = max(search.start, chunk_start);
+  }
+
+out:
+  search_deinit(&search);
+}
+
+static void search_count_job_run(void *arg) {
+  struct search_count_job *job = arg;
+  search_count_job_count(job);
+  atomic_store(&job->done, true);
+  search_count_job_release(job);
+}
+
+static void search_count_cancel(struct search_count *count) {
+  if (count->job) {
+    atomic_store(&count->job->cancelled, true);
+    search_count_job_release(count->job);
+    count->job = NULL;
+  }
+}
+
+static void search_count_start(
+    struct search_count *count, struct pool *pool, size_t cursor) {
+  search_count_cancel(count);
+
+  struct search_count_job *job = xmalloc(sizeof(*job));
+  memset(job, 0, sizeof(*job));
+  atomic_init(&job->refs, 2);
+  atomic_init(&job->cancelled, false);
+  atomic_init(&job->done, false);
+  job->pattern = xstrdup(count->pattern);
+  job->flags = count->flags;
+  job->flags |= buffer_is_utf8(count->buffer) ?
+      SEARCH_VALID_UTF8 : SEARCH_INVALID_UTF8;
+  // With the gap at the start the text is in one piece. The search that led
+  // here has just moved it there, so this is free.
+  struct gapbuf *gb = count->buffer->text;
+  gb_mvgap(gb, 0);
+  job->text = gb_snapshot(gb);
+  job->ranges = buffer_search_candidates(
+      count->buffer, count->pattern, count->flags & SEARCH_IGNORE_CASE);
+  job->cursor = cursor;
+  pool_submit(pool, search_count_job_run, job);
+
+  count->job = job;
+  count->version = count->buffer->version;
+  count->ready = false;
+}
+
+void editor_count_matches(struct editor *editor, char *pattern, size_t cursor) {
+  struct search_count *count = &editor->search_count;
+  editor_clear_search_count(editor);
+  if (strchr(editor->opt.shortmess, 'S')) {
+    return;
+  }
+
+  count->buffer = editor->window->buffer;
+  count->pattern = xstrdup(pattern);
+  count->flags = editor_search_flags(editor, pattern);
+  count->visible = true;
+  search_count_start(count, editor_pool(editor), cursor);
+}
+
+bool editor_update_search_count(struct editor *editor) {
+  struct search_count *count = &editor->search_count;
+  if (!count->visible) {
+    return false;
+  }
+
+  // Recounting after every edit would mean searching the whole buffer on
+  // every key press, so the count is dropped until the next search.
+  if (count->version != count->buffer->version) {
+    bool was_ready = count->ready;
+    editor_clear_search_count(editor);
+    return was_ready;
+  }
+
+  struct search_count_job *job = count->job;
+  if (!job || !atomic_load(&job->done)) {
+    return false;
+  }
+
+  if (job->error) {
+    editor_clear_search_count(editor);
+    return false;
+  }
+
+  count->ready = true;
+  count->current = job->current;
+  count->total = job->total;
+  count->limited = job->limited;
+  count->timed_out = job->timed_out;
+  search_count_job_release(job);
+  count->job = NULL;
+  return true;
+}
+
+void editor_clear_search_count(struct editor *editor) {
+  struct search_count *count = &editor->search_count;
+  search_count_cancel(count);
+  free(count->pattern);
+  memset(count, 0, sizeof(*count));
+}
+
+void search_count_format(
+    struct search_count *count, char *buf, size_t buflen) {
+  if (count->timed_out) {
+    snprintf(buf, buflen, "[?/??]");
+  } else if (count->limited && count->current > SEARCH_COUNT_LIMIT) {
+    snprintf(buf, buflen, "[>%d/>%d]", SEARCH_COUNT_LIMIT, SEARCH_COUNT_LIMIT);
+  } else if (count->limited) {
+    snprintf(buf, buflen, "[%zu/>%d]", count->current, SEARCH_COUNT_LIMIT);
+  } else {
+    snprintf(buf, buflen, "[%zu/%zu]", count->current, count->total);
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct buffer;
+struct editor;
+struct search_count_job;
+
+// The "[n/total]" shown in the status bar after a search, like vim does when
+// 'shortmess' doesn't contain S. The matches are counted on the editor's
+// thread pool, over a snapshot of the buffer's text, so that searching a huge
+// buffer never stalls the editor; the count shows up once it's ready. Editing
+// the buffer drops the count, until the next search counts again.
+struct search_count {
+  // The count in progress (possibly NULL).
+  struct search_count_job *job;
+
+  // What's being counted.
+  struct buffer *buffer;
+  size_t version;
+  char *pattern;
+  // A combination of enum search_flags.
+  int flags;
+
+  // Whether the count should be shown in the status bar.
+  bool visible;
+  // Whether the fields below are filled in.
+  bool ready;
+  // The index of the match under (or before) the cursor, and the total.
+  size_t current;
+  size_t total;
+  // Set if counting stopped early, either because there were more than
+  // SEARCH_COUNT_LIMIT matches or because it took too long.
+  bool limited;
+  bool timed_out;
+};
+
+// Counting stops once this many matches are found.
+#define SEARCH_COUNT_LIMIT 99
+
+// Starts counting the matches of pattern in the current buffer, relative to
+// the given cursor position, replacing any count already shown or in progress.
+void editor_count_matches(struct editor *editor, char *pattern, size_t cursor);
+
+// Picks up the result of the count in progress, if it's done, and drops the
+// count if the buffer changed in the meantime. Returns true if what should
+// be shown in the status bar changed.
+bool editor_update_search_count(struct editor *editor);
+
+// Stops showing the count, cancelling it if it's still in progress.
+void editor_clear_search_count(struct editor *editor);
+
+// Writes the count as shown in the status bar, e.g. "[3/10]".
+void search_count_format(struct search_count *count, char *buf, size_t buflen);
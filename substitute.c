@@ -0,0 +1,625 @@
+#include "substitute.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "history.h"
+#include "pool.h"
+#include "search.h"
+#include "utf8.h"
+#include "util.h"
+#include "window.h"
+
+// Text longer than this is split (at line boundaries) into pieces of about
+// this size, which are searched in parallel on the editor's pool.
+#define SUBSTITUTE_CHUNK_SIZE (1 << 20)
+
+// Like vim's 'report' option: only say how many substitutions were made if
+// there were more than this many.
+#define SUBSTITUTE_REPORT 2
+
+// A piece of the replacement string: either some literal text, or the text
+// matched by one of the capture groups.
+struct replacement_part {
+  // The group, or -1 for literal text.
+  int group;
+  // Where the literal text is in replacement->text.
+  size_t start;
+  size_t len;
+};
+
+struct replacement {
+  struct buf *text;
+  struct replacement_part *parts;
+  size_t nparts;
+  // The number of groups that need to be kept for each match (at least 1, for
+  // the match itself).
+  int ngroups;
+};
+
+static void replacement_add(
+    struct replacement *rep, int group, size_t start, size_t len) {
+  struct replacement_part *last =
+      rep->nparts ? &rep->parts[rep->nparts - 1] : NULL;
+  if (group < 0 && last && last->group < 0) {
+    last->len += len;
+    return;
+  }
+  rep->parts = xrealloc(rep->parts, (rep->nparts + 1) * sizeof(*rep->parts));
+  rep->parts[rep->nparts++] = (struct replacement_part) {group, start, len};
+  rep->ngroups = max(rep->ngroups, group + 1);
+}
+
+// & and \0 to \9 stand for the match and its groups, \r and \n for a newline
+// and \t for a tab. A backslash before anything else makes it literal.
+static void replacement_parse(struct replacement *rep, char *s) {
+  rep->text = buf_create(strlen(s) + 1);
+  rep->parts = NULL;
+  rep->nparts = 0;
+  rep->ngroups = 1;
+
+  for (; *s; ++s) {
+    char c = *s;
+    int group = -1;
+    if (c == '&') {
+      group = 0;
+    } else if (c == '\\' && s[1]) {
+      c = *++s;
+      if (isdigit((unsigned char) c)) {
+        group = c - '0';
+      } else if (c == 'r' || c == 'n') {
+        c = '\n';
+      } else if (c == 't') {
+        c = '\t';
+      }
+    }
+
+    if (group >= 0) {
+      replacement_add(rep, group, 0, 0);
+    } else {
+      replacement_add(rep, -1, rep->text->len, 1);
+      buf_append_char(rep->text, c);
+    }
+  }
+}
+
+static void replacement_free(struct replacement *rep) {
+  buf_free(rep->text);
+  free(rep->parts);
+}
+
+// The matches found in one chunk of the text.
+struct substitute_chunk {
+  // For each match, the regions matched by groups 0 to ngroups - 1 (empty if
+  // a group didn't take part in the match).
+  struct regionbuf *groups;
+  // Set if pcre2 gave up on the pattern partway through the chunk.
+  int error;
+};
+
+// The search for the matches, shared by the editor and the pool threads
+// helping out.
+struct substitute_job {
+  char *pattern;
+  int flags;
+  bool all_matches;
+  int ngroups;
+  char *text;
+  size_t len;
+
+  // The lines in each chunk, and what was found in them.
+  struct region *lines;
+  struct substitute_chunk *chunks;
+  size_t nchunks;
+};
+
+static void substitute_job_free(struct substitute_job *job) {
+  for (size_t i = 0; i < job->nchunks; ++i) {
+    if (job->chunks[i].groups) {
+      regionbuf_free(job->chunks[i].groups);
+    }
+  }
+  free(job->lines);
+  free(job->chunks);
+  free(job->pattern);
+  free(job);
+}
+
+// Finds the matches starting in [start, end), adding the regions matched by
+// groups 0 to ngroups - 1 for each to groups (empty if a group didn't take
+// part in the match).
+static void substitute_search(struct search *search, bool all_matches,
+    int ngroups, size_t start, size_t end, struct regionbuf *groups) {
+  search->start = start;
+  search->error = 0;
+  struct region match;
+  while (search->start < end &&
+         search_next_match_before(search, end - 1, &match)) {
+    regionbuf_add(groups, &match);
+    for (int i = 1; i < ngroups; ++i) {
+      struct region group;
+      if (!search_get_group(search, i, &group)) {
+        region_set(&group, match.start, match.start);
+      }
+      regionbuf_add(groups, &group);
+    }
+
+    if (!all_matches) {
+      char *text = (char*) search->str;
+      char *newline = memchr(text + match.start, '\n', search->len - match.start);
+      size_t next_line =
+          newline ? (size_t) (newline - text) + 1 : search->len;
+      search->start = max(search->start, next_line);
+    }
+  }
+}
+
+static void substitute_job_work(
+    void *arg, struct pool_chunks *chunks, bool caller) {
+  (void) caller;
+  struct substitute_job *job = arg;
+  struct search search;
+  bool compiled = false;
+
+  size_t i;
+  while (pool_chunks_next(chunks, &i)) {
+    if (!compiled) {
+      // The pattern was checked before the job was started.
+      int rc = search_init(
+          &search, job->pattern, job->flags, job->text, job->len);
+      assert(!rc);
+      compiled = true;
+    }
+    struct substitute_chunk *chunk = &job->chunks[i];
+    chunk->groups = regionbuf_create(16);
+    substitute_search(&search, job->all_matches, job->ngroups,
+        job->lines[i].start, job->lines[i].end, chunk->groups);
+    chunk->error = search.error;
+    pool_chunks_done(chunks);
+  }
+
+  if (compiled) {
+    search_deinit(&search);
+  }
+}
+
+// Finds the matches in the given part of the text, spreading the work over
+// the editor's pool if there's a lot of it.
+static struct substitute_job *substitute_find_matches(
+    struct editor *editor, char *pattern, int flags, bool all_matches,
+    int ngroups, char *text, size_t len, size_t start, size_t end) {
+  struct substitute_job *job = xmalloc(sizeof(*job));
+  job->pattern = xstrdup(pattern);
+  job->flags = flags;
+  job->all_matches = all_matches;
+  job->ngroups = ngroups;
+  job->text = text;
+  job->len = len;
+  job->nchunks = pool_split_lines(
+      text, start, end, SUBSTITUTE_CHUNK_SIZE, &job->lines);
+  job->chunks = xmalloc(max(1, job->nchunks) * sizeof(*job->chunks));
+  memset(job->chunks, 0, job->nchunks * sizeof(*job->chunks));
+  pool_run_chunks(editor_pool(editor), job->nchunks, substitute_job_work, job);
+  return job;
+}
+
+enum substitute_answer {
+  SUBSTITUTE_YES,
+  SUBSTITUTE_NO,
+  SUBSTITUTE_ALL,
+  SUBSTITUTE_LAST,
+  SUBSTITUTE_QUIT,
+};
+
+static enum substitute_answer substitute_ask(
+    struct editor *editor, struct region *match, char *replacement) {
+  window_set_cursor(editor->window, match->start);
+  editor->window->have_incsearch_match = true;
+  editor->window->incsearch_match = *match;
+  editor->status_cursor = 0;
+  editor_status_msg(editor, "replace with %s (y/n/a/q/l)?", replacement);
+  editor_draw(editor);
+
+  for (;;) {
+    switch (editor_getchar(editor)) {
+    case 'y': return SUBSTITUTE_YES;
+    case 'n': return SUBSTITUTE_NO;
+    case 'a': return SUBSTITUTE_ALL;
+    case 'l': return SUBSTITUTE_LAST;
+    // <esc> and <c-c> come through as 0.
+    case 'q': case '\0': return SUBSTITUTE_QUIT;
+    default: break;
+    }
+  }
+}
+
+static size_t replacement_len(
+    struct replacement *rep, struct region *groups) {
+  size_t len = 0;
+  for (size_t i = 0; i < rep->nparts; ++i) {
+    struct replacement_part *part = &rep->parts[i];
+    if (part->group < 0) {
+      len += part->len;
+    } else {
+      len += groups[part->group].end - groups[part->group].start;
+    }
+  }
+  return len;
+}
+
+static char *replacement_write(struct replacement *rep,
+    struct region *groups, char *text, char *out) {
+  for (size_t i = 0; i < rep->nparts; ++i) {
+    struct replacement_part *part = &rep->parts[i];
+    if (part->group < 0) {
+      memcpy(out, rep->text->buf + part->start, part->len);
+      out += part->len;
+    } else {
+      struct region *group = &groups[part->group];
+      memcpy(out, text + group->start, group->end - group->start);
+      out += group->end - group->start;
+    }
+  }
+  return out;
+}
+
+// Splits s at the first delimiter that isn't escaped with a backslash,
+// returning what follows it (or NULL if there isn't one).
+static char *split_at_delimiter(char *s, char delimiter) {
+  for (; *s; ++s) {
+    if (*s == '\\' && s[1]) {
+      ++s;
+    } else if (*s == delimiter) {
+      *s = '\0';
+      return s + 1;
+    }
+  }
+  return NULL;
+}
+
+static const char *plural(size_t n, const char *word, const char *words) {
+  return n == 1 ? word : words;
+}
+
+// A parsed :s command.
+struct substitute {
+  char *copy;
+  // Whether a pattern was given, rather than using the last one.
+  bool have_pattern;
+  char *pattern;
+  char *replacement;
+  // A combination of enum search_flags.
+  int flags;
+  bool all_matches;
+  bool confirm;
+  bool report_only;
+  bool quiet;
+};
+
+// Parses what follows the s. On failure, leaves an error message in error.
+static bool substitute_parse(struct editor *editor, char *arg,
+    struct substitute *sub, char *error, size_t errorlen) {
+  memset(sub, 0, sizeof(*sub));
+  sub->copy = xstrdup(arg);
+  char delimiter = *sub->copy;
+  sub->pattern = sub->copy + 1;
+  sub->replacement = split_at_delimiter(sub->pattern, delimiter);
+  char *flags = NULL;
+  if (sub->replacement) {
+    flags = split_at_delimiter(sub->replacement, delimiter);
+  } else {
+    sub->replacement = "";
+  }
+
+  char case_flag = '\0';
+  for (char *f = flags; f && *f; ++f) {
+    switch (*f) {
+    case 'g': sub->all_matches = true; break;
+    case 'c': sub->confirm = true; break;
+    case 'i': case 'I': case_flag = *f; break;
+    case 'e': sub->quiet = true; break;
+    case 'n': sub->report_only = true; break;
+    default:
+      snprintf(error, errorlen, "Trailing characters: %s", f);
+      return false;
+    }
+  }
+
+  sub->have_pattern = *sub->pattern;
+  if (!sub->have_pattern) {
+    sub->pattern = editor_get_register(editor, '/')->buf->buf;
+    if (!*sub->pattern) {
+      snprintf(error, errorlen, "No previous regular expression");
+      return false;
+    }
+  }
+
+  sub->flags = editor_search_flags(editor, sub->pattern);
+  if (case_flag == 'i') {
+    sub->flags |= SEARCH_IGNORE_CASE;
+  } else if (case_flag == 'I') {
+    sub->flags &= ~SEARCH_IGNORE_CASE;
+  }
+  struct search search;
+  int rc = search_init(&search, sub->pattern, sub->flags, "", 0);
+  if (rc) {
+    char message[48];
+    search_get_error(rc, message, sizeof(message));
+    snprintf(error, errorlen, "Bad regex \"%s\": %s", sub->pattern, message);
+    return false;
+  }
+  search_deinit(&search);
+  return true;
+}
+
+void editor_substitute(
+    struct editor *editor, size_t first, size_t last, char *arg) {
+  struct substitute sub;
+  char error[256];
+  if (!substitute_parse(editor, arg, &sub, error, sizeof(error))) {
+    editor_status_err(editor, "%s", error);
+    free(sub.copy);
+    return;
+  }
+
+  if (sub.have_pattern) {
+    struct editor_register *lsp = editor_get_register(editor, '/');
+    lsp->write(lsp, sub.pattern);
+    history_add_item(&editor->search_history, sub.pattern);
+  }
+  editor->highlight_search_matches = true;
+
+  struct replacement rep;
+  replacement_parse(&rep, sub.replacement);
+
+  struct buffer *buffer = editor->window->buffer;
+  sub.flags |= buffer_is_utf8(buffer) ? SEARCH_VALID_UTF8 : SEARCH_INVALID_UTF8;
+  struct gapbuf *gb = buffer->text;
+  gb_mvgap(gb, 0);
+  char *text = gb->gapend;
+  size_t len = gb_size(gb);
+  size_t start = gb_linecol_to_pos(gb, first, 0);
+  size_t end = last + 1 < gb_nlines(gb) ?
+      gb_linecol_to_pos(gb, last + 1, 0) : len;
+
+  struct substitute_job *job = substitute_find_matches(
+      editor, sub.pattern, sub.flags, sub.all_matches, rep.ngroups,
+      text, len, start, end);
+
+  for (size_t i = 0; i < job->nchunks; ++i) {
+    if (job->chunks[i].error) {
+      char message[48];
+      search_get_error(job->chunks[i].error, message, sizeof(message));
+      editor_status_err(editor, "Search for \"%s\" gave up: %s",
+          sub.pattern, message);
+      substitute_job_free(job);
+      replacement_free(&rep);
+      free(sub.copy);
+      return;
+    }
+  }
+
+  // Gather the matches to replace in order, dropping any that overlap the one
+  // before (which happens if a match runs past the end of its chunk).
+  size_t ngroups = (size_t) rep.ngroups;
+  struct regionbuf *accepted = regionbuf_create(16);
+  size_t nmatches = 0;
+  size_t prev_end = 0;
+  enum substitute_answer answer = SUBSTITUTE_YES;
+  for (size_t i = 0; i < job->nchunks && answer != SUBSTITUTE_QUIT; ++i) {
+    struct regionbuf *groups = job->chunks[i].groups;
+    for (size_t j = 0; j < groups->len; j += ngroups) {
+      struct region *match = &groups->buf[j];
+      if (nmatches && match->start < prev_end) {
+        continue;
+      }
+      nmatches++;
+      prev_end = match->end;
+
+      if (sub.confirm && answer != SUBSTITUTE_ALL && !sub.report_only) {
+        answer = substitute_ask(editor, match, sub.replacement);
+        if (answer == SUBSTITUTE_QUIT) {
+          break;
+        }
+      }
+      if (answer != SUBSTITUTE_NO) {
+        regionbuf_insert_n(accepted, match, ngroups, accepted->len);
+      }
+      if (answer == SUBSTITUTE_LAST) {
+        answer = SUBSTITUTE_QUIT;
+        break;
+      }
+    }
+  }
+  editor->window->have_incsearch_match = false;
+  // Drawing the prompts shouldn't have moved the gap, but just in case.
+  gb_mvgap(gb, 0);
+  text = gb->gapend;
+
+  size_t nsubs = accepted->len / ngroups;
+  size_t nlines = 0;
+  for (size_t i = 0; i < nsubs; ++i) {
+    size_t pos = accepted->buf[i * ngroups].start;
+    size_t prev = i ? accepted->buf[(i - 1) * ngroups].start : pos;
+    if (!i || memchr(text + prev, '\n', pos - prev)) {
+      nlines++;
+    }
+  }
+
+  if (!nmatches) {
+    if (!sub.quiet) {
+      editor_status_err(editor, "Pattern not found: %s", sub.pattern);
+    }
+  } else if (sub.report_only) {
+    editor_status_msg(editor, "%zu %s on %zu %s",
+        nsubs, plural(nsubs, "match", "matches"),
+        nlines, plural(nlines, "line", "lines"));
+  } else if (nsubs) {
+    // Build the new text for everything from the first match to the end of
+    // the last one in one go, then swap it in as a single change.
+    size_t from = accepted->buf[0].start;
+    size_t to = accepted->buf[(nsubs - 1) * ngroups].end;
+    size_t new_len = to - from;
+    for (size_t i = 0; i < nsubs; ++i) {
+      struct region *groups = &accepted->buf[i * ngroups];
+      new_len -= groups->end - groups->start;
+      new_len += replacement_len(&rep, groups);
+    }
+
+    struct buf *out = buf_create(new_len + 1);
+    struct buffer_change *changes = xmalloc(nsubs * sizeof(*changes));
+    char *p = out->buf;
+    size_t prev = from;
+    size_t last_start = 0;
+    for (size_t i = 0; i < nsubs; ++i) {
+      struct region *groups = &accepted->buf[i * ngroups];
+      memcpy(p, text + prev, groups->start - prev);
+      p += groups->start - prev;
+      char *replaced = p;
+      p = replacement_write(&rep, groups, text, p);
+      changes[i] = (struct buffer_change) {
+          groups->start, groups->end, (size_t) (p - replaced)};
+      last_start = from + (size_t) (replaced - out->buf);
+      prev = groups->end;
+    }
+    out->len = new_len;
+    out->buf[out->len] = '\0';
+
+    buffer_start_action_group(buffer);
+    buffer_do_replace(buffer, from, to - from, out, changes, nsubs);
+    free(changes);
+
+    size_t line, col;
+    gb_pos_to_linecol(gb, last_start, &line, &col);
+    editor_jump_to_line(editor, (int) line);
+
+    if (nsubs > SUBSTITUTE_REPORT) {
+      editor_status_msg(editor, "%zu %s on %zu %s",
+          nsubs, plural(nsubs, "substitution", "substitutions"),
+          nlines, plural(nlines, "line", "lines"));
+    }
+  }
+
+  regionbuf_free(accepted);
+  substitute_job_free(job);
+  replacement_free(&rep);
+  free(sub.copy);
+}
+
+void substitute_preview_free(struct substitute_preview *preview) {
+  if (!preview) {
+    return;
+  }
+  for (size_t i = 0; i < preview->nlines; ++i) {
+    if (preview->lines[i]) {
+      buf_free(preview->lines[i]);
+      regionbuf_free(preview->replaced[i]);
+    }
+  }
+  free(preview->lines);
+  free(preview->replaced);
+  free(preview);
+}
+
+void editor_preview_substitute(struct editor *editor, char *command) {
+  struct window *window = editor->window;
+  substitute_preview_free(window->substitute_preview);
+  window->substitute_preview = NULL;
+  if (!*editor->opt.inccommand) {
+    return;
+  }
+
+  struct gapbuf *gb = window->buffer->text;
+  int first, last;
+  editor_parse_range(editor, &command, &first, &last);
+  char *arg = command_parse_substitute(command);
+  if (!arg || first < 0 || last >= (int) gb_nlines(gb)) {
+    return;
+  }
+
+  struct substitute sub;
+  char error[256];
+  if (!substitute_parse(editor, arg, &sub, error, sizeof(error))) {
+    free(sub.copy);
+    return;
+  }
+  struct replacement rep;
+  replacement_parse(&rep, sub.replacement);
+
+  sub.flags |= buffer_is_utf8(window->buffer) ?
+      SEARCH_VALID_UTF8 : SEARCH_INVALID_UTF8;
+  gb_mvgap(gb, 0);
+  char *text = gb->gapend;
+  struct search search;
+  search_init(&search, sub.pattern, sub.flags, text, gb_size(gb));
+
+  struct substitute_preview *preview = xmalloc(sizeof(*preview));
+  preview->top = window->top;
+  preview->nlines = window_h(window);
+  preview->lines = xmalloc(preview->nlines * sizeof(*preview->lines));
+  preview->replaced = xmalloc(preview->nlines * sizeof(*preview->replaced));
+
+  size_t ngroups = (size_t) rep.ngroups;
+  struct regionbuf *groups = regionbuf_create(16);
+  for (size_t i = 0; i < preview->nlines; ++i) {
+    size_t line = preview->top + i;
+    preview->lines[i] = NULL;
+    if (line < (size_t) first || line > (size_t) last ||
+        line >= gb_nlines(gb)) {
+      continue;
+    }
+
+    size_t start = gb_linecol_to_pos(gb, line, 0);
+    size_t end = start + gb->lines->buf[line];
+    groups->len = 0;
+    substitute_search(
+        &search, sub.all_matches, rep.ngroups, start, end + 1, groups);
+    if (!groups->len) {
+      continue;
+    }
+
+    struct buf *buf = buf_create(end - start + 1);
+    struct regionbuf *replaced = regionbuf_create(groups->len / ngroups);
+    size_t prev = start;
+    for (size_t j = 0; j < groups->len; j += ngroups) {
+      struct region *match = &groups->buf[j];
+      if (match->start < prev) {
+        continue;
+      }
+      size_t len = match->start - prev + replacement_len(&rep, match);
+      buf_grow(buf, max(buf->cap * 2, buf->len + len + 1));
+      char *p = buf->buf + buf->len;
+      memcpy(p, text + prev, match->start - prev);
+      p += match->start - prev;
+      struct region region;
+      region.start = (size_t) (p - buf->buf);
+      p = replacement_write(&rep, match, text, p);
+      region.end = (size_t) (p - buf->buf);
+      regionbuf_add(replaced, &region);
+      buf->len = (size_t) (p - buf->buf);
+      prev = match->end;
+    }
+    if (prev < end) {
+      buf_grow(buf, max(buf->cap, buf->len + end - prev + 1));
+      memcpy(buf->buf + buf->len, text + prev, end - prev);
+      buf->len += end - prev;
+    }
+    buf->buf[buf->len] = '\0';
+    preview->lines[i] = buf;
+    preview->replaced[i] = replaced;
+  }
+
+  regionbuf_free(groups);
+  search_deinit(&search);
+  replacement_free(&rep);
+  free(sub.copy);
+  window->substitute_preview = preview;
+}
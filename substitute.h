@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+
+struct editor;
+
+// What the lines visible in a window would look like after a :s.
+struct substitute_preview {
+  // The first line visible in the window.
+  size_t top;
+  size_t nlines;
+  // For each visible line, its new text (or NULL if it's unchanged), and the
+  // parts of the new text that were put in by the substitution.
+  struct buf **lines;
+  struct regionbuf **replaced;
+};
+
+// Runs :[range]s/pattern/replacement/[flags] on the lines first to last
+// (0-based, inclusive) of the current buffer. arg is what follows the "s",
+// starting with the delimiter.
+void editor_substitute(
+    struct editor *editor, size_t first, size_t last, char *arg);
+
+// If 'inccommand' is set and the command being typed is a :s, previews its
+// effect on the lines visible in the current window. Nothing else is
+// searched, and the buffer isn't changed.
+void editor_preview_substitute(struct editor *editor, char *command);
+void substitute_preview_free(struct substitute_preview *preview);
@@ -1,27 +1,24 @@
 #include "syntax.h"
 
-#include <assert.h>
 #include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "buf.h"
 #include "buffer.h"
+#include "editor.h"
 #include "gap.h"
+#include "keywords.h"
+#include "pool.h"
 #include "util.h"
 
-char c_regex[] =
-  // Types
-  "(char|short|int|long|signed|unsigned|void|float|double|struct|enum|union|"
-  "typedef|size_t|ssize_t|off_t|ptrdiff_t|sig_atomic_t|clock_t|time_t|va_list|"
-  "jmp_buf|FILE|DIR|bool|_Bool|int8_t|uint8_t|int16_t|uint16_t|int32_t|"
-  "uint32_t|int64_t|uint64_t|intptr_t|uintptr_t|"
-  // These are not really types but just for the purposes of highlighting
-  "auto|const|extern|inline|register|restrict|static|volatile)\\b|"
-  // Preprocessor directives
-  "(#include|#define|#undef|#pragma|#ifdef|#ifndef|#if|#else|#error|#endif)\\b|"
-  // Constants
-  "(true|false|NULL)\\b|"
-  // Statements
-  "(asm|break|case|continue|default|do|else|for|goto|if|return|sizeof|switch|while)\\b";
+#include "c_keywords.h"
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
 
@@ -36,16 +33,66 @@ static bool gb_startswith_at(struct gapbuf *gb, size_t pos, char *prefix) {
 }
 
 static bool is_word_char(char c) {
-  return isalnum(c) || c == '_';
+  return isalnum((unsigned char) c) || c == '_';
 }
 
-static size_t gb_findstring(struct gapbuf *gb, size_t from, char *s) {
-  size_t i = 0;
-  size_t size = gb_size(gb);
-  while (from + i < size && !gb_startswith_at(gb, from + i, s)) {
-    i++;
+// Returns the offset just past the first "*/" at or after from if it's on the
+// same line, or else the offset of the end of the line (and clears *closed).
+static size_t gb_find_comment_end(
+    struct gapbuf *gb, size_t from, bool *closed) {
+  size_t eol = gb_indexof(gb, '\n', from);
+  size_t end = gb_findstring(gb, "*/", 2, from, eol);
+  *closed = end < eol;
+  return *closed ? end + 2 : eol;
+}
+
+// Returns the length of the word starting at pos: the first character, whatever
+// it is, and the word characters after it.
+static size_t gb_word_length(struct gapbuf *gb, size_t pos) {
+  size_t n;
+  const char *s = gb_span(gb, pos, &n);
+  size_t len = 1;
+  while (len < n && is_word_char(s[len])) {
+    len++;
   }
-  return from + i;
+  if (len == n) {
+    // The word runs into the gap.
+    size_t size = gb_size(gb);
+    while (pos + len < size && is_word_char(gb_getchar(gb, pos + len))) {
+      len++;
+    }
+  }
+  return len;
+}
+
+// Returns the len characters at pos, copied into copy (which must have room
+// for len + 1) if they're split by the gap.
+static const char *gb_word(
+    struct gapbuf *gb, size_t pos, size_t len, char *copy) {
+  size_t n;
+  const char *word = gb_span(gb, pos, &n);
+  if (n < len) {
+    gb_getstring_into(gb, pos, len, copy);
+    word = copy;
+  }
+  return word;
+}
+
+// The kind of token the word at pos is if it's a keyword, or else
+// SYNTAX_TOKEN_NONE.
+static enum syntax_token_kind c_keyword(
+    struct gapbuf *gb, size_t pos, size_t len) {
+  if (len > C_KEYWORDS_MAX_LEN) {
+    return SYNTAX_TOKEN_NONE;
+  }
+  char copy[C_KEYWORDS_MAX_LEN + 1];
+  const char *word = gb_word(gb, pos, len, copy);
+  const struct keyword *keyword =
+      &c_keywords[keyword_hash(word, len, C_KEYWORDS_SEED) & C_KEYWORDS_MASK];
+  if (keyword->len != len || memcmp(keyword->word, word, len)) {
+    return SYNTAX_TOKEN_NONE;
+  }
+  return (enum syntax_token_kind) keyword->kind;
 }
 
 static bool is_escaped(struct gapbuf *gb, size_t pos) {
@@ -56,9 +103,26 @@ static bool is_escaped(struct gapbuf *gb, size_t pos) {
   return backslashes % 2 == 1;
 }
 
+// Returns the offset just past the closing quote of the string (or character)
+// literal continued at from if it's on the same line, or else the offset of
+// the end of the line. Sets *continued if the literal goes on to the next
+// line, because the newline is escaped.
+static size_t gb_find_string_end(
+    struct gapbuf *gb, size_t from, char quote, bool *continued) {
+  size_t eol = gb_indexof(gb, '\n', from);
+  *continued = false;
+  for (size_t pos = from; (pos = gb_findstring(gb, &quote, 1, pos, eol)) < eol;
+       ++pos) {
+    if (!is_escaped(gb, pos)) {
+      return pos + 1;
+    }
+  }
+  *continued = eol < gb_size(gb) && is_escaped(gb, eol);
+  return eol;
+}
+
 static void c_next_token(struct syntax *syntax, struct syntax_token *token) {
   struct gapbuf *gb = syntax->buffer->text;
-  size_t size = gb_size(gb);
   char ch = gb_getchar(gb, syntax->pos);
 
 #define RETURN_TOKEN(type, len_) \
@@ -68,8 +132,38 @@ static void c_next_token(struct syntax *syntax, struct syntax_token *token) {
     syntax->pos += token->len; \
     return;
 
+  // A comment or string that goes on past the end of a line is a token per
+  // line, with the state saying where the next line starts.
+  bool closed, continued;
+  size_t end;
+  switch (syntax->state) {
+  case STATE_COMMENT:
+  case STATE_PREPROC_COMMENT:
+    if (ch == '\n') {
+      RETURN_TOKEN(COMMENT, 1);
+    }
+    end = gb_find_comment_end(gb, syntax->pos, &closed);
+    if (closed) {
+      syntax->state =
+          syntax->state == STATE_COMMENT ? STATE_INIT : STATE_PREPROC;
+    }
+    RETURN_TOKEN(COMMENT, end - syntax->pos);
+  case STATE_STRING:
+    if (ch == '\n') {
+      RETURN_TOKEN(LITERAL_STRING, 1);
+    }
+    end = gb_find_string_end(gb, syntax->pos, '"', &continued);
+    if (!continued) {
+      syntax->state = STATE_INIT;
+    }
+    RETURN_TOKEN(LITERAL_STRING, end - syntax->pos);
+  default:
+    break;
+  }
+
   if (isspace(ch)) {
-    if (ch == '\n' && gb_getchar(gb, syntax->pos - 1) != '\\') {
+    if (ch == '\n' &&
+        (!syntax->pos || gb_getchar(gb, syntax->pos - 1) != '\\')) {
       syntax->state = STATE_INIT;
     }
     RETURN_TOKEN(IDENTIFIER, 1);
@@ -79,30 +173,16 @@ static void c_next_token(struct syntax *syntax, struct syntax_token *token) {
     RETURN_TOKEN(LITERAL_NUMBER, 1);
   }
 
-  char prefix[16 + 1];
-  gb_getstring_into(gb, syntax->pos, 16, prefix);
-
-  int rc = pcre2_match(syntax->regex,
-      (unsigned char*) prefix, PCRE2_ZERO_TERMINATED, 0, 0, syntax->groups, NULL);
-  if (rc > 0) {
-    PCRE2_SIZE *offsets = pcre2_get_ovector_pointer(syntax->groups);
-
-    token->pos = syntax->pos;
-    token->len = offsets[1] - offsets[0];
-    syntax->pos += token->len;
-
-    if (offsets[2] != PCRE2_UNSET) {
-      token->kind = SYNTAX_TOKEN_TYPE;
-    } else if (offsets[4] != PCRE2_UNSET) {
+  size_t len = gb_word_length(gb, syntax->pos);
+  enum syntax_token_kind keyword = c_keyword(gb, syntax->pos, len);
+  if (keyword != SYNTAX_TOKEN_NONE) {
+    if (keyword == SYNTAX_TOKEN_PREPROC) {
       syntax->state = STATE_PREPROC;
-      token->kind = SYNTAX_TOKEN_PREPROC;
-    } else if (offsets[6] != PCRE2_UNSET) {
-      token->kind = SYNTAX_TOKEN_LITERAL_NUMBER;
-    } else if (offsets[8] != PCRE2_UNSET) {
-      token->kind = SYNTAX_TOKEN_STATEMENT;
-    } else {
-      assert(0);
     }
+    token->pos = syntax->pos;
+    token->kind = keyword;
+    token->len = len;
+    syntax->pos += len;
     return;
   }
 
@@ -112,39 +192,33 @@ static void c_next_token(struct syntax *syntax, struct syntax_token *token) {
   }
 
   if (gb_startswith_at(gb, syntax->pos, "/*")) {
-    size_t end = gb_findstring(gb, syntax->pos, "*/");
-    if (end != size) {
-      end += 2;
+    end = gb_find_comment_end(gb, syntax->pos + 2, &closed);
+    if (!closed) {
+      syntax->state = syntax->state == STATE_PREPROC ?
+          STATE_PREPROC_COMMENT : STATE_COMMENT;
     }
     RETURN_TOKEN(COMMENT, end - syntax->pos);
   }
 
   if (ch == '"') {
-    size_t start = syntax->pos + 1;
-    size_t end;
-    do {
-      end = gb_indexof(gb, '"', start);
-      start = end + 1;
-    } while (end < size && is_escaped(gb, end));
-    RETURN_TOKEN(LITERAL_STRING, end - syntax->pos + 1);
+    end = gb_find_string_end(gb, syntax->pos + 1, '"', &continued);
+    if (continued) {
+      syntax->state = STATE_STRING;
+    }
+    RETURN_TOKEN(LITERAL_STRING, end - syntax->pos);
   }
 
   if (syntax->state == STATE_PREPROC && ch == '<') {
-    size_t end = gb_indexof(gb, '>', syntax->pos + 1);
     size_t newline = gb_indexof(gb, '\n', syntax->pos + 1);
+    end = gb_findstring(gb, ">", 1, syntax->pos + 1, newline);
     if (end < newline) {
       RETURN_TOKEN(LITERAL_STRING, end - syntax->pos + 1);
     }
   }
 
   if (ch == '\'') {
-    size_t start = syntax->pos + 1;
-    size_t end;
-    do {
-      end = gb_indexof(gb, '\'', start);
-      start = end + 1;
-    } while (end < size && is_escaped(gb, end));
-    RETURN_TOKEN(LITERAL_CHAR, end - syntax->pos + 1);
+    end = gb_find_string_end(gb, syntax->pos + 1, '\'', &continued);
+    RETURN_TOKEN(LITERAL_CHAR, end - syntax->pos);
   }
 
   if (ispunct(ch)) {
@@ -155,81 +229,1386 @@ static void c_next_token(struct syntax *syntax, struct syntax_token *token) {
     }
   }
 
-  size_t end = syntax->pos + 1;
-  while (is_word_char(gb_getchar(gb, end++))) {}
   if (syntax->state == STATE_PREPROC) {
-    RETURN_TOKEN(PREPROC, end - syntax->pos - 1);
+    RETURN_TOKEN(PREPROC, len);
   } else {
-    RETURN_TOKEN(IDENTIFIER, end - syntax->pos - 1);
+    RETURN_TOKEN(IDENTIFIER, len);
   }
 }
 
-static void c_token_at(struct syntax *syntax, struct syntax_token *token, size_t pos) {
-  do {
-    c_next_token(syntax, token);
-  } while (!(token->pos <= pos && pos < token->pos + token->len));
-}
+// The longest keyword a syntax file can define.
+#define SYNTAX_KEYWORD_MAX_LEN 64
+// How much of the rest of the line a syntax file's rules are matched against.
+#define SYNTAX_MATCH_WINDOW 256
+
+// A filetype defined by a syntax file (see syntax_load_path).
+struct syntax_definition {
+  // An open addressing hash table of the keywords, with empty slots left NULL.
+  struct keyword *keywords;
+  size_t mask;
 
-static struct filetype {
+  // The comments, strings, regions and matches, in the order they're tried.
+  struct syntax_rule {
+    enum syntax_token_kind kind;
+    // What ends a region, or NULL for a match. The newline ending a region
+    // that runs to the end of the line isn't part of it.
+    char *end;
+    bool eol;
+    char escape;
+  } *rules;
+  size_t nrules;
+  // All of the rules, as an anchored alternation in which each alternative
+  // starts with (*MARK:i) for the index of its rule. NULL if there are none.
+  pcre2_code *regex;
+};
+
+#define FILETYPE_MAX_EXTS 8
+
+struct filetype {
   char *name;
-  char *exts[2];
+  char *exts[FILETYPE_MAX_EXTS];
   tokenizer_func tokenizer;
-  char *regex;
-} supported_filetypes[] = {
-  {"c", {"c", "h"}, c_token_at, c_regex},
+  // NULL for a built in filetype.
+  struct syntax_definition *definition;
+};
+
+// Tries the rules at syntax->pos, against the rest of the line. Returns the
+// one that matched (and the length of the match), or NULL.
+static struct syntax_rule *syntax_match_rule(
+    struct syntax *syntax, size_t *len) {
+  struct syntax_definition *def = syntax->filetype->definition;
+  if (!def->regex) {
+    return NULL;
+  }
+  struct gapbuf *gb = syntax->buffer->text;
+  size_t size = gb_size(gb);
+  size_t pos = syntax->pos;
+  size_t n = min(size - pos, SYNTAX_MATCH_WINDOW);
+  size_t span;
+  const char *s = gb_span(gb, pos, &span);
+  char copy[SYNTAX_MATCH_WINDOW + 1];
+  if (span < n) {
+    gb_getstring_into(gb, pos, n, copy);
+    s = copy;
+  }
+
+  uint32_t options = 0;
+  const char *newline = memchr(s, '\n', n);
+  if (newline) {
+    n = (size_t) (newline - s);
+  } else if (pos + n < size) {
+    options |= PCRE2_NOTEOL;
+  }
+  if (pos > 0 && gb_getchar(gb, pos - 1) != '\n') {
+    options |= PCRE2_NOTBOL;
+  }
+  int rc = pcre2_match(
+      def->regex, (PCRE2_SPTR) s, n, 0, options, syntax->groups, NULL);
+  if (rc < 0) {
+    return NULL;
+  }
+  PCRE2_SIZE *offsets = pcre2_get_ovector_pointer(syntax->groups);
+  // An empty match wouldn't get the tokenizer anywhere.
+  if (offsets[1] == 0) {
+    return NULL;
+  }
+  *len = offsets[1];
+  return &def->rules[strtoul((char*) pcre2_get_mark(syntax->groups), NULL, 10)];
+}
+
+// Whether the character at pos is escaped by the rule's escape character,
+// not counting those before from.
+static bool syntax_rule_escaped(struct gapbuf *gb, struct syntax_rule *rule,
+    size_t from, size_t pos) {
+  size_t escapes = 0;
+  while (rule->escape && pos - escapes > from &&
+         gb_getchar(gb, pos - escapes - 1) == rule->escape) {
+    escapes++;
+  }
+  return escapes % 2 == 1;
+}
+
+// Returns the offset just past the end of the region continued at from if
+// it's on the same line, or else the offset of the end of the line (and
+// clears *closed). A region that runs to the end of the line only goes on to
+// the next one if the newline is escaped.
+static size_t gb_find_region_end(
+    struct gapbuf *gb, struct syntax_rule *rule, size_t from, bool *closed) {
+  size_t eol = gb_indexof(gb, '\n', from);
+  if (rule->eol) {
+    *closed = eol == gb_size(gb) || !syntax_rule_escaped(gb, rule, from, eol);
+    return eol;
+  }
+  size_t len = strlen(rule->end);
+  for (size_t pos = from;
+       (pos = gb_findstring(gb, rule->end, len, pos, eol)) < eol; ++pos) {
+    if (!syntax_rule_escaped(gb, rule, from, pos)) {
+      *closed = true;
+      return pos + len;
+    }
+  }
+  *closed = false;
+  return eol;
+}
+
+static enum syntax_token_kind syntax_definition_keyword(
+    struct syntax_definition *def, struct gapbuf *gb, size_t pos, size_t len) {
+  if (len > SYNTAX_KEYWORD_MAX_LEN) {
+    return SYNTAX_TOKEN_NONE;
+  }
+  char copy[SYNTAX_KEYWORD_MAX_LEN + 1];
+  const char *word = gb_word(gb, pos, len, copy);
+  for (size_t i = keyword_hash(word, len, 0) & def->mask;
+       def->keywords[i].word; i = (i + 1) & def->mask) {
+    struct keyword *keyword = &def->keywords[i];
+    if (keyword->len == len && !memcmp(keyword->word, word, len)) {
+      return (enum syntax_token_kind) keyword->kind;
+    }
+  }
+  return SYNTAX_TOKEN_NONE;
+}
+
+static void syntax_definition_next_token(
+    struct syntax *syntax, struct syntax_token *token) {
+  struct gapbuf *gb = syntax->buffer->text;
+  size_t size = gb_size(gb);
+  size_t pos = syntax->pos;
+  unsigned char ch = (unsigned char) gb_getchar(gb, pos);
+
+  token->pos = pos;
+  token->kind = SYNTAX_TOKEN_IDENTIFIER;
+  token->len = 1;
+
+  struct syntax_rule *rule;
+  size_t len;
+  bool closed;
+  if (syntax->state >= STATE_REGION) {
+    rule = &syntax->filetype->definition->rules[syntax->state - STATE_REGION];
+    token->kind = rule->kind;
+    if (ch != '\n') {
+      token->len = gb_find_region_end(gb, rule, pos, &closed) - pos;
+      if (closed) {
+        syntax->state = STATE_INIT;
+      }
+    }
+  } else if (ch == '\n') {
+    // A newline is a token of its own.
+  } else if (isspace(ch)) {
+    while (pos + token->len < size &&
+           gb_getchar(gb, pos + token->len) != '\n' &&
+           isspace((unsigned char) gb_getchar(gb, pos + token->len))) {
+      token->len++;
+    }
+  } else if ((rule = syntax_match_rule(syntax, &len))) {
+    token->kind = rule->kind;
+    token->len = len;
+    if (rule->end) {
+      token->len = gb_find_region_end(gb, rule, pos + len, &closed) - pos;
+      if (!closed) {
+        syntax->state = (enum syntax_state) (STATE_REGION +
+            (rule - syntax->filetype->definition->rules));
+      }
+    }
+  } else if (is_word_char((char) ch)) {
+    token->len = gb_word_length(gb, pos);
+    enum syntax_token_kind keyword = syntax_definition_keyword(
+        syntax->filetype->definition, gb, pos, token->len);
+    if (isdigit(ch)) {
+      token->kind = SYNTAX_TOKEN_LITERAL_NUMBER;
+    } else if (keyword != SYNTAX_TOKEN_NONE) {
+      token->kind = keyword;
+    }
+  } else {
+    token->kind = SYNTAX_TOKEN_PUNCTUATION;
+  }
+  syntax->pos += token->len;
+}
+
+static struct filetype builtin_filetypes[] = {
+  {"c", {"c", "h"}, c_next_token, NULL},
 };
 
+// The filetypes loaded from syntax files. These are kept until the editor
+// exits, since buffers (and their tokenizers on the thread pool) point at them.
+static struct {
+  struct filetype **buf;
+  size_t len;
+  size_t cap;
+  // The syntaxpath they were loaded from.
+  char *path;
+} loaded_filetypes = {NULL, 0, 0, NULL};
+static pthread_mutex_t loaded_filetypes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Must be called with the lock held, unless only built in filetypes matter.
+static struct filetype *filetype_find(
+    bool (*pred)(struct filetype*, const char*), const char *arg) {
+  for (size_t i = 0; i < ARRAY_SIZE(builtin_filetypes); ++i) {
+    if (pred(&builtin_filetypes[i], arg)) {
+      return &builtin_filetypes[i];
+    }
+  }
+  for (size_t i = 0; i < loaded_filetypes.len; ++i) {
+    if (pred(loaded_filetypes.buf[i], arg)) {
+      return loaded_filetypes.buf[i];
+    }
+  }
+  return NULL;
+}
+
+static bool filetype_has_name(struct filetype *filetype, const char *name) {
+  return !strcmp(filetype->name, name);
+}
+
+static bool filetype_has_ext(struct filetype *filetype, const char *ext) {
+  for (int i = 0; i < FILETYPE_MAX_EXTS && filetype->exts[i]; ++i) {
+    if (!strcmp(filetype->exts[i], ext)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static struct filetype *filetype_named(const char *name) {
+  pthread_mutex_lock(&loaded_filetypes_lock);
+  struct filetype *filetype = filetype_find(filetype_has_name, name);
+  pthread_mutex_unlock(&loaded_filetypes_lock);
+  return filetype;
+}
+
 char *syntax_detect_filetype(char *path) {
   char *dot = strrchr(path, '.');
   if (!dot || dot == path) {
     return "";
   }
-  for (size_t i = 0; i < ARRAY_SIZE(supported_filetypes); ++i) {
-    struct filetype *filetype = &supported_filetypes[i];
-    for (int i = 0; i < 2; ++i) {
-      if (!strcmp(dot + 1, filetype->exts[i])) {
-        return filetype->name;
+  pthread_mutex_lock(&loaded_filetypes_lock);
+  struct filetype *filetype = filetype_find(filetype_has_ext, dot + 1);
+  pthread_mutex_unlock(&loaded_filetypes_lock);
+  return filetype ? filetype->name : "";
+}
+
+static const char *syntax_token_kind_names[] = {
+  [SYNTAX_TOKEN_COMMENT] = "COMMENT",
+  [SYNTAX_TOKEN_IDENTIFIER] = "IDENTIFIER",
+  [SYNTAX_TOKEN_LITERAL_CHAR] = "LITERAL_CHAR",
+  [SYNTAX_TOKEN_LITERAL_NUMBER] = "LITERAL_NUMBER",
+  [SYNTAX_TOKEN_LITERAL_STRING] = "LITERAL_STRING",
+  [SYNTAX_TOKEN_PREPROC] = "PREPROC",
+  [SYNTAX_TOKEN_PUNCTUATION] = "PUNCTUATION",
+  [SYNTAX_TOKEN_STATEMENT] = "STATEMENT",
+  [SYNTAX_TOKEN_TYPE] = "TYPE",
+};
+
+static enum syntax_token_kind syntax_token_kind_named(const char *name) {
+  for (size_t i = 0; i < ARRAY_SIZE(syntax_token_kind_names); ++i) {
+    if (syntax_token_kind_names[i] &&
+        !strcmp(syntax_token_kind_names[i], name)) {
+      return (enum syntax_token_kind) i;
+    }
+  }
+  return SYNTAX_TOKEN_NONE;
+}
+
+// A syntax file being read, and what's been read so far.
+struct syntax_file {
+  const char *path;
+  size_t lineno;
+  char *error;
+  size_t errorlen;
+
+  struct filetype *filetype;
+  size_t nexts;
+  char **words;
+  enum syntax_token_kind *kinds;
+  size_t nwords;
+  size_t wordscap;
+  struct syntax_rule *rules;
+  size_t rulescap;
+  // The rules' alternatives, for the regex.
+  struct buf *pattern;
+};
+
+ATTR_PRINTFLIKE(2, 3)
+static bool syntax_file_error(
+    struct syntax_file *file, const char *format, ...) {
+  int n = snprintf(file->error, file->errorlen, "%s:%zu: ",
+      file->path, file->lineno);
+  if (n >= 0 && (size_t) n < file->errorlen) {
+    va_list args;
+    va_start(args, format);
+    vsnprintf(file->error + n, file->errorlen - (size_t) n, format, args);
+    va_end(args);
+  }
+  return false;
+}
+
+static bool syntax_file_add_rule(struct syntax_file *file,
+    enum syntax_token_kind kind, char *pattern, bool literal,
+    char *end, char *escape) {
+  if (!pattern || !*pattern) {
+    return syntax_file_error(file, "missing pattern");
+  }
+  if (end && !*end) {
+    return syntax_file_error(file, "missing end");
+  }
+  if (escape && strlen(escape) != 1) {
+    return syntax_file_error(file, "escape must be one character: %s", escape);
+  }
+
+  struct syntax_definition *def = file->filetype->definition;
+  if (def->nrules == file->rulescap) {
+    file->rulescap = max(8, file->rulescap * 2);
+    file->rules = xrealloc(file->rules, file->rulescap * sizeof(*file->rules));
+  }
+  struct syntax_rule *rule = &file->rules[def->nrules];
+  rule->kind = kind;
+  rule->eol = end && !strcmp(end, "$");
+  rule->end = end ? xstrdup(rule->eol ? "" : end) : NULL;
+  rule->escape = escape ? *escape : '\0';
+
+  buf_appendf(file->pattern, "%s(*MARK:%zu)(?:",
+      def->nrules ? "|" : "", def->nrules);
+  if (literal) {
+    for (char *c = pattern; *c; ++c) {
+      if (!isalnum((unsigned char) *c)) {
+        buf_append_char(file->pattern, '\\');
       }
+      buf_append_char(file->pattern, *c);
+    }
+  } else {
+    buf_append(file->pattern, pattern);
+  }
+  buf_append(file->pattern, ")");
+  def->nrules++;
+  return true;
+}
+
+static bool syntax_file_add_keyword(
+    struct syntax_file *file, enum syntax_token_kind kind, char *word) {
+  if (strlen(word) > SYNTAX_KEYWORD_MAX_LEN) {
+    return syntax_file_error(file, "keyword too long: %s", word);
+  }
+  for (char *c = word; *c; ++c) {
+    if (!is_word_char(*c)) {
+      return syntax_file_error(file, "not a word: %s", word);
+    }
+  }
+  if (file->nwords == file->wordscap) {
+    file->wordscap = max(64, file->wordscap * 2);
+    file->words = xrealloc(file->words, file->wordscap * sizeof(*file->words));
+    file->kinds = xrealloc(file->kinds, file->wordscap * sizeof(*file->kinds));
+  }
+  file->words[file->nwords] = xstrdup(word);
+  file->kinds[file->nwords] = kind;
+  file->nwords++;
+  return true;
+}
+
+static bool syntax_file_read_line(struct syntax_file *file, char *line) {
+  char *directive = strtok(line, " \t");
+  if (!directive || !strncmp(directive, "//", 2)) {
+    return true;
+  }
+
+  char *arg;
+  if (!strcmp(directive, "extensions")) {
+    while ((arg = strtok(NULL, " \t"))) {
+      if (file->nexts == FILETYPE_MAX_EXTS) {
+        return syntax_file_error(file, "too many extensions");
+      }
+      file->filetype->exts[file->nexts++] = xstrdup(arg);
+    }
+    return true;
+  }
+
+  if (!strcmp(directive, "match")) {
+    char *kind = strtok(NULL, " \t");
+    if (!kind || syntax_token_kind_named(kind) == SYNTAX_TOKEN_NONE) {
+      return syntax_file_error(file, "unknown kind: %s", kind ? kind : "");
+    }
+    char *pattern = strtok(NULL, "");
+    if (pattern) {
+      pattern += strspn(pattern, " \t");
+    }
+    return syntax_file_add_rule(
+        file, syntax_token_kind_named(kind), pattern, false, NULL, NULL);
+  }
+
+  enum syntax_token_kind kind = syntax_token_kind_named(directive);
+  if (kind != SYNTAX_TOKEN_NONE) {
+    while ((arg = strtok(NULL, " \t"))) {
+      if (!syntax_file_add_keyword(file, kind, arg)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  char *args[4] = {NULL, NULL, NULL, NULL};
+  size_t nargs = 0;
+  while ((arg = strtok(NULL, " \t"))) {
+    if (nargs == ARRAY_SIZE(args)) {
+      return syntax_file_error(file, "too many arguments");
+    }
+    args[nargs++] = arg;
+  }
+
+  if (!strcmp(directive, "comment") && nargs <= 2) {
+    return syntax_file_add_rule(file, SYNTAX_TOKEN_COMMENT,
+        args[0], true, args[1] ? args[1] : "$", NULL);
+  }
+  if (!strcmp(directive, "string") && nargs <= 2) {
+    return syntax_file_add_rule(file, SYNTAX_TOKEN_LITERAL_STRING,
+        args[0], true, args[0], args[1]);
+  }
+  if (!strcmp(directive, "region")) {
+    kind = args[0] ? syntax_token_kind_named(args[0]) : SYNTAX_TOKEN_NONE;
+    if (kind == SYNTAX_TOKEN_NONE) {
+      return syntax_file_error(
+          file, "unknown kind: %s", args[0] ? args[0] : "");
+    }
+    return syntax_file_add_rule(
+        file, kind, args[1], true, args[2] ? args[2] : "", args[3]);
+  }
+  if (!strcmp(directive, "comment") || !strcmp(directive, "string")) {
+    return syntax_file_error(file, "too many arguments");
+  }
+  return syntax_file_error(file, "unknown directive: %s", directive);
+}
+
+// Puts the keywords read into a hash table about twice as big as them.
+static void syntax_file_build_keywords(struct syntax_file *file) {
+  struct syntax_definition *def = file->filetype->definition;
+  size_t size = 16;
+  while (size < 2 * file->nwords) {
+    size *= 2;
+  }
+  def->mask = size - 1;
+  def->keywords = xmalloc(size * sizeof(*def->keywords));
+  memset(def->keywords, 0, size * sizeof(*def->keywords));
+  for (size_t i = 0; i < file->nwords; ++i) {
+    size_t len = strlen(file->words[i]);
+    size_t slot = keyword_hash(file->words[i], len, 0) & def->mask;
+    while (def->keywords[slot].word &&
+           strcmp(def->keywords[slot].word, file->words[i])) {
+      slot = (slot + 1) & def->mask;
+    }
+    // A word listed again keeps the kind it was first given.
+    if (!def->keywords[slot].word) {
+      def->keywords[slot].word = file->words[i];
+      def->keywords[slot].len = len;
+      def->keywords[slot].kind = (int) file->kinds[i];
+      file->words[i] = NULL;
+    }
+  }
+}
+
+static bool syntax_file_compile(struct syntax_file *file) {
+  struct syntax_definition *def = file->filetype->definition;
+  def->rules = file->rules;
+  file->rules = NULL;
+  if (!def->nrules) {
+    return true;
+  }
+  int errorcode;
+  PCRE2_SIZE erroroffset;
+  def->regex = pcre2_compile((PCRE2_SPTR) file->pattern->buf,
+      file->pattern->len, PCRE2_ANCHORED, &errorcode, &erroroffset, NULL);
+  if (!def->regex) {
+    char message[256];
+    pcre2_get_error_message(errorcode, (unsigned char*) message,
+        sizeof(message));
+    return syntax_file_error(file, "bad regex: %s", message);
+  }
+  // Without JIT support, pcre2_match falls back to interpreting the regex.
+  pcre2_jit_compile(def->regex, PCRE2_JIT_COMPLETE);
+  return true;
+}
+
+static void syntax_definition_free(struct syntax_definition *def) {
+  for (size_t i = 0; i <= def->mask; ++i) {
+    free((char*) def->keywords[i].word);
+  }
+  free(def->keywords);
+  for (size_t i = 0; i < def->nrules; ++i) {
+    free(def->rules[i].end);
+  }
+  free(def->rules);
+  pcre2_code_free(def->regex);
+  free(def);
+}
+
+static void filetype_free(struct filetype *filetype) {
+  free(filetype->name);
+  for (int i = 0; i < FILETYPE_MAX_EXTS; ++i) {
+    free(filetype->exts[i]);
+  }
+  syntax_definition_free(filetype->definition);
+  free(filetype);
+}
+
+// Reads and compiles the syntax file at path, which defines the filetype
+// called name. Returns NULL if it can't.
+static struct filetype *filetype_load(const char *path, const char *name,
+    char *error, size_t errorlen) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) {
+    snprintf(error, errorlen, "Can't open file %s", path);
+    return NULL;
+  }
+
+  struct filetype *filetype = xmalloc(sizeof(*filetype));
+  memset(filetype, 0, sizeof(*filetype));
+  filetype->name = xstrdup(name);
+  filetype->tokenizer = syntax_definition_next_token;
+  filetype->definition = xmalloc(sizeof(*filetype->definition));
+  memset(filetype->definition, 0, sizeof(*filetype->definition));
+
+  struct syntax_file file;
+  memset(&file, 0, sizeof(file));
+  file.path = path;
+  file.error = error;
+  file.errorlen = errorlen;
+  file.filetype = filetype;
+  file.pattern = buf_create(256);
+
+  bool ok = true;
+  size_t n = 0;
+  char *line = NULL;
+  ssize_t len = 0;
+  while (ok && (len = getline(&line, &n, fp)) != -1) {
+    file.lineno++;
+    if (len > 0 && line[len - 1] == '\n') {
+      line[len - 1] = '\0';
+    }
+    ok = syntax_file_read_line(&file, line);
+  }
+  free(line);
+  fclose(fp);
+
+  // The keyword table is built even if something went wrong, so that freeing
+  // the definition frees the words.
+  syntax_file_build_keywords(&file);
+  ok = ok && syntax_file_compile(&file);
+  if (file.rules) {
+    filetype->definition->rules = file.rules;
+  }
+  for (size_t i = 0; i < file.nwords; ++i) {
+    free(file.words[i]);
+  }
+  free(file.words);
+  free(file.kinds);
+  buf_free(file.pattern);
+
+  if (!ok) {
+    filetype_free(filetype);
+    return NULL;
+  }
+  return filetype;
+}
+
+#define SYNTAX_FILE_SUFFIX ".syntax"
+
+// Loads the syntax files in dir whose filetypes aren't defined yet. Must be
+// called with the lock held.
+static bool syntax_load_dir(const char *dir, char *error, size_t errorlen) {
+  char *path = abspath(dir);
+  DIR *d = opendir(path);
+  if (!d) {
+    free(path);
+    return true;
+  }
+
+  bool ok = true;
+  size_t suffixlen = strlen(SYNTAX_FILE_SUFFIX);
+  struct dirent *entry;
+  while ((entry = readdir(d))) {
+    size_t len = strlen(entry->d_name);
+    if (len <= suffixlen ||
+        strcmp(entry->d_name + len - suffixlen, SYNTAX_FILE_SUFFIX)) {
+      continue;
+    }
+    char name[NAME_MAX + 1];
+    strcpy(name, entry->d_name);
+    name[len - suffixlen] = '\0';
+    if (filetype_find(filetype_has_name, name)) {
+      continue;
+    }
+
+    char file[PATH_MAX];
+    snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+    // Keep going after a bad file, but report the first one.
+    struct filetype *filetype =
+        filetype_load(file, name, ok ? error : NULL, ok ? errorlen : 0);
+    if (!filetype) {
+      ok = false;
+      continue;
+    }
+    if (loaded_filetypes.len == loaded_filetypes.cap) {
+      loaded_filetypes.cap = max(8, loaded_filetypes.cap * 2);
+      loaded_filetypes.buf = xrealloc(loaded_filetypes.buf,
+          loaded_filetypes.cap * sizeof(*loaded_filetypes.buf));
+    }
+    loaded_filetypes.buf[loaded_filetypes.len++] = filetype;
+  }
+  closedir(d);
+  free(path);
+  return ok;
+}
+
+bool syntax_load_path(char *syntaxpath, char *error, size_t errorlen) {
+  pthread_mutex_lock(&loaded_filetypes_lock);
+  if (loaded_filetypes.path && !strcmp(loaded_filetypes.path, syntaxpath)) {
+    pthread_mutex_unlock(&loaded_filetypes_lock);
+    return true;
+  }
+  free(loaded_filetypes.path);
+  loaded_filetypes.path = xstrdup(syntaxpath);
+
+  bool ok = true;
+  char *p, *dirs;
+  p = dirs = xstrdup(syntaxpath);
+  char *dir;
+  while ((dir = strsep(&dirs, ","))) {
+    if (*dir && !syntax_load_dir(dir, ok ? error : NULL, ok ? errorlen : 0)) {
+      ok = false;
     }
   }
-  return "";
+  free(p);
+  pthread_mutex_unlock(&loaded_filetypes_lock);
+  return ok;
+}
+
+// Checkpoints are made at the first token starting at least this many bytes
+// after the last one: about every 250 lines of typical code.
+#define SYNTAX_CHECKPOINT_INTERVAL (1 << 13)
+
+// Where the tokenizer was (at the start of a token) every so often, the last
+// time it went through a buffer. Tokenizing only ever depends on the text
+// before the current position and the state, so starting from a checkpoint
+// gives the same tokens as starting from the top. A comment or string that
+// spans lines is a token per line, with the state saying it goes on, so even
+// a huge one has checkpoints all through it. An edit drops the checkpoints at
+// or after it, since the tokens before the edit stay the same but those after
+// it might not.
+struct syntax_checkpoints {
+  // Must be first, so the listener callbacks can get at the checkpoints.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+  // The checkpoints are only good for the filetype that made them.
+  struct filetype *filetype;
+
+  struct syntax_checkpoint {
+    size_t pos;
+    enum syntax_state state;
+  } *buf;
+  size_t len;
+  size_t cap;
+};
+
+static void syntax_checkpoints_edited(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  (void) n;
+  struct syntax_checkpoints *checkpoints =
+      (struct syntax_checkpoints*) listener;
+  while (checkpoints->len &&
+         checkpoints->buf[checkpoints->len - 1].pos >= pos) {
+    checkpoints->len--;
+  }
+}
+
+static struct syntax_checkpoints *buffer_syntax_checkpoints(
+    struct buffer *buffer, struct filetype *filetype) {
+  struct syntax_checkpoints *checkpoints = buffer->syntax_checkpoints;
+  if (checkpoints && checkpoints->filetype == filetype) {
+    return checkpoints;
+  }
+  syntax_checkpoints_free(checkpoints);
+
+  checkpoints = xmalloc(sizeof(*checkpoints));
+  checkpoints->listener.inserted = syntax_checkpoints_edited;
+  checkpoints->listener.deleted = syntax_checkpoints_edited;
+  checkpoints->buffer = buffer;
+  checkpoints->filetype = filetype;
+  checkpoints->cap = 16;
+  checkpoints->buf = xmalloc(checkpoints->cap * sizeof(*checkpoints->buf));
+  checkpoints->len = 0;
+  buffer_add_listener(buffer, &checkpoints->listener);
+  buffer->syntax_checkpoints = checkpoints;
+  return checkpoints;
+}
+
+void syntax_checkpoints_free(struct syntax_checkpoints *checkpoints) {
+  if (!checkpoints) {
+    return;
+  }
+  buffer_remove_listener(checkpoints->buffer, &checkpoints->listener);
+  checkpoints->buffer->syntax_checkpoints = NULL;
+  free(checkpoints->buf);
+  free(checkpoints);
+}
+
+size_t syntax_checkpoints_count(struct buffer *buffer) {
+  return buffer->syntax_checkpoints ? buffer->syntax_checkpoints->len : 0;
+}
+
+static void syntax_checkpoints_add(
+    struct syntax_checkpoints *checkpoints, size_t pos,
+    enum syntax_state state) {
+  if (checkpoints->len == checkpoints->cap) {
+    checkpoints->cap *= 2;
+    checkpoints->buf = xrealloc(
+        checkpoints->buf, checkpoints->cap * sizeof(*checkpoints->buf));
+  }
+  struct syntax_checkpoint *checkpoint = &checkpoints->buf[checkpoints->len++];
+  checkpoint->pos = pos;
+  checkpoint->state = state;
+}
+
+static size_t syntax_checkpoints_last(struct syntax_checkpoints *checkpoints) {
+  return checkpoints->len ? checkpoints->buf[checkpoints->len - 1].pos : 0;
+}
+
+// Adds a checkpoint for where the tokenizer is now, if it's far enough past
+// the last one.
+static void syntax_checkpoint(struct syntax *syntax) {
+  struct syntax_checkpoints *checkpoints = syntax->checkpoints;
+  size_t last = syntax_checkpoints_last(checkpoints);
+  if (syntax->pos >= last + SYNTAX_CHECKPOINT_INTERVAL) {
+    syntax_checkpoints_add(checkpoints, syntax->pos, syntax->state);
+  }
+}
+
+// The last checkpoint at or before pos (or the top).
+static struct syntax_checkpoint syntax_checkpoint_before(
+    struct syntax_checkpoints *checkpoints, size_t pos) {
+  size_t lo = 0, hi = checkpoints->len;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (checkpoints->buf[mid].pos <= pos) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  struct syntax_checkpoint start = {0, STATE_INIT};
+  if (lo > 0) {
+    start = checkpoints->buf[lo - 1];
+  }
+  return start;
+}
+
+// Moves the tokenizer to the last checkpoint at or before pos (or to the top),
+// unless it's already somewhere in between.
+static void syntax_seek(struct syntax *syntax, size_t pos) {
+  struct syntax_checkpoint start =
+      syntax_checkpoint_before(syntax->checkpoints, pos);
+  if (syntax->pos > pos || syntax->pos < start.pos) {
+    syntax->pos = start.pos;
+    syntax->state = start.state;
+  }
+}
+
+static struct filetype *buffer_filetype(struct buffer *buffer) {
+  return filetype_named(buffer->opt.filetype);
 }
 
 bool syntax_init(struct syntax *syntax, struct buffer *buffer) {
   syntax->buffer = buffer;
   syntax->tokenizer = NULL;
-  unsigned char *regex = NULL;
-  for (size_t i = 0; i < ARRAY_SIZE(supported_filetypes); ++i) {
-    struct filetype *filetype = &supported_filetypes[i];
-    if (!strcmp(buffer->opt.filetype, filetype->name)) {
-      syntax->tokenizer = filetype->tokenizer;
-      regex = (unsigned char*) filetype->regex;
+  syntax->groups = NULL;
+  struct filetype *filetype = buffer_filetype(buffer);
+  syntax->filetype = filetype;
+  if (!filetype) {
+    return false;
+  }
+  syntax->tokenizer = filetype->tokenizer;
+  if (filetype->definition && filetype->definition->regex) {
+    syntax->groups = pcre2_match_data_create_from_pattern(
+        filetype->definition->regex, NULL);
+  }
+  syntax->state = STATE_INIT;
+  syntax->token_state = STATE_INIT;
+  syntax->pos = 0;
+  syntax->checkpoints = buffer_syntax_checkpoints(buffer, filetype);
+  return true;
+}
+
+void syntax_deinit(struct syntax *syntax) {
+  // The checkpoints belong to the buffer, and the filetype to everyone.
+  pcre2_match_data_free(syntax->groups);
+  syntax->groups = NULL;
+}
+
+void syntax_token_at(struct syntax *syntax, struct syntax_token *token, size_t pos) {
+  syntax_seek(syntax, pos);
+  do {
+    syntax_checkpoint(syntax);
+    syntax->token_state = syntax->state;
+    syntax->tokenizer(syntax, token);
+  } while (!(token->pos <= pos && pos < token->pos + token->len));
+}
+
+// Buffers bigger than this are tokenized on the editor's thread pool instead
+// of while drawing, so that a keystroke never waits on the tokenizer.
+#define SYNTAX_BACKGROUND_SIZE (1 << 20)
+// A background job tokenizes the lines from the first one that isn't up to
+// date to this many lines past the last one drawn, at most about this much
+// text at a time.
+#define SYNTAX_LOOKAHEAD 1000
+#define SYNTAX_JOB_SIZE (1 << 20)
+// The snapshot a job works on goes this far past its last line. Tokens never
+// go past the end of the line they start on, and only look ahead that far, so
+// the lines before the end of a snapshot come out the same as they would in
+// the whole text.
+#define SYNTAX_SNAPSHOT_SLACK 64
+
+// Tokenizing some lines on the editor's thread pool. The job works on a
+// snapshot of the text starting from the checkpoint before the first line,
+// so it doesn't have to touch the buffer. An edit cancels it, and whoever lets
+// go of the job last frees it.
+struct syntax_job {
+  struct buffer *snapshot;
+  // Where the snapshot starts in the buffer, where the tokenizer starts in the
+  // snapshot (and its state there), and where the first line starts.
+  size_t base;
+  size_t resume;
+  enum syntax_state state;
+  size_t start;
+
+  size_t first;
+  size_t nlines;
+  unsigned int *lens;
+  // Whether there's a line after the last one.
+  bool more;
+  struct syntax_line *lines;
+  // Whether each line was still valid when the job started, and the state it
+  // started in then. Once a line ends in the state the next one started in,
+  // the rest are up to date as they are, so the job stops there.
+  struct syntax_job_line {
+    bool valid;
+    struct syntax_line_state in;
+  } *known;
+  // The number of lines tokenized.
+  size_t ntokenized;
+
+  atomic_bool cancelled;
+  atomic_bool done;
+  // One reference for the cache, and one for the thread.
+  atomic_size_t refs;
+};
+
+struct syntax_cache {
+  // Must be first, so the listener callbacks can get at the cache.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+  // The tokenizer for the lines tokenized while drawing.
+  struct syntax syntax;
+  // The last token read, which is often the one the next line starts in.
+  struct syntax_token token;
+
+  struct syntax_line *lines;
+  size_t nlines;
+  size_t cap;
+  // The lines before this one are known to be up to date.
+  size_t verified;
+
+  // The lines before this one should be tokenized in the background.
+  size_t wanted;
+  // The background tokenizing in progress (or NULL).
+  struct syntax_job *job;
+
+  TAILQ_HEAD(, syntax_listener) listeners;
+};
+
+static void syntax_job_release(struct syntax_job *job) {
+  if (atomic_fetch_sub(&job->refs, 1) > 1) {
+    return;
+  }
+  buffer_free(job->snapshot);
+  for (size_t i = 0; i < job->nlines; ++i) {
+    free(job->lines[i].runs);
+  }
+  free(job->lines);
+  free(job->lens);
+  free(job->known);
+  free(job);
+}
+
+static void syntax_cache_cancel(struct syntax_cache *cache) {
+  if (cache->job) {
+    atomic_store(&cache->job->cancelled, true);
+    syntax_job_release(cache->job);
+    cache->job = NULL;
+  }
+}
+
+// Adds or removes entries for the lines an edit at pos added or removed, and
+// invalidates the line it's on.
+static void syntax_cache_edited(
+    struct syntax_cache *cache, size_t pos, bool deleted) {
+  struct gapbuf *gb = cache->buffer->text;
+  size_t line, col;
+  gb_pos_to_linecol(gb, pos, &line, &col);
+  size_t nlines = gb_nlines(gb);
+
+  if (deleted) {
+    size_t n = cache->nlines - nlines;
+    for (size_t i = line + 1; i <= line + n; ++i) {
+      free(cache->lines[i].runs);
     }
+    memmove(&cache->lines[line + 1], &cache->lines[line + 1 + n],
+        (cache->nlines - line - 1 - n) * sizeof(*cache->lines));
+  } else {
+    size_t n = nlines - cache->nlines;
+    if (nlines > cache->cap) {
+      cache->cap = max(nlines, cache->cap * 2);
+      cache->lines = xrealloc(cache->lines, cache->cap * sizeof(*cache->lines));
+    }
+    memmove(&cache->lines[line + 1 + n], &cache->lines[line + 1],
+        (cache->nlines - line - 1) * sizeof(*cache->lines));
+    memset(&cache->lines[line + 1], 0, n * sizeof(*cache->lines));
+  }
+  size_t removed = cache->nlines > nlines ? cache->nlines - nlines : 0;
+  size_t added = nlines > cache->nlines ? nlines - cache->nlines : 0;
+  cache->nlines = nlines;
+  cache->lines[line].valid = false;
+  cache->verified = min(cache->verified, line);
+  cache->wanted = min(cache->wanted, nlines);
+  syntax_cache_cancel(cache);
+  // The tokenizer may have been somewhere past the edit, so make it seek.
+  cache->syntax.pos = 0;
+  cache->syntax.state = STATE_INIT;
+  cache->token.len = 0;
+
+  if (removed || added) {
+    struct syntax_listener *listener;
+    TAILQ_FOREACH(listener, &cache->listeners, pointers) {
+      listener->moved(listener, line, removed, added);
+    }
+  }
+}
+
+static void syntax_cache_tokenized(
+    struct syntax_cache *cache, size_t i, size_t pos) {
+  struct syntax_listener *listener;
+  TAILQ_FOREACH(listener, &cache->listeners, pointers) {
+    listener->tokenized(listener, i, pos, &cache->lines[i]);
+  }
+}
+
+static void syntax_cache_inserted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  (void) n;
+  syntax_cache_edited((struct syntax_cache*) listener, pos, false);
+}
+
+static void syntax_cache_deleted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  (void) n;
+  syntax_cache_edited((struct syntax_cache*) listener, pos, true);
+}
+
+void syntax_cache_free(struct syntax_cache *cache) {
+  if (!cache) {
+    return;
+  }
+  syntax_cache_cancel(cache);
+  buffer_remove_listener(cache->buffer, &cache->listener);
+  struct syntax_listener *listener;
+  TAILQ_FOREACH(listener, &cache->listeners, pointers) {
+    listener->cache = NULL;
+  }
+  cache->buffer->syntax_cache = NULL;
+  syntax_deinit(&cache->syntax);
+  for (size_t i = 0; i < cache->nlines; ++i) {
+    free(cache->lines[i].runs);
   }
+  free(cache->lines);
+  free(cache);
+}
+
+// Returns the buffer's cache, starting it over if the filetype changed.
+static struct syntax_cache *buffer_syntax_cache(struct buffer *buffer) {
+  struct syntax_cache *cache = buffer->syntax_cache;
+  struct filetype *filetype = buffer_filetype(buffer);
+  if (cache && filetype && cache->syntax.filetype == filetype) {
+    return cache;
+  }
+  syntax_cache_free(cache);
+  if (!filetype) {
+    return NULL;
+  }
+
+  cache = xmalloc(sizeof(*cache));
+  cache->buffer = buffer;
+  cache->listener.inserted = syntax_cache_inserted;
+  cache->listener.deleted = syntax_cache_deleted;
+  buffer_add_listener(buffer, &cache->listener);
+  syntax_init(&cache->syntax, buffer);
+  cache->nlines = gb_nlines(buffer->text);
+  cache->cap = cache->nlines;
+  cache->lines = xmalloc(cache->cap * sizeof(*cache->lines));
+  memset(cache->lines, 0, cache->cap * sizeof(*cache->lines));
+  cache->token.len = 0;
+  cache->verified = 0;
+  cache->wanted = 0;
+  cache->job = NULL;
+  TAILQ_INIT(&cache->listeners);
+  buffer->syntax_cache = cache;
+  return cache;
+}
 
-  if (!syntax->tokenizer) {
+bool buffer_syntax_add_listener(
+    struct buffer *buffer, struct syntax_listener *listener) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (!cache) {
     return false;
   }
-  syntax->state = STATE_INIT;
-  syntax->pos = 0;
+  TAILQ_INSERT_TAIL(&cache->listeners, listener, pointers);
+  listener->cache = cache;
+  size_t pos = 0;
+  for (size_t i = 0; i < cache->nlines; ++i) {
+    if (cache->lines[i].valid) {
+      listener->tokenized(listener, i, pos, &cache->lines[i]);
+    }
+    pos += buffer->text->lines->buf[i] + 1;
+  }
+  return true;
+}
 
-  int errorcode;
-  PCRE2_SIZE erroroffset;
-  syntax->regex = pcre2_compile(regex,
-      PCRE2_ZERO_TERMINATED, PCRE2_ANCHORED,
-      &errorcode, &erroroffset, NULL);
-  assert(regex);
-  syntax->groups = pcre2_match_data_create_from_pattern(syntax->regex, NULL);
+void syntax_remove_listener(struct syntax_listener *listener) {
+  if (listener->cache) {
+    TAILQ_REMOVE(&listener->cache->listeners, listener, pointers);
+    listener->cache = NULL;
+  }
+}
+
+// The state at pos, given the token containing it, which was just read.
+static struct syntax_line_state syntax_state_at(
+    struct syntax *syntax, struct syntax_token *token, size_t pos) {
+  struct syntax_line_state state;
+  state.open = token->pos < pos ? token->kind : SYNTAX_TOKEN_NONE;
+  state.state = syntax->token_state;
+  return state;
+}
+
+static bool syntax_line_state_equal(
+    struct syntax_line_state a, struct syntax_line_state b) {
+  return a.open == b.open && a.state == b.state;
+}
+
+static void syntax_line_add_run(struct syntax_line *line, size_t *cap,
+    enum syntax_token_kind kind, size_t len) {
+  if (line->nruns) {
+    uint32_t last = line->runs[line->nruns - 1];
+    if (SYNTAX_RUN_KIND(last) == kind &&
+        SYNTAX_RUN_LEN(last) + len <= SYNTAX_RUN_MAX_LEN) {
+      line->runs[line->nruns - 1] += (uint32_t) len;
+      return;
+    }
+  }
+  if (line->nruns == *cap) {
+    *cap = max(4, *cap * 2);
+    line->runs = xrealloc(line->runs, *cap * sizeof(*line->runs));
+  }
+  line->runs[line->nruns++] = (uint32_t) kind << 28 | (uint32_t) len;
+}
+
+void syntax_tokenize_line(struct syntax *syntax,
+    struct syntax_token *token, struct syntax_line *line,
+    size_t start, size_t len, bool next) {
+  size_t end = start + len;
+
+  free(line->runs);
+  line->runs = NULL;
+  line->nruns = 0;
+  size_t cap = 0;
+
+  if (!(token->pos <= start && start < token->pos + token->len)) {
+    syntax_token_at(syntax, token, start);
+  }
+  line->in = syntax_state_at(syntax, token, start);
+  size_t pos = start;
+  while (pos < end) {
+    if (pos >= token->pos + token->len) {
+      syntax_token_at(syntax, token, pos);
+    }
+    size_t run_end = min(end, token->pos + token->len);
+    size_t n = run_end - pos;
+    while (n > 0) {
+      size_t run = min(n, SYNTAX_RUN_MAX_LEN);
+      syntax_line_add_run(line, &cap, token->kind, run);
+      n -= run;
+    }
+    pos = run_end;
+  }
+
+  line->out = line->in;
+  if (next) {
+    if (end + 1 >= token->pos + token->len) {
+      syntax_token_at(syntax, token, end + 1);
+    }
+    line->out = syntax_state_at(syntax, token, end + 1);
+  }
+  line->valid = true;
+}
+
+// Moves verified past the lines after it that weren't edited, as far as the
+// states they start in still line up with the lines before them.
+static void syntax_cache_extend_verified(struct syntax_cache *cache) {
+  while (cache->verified > 0 && cache->verified < cache->nlines &&
+         cache->lines[cache->verified].valid &&
+         syntax_line_state_equal(cache->lines[cache->verified].in,
+             cache->lines[cache->verified - 1].out)) {
+    cache->verified++;
+  }
+}
+
+// Tokenizes the lines up to the given one that need it. Returns false if the
+// deadline passed first.
+static bool syntax_cache_verify(
+    struct syntax_cache *cache, size_t line, struct deadline *deadline) {
+  struct gapbuf *gb = cache->buffer->text;
+  size_t pos = 0;
+  for (size_t i = 0; i < cache->verified; ++i) {
+    pos += gb->lines->buf[i] + 1;
+  }
+  // A line that wasn't edited only needs tokenizing again if the state it
+  // starts in changed.
+  for (; cache->verified <= line; ++cache->verified) {
+    size_t i = cache->verified;
+    struct syntax_line_state in = {SYNTAX_TOKEN_NONE, STATE_INIT};
+    if (i > 0) {
+      in = cache->lines[i - 1].out;
+    }
+    if (!cache->lines[i].valid ||
+        !syntax_line_state_equal(cache->lines[i].in, in)) {
+      if (deadline_passed(deadline)) {
+        return false;
+      }
+      syntax_tokenize_line(&cache->syntax, &cache->token, &cache->lines[i],
+          pos, gb->lines->buf[i], i + 1 < cache->nlines);
+      syntax_cache_tokenized(cache, i, pos);
+    }
+    pos += gb->lines->buf[i] + 1;
+  }
+  syntax_cache_extend_verified(cache);
   return true;
 }
 
-void syntax_deinit(struct syntax *syntax) {
-  if (syntax->tokenizer) {
-    pcre2_code_free(syntax->regex);
-    pcre2_match_data_free(syntax->groups);
+struct syntax_line *buffer_syntax_line(
+    struct buffer *buffer, size_t line, struct deadline *deadline) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (!cache) {
+    return NULL;
+  }
+  if (line < cache->verified) {
+    return &cache->lines[line];
+  }
+
+  if (gb_size(buffer->text) > SYNTAX_BACKGROUND_SIZE) {
+    cache->wanted = max(cache->wanted,
+        min(cache->nlines, line + 1 + SYNTAX_LOOKAHEAD));
+    // A line that hasn't been edited probably has the same tokens it had.
+    return buffer_syntax_cached_line(buffer, line);
   }
+  if (!syntax_cache_verify(cache, line, deadline)) {
+    return buffer_syntax_cached_line(buffer, line);
+  }
+  return &cache->lines[line];
 }
 
-void syntax_token_at(struct syntax *syntax, struct syntax_token *token, size_t pos) {
-  syntax->tokenizer(syntax, token, pos);
+struct syntax_line *buffer_syntax_cached_line(
+    struct buffer *buffer, size_t line) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (!cache || !cache->lines[line].valid) {
+    return NULL;
+  }
+  return &cache->lines[line];
+}
+
+void buffer_syntax_tokenize(struct buffer *buffer) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (cache) {
+    syntax_cache_verify(cache, cache->nlines - 1, NULL);
+  }
+}
+
+size_t buffer_syntax_tokenize_to(struct buffer *buffer, size_t line) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (!cache) {
+    return 0;
+  }
+  if (line >= cache->verified) {
+    syntax_cache_verify(cache, min(line, cache->nlines - 1), NULL);
+  }
+  return cache->verified;
+}
+
+void buffer_syntax_request(struct buffer *buffer) {
+  struct syntax_cache *cache = buffer_syntax_cache(buffer);
+  if (cache) {
+    cache->wanted = cache->nlines;
+  }
+}
+
+static void syntax_job_run(void *arg) {
+  struct syntax_job *job = arg;
+  struct syntax syntax;
+  syntax_init(&syntax, job->snapshot);
+  syntax_checkpoints_add(syntax.checkpoints, job->resume, job->state);
+
+  struct syntax_token token = {SYNTAX_TOKEN_NONE, 0, 0};
+  size_t start = job->start;
+  for (size_t i = 0; i < job->nlines; ++i) {
+    if (atomic_load(&job->cancelled)) {
+      break;
+    }
+    syntax_tokenize_line(&syntax, &token, &job->lines[i],
+        start, job->lens[i], i + 1 < job->nlines || job->more);
+    start += job->lens[i] + 1;
+    job->ntokenized = i + 1;
+    if (i + 1 < job->nlines && job->known[i + 1].valid &&
+        syntax_line_state_equal(job->known[i + 1].in, job->lines[i].out)) {
+      break;
+    }
+  }
+  syntax_deinit(&syntax);
+
+  atomic_store(&job->done, true);
+  syntax_job_release(job);
+}
+
+static void syntax_cache_start(struct syntax_cache *cache, struct pool *pool) {
+  struct gapbuf *gb = cache->buffer->text;
+  unsigned int *lens = gb->lines->buf;
+  size_t first = cache->verified;
+  size_t start = 0;
+  for (size_t i = 0; i < first; ++i) {
+    start += lens[i] + 1;
+  }
+  struct syntax_checkpoint from =
+      syntax_checkpoint_before(cache->syntax.checkpoints, start);
+  // The tokenizer looks back one character, to see if a newline is escaped.
+  size_t base = from.pos > 0 ? from.pos - 1 : 0;
+
+  // The checkpoint is usually close, but there might be a huge line in
+  // between. Since that text has to be copied and tokenized anyway, take on
+  // at least as much again, so that getting past it doesn't mean copying it
+  // over and over.
+  size_t size = max(SYNTAX_JOB_SIZE, start - base);
+  size_t last = first;
+  size_t end = start;
+  while (last < cache->wanted && (last == first || end - start < size)) {
+    end += lens[last++] + 1;
+  }
+  size_t stop = min(gb_size(gb), end + SYNTAX_SNAPSHOT_SLACK);
+
+  struct syntax_job *job = xmalloc(sizeof(*job));
+  job->snapshot = buffer_snapshot(cache->buffer, base, stop - base);
+  job->base = base;
+  job->resume = from.pos - base;
+  job->state = from.state;
+  job->start = start - base;
+  job->first = first;
+  job->nlines = last - first;
+  job->lens = xmalloc(job->nlines * sizeof(*job->lens));
+  memcpy(job->lens, &lens[first], job->nlines * sizeof(*job->lens));
+  job->more = last < cache->nlines;
+  job->lines = xmalloc(job->nlines * sizeof(*job->lines));
+  memset(job->lines, 0, job->nlines * sizeof(*job->lines));
+  job->known = xmalloc(job->nlines * sizeof(*job->known));
+  for (size_t i = 0; i < job->nlines; ++i) {
+    job->known[i].valid = cache->lines[first + i].valid;
+    job->known[i].in = cache->lines[first + i].in;
+  }
+  job->ntokenized = 0;
+  atomic_init(&job->cancelled, false);
+  atomic_init(&job->done, false);
+  atomic_init(&job->refs, 2);
+  cache->job = job;
+  pool_submit(pool, syntax_job_run, job);
+}
+
+// Swaps in the lines the job tokenized, and keeps the checkpoints it made.
+// If the job stopped at a line that was up to date, so are the ones after it
+// that weren't edited, as far as the states they start in still line up.
+static void syntax_cache_take_results(
+    struct syntax_cache *cache, struct syntax_job *job) {
+  for (size_t i = 0; i < job->ntokenized; ++i) {
+    struct syntax_line *line = &cache->lines[job->first + i];
+    free(line->runs);
+    *line = job->lines[i];
+    job->lines[i].runs = NULL;
+  }
+  cache->verified = job->first + job->ntokenized;
+  syntax_cache_extend_verified(cache);
+
+  size_t end = job->start;
+  for (size_t i = 0; i < job->ntokenized; ++i) {
+    syntax_cache_tokenized(cache, job->first + i, job->base + end);
+    end += job->lens[i] + 1;
+  }
+  struct syntax_checkpoints *checkpoints = cache->syntax.checkpoints;
+  struct syntax_checkpoints *made = job->snapshot->syntax_checkpoints;
+  for (size_t i = 0; i < made->len; ++i) {
+    size_t pos = made->buf[i].pos;
+    if (pos < end && job->base + pos > syntax_checkpoints_last(checkpoints)) {
+      syntax_checkpoints_add(checkpoints, job->base + pos, made->buf[i].state);
+    }
+  }
+}
+
+bool buffer_syntax_update(struct buffer *buffer, struct pool *pool) {
+  struct syntax_cache *cache = buffer->syntax_cache;
+  if (!cache) {
+    return false;
+  }
+
+  bool changed = false;
+  struct syntax_job *job = cache->job;
+  if (job) {
+    if (!atomic_load(&job->done)) {
+      return false;
+    }
+    // Drawing might have tokenized the lines itself since the job was
+    // started, if the buffer is small (or has shrunk since).
+    if (cache->verified == job->first) {
+      syntax_cache_take_results(cache, job);
+      changed = true;
+    }
+    syntax_job_release(job);
+    cache->job = NULL;
+  }
+
+  if (cache->verified < cache->wanted) {
+    syntax_cache_start(cache, pool);
+  } else {
+    cache->wanted = 0;
+  }
+  return changed;
+}
+
+bool buffer_syntax_pending(struct buffer *buffer) {
+  struct syntax_cache *cache = buffer->syntax_cache;
+  return cache && (cache->job || cache->verified < cache->wanted);
+}
+
+bool editor_update_syntax(struct editor *editor) {
+  bool changed = false;
+  struct buffer *buffer;
+  TAILQ_FOREACH(buffer, &editor->buffers, pointers) {
+    changed |= buffer_syntax_update(buffer, editor_pool(editor));
+  }
+  return changed;
+}
+
+bool editor_syntax_pending(struct editor *editor) {
+  struct buffer *buffer;
+  TAILQ_FOREACH(buffer, &editor->buffers, pointers) {
+    if (buffer_syntax_pending(buffer)) {
+      return true;
+    }
+  }
+  return false;
 }
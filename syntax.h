@@ -2,6 +2,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/queue.h>
 
 #include <pcre2.h>
 
@@ -22,21 +24,179 @@ struct syntax_token {
   size_t len;
 };
 
+struct deadline;
+struct editor;
+struct filetype;
+struct pool;
 struct syntax;
-typedef void (*tokenizer_func)(struct syntax*, struct syntax_token*, size_t);
+struct syntax_checkpoints;
+// Reads the token starting at syntax->pos, and moves past it.
+typedef void (*tokenizer_func)(struct syntax*, struct syntax_token*);
 struct syntax {
   struct buffer *buffer;
+  struct filetype *filetype;
   tokenizer_func tokenizer;
+  // For matching the rules of a filetype defined by a syntax file.
+  pcre2_match_data *groups;
   size_t pos;
   enum syntax_state {
     STATE_INIT,
-    STATE_PREPROC
+    STATE_PREPROC,
+    // In a block comment that started on an earlier line (in a preprocessor
+    // directive, for the second one).
+    STATE_COMMENT,
+    STATE_PREPROC_COMMENT,
+    // In a string continued from an earlier line with a backslash.
+    STATE_STRING,
+    // In a region of a filetype defined by a syntax file, that started on an
+    // earlier line: STATE_REGION plus the index of its rule.
+    STATE_REGION,
   } state;
-  pcre2_code *regex;
-  pcre2_match_data *groups;
+  // The state before the last token was read.
+  enum syntax_state token_state;
+  // The buffer's checkpoints, which tokenizing picks up from.
+  struct syntax_checkpoints *checkpoints;
 };
 
+// Loads the syntax files in the directories in syntaxpath (separated by
+// commas), each of which defines the filetype it's named after: e.g.
+// python.syntax defines "python". A file is made of lines like these, where
+// KIND names a SYNTAX_TOKEN_* kind:
+//
+//   extensions py pyw           the extensions detected as this filetype
+//   comment # [END]             a comment, to the end of the line by default
+//   string " [ESCAPE]           a string
+//   region KIND START END [ESCAPE]
+//                               text from START to END (or to the end of the
+//                               line, if END is $), where END doesn't count
+//                               right after ESCAPE
+//   match KIND REGEX            text the regex matches, up to the end of the
+//                               line ("^" only matches at the start of one)
+//   KIND word...                keywords
+//
+// Blank lines and lines starting with "//" are skipped. At each token, the
+// comments, strings, regions and matches are tried in the order they're
+// defined in, before anything else; they're compiled into a single regex
+// when the file is loaded. A word (a run of letters, digits and underscores)
+// is a keyword, a number if it starts with a digit, or else an identifier.
+//
+// A filetype is only ever loaded once, for all the buffers that use it, so a
+// file is skipped if its filetype is already defined (by a directory earlier
+// in the path, say). Nothing is done if the path is the same as last time.
+// Returns false, with a message in error, if some file couldn't be loaded.
+bool syntax_load_path(char *syntaxpath, char *error, size_t errorlen);
 char *syntax_detect_filetype(char *path);
 bool syntax_init(struct syntax *syntax, struct buffer *buffer);
 void syntax_deinit(struct syntax *syntax);
+// Finds the token containing pos. This is cheapest when called with
+// increasing positions, as when drawing a window; otherwise tokenizing
+// starts over from the nearest checkpoint before pos.
 void syntax_token_at(struct syntax *syntax, struct syntax_token *token, size_t pos);
+
+// Frees a buffer's checkpoints (which may be NULL).
+void syntax_checkpoints_free(struct syntax_checkpoints *checkpoints);
+// The number of checkpoints the buffer has.
+size_t syntax_checkpoints_count(struct buffer *buffer);
+
+// A run of characters in one token, packed into 32 bits: the kind in the top
+// four, the length in the rest. A token longer than that takes several runs.
+#define SYNTAX_RUN_KIND(run) ((enum syntax_token_kind) ((run) >> 28))
+#define SYNTAX_RUN_LEN(run) ((size_t) ((run) & 0x0fffffff))
+#define SYNTAX_RUN_MAX_LEN 0x0fffffff
+
+// What a line's tokens depend on other than its own text: the token it
+// starts in the middle of (e.g. a comment opened on an earlier line), if any,
+// and the tokenizer's state.
+struct syntax_line_state {
+  enum syntax_token_kind open;
+  enum syntax_state state;
+};
+
+// The tokens on one line, as runs covering the line's text (without the
+// newline).
+struct syntax_line {
+  uint32_t *runs;
+  size_t nruns;
+  // Cleared when the line is edited.
+  bool valid;
+  // The state at the start of this line and of the next one, as of when the
+  // line was tokenized.
+  struct syntax_line_state in;
+  struct syntax_line_state out;
+};
+
+// The tokens on each line of a buffer, shared by all the windows showing it,
+// so that drawing only tokenizes lines that changed. An edit invalidates the
+// lines it touches. The lines after those are only tokenized again if the
+// state they start in turns out to have changed, e.g. because the edit
+// opened a comment.
+struct syntax_cache;
+
+// Returns the tokens on the given line, tokenizing whatever needs it to make
+// sure they're up to date. Returns NULL if the buffer's filetype has no
+// syntax highlighting. The returned line is only valid until the buffer is
+// next changed.
+//
+// A big buffer is never tokenized here, so that drawing never has to wait:
+// the line is tokenized in the background instead (along with those around
+// it) by buffer_syntax_update. Until then, this returns the tokens the line
+// had before, or NULL if it was edited since. The same goes if the deadline
+// (if any) passes before the line is reached; the next call picks up from
+// there.
+struct syntax_line *buffer_syntax_line(
+    struct buffer *buffer, size_t line, struct deadline *deadline);
+void syntax_cache_free(struct syntax_cache *cache);
+// Returns the line's tokens as they're cached, without tokenizing anything,
+// or NULL if the line was edited since it was last tokenized.
+struct syntax_line *buffer_syntax_cached_line(
+    struct buffer *buffer, size_t line);
+// Tokenizes every line that needs it right away, whatever the buffer's size.
+void buffer_syntax_tokenize(struct buffer *buffer);
+// The same for the lines up to the given one. Returns how many lines from the
+// top are up to date now, which takes in at least those.
+size_t buffer_syntax_tokenize_to(struct buffer *buffer, size_t line);
+// Has every line that needs it tokenized in the background instead, by
+// buffer_syntax_update.
+void buffer_syntax_request(struct buffer *buffer);
+
+// Something worked out from the tokens in a buffer's syntax cache, which is
+// told as the cached lines change so that it can be kept up to date with them
+// rather than tokenizing the buffer again itself.
+struct syntax_listener {
+  // Called when an edit to the given line removed or added lines after it.
+  // The line itself gets tokenized again later.
+  void (*moved)(struct syntax_listener *listener,
+      size_t line, size_t removed, size_t added);
+  // Called when the given line, which starts at pos, was tokenized.
+  void (*tokenized)(struct syntax_listener *listener,
+      size_t i, size_t pos, struct syntax_line *line);
+  // The cache listened to, or NULL once it's been freed (e.g. because the
+  // buffer's filetype changed).
+  struct syntax_cache *cache;
+  TAILQ_ENTRY(syntax_listener) pointers;
+};
+
+// Starts telling the listener about the buffer's lines, beginning with those
+// tokenized so far. Returns false if the buffer's filetype has no syntax
+// highlighting.
+bool buffer_syntax_add_listener(
+    struct buffer *buffer, struct syntax_listener *listener);
+void syntax_remove_listener(struct syntax_listener *listener);
+
+// Tokenizes the line of the given length starting at start, and works out
+// the state the next line (if there is one) starts in. *token is the last
+// token read, which is picked up from if the line starts in it.
+void syntax_tokenize_line(struct syntax *syntax,
+    struct syntax_token *token, struct syntax_line *line,
+    size_t start, size_t len, bool next);
+
+// Takes in the lines tokenized in the background if they're done, and starts
+// tokenizing the lines asked for since if nothing is in progress. Returns
+// whether any lines were tokenized.
+bool buffer_syntax_update(struct buffer *buffer, struct pool *pool);
+// Whether the buffer has lines being tokenized or waiting to be.
+bool buffer_syntax_pending(struct buffer *buffer);
+
+// The same for all of the loaded buffers, on the editor's thread pool.
+bool editor_update_syntax(struct editor *editor);
+bool editor_syntax_pending(struct editor *editor);
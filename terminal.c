@@ -1,9 +1,12 @@
 #include "terminal.h"
 
+#include <fcntl.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <termbox.h>
 
@@ -11,18 +14,42 @@
 // happen is if we receive SIGTERM while the editor is in the background.
 static bool terminal_is_shut_down = false;
 
+// Write seq straight to the terminal termbox draws on. termbox has no call for
+// sending raw bytes, but it opens /dev/tty itself and empties its buffer
+// before returning from tb_init and tb_render, so nothing of its can be left
+// to come out after (or before) seq.
+static void terminal_send(const char *seq) {
+  int fd = open("/dev/tty", O_WRONLY);
+  if (fd < 0) {
+    return;
+  }
+  size_t len = strlen(seq);
+  while (len > 0) {
+    ssize_t written = write(fd, seq, len);
+    if (written <= 0) {
+      break;
+    }
+    seq += written;
+    len -= (size_t) written;
+  }
+  close(fd);
+}
+
 void terminal_resume(void) {
   int err = tb_init();
   if (err) {
     fprintf(stderr, "tb_init() failed with error code %d\n", err);
     exit(1);
   }
+  // Ask the terminal to mark where pasted text starts and ends.
+  terminal_send("\033[?2004h");
   terminal_is_shut_down = false;
 }
 
 void terminal_shutdown(void) {
   if (!terminal_is_shut_down) {
     terminal_is_shut_down = true;
+    terminal_send("\033[?2004l");
     tb_shutdown();
   }
 }
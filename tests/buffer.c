@@ -2,6 +2,7 @@
 #include "buffer.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "buf.h"
@@ -115,3 +116,36 @@ void test_buffer__marks(void) {
   cl_assert_equal_i(mark.region.start, 12);
   cl_assert_equal_i(mark.region.end, 13);
 }
+
+static void assert_snapshot(struct gb_snapshot *snap, const char *expected) {
+  size_t len = gb_snapshot_size(snap);
+  char *text = xmalloc(len + 1);
+  gb_snapshot_getstring_into(snap, 0, len, text);
+  cl_assert_equal_s(text, expected);
+  free(text);
+}
+
+void test_buffer__snapshot(void) {
+  insert_text(0, "hello, world");
+  struct gapbuf *gb = buffer->text;
+  struct gb_snapshot *snap = gb_snapshot(gb);
+
+  // Typing at the gap doesn't need a copy.
+  char *memory = gb->bufstart;
+  insert_text(12, "!");
+  cl_assert_equal_p(gb->bufstart, memory);
+
+  // Anything else does, until the snapshots are gone.
+  struct gb_snapshot *later = gb_snapshot(gb);
+  delete_text(0, 1);
+  insert_text(0, "j");
+  cl_assert(gb->bufstart != memory);
+  assert_snapshot(snap, "hello, world\n");
+  assert_snapshot(later, "hello, world!\n");
+  assert_contents("jello, world!\n");
+
+  gb_snapshot_free(snap);
+  gb_snapshot_free(later);
+  insert_text(0, "(");
+  assert_contents("(jello, world!\n");
+}
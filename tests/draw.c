@@ -1,10 +1,15 @@
 #include "clar.h"
 #include "editor.h"
 
+#include <sched.h>
 #include <string.h>
 #include <termbox.h>
 
 #include "buf.h"
+#include "buffer.h"
+#include "gap.h"
+#include "substitute.h"
+#include "window.h"
 
 static struct editor *editor = NULL;
 static struct tb_cell *cells = NULL;
@@ -50,6 +55,7 @@ void test_draw__initialize(void) {
 
 void test_draw__cleanup(void) {
   editor_free(editor);
+  clock_stop(NULL, 0);
 }
 
 void test_draw__simple_text(void) {
@@ -76,6 +82,51 @@ void test_draw__linewise_visual_mode(void) {
   assert_line(0, bgcolors, "gggggwggggggg");
 }
 
+void test_draw__visual_mode_tabs(void) {
+  type(":set tabstop=4<cr>");
+  type("ia\tb<cr>c<esc>ggvj");
+  editor_draw(editor);
+  assert_line(0, chars,    "a    b");
+  assert_line(0, bgcolors, "gggggg");
+  assert_line(1, bgcolors, "w.");
+}
+
+void test_draw__visual_mode_scrolled(void) {
+  for (int i = 0; i < 100; ++i) {
+    type("oline<esc>");
+  }
+  type("ggvG$");
+  editor_draw(editor);
+  assert_line(0, bgcolors, "ggggg");
+  assert_line(editor->height - 3, bgcolors, "ggggg");
+  assert_line(editor->height - 2, bgcolors, "ggggw");
+}
+
+void test_draw__cursor_on_tab(void) {
+  type(":set tabstop=4<cr>");
+  type("i\tx<esc>0");
+  editor_draw(editor);
+  assert_line(0, chars,    "    x");
+  assert_line(0, bgcolors, "...w.");
+
+  type(":set tabstop=2<cr>");
+  editor_draw(editor);
+  assert_line(0, chars,    "  x");
+  assert_line(0, bgcolors, ".w.");
+}
+
+void test_draw__sidescroll_tabs(void) {
+  for (int i = 0; i < 20; ++i) {
+    type("i\t<esc>");
+  }
+  type("A end<esc>");
+  editor_draw(editor);
+  // The line is 164 columns wide, so the window scrolls to put the cursor
+  // (on the newline, in column 164) in the middle.
+  assert_line(0, chars,    "                                     end");
+  assert_line(0, bgcolors, "........................................w");
+}
+
 void test_draw__number(void) {
   type(":set number<cr>");
   type("ihello, world!");
@@ -85,6 +136,71 @@ void test_draw__number(void) {
   assert_line(0, bgcolors, ".................");
 }
 
+void test_draw__redraw_after_changes(void) {
+  type("ione<cr>two<cr>three<esc>gg");
+  editor_draw(editor);
+  assert_line(0, chars, "one");
+
+  // Edits to a line, and lines being added and removed.
+  type("x");
+  editor_draw(editor);
+  assert_line(0, chars, "ne.");
+  assert_line(1, chars, "two");
+  type("Ozero<esc>");
+  editor_draw(editor);
+  assert_line(0, chars, "zero");
+  assert_line(1, chars, "ne.");
+  type("jVd");
+  editor_draw(editor);
+  assert_line(1, chars, "two");
+  assert_line(2, chars, "three");
+  assert_line(3, chars, "~....");
+
+  // Options.
+  type(":set number<cr>");
+  editor_draw(editor);
+  assert_line(1, chars, "  2.two");
+  type(":set relativenumber<cr>");
+  editor_draw(editor);
+  assert_line(0, chars, "  1.zero");
+  assert_line(1, chars, "2  .two");
+  type("j");
+  editor_draw(editor);
+  assert_line(0, chars, "  2.zero");
+  assert_line(2, chars, "3  .three");
+
+  // Scrolling.
+  type(":set nonumber<cr>:set norelativenumber<cr>G");
+  for (int i = 0; i < 30; ++i) {
+    type("o<esc>");
+  }
+  type("otail<esc>");
+  editor_draw(editor);
+  assert_line(editor->height - 2, chars, "tail");
+  type("gg");
+  editor_draw(editor);
+  assert_line(0, chars, "zero");
+  assert_line(2, chars, "three");
+  type("G");
+  editor_draw(editor);
+  assert_line(editor->height - 2, chars, "tail");
+  assert_line(editor->height - 3, chars, "....");
+}
+
+void test_draw__redraw_split(void) {
+  type("ione<cr>two<esc>:split<cr>");
+  editor_draw(editor);
+  size_t below = window_h(editor->window);
+  assert_line(below + 1, chars, "two");
+
+  // Edits made in one window show in the other.
+  type("ggx");
+  editor_draw(editor);
+  assert_line(0, chars, "ne.");
+  assert_line(below, chars, "ne.");
+  assert_line(below + 1, chars, "two");
+}
+
 void test_draw__hlsearch(void) {
   type(":set hlsearch<cr>");
   type("ihello, word world!<esc>0");
@@ -95,6 +211,103 @@ void test_draw__hlsearch(void) {
   assert_line(0, bgcolors, ".......wyy..yyy...");
 }
 
+void test_draw__hlsearch_after_edit(void) {
+  type(":set hlsearch<cr>");
+  type("iword<cr>hello<cr>world<esc>gg");
+  type("/wor<cr>gg");
+  editor_draw(editor);
+  assert_line(0, bgcolors, "wyy.");
+  assert_line(2, bgcolors, "yyy..");
+
+  type("jVd");
+  editor_draw(editor);
+  assert_line(1, chars,    "world");
+  assert_line(0, bgcolors, "yyy.");
+  assert_line(1, bgcolors, "wyy..");
+
+  type("ggOa word<esc>");
+  editor_draw(editor);
+  assert_line(0, chars,    "a word");
+  assert_line(0, bgcolors, "..yyy.");
+  assert_line(1, bgcolors, "yyy.");
+  assert_line(2, bgcolors, "yyy..");
+
+  type("0xx");
+  editor_draw(editor);
+  assert_line(0, chars,    "word");
+  assert_line(0, bgcolors, "wyy.");
+}
+
+void test_draw__redrawtime(void) {
+  type(":set filetype=c<cr>:set redrawtime=1<cr>");
+  struct buf *text = buf_create(1 << 19);
+  while (text->len < 1 << 19) {
+    buf_append(text, "int x = 1;\n");
+  }
+  buffer_do_insert(editor->window->buffer, text, 0);
+  type("G");
+
+  // Tokenizing everything above the last line doesn't fit in a frame, so it's
+  // drawn plain at first.
+  buf_clear(editor->status);
+  struct timespec now;
+  clock_now(&now);
+  clock_stop(&now, 1);
+  editor_draw(editor);
+  size_t y = gb_nlines(editor->window->buffer->text) - 2 - editor->window->top;
+  cl_assert(editor->redraw_incomplete);
+  cl_assert_equal_s(
+      "'redrawtime' exceeded, highlighting cut short", editor->status->buf);
+  assert_line(y, fgcolors, "wwwwwwwwww");
+
+  // Later frames pick up where it left off.
+  clock_stop(&now, 0);
+  editor_draw(editor);
+  cl_assert(!editor->redraw_incomplete);
+  assert_line(y, fgcolors, "???.....?.");
+}
+
+void test_draw__redrawtime_keeps_message(void) {
+  type(":set filetype=c<cr>:set redrawtime=1<cr>");
+  struct buf *text = buf_create(1 << 10);
+  while (text->len < 1 << 10) {
+    buf_append(text, "int x = 1;\n");
+  }
+  buffer_do_insert(editor->window->buffer, text, 0);
+  type("G");
+
+  editor_status_msg(editor, "written");
+  struct timespec now;
+  clock_now(&now);
+  clock_stop(&now, 1);
+  editor_draw(editor);
+  cl_assert(editor->redraw_incomplete);
+  cl_assert_equal_s("written", editor->status->buf);
+}
+
+void test_draw__nested_splits(void) {
+  type("ione<cr>two<esc>:set number<cr>:vsplit<cr>:split<cr>");
+  editor_draw(editor);
+  size_t h = window_h(editor->window);
+
+  // Top left, bottom left and right.
+  assert_line(0, chars, "  1.one................................|  1.one");
+  assert_line(1, chars, "  2.two................................|  2.two");
+  assert_line(h - 1, bgcolors, "wwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwwww.");
+  assert_line(h, chars, "  1.one................................|~");
+  assert_line(h + 1, chars, "  2.two................................|~");
+}
+
+void test_draw__substitute_preview(void) {
+  type(":set inccommand=nosplit<cr>");
+  type("ihello, word world!<esc>");
+  editor_preview_substitute(editor, "s/wor/X\\r/g");
+  editor_draw(editor);
+  assert_line(0, chars,    "hello, X^Md X^Mld!");
+  assert_line(0, fgcolors, "wwwwwwwbbbwwbbbwww");
+  assert_line(0, bgcolors, ".......yyy..yyy...");
+}
+
 void test_draw__message(void) {
   type("i1<cr>2<cr>3<cr>4<esc>gg");
   editor_draw(editor);
@@ -127,3 +340,27 @@ void test_draw__message(void) {
   assert_line(editor->height - 3, chars, "~.....");
   assert_line(editor->height - 2, chars, "~.....");
 }
+
+void test_draw__search_count_narrow(void) {
+  editor_free(editor);
+  editor = editor_create(16, tb_height());
+  type("ifoo foo foo<esc>:set ruler<cr>0/foo<cr>");
+  while (editor->search_count.job) {
+    sched_yield();
+    editor_update_search_count(editor);
+  }
+  cl_assert(editor->search_count.ready);
+  editor_draw(editor);
+  // Where the ruler ("1,5        All") would push the count off the left.
+  assert_line(tb_height() - 1, chars, "[2/3]");
+}
+
+void test_draw__no_room_for_text(void) {
+  editor_free(editor);
+  editor = editor_create(3, tb_height());
+  type("ifoo foo<esc>:set number<cr>:set hlsearch<cr>/foo<cr>");
+  editor_draw(editor);
+  // The line numbers take up the whole window, and the text isn't drawn.
+  assert_line(0, chars, "  1.......");
+  assert_line(1, chars, "~");
+}
@@ -1,17 +1,22 @@
 #include "clar.h"
 #include "editor.h"
 
+#include <sched.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <termbox.h>
+#include <time.h>
 
 #include "buf.h"
 #include "buffer.h"
 #include "gap.h"
+#include "search.h"
 #include "window.h"
 #include "util.h"
 
 #include "asserts.h"
+#include "mock_termbox.h"
 
 static struct editor *editor = NULL;
 
@@ -29,6 +34,7 @@ void test_editor__initialize(void) {
 
 void test_editor__cleanup(void) {
   editor_free(editor);
+  clock_stop(NULL, 0);
 }
 
 void test_editor__basic_editing(void) {
@@ -133,6 +139,35 @@ void test_editor__percent_motion(void) {
   type("%"); assert_cursor_over('['); assert_cursor_at(0, 10);
 }
 
+void test_editor__percent_motion_c(void) {
+  type(":set filetype=c<cr>");
+  type("iint f(void) {<cr>/* { */<cr>return '}';<cr>}<esc>gg");
+  type("%"); assert_cursor_at(0, 10);
+  type("%"); assert_cursor_at(0, 5);
+  type("f{"); assert_cursor_at(0, 12);
+  type("%"); assert_cursor_at(3, 0);
+  type("%"); assert_cursor_at(0, 12);
+}
+
+void test_editor__section_motions(void) {
+  type("ia<cr>{<cr>}<cr>b<cr>{<cr>}<cr>c<esc>gg");
+  type("]]"); assert_cursor_at(1, 0);
+  type("]["); assert_cursor_at(2, 0);
+  type("]]"); assert_cursor_at(4, 0);
+  type("[]"); assert_cursor_at(2, 0);
+  type("2[["); assert_cursor_at(0, 0);
+}
+
+void test_editor__section_motions_c(void) {
+  type(":set filetype=c<cr>");
+  type("iint a() {<cr>}<cr>int b() {<cr>}<esc>gg");
+  type("]]"); assert_cursor_at(0, 8);
+  type("]]"); assert_cursor_at(2, 8);
+  type("[]"); assert_cursor_at(1, 0);
+  type("[["); assert_cursor_at(0, 8);
+  type("0d]["); assert_buffer_contents("}\nint b() {\n}\n");
+}
+
 void test_editor__command_history_traversal(void) {
   type(":set number<cr>");
   type(":set norelativenumber<cr>");
@@ -198,6 +233,49 @@ void test_editor__autoindent(void) {
   assert_buffer_contents("custom\n  indented\n");
 }
 
+void test_editor__bracketed_paste(void) {
+  type(":set autoindent<cr>");
+  type("i  x<esc>[200~if (y) {<cr>  z;<cr>}<esc>[201~;<esc>");
+  assert_buffer_contents("  xif (y) {\n  z;\n};\n");
+  assert_cursor_at(2, 2);
+
+  // The paste is a single edit, and typing carries on after it.
+  struct edit_action_group *group =
+      TAILQ_FIRST(&editor->window->buffer->undo_stack);
+  struct edit_action *action = TAILQ_FIRST(&group->actions);
+  cl_assert_equal_s(action->buf->buf, ";");
+  action = TAILQ_NEXT(action, pointers);
+  cl_assert_equal_s(action->buf->buf, "if (y) {\n  z;\n}");
+
+  // Outside of insert mode, the pasted text is handled as if it were typed.
+  type("ggdG<esc>[200~ihi<esc>[201~<esc>");
+  assert_buffer_contents("hi\n");
+}
+
+void test_editor__bracketed_paste_stalls(void) {
+  // Without its end marker, a paste is over once input stops coming in, and
+  // what did come in is handled.
+  mock_tb_waited_ms = 0;
+  type("<esc>[200~iabc");
+  cl_assert(mock_tb_waited_ms > 0);
+  type("<esc>ad<esc>");
+  assert_buffer_contents("abcd\n");
+}
+
+void test_editor__escape_not_delayed(void) {
+  mock_tb_waited_ms = 0;
+  type("ifoo<esc>");
+  cl_assert_equal_i(mock_tb_waited_ms, 0);
+  cl_assert_equal_i(editor->mode->kind, EDITING_MODE_normal);
+
+  // Unless 'ttimeoutlen' asks to wait for the rest of a sequence.
+  type(":set ttimeoutlen=30<cr>");
+  mock_tb_waited_ms = 0;
+  type("ibar<esc>");
+  cl_assert_equal_i(mock_tb_waited_ms, 30);
+  assert_buffer_contents("foobar\n");
+}
+
 void test_editor__completion(void) {
   cl_assert_equal_s(type(":sp<tab>"), ":split");
   cl_assert_equal_s(type("<tab>"), ":splitfind");
@@ -205,3 +283,211 @@ void test_editor__completion(void) {
   cl_assert_equal_s(type("<bs><bs><bs><bs><bs>vsp<tab>"), ":vsplit");
   type("<esc>");
 }
+
+static char *search_count(void) {
+  static char buf[32];
+  editor_update_search_count(editor);
+  while (editor->search_count.job) {
+    sched_yield();
+    editor_update_search_count(editor);
+  }
+  if (!editor->search_count.visible) {
+    return "";
+  }
+  search_count_format(&editor->search_count, buf, sizeof(buf));
+  return buf;
+}
+
+void test_editor__search_count(void) {
+  type("ia foo b foo c foo<esc>0");
+  type("/foo<cr>");
+  cl_assert_equal_s(search_count(), "[1/3]");
+  type("n");
+  cl_assert_equal_s(search_count(), "[2/3]");
+  type("N");
+  cl_assert_equal_s(search_count(), "[1/3]");
+  type("N");
+  cl_assert_equal_s(search_count(), "[3/3]");
+  type("*");
+  cl_assert_equal_s(search_count(), "[1/3]");
+
+  type(":set shortmess=S<cr>");
+  type("n");
+  cl_assert_equal_s(search_count(), "");
+}
+
+void test_editor__search_count_limit(void) {
+  char text[201];
+  memset(text, 'x', 200);
+  text[200] = '\0';
+  buffer_do_insert(editor->window->buffer, buf_from_cstr(text), 0);
+  type("0/x<cr>");
+  cl_assert_equal_s(search_count(), "[2/>99]");
+  type("G$N");
+  cl_assert_equal_s(search_count(), "[>99/>99]");
+}
+
+void test_editor__search_count_dropped_after_edit(void) {
+  type("ifoo foo<esc>0");
+  type("/foo<cr>");
+  cl_assert_equal_s(search_count(), "[2/2]");
+  buffer_do_insert(editor->window->buffer, buf_from_cstr("foo "), 0);
+  cl_assert_equal_s(search_count(), "");
+  type("n");
+  cl_assert_equal_s(search_count(), "[1/3]");
+}
+
+void test_editor__search_unicode_classes(void) {
+  buffer_do_insert(editor->window->buffer,
+      buf_from_cstr("a d\xc3\xa9j\xc3\xa0 vu\n"), 0);
+  type("gg");
+  cl_assert_equal_s(type("/\\w{4}<cr>"), "Pattern not found: \"\\w{4}\"");
+  type(":set unicodeclasses<cr>");
+  type("/<cr>");
+  cl_assert_equal_i(window_cursor(editor->window), 2);
+}
+
+static char *incsearch(struct incsearch *state, char *pattern,
+    enum search_direction direction) {
+  static char buf[32];
+  struct region match;
+  switch (editor_incsearch(editor, state, pattern, 0, direction, &match)) {
+  case INCSEARCH_FOUND:
+    snprintf(buf, sizeof(buf), "%zu-%zu", match.start, match.end);
+    return buf;
+  case INCSEARCH_NOT_FOUND: return "none";
+  case INCSEARCH_INTERRUPTED: return "interrupted";
+  }
+  return NULL;
+}
+
+void test_editor__incsearch(void) {
+  struct incsearch state;
+  incsearch_init(&state);
+  type("ifoo fob foobar<esc>");
+
+  cl_assert_equal_s(incsearch(&state, "f", SEARCH_FORWARDS), "4-5");
+  cl_assert_equal_s(incsearch(&state, "fo", SEARCH_FORWARDS), "4-6");
+  cl_assert_equal_i(state.searched, 4);
+  cl_assert_equal_s(incsearch(&state, "foo", SEARCH_FORWARDS), "8-11");
+  cl_assert_equal_s(incsearch(&state, "foox", SEARCH_FORWARDS), "none");
+  cl_assert(state.done);
+  cl_assert_equal_s(incsearch(&state, "fooxy", SEARCH_FORWARDS), "none");
+  // Not an extension of the last pattern, so the search starts over.
+  cl_assert_equal_s(incsearch(&state, "foo", SEARCH_FORWARDS), "8-11");
+  cl_assert_equal_s(incsearch(&state, "foob", SEARCH_FORWARDS), "8-12");
+  cl_assert_equal_s(incsearch(&state, "fo+", SEARCH_FORWARDS), "4-6");
+
+  cl_assert_equal_s(incsearch(&state, "fo", SEARCH_BACKWARDS), "8-10");
+  cl_assert_equal_s(incsearch(&state, "fob", SEARCH_BACKWARDS), "4-7");
+  incsearch_deinit(&state);
+}
+
+void test_editor__incsearch_wraps_around(void) {
+  struct incsearch state;
+  incsearch_init(&state);
+  type("ifoo fob foobar<esc>");
+
+  struct region match;
+  cl_assert_equal_i(INCSEARCH_FOUND, editor_incsearch(
+      editor, &state, "fo", 9, SEARCH_FORWARDS, &match));
+  cl_assert_equal_i(match.start, 0);
+  cl_assert(state.wrapped);
+  cl_assert_equal_i(INCSEARCH_FOUND, editor_incsearch(
+      editor, &state, "foob", 9, SEARCH_FORWARDS, &match));
+  cl_assert_equal_i(match.start, 8);
+  incsearch_deinit(&state);
+}
+
+void test_editor__incsearch_interrupted(void) {
+  struct incsearch state;
+  incsearch_init(&state);
+  type("ifoo fob foobar<esc>");
+
+  struct tb_event ev = {.type = TB_EVENT_KEY, .ch = 'x'};
+  editor_push_event(editor, &ev);
+  cl_assert_equal_s(incsearch(&state, "fo", SEARCH_FORWARDS), "interrupted");
+  cl_assert(editor_input_pending(editor));
+  editor_waitkey(editor, &ev);
+  cl_assert_equal_i(ev.ch, 'x');
+  cl_assert(!editor_input_pending(editor));
+  cl_assert_equal_s(incsearch(&state, "fo", SEARCH_FORWARDS), "4-6");
+  incsearch_deinit(&state);
+}
+
+void test_editor__frames_skipped_while_input_pending(void) {
+  struct timespec now;
+  clock_now(&now);
+  clock_stop(&now, 0);
+  editor_draw(editor);
+  cl_assert(editor_should_draw(editor));
+
+  struct tb_event ev = {.type = TB_EVENT_KEY, .ch = 'x'};
+  editor_push_event(editor, &ev);
+  cl_assert(!editor_should_draw(editor));
+
+  // Unless a frame is overdue.
+  now.tv_nsec += (EDITOR_FRAME_MS - 1) * 1000000L;
+  clock_stop(&now, 0);
+  cl_assert(!editor_should_draw(editor));
+  now.tv_nsec += 1000000L;
+  clock_stop(&now, 0);
+  cl_assert(editor_should_draw(editor));
+
+  editor_waitkey(editor, &ev);
+  cl_assert_equal_i(ev.ch, 'x');
+  editor_draw(editor);
+  cl_assert(editor_should_draw(editor));
+}
+
+void test_editor__search_interrupted(void) {
+  struct buf *text = buf_create(1 << 22);
+  while (text->len < 3 << 20) {
+    buf_append(text, "foo bar baz\n");
+  }
+  buffer_do_insert(editor->window->buffer, text, 0);
+
+  type("gg");
+  cl_assert_equal_s(type("/qu+x<cr><C-c>"), "Interrupted");
+  assert_cursor_at(0, 0);
+  cl_assert(!editor_input_pending(editor));
+}
+
+void test_editor__search_gives_up(void) {
+  char text[4096];
+  memset(text, 'a', sizeof(text) - 3);
+  strcpy(text + sizeof(text) - 3, "c\n");
+  type("ib<esc>");
+  buffer_do_insert(editor->window->buffer, buf_from_cstr(text), 0);
+
+  type("gg");
+  cl_assert_equal_s(type("/(a*)*b<cr>"),
+      "Search for \"(a*)*b\" gave up: match limit exceeded");
+  assert_cursor_at(0, 0);
+}
+
+void test_editor__search_parallel(void) {
+  struct buf *text = buf_create(1 << 24);
+  while (text->len < 14 << 20) {
+    buf_append(text, "foo bar baz\n");
+  }
+  size_t line = strlen("foo bar baz\n");
+  // Far enough from the top that the search is spread over the pool.
+  size_t first = (6 << 20) / line * line;
+  size_t second = (11 << 20) / line * line;
+  memcpy(text->buf + first, "needle", strlen("needle"));
+  memcpy(text->buf + second, "needle", strlen("needle"));
+  buffer_do_insert(editor->window->buffer, text, 0);
+
+  type("gg/needle<cr>");
+  cl_assert_equal_i(window_cursor(editor->window), first);
+  type("n");
+  cl_assert_equal_i(window_cursor(editor->window), second);
+  cl_assert_equal_s(type("n"), "search hit BOTTOM, continuing at TOP");
+  cl_assert_equal_i(window_cursor(editor->window), first);
+
+  // Matches can run past the end of the lines they start on.
+  type("gg/baz\\nneedle<cr>");
+  cl_assert_equal_i(window_cursor(editor->window), first - strlen("baz\n"));
+  cl_assert_equal_s(type("/nope<cr>"), "Pattern not found: \"nope\"");
+}
@@ -6,6 +6,7 @@
 #include <termbox.h>
 
 #include "attrs.h"
+#include "mock_termbox.h"
 
 #define MOCK_TB_WIDTH 80
 #define MOCK_TB_HEIGHT 24
@@ -89,6 +90,13 @@ int tb_select_output_mode(int mode ATTR_UNUSED) {
 }
 
 
+int mock_tb_waited_ms = 0;
+
+int tb_peek_event(struct tb_event *event ATTR_UNUSED, int timeout) {
+  mock_tb_waited_ms += timeout;
+  return 0;
+}
+
 int tb_poll_event(struct tb_event *event ATTR_UNUSED) {
   return 0;
 }
@@ -0,0 +1,5 @@
+#pragma once
+
+// The total of the timeouts tb_peek_event was called with, i.e. how long the
+// editor would have waited for input that never came.
+extern int mock_tb_waited_ms;
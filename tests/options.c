@@ -1,6 +1,7 @@
 #include "clar.h"
 #include "editor.h"
 
+#include <string.h>
 #include <termbox.h>
 
 #include "buf.h"
@@ -161,3 +162,11 @@ void test_options__completion(void) {
   cl_assert_equal_s(type("<tab>"), ":set numberwidth");
   type("<esc>");
 }
+
+void test_options__syntaxpath(void) {
+  // Setting it loads the syntax files there, and says if some are broken.
+  char *status = type(":set syntaxpath=" CLAR_FIXTURE_PATH "/syntax<cr>");
+  cl_assert(strstr(status, "broken.syntax:3: unknown directive: NOPE"));
+  editor_open(editor, "x.toy");
+  cl_assert_equal_s(editor->window->buffer->opt.filetype, "toy");
+}
@@ -0,0 +1,271 @@
+#include "clar.h"
+#include "parse.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "gap.h"
+#include "pool.h"
+#include "syntax.h"
+#include "util.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof(arr[0]))
+
+static struct buffer *buffer = NULL;
+
+static const char *source =
+    "typedef unsigned long word;\n"
+    "typedef struct {\n"
+    "  int x; /* } */\n"
+    "} point;\n"
+    "typedef int (*callback)(void *arg);\n"
+    "static int table[] = {1, 2};\n"
+    "struct node {\n"
+    "  struct node *next;\n"
+    "};\n"
+    "int\n"
+    "main(int argc, char **argv)\n"
+    "{\n"
+    "  char *s = \"(}\";\n"
+    "  if (argc) { return ')'; }\n"
+    "  return 0;\n"
+    "}\n";
+
+void test_parse__initialize(void) {
+  buffer = buffer_create(NULL);
+  buffer->opt.filetype = xstrdup("c");
+  buffer_do_insert(buffer, buf_from_cstr((char*) source), 0);
+}
+
+void test_parse__cleanup(void) {
+  buffer_free(buffer);
+}
+
+static size_t offset_of(const char *needle) {
+  const char *found = strstr(source, needle);
+  cl_assert(found);
+  return (size_t) (found - source);
+}
+
+static void assert_match(size_t pos, size_t bracket, size_t match) {
+  struct parse *parse = buffer_parse(buffer, true);
+  size_t actual_bracket, actual_match;
+  cl_assert(parse_match_bracket(parse, pos, &actual_bracket, &actual_match));
+  cl_assert_equal_i(bracket, actual_bracket);
+  cl_assert_equal_i(match, actual_match);
+}
+
+static void assert_block_names(const char **names, size_t n) {
+  struct parse *parse = buffer_parse(buffer, true);
+  cl_assert_equal_i(n, parse_nblocks(parse));
+  for (size_t i = 0; i < n; ++i) {
+    size_t pos;
+    struct buf *name = parse_block_name(parse, parse_get_block(parse, i), &pos);
+    cl_assert(name);
+    cl_assert_equal_s(names[i], name->buf);
+    buf_free(name);
+  }
+}
+
+void test_parse__not_c(void) {
+  free(buffer->opt.filetype);
+  buffer->opt.filetype = xstrdup("python");
+  cl_assert(!buffer_parse(buffer, true));
+  cl_assert(!buffer->parse);
+}
+
+void test_parse__match_bracket(void) {
+  // The brace in the comment doesn't count.
+  size_t open = offset_of("{\n  int x;");
+  size_t close = offset_of("} point");
+  assert_match(open, open, close);
+  assert_match(close, close, open);
+
+  // Nor do the ones in strings and character literals.
+  size_t body = offset_of("{\n  char");
+  size_t end = strlen(source) - 2;
+  assert_match(body, body, end);
+  assert_match(end, end, body);
+  size_t brace = offset_of("{ return");
+  assert_match(brace, brace, offset_of("}\n  return 0"));
+
+  // The first bracket at or after pos on its line.
+  size_t main = offset_of("main(");
+  assert_match(main, main + 4, offset_of(")\n{"));
+  size_t star = offset_of("*callback");
+  assert_match(star, offset_of(")(void"), star - 1);
+
+  struct parse *parse = buffer_parse(buffer, true);
+  size_t bracket, match;
+  cl_assert(!parse_match_bracket(
+      parse, offset_of("return 0"), &bracket, &match));
+}
+
+void test_parse__blocks(void) {
+  const char *names[] = {"point", "table", "node", "main"};
+  assert_block_names(names, ARRAY_SIZE(names));
+
+  struct parse *parse = buffer_parse(buffer, true);
+  size_t brace;
+  cl_assert(parse_find_block(parse, 0, true, false, &brace));
+  cl_assert_equal_i(offset_of("{\n  int x;"), brace);
+  cl_assert(parse_find_block(parse, brace, true, false, &brace));
+  cl_assert_equal_i(offset_of("{1, 2}"), brace);
+  cl_assert(parse_find_block(parse, brace, true, true, &brace));
+  cl_assert_equal_i(offset_of("2}") + 1, brace);
+  cl_assert(parse_find_block(parse, brace, false, false, &brace));
+  cl_assert_equal_i(offset_of("{1, 2}"), brace);
+  cl_assert(parse_find_block(parse, brace, false, true, &brace));
+  cl_assert_equal_i(offset_of("} point"), brace);
+  cl_assert(!parse_find_block(
+      parse, offset_of("{\n  char"), true, false, &brace));
+  cl_assert(!parse_find_block(parse, 0, false, false, &brace));
+}
+
+void test_parse__types(void) {
+  struct parse *parse = buffer_parse(buffer, true);
+  cl_assert(parse_is_type(parse, "word", 4));
+  cl_assert(parse_is_type(parse, "point", 5));
+  cl_assert(parse_is_type(parse, "callback", 8));
+  cl_assert(!parse_is_type(parse, "arg", 3));
+  cl_assert(!parse_is_type(parse, "node", 4));
+  cl_assert(!parse_is_type(parse, "unsigned", 8));
+}
+
+void test_parse__edits(void) {
+  buffer_parse(buffer, true);
+
+  // Renaming a typedef.
+  size_t pos = offset_of("word;");
+  buffer_do_delete(buffer, 4, pos);
+  buffer_do_insert(buffer, buf_from_cstr("size"), pos);
+  struct parse *parse = buffer_parse(buffer, true);
+  cl_assert(parse_is_type(parse, "size", 4));
+  cl_assert(!parse_is_type(parse, "word", 4));
+
+  // Commenting out a block, and back in.
+  pos = offset_of("struct node {");
+  size_t end = pos + 2 + strlen("struct node {\n  struct node *next;\n};");
+  buffer_do_insert(buffer, buf_from_cstr("/*"), pos);
+  buffer_do_insert(buffer, buf_from_cstr("*/"), end);
+  const char *commented[] = {"point", "table", "main"};
+  assert_block_names(commented, ARRAY_SIZE(commented));
+  buffer_do_delete(buffer, 2, end);
+  buffer_do_delete(buffer, 2, pos);
+  const char *uncommented[] = {"point", "table", "node", "main"};
+  assert_block_names(uncommented, ARRAY_SIZE(uncommented));
+
+  // Adding a line, and then a function.
+  buffer_do_insert(buffer, buf_from_cstr("\n"), 0);
+  buffer_do_insert(buffer, buf_from_cstr("void f(void) {}\n"),
+      gb_size(buffer->text) - 1);
+  const char *added[] = {"point", "table", "node", "main", "f"};
+  assert_block_names(added, ARRAY_SIZE(added));
+  cl_assert(parse_is_type(buffer_parse(buffer, true), "size", 4));
+
+  // Unbalanced braces leave the last block open.
+  buffer_do_insert(buffer, buf_from_cstr("{"), gb_size(buffer->text) - 3);
+  parse = buffer_parse(buffer, true);
+  cl_assert_equal_i(5, parse_nblocks(parse));
+  struct parse_block *block = parse_get_block(parse, 4);
+  cl_assert_equal_i(gb_nlines(buffer->text), block->close_line);
+  size_t brace;
+  cl_assert(!parse_find_block(
+      parse, parse_block_pos(parse, block), true, true, &brace));
+}
+
+void test_parse__background(void) {
+  // Drawing doesn't wait for the buffer to be tokenized, so the types come in
+  // as the syntax cache's lines do.
+  struct parse *parse = buffer_parse(buffer, false);
+  cl_assert(!parse_is_type(parse, "word", 4));
+  cl_assert(buffer_syntax_pending(buffer));
+
+  struct pool *pool = pool_create();
+  do {
+    sched_yield();
+    buffer_syntax_update(buffer, pool);
+  } while (buffer_syntax_pending(buffer));
+  parse = buffer_parse(buffer, false);
+  cl_assert(parse_is_type(parse, "word", 4));
+  cl_assert(parse_is_type(parse, "callback", 8));
+
+  // An edit only has the lines it touched read again.
+  size_t pos = offset_of("word;");
+  buffer_do_insert(buffer, buf_from_cstr("_t"), pos + 4);
+  cl_assert(buffer_syntax_line(buffer, 0, NULL));
+  parse = buffer_parse(buffer, false);
+  cl_assert(parse_is_type(parse, "word_t", 6));
+  cl_assert(!parse_is_type(parse, "word", 4));
+  cl_assert(!buffer_syntax_pending(buffer));
+  pool_free(pool);
+}
+
+void test_parse__lazy(void) {
+  // The motions only tokenize as far as they have to look.
+  struct buffer *big = buffer_create(NULL);
+  big->opt.filetype = xstrdup("c");
+  struct buf *text = buf_create(1 << 20);
+  size_t far = 0;
+  for (int i = 0; i < 5000; ++i) {
+    if (i == 3000) {
+      far = text->len + strlen("void f3000(void) ");
+    }
+    buf_appendf(text, "void f%d(void) {\n  if (x) { y(\"}\"); }\n}\n", i);
+  }
+  buffer_do_insert(big, text, 0);
+  size_t last = gb_nlines(big->text) - 2;
+  size_t line = strlen("void f0(void) {\n");
+  size_t body = line + strlen("  if (x) { y(\"}\"); }\n");
+  size_t next = body + 2;
+
+  struct parse *parse = buffer_parse_lazy(big);
+  size_t bracket, match;
+  cl_assert(parse_match_bracket(parse, 0, &bracket, &match));
+  cl_assert_equal_i(strlen("void f0"), bracket);
+  cl_assert(parse_match_bracket(parse, bracket + 6, &bracket, &match));
+  cl_assert_equal_i(body, match);
+  cl_assert(parse_match_bracket(parse, body, &bracket, &match));
+  cl_assert_equal_i(strlen("void f0(void) "), match);
+
+  size_t brace;
+  cl_assert(parse_find_block(parse, 0, true, false, &brace));
+  cl_assert_equal_i(strlen("void f0(void) "), brace);
+  cl_assert(parse_find_block(parse, brace, true, false, &brace));
+  cl_assert_equal_i(next + strlen("void f1(void) "), brace);
+  // From inside a block, back to where it opens and on to where it closes.
+  cl_assert(parse_find_block(parse, line + 2, false, false, &brace));
+  cl_assert_equal_i(strlen("void f0(void) "), brace);
+  cl_assert(parse_find_block(parse, line + 2, true, true, &brace));
+  cl_assert_equal_i(body, brace);
+  cl_assert(!buffer_syntax_cached_line(big, last));
+
+  // An edit above what was read is taken in.
+  char *table = "int a[] = {1};\n";
+  buffer_do_insert(big, buf_from_cstr(table), 0);
+  cl_assert(parse_find_block(parse, 0, true, false, &brace));
+  cl_assert_equal_i(strlen("int a[] = "), brace);
+  cl_assert(parse_find_block(parse, brace, true, true, &brace));
+  cl_assert_equal_i(strlen("int a[] = {1"), brace);
+  cl_assert(parse_find_block(parse, brace, true, true, &brace));
+  cl_assert_equal_i(strlen(table) + body, brace);
+  buffer_do_delete(big, strlen(table), 0);
+  cl_assert(parse_find_block(parse, 0, true, true, &brace));
+  cl_assert_equal_i(body, brace);
+  cl_assert(!buffer_syntax_cached_line(big, last));
+
+  // Further down, it agrees with working out the whole buffer.
+  cl_assert(parse_match_bracket(parse, far, &bracket, &match));
+  size_t lazy = match;
+  cl_assert(parse_find_block(parse, far + 1, true, false, &brace));
+  size_t lazy_next = brace;
+  parse = buffer_parse(big, true);
+  cl_assert(parse_match_bracket(parse, far, &bracket, &match));
+  cl_assert_equal_i(lazy, match);
+  cl_assert(parse_find_block(parse, far + 1, true, false, &brace));
+  cl_assert_equal_i(lazy_next, brace);
+  buffer_free(big);
+}
@@ -0,0 +1,135 @@
+#include "clar.h"
+#include "quickfix.h"
+
+#include <sched.h>
+#include <string.h>
+
+#include <termbox.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "util.h"
+#include "window.h"
+
+#include "asserts.h"
+
+static struct editor *editor = NULL;
+
+static char *type(const char *keys) {
+  editor_send_keys(editor, keys);
+  return editor->status->buf;
+}
+
+static void wait_for_vimgrep(void) {
+  while (editor->quickfix.grep) {
+    sched_yield();
+    editor_update_quickfix(editor);
+  }
+}
+
+static void assert_entry(size_t i, size_t line, size_t column, char *text) {
+  cl_assert(i < editor->quickfix.len);
+  struct quickfix_entry *entry = &editor->quickfix.entries[i];
+  cl_assert_equal_i(line, entry->line);
+  cl_assert_equal_i(column, entry->column);
+  cl_assert_equal_s(text, entry->text);
+}
+
+void test_quickfix__initialize(void) {
+  cl_fixture_sandbox("tags.c");
+  tb_init();
+  editor = editor_create(tb_width(), tb_height());
+}
+
+void test_quickfix__cleanup(void) {
+  editor_free(editor);
+}
+
+void test_quickfix__vimgrep(void) {
+  type(":vimgrep /ba[rz]/ tags.c<cr>");
+  wait_for_vimgrep();
+
+  cl_assert_equal_i(4, editor->quickfix.len);
+  assert_entry(0, 4, 6, "void baz(void) {");
+  assert_entry(1, 7, 6, "void bar(void) {");
+  assert_entry(2, 11, 3, "bar();");
+  assert_entry(3, 12, 3, "baz();");
+
+  cl_assert_equal_s("(1 of 4): void baz(void) {", editor->status->buf);
+  cl_assert(strstr(editor->window->buffer->path, "tags.c"));
+  assert_cursor_at(3, 5);
+
+  cl_assert_equal_s(type(":cnext<cr>"), "(2 of 4): void bar(void) {");
+  assert_cursor_at(6, 5);
+  type(":cn<cr>");
+  cl_assert_equal_s(type(":cn<cr>"), "(4 of 4): baz();");
+  assert_cursor_at(11, 2);
+  cl_assert_equal_s(type(":cn<cr>"), "No more items");
+  cl_assert_equal_s(type(":cprevious<cr>"), "(3 of 4): bar();");
+  assert_cursor_at(10, 2);
+}
+
+void test_quickfix__vimgrep_flags(void) {
+  type(":vimgrep /a/j tags.c<cr>");
+  wait_for_vimgrep();
+  cl_assert_equal_i(5, editor->quickfix.len);
+  cl_assert(!editor->window->buffer->path);
+
+  type(":vimgrep /a/gj tags.c<cr>");
+  wait_for_vimgrep();
+  cl_assert_equal_i(6, editor->quickfix.len);
+  assert_entry(0, 1, 23, "// This line intentionally left blank");
+  assert_entry(1, 1, 35, "// This line intentionally left blank");
+  assert_entry(2, 4, 7, "void baz(void) {");
+}
+
+void test_quickfix__vimgrep_searches_loaded_buffers(void) {
+  type(":e tags.c<cr>");
+  type("ggiquux<esc>");
+  type(":vimgrep quux **/*.c<cr>");
+  wait_for_vimgrep();
+  cl_assert_equal_i(3, editor->quickfix.len);
+  assert_entry(0, 1, 1, "quux// This line intentionally left blank");
+}
+
+void test_quickfix__vimgrep_no_match(void) {
+  type(":vimgrep /nope/ tags.c<cr>");
+  wait_for_vimgrep();
+  cl_assert_equal_s("No match: nope", editor->status->buf);
+  cl_assert_equal_s(type(":cnext<cr>"), "No Errors");
+}
+
+void test_quickfix__copen(void) {
+  type(":vimgrep /ba[rz]/ tags.c<cr>");
+  wait_for_vimgrep();
+  type(":cnext<cr>");
+  type(":copen<cr>");
+
+  struct buffer *buffer = editor->window->buffer;
+  cl_assert(buffer == editor->quickfix.buffer);
+  assert_contents(
+      "tags.c|4 col 6| void baz(void) {\n"
+      "tags.c|7 col 6| void bar(void) {\n"
+      "tags.c|11 col 3| bar();\n"
+      "tags.c|12 col 3| baz();\n");
+  assert_cursor_at(1, 0);
+
+  type("jj<cr>");
+  cl_assert(editor->window->buffer != editor->quickfix.buffer);
+  cl_assert_equal_s("(4 of 4): baz();", editor->status->buf);
+  assert_cursor_at(11, 2);
+}
+
+void test_quickfix__outline(void) {
+  cl_assert_equal_s(type(":outline<cr>"), "No file name");
+  type(":e tags.c<cr>");
+  cl_assert_equal_s(type(":outline<cr>"), "3 declarations");
+  assert_entry(0, 4, 6, "void baz(void) {");
+  assert_entry(1, 7, 6, "void bar(void) {");
+  assert_entry(2, 10, 6, "void foo(void) {");
+
+  cl_assert_equal_s(type(":cn<cr>"), "(2 of 3): void bar(void) {");
+  assert_cursor_at(6, 5);
+}
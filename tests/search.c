@@ -0,0 +1,165 @@
+#include "clar.h"
+#include "search.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char matches_buffer[256];
+
+static char *matches(char *pattern, int flags, char *str) {
+  struct search search;
+  int rc = search_init(&search, pattern, flags, str, strlen(str));
+  cl_assert_equal_i(rc, 0);
+
+  char *out = matches_buffer;
+  *out = '\0';
+  struct region match;
+  while (search_next_match(&search, &match)) {
+    out += sprintf(out, "%s%zu-%zu",
+        out == matches_buffer ? "" : ",", match.start, match.end);
+  }
+  search_deinit(&search);
+  return matches_buffer;
+}
+
+void test_search__literal(void) {
+  cl_assert_equal_s(matches("foo", 0, "foo bar foofoo"), "0-3,8-11,11-14");
+  cl_assert_equal_s(matches("foo", 0, "fo of"), "");
+  cl_assert_equal_s(matches("aab", 0, "aaaab"), "2-5");
+  cl_assert_equal_s(matches("foo", 0, "Foo FOO foo"), "8-11");
+  cl_assert_equal_s(matches("a-b c", 0, "a-b ca-b c"), "0-5,5-10");
+}
+
+void test_search__literal_ignore_case(void) {
+  cl_assert_equal_s(
+      matches("foo", SEARCH_IGNORE_CASE, "Foo FOO foo fOx"), "0-3,4-7,8-11");
+  cl_assert_equal_s(matches("-x", SEARCH_IGNORE_CASE, "a-X -x x-"), "1-3,4-6");
+  cl_assert_equal_s(matches("abcab", SEARCH_IGNORE_CASE, "ABCABCAB"), "0-5");
+}
+
+void test_search__literal_words(void) {
+  cl_assert_equal_s(
+      matches("[[:<:]]foo[[:>:]]", 0, "foo foobar _foo foo_ (foo)"),
+      "0-3,22-25");
+  cl_assert_equal_s(
+      matches("[[:<:]]foo[[:>:]]", SEARCH_IGNORE_CASE, "xfoo FOO"), "5-8");
+}
+
+void test_search__regex(void) {
+  cl_assert_equal_s(matches("fo+", 0, "f fo foo"), "2-4,5-8");
+  cl_assert_equal_s(matches("^a", 0, "ab\nba\nab"), "0-1,6-7");
+  cl_assert_equal_s(matches("[[:<:]]f.o[[:>:]]", 0, "fxo fxoo"), "0-3");
+}
+
+void test_search__utf8(void) {
+  // "\xc3\xa9" is an e with an acute accent.
+  cl_assert_equal_s(matches("h.llo", 0, "h\xc3\xa9llo"), "0-6");
+  cl_assert_equal_s(matches("[^x]", 0, "\xc3\xa9"), "0-2");
+  cl_assert_equal_s(matches("x*", 0, "\xc3\xa9"), "0-0,2-2");
+  cl_assert_equal_s(
+      matches("\xc3\x89T\xc3\xa9", SEARCH_IGNORE_CASE, "\xc3\xa9t\xc3\x89"),
+      "0-5");
+  cl_assert_equal_s(matches("\\w+", 0, "d\xc3\xa9j\xc3\xa0"), "0-1,3-4");
+  cl_assert_equal_s(matches("\\w+", SEARCH_UCP, "d\xc3\xa9j\xc3\xa0"), "0-6");
+  // Text that isn't valid UTF-8 is matched a byte at a time.
+  cl_assert_equal_s(matches("caf.", 0, "caf\xe9 caf\xc3\xa9"), "0-4,5-9");
+
+  // A search starting in the middle of a character starts at the next one.
+  char *str = "\xc3\xa9x";
+  struct search search;
+  search_init(&search, ".", SEARCH_VALID_UTF8, str, strlen(str));
+  cl_assert(search.utf);
+  search.start = 1;
+  struct region match;
+  cl_assert(search_next_match(&search, &match));
+  cl_assert_equal_i(match.start, 2);
+  search_deinit(&search);
+}
+
+void test_search__next_match_before(void) {
+  char *str = "foo foo foo";
+  struct search search;
+  struct region match;
+
+  char *patterns[] = {"foo", "fo+"};
+  for (int i = 0; i < 2; ++i) {
+    search_init(&search, patterns[i], 0, str, strlen(str));
+    cl_assert(search_next_match_before(&search, 4, &match));
+    cl_assert_equal_i(match.start, 0);
+    cl_assert(search_next_match_before(&search, 4, &match));
+    cl_assert_equal_i(match.start, 4);
+    cl_assert(!search_next_match_before(&search, 7, &match));
+    cl_assert(search_next_match_before(&search, 8, &match));
+    cl_assert_equal_i(match.start, 8);
+    search_deinit(&search);
+  }
+}
+
+static bool is_literal(char *pattern, int flags) {
+  struct search search;
+  search_init(&search, pattern, flags, "", 0);
+  bool literal = search.literal != NULL;
+  search_deinit(&search);
+  return literal;
+}
+
+void test_search__detects_literals(void) {
+  cl_assert(is_literal("foo_bar", 0));
+  cl_assert(is_literal("foo bar", SEARCH_IGNORE_CASE));
+  cl_assert(is_literal("[[:<:]]foo[[:>:]]", 0));
+  cl_assert(!is_literal("foo.bar", 0));
+  cl_assert(!is_literal("a\\.b", 0));
+  cl_assert(!is_literal("[ab]", 0));
+  cl_assert(!is_literal("\xc3\xa9", SEARCH_IGNORE_CASE));
+  cl_assert(is_literal("\xc3\xa9", 0));
+  cl_assert(!is_literal("[[:<:]]foo[[:>:]]", SEARCH_UCP));
+}
+
+void test_search__gives_up_on_pathological_patterns(void) {
+  char text[4096];
+  memset(text, 'a', sizeof(text));
+  memcpy(text + sizeof(text) - 3, "c\nb", 3);
+
+  struct search search;
+  cl_assert_equal_i(
+      search_init(&search, "(a*)*b", 0, text, sizeof(text)), 0);
+  struct region match;
+  cl_assert(!search_next_match(&search, &match));
+  cl_assert_equal_i(search.error, PCRE2_ERROR_MATCHLIMIT);
+  char error[48];
+  search_get_error(search.error, error, sizeof(error));
+  cl_assert_equal_s(error, "match limit exceeded");
+  // It stays given up.
+  search.start = sizeof(text) - 1;
+  cl_assert(!search_next_match(&search, &match));
+  search_deinit(&search);
+}
+
+static bool interrupt_second_time(void *arg) {
+  int *calls = arg;
+  return ++*calls == 2;
+}
+
+void test_search__interrupted(void) {
+  size_t len = 4 << 20;
+  char *text = malloc(len);
+  memset(text, 'x', len);
+  memcpy(text + len - 3, "yz", 2);
+
+  struct search search;
+  cl_assert_equal_i(search_init(&search, "y+z", 0, text, len), 0);
+  int calls = 0;
+  search.interrupted = interrupt_second_time;
+  search.interrupted_arg = &calls;
+  struct region match;
+  cl_assert(!search_next_match(&search, &match));
+  cl_assert_equal_i(calls, 2);
+  cl_assert_equal_i(search.error, SEARCH_INTERRUPTED);
+
+  search.error = 0;
+  cl_assert(search_next_match(&search, &match));
+  cl_assert_equal_i(match.start, len - 3);
+  search_deinit(&search);
+  free(text);
+}
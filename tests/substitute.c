@@ -0,0 +1,172 @@
+#include "clar.h"
+#include "substitute.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <termbox.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "util.h"
+#include "window.h"
+
+#include "asserts.h"
+
+static struct editor *editor = NULL;
+
+static char *type(const char *keys) {
+  editor_send_keys(editor, keys);
+  return editor->status->buf;
+}
+
+void test_substitute__initialize(void) {
+  tb_init();
+  editor = editor_create(tb_width(), tb_height());
+  type("ifoo foo<cr>bar foo<cr>foo<esc>gg");
+}
+
+void test_substitute__cleanup(void) {
+  editor_free(editor);
+}
+
+void test_substitute__current_line(void) {
+  type(":s/foo/baz/<cr>");
+  assert_buffer_contents("baz foo\nbar foo\nfoo\n");
+  type(":s/foo/baz/<cr>");
+  assert_buffer_contents("baz baz\nbar foo\nfoo\n");
+  cl_assert_equal_s(type(":s/foo/baz/<cr>"), "Pattern not found: foo");
+}
+
+void test_substitute__ranges(void) {
+  type(":%s/foo/x/<cr>");
+  assert_buffer_contents("x foo\nbar x\nx\n");
+  assert_cursor_at(2, 0);
+
+  type("u:2,$s/foo/y/<cr>");
+  assert_buffer_contents("foo foo\nbar y\ny\n");
+  type("ugg:1,.+1s/foo/z/g<cr>");
+  assert_buffer_contents("z z\nbar z\nfoo\n");
+  cl_assert_equal_s(type(":3,5s/foo/z/<cr>"), "Invalid range");
+  cl_assert_equal_s(type(":2split<cr>"), "No range allowed");
+}
+
+void test_substitute__global(void) {
+  cl_assert_equal_s(
+      type(":%s/foo/x/g<cr>"), "4 substitutions on 3 lines");
+  assert_buffer_contents("x x\nbar x\nx\n");
+  type("u");
+  assert_buffer_contents("foo foo\nbar foo\nfoo\n");
+}
+
+void test_substitute__replacement(void) {
+  type(":%substitute#(\\w+) (\\w+)#\\2-\\1 [&]#<cr>");
+  assert_buffer_contents("foo-foo [foo foo]\nfoo-bar [bar foo]\nfoo\n");
+  type("u:su/o\\b/\\/\\r/g<cr>");
+  assert_buffer_contents("fo/\n fo/\n\nbar foo\nfoo\n");
+  type("u:s/ //<cr>");
+  assert_buffer_contents("foofoo\nbar foo\nfoo\n");
+}
+
+void test_substitute__flags(void) {
+  cl_assert_equal_s(
+      type(":%s/FOO/x/gn<cr>"), "Pattern not found: FOO");
+  cl_assert_equal_s(
+      type(":%s/FOO/x/gin<cr>"), "4 matches on 3 lines");
+  assert_buffer_contents("foo foo\nbar foo\nfoo\n");
+  cl_assert_equal_s(type(":s/nope/x/e<cr>"), ":s/nope/x/e");
+  cl_assert_equal_s(type(":s/foo/x/z<cr>"), "Trailing characters: z");
+
+  type(":%s/foo/x/gc<cr>ynl");
+  assert_buffer_contents("x foo\nbar x\nfoo\n");
+  type("u:%s/foo/x/gc<cr>nq");
+  assert_buffer_contents("foo foo\nbar foo\nfoo\n");
+  type(":%s/foo/x/gc<cr>na");
+  assert_buffer_contents("foo x\nbar x\nx\n");
+}
+
+void test_substitute__uses_last_search_pattern(void) {
+  type("/bar<cr>");
+  type(":%s//x/<cr>");
+  assert_buffer_contents("foo foo\nx foo\nfoo\n");
+  type(":%s/foo/y/<cr>");
+  type("gg/<cr>");
+  assert_cursor_at(0, 2);
+}
+
+void test_substitute__keeps_marks(void) {
+  type(":split<cr>jl");
+  type("<C-w>j");
+  type(":%s/o/00/g<cr>");
+  assert_buffer_contents("f0000 f0000\nbar f0000\nf0000\n");
+  type("<C-w>k");
+  assert_cursor_at(1, 1);
+}
+
+void test_substitute__large_buffer(void) {
+  struct buf *text = buf_create(1 << 22);
+  while (text->len < 3 << 20) {
+    buf_append(text, "foo bar baz foo\n");
+  }
+  size_t nlines = text->len / strlen("foo bar baz foo\n");
+  struct buffer *buffer = editor->window->buffer;
+  buffer_do_insert(buffer, text, 0);
+
+  type(":%s/foo/quux/g<cr>");
+  char expected[64];
+  snprintf(expected, sizeof(expected), "%zu substitutions on %zu lines",
+      2 * nlines + 4, nlines + 3);
+  cl_assert_equal_s(editor->status->buf, expected);
+  struct buf *line = gb_getline(buffer->text, 0);
+  cl_assert_equal_s(line->buf, "quux bar baz quux");
+  buf_free(line);
+  cl_assert_equal_i(gb_nlines(buffer->text), nlines + 3);
+}
+
+static void assert_preview_line(size_t line, const char *text) {
+  struct substitute_preview *preview = editor->window->substitute_preview;
+  cl_assert(preview);
+  cl_assert(line < preview->nlines);
+  if (!text) {
+    cl_assert(!preview->lines[line]);
+    return;
+  }
+  cl_assert(preview->lines[line]);
+  cl_assert_equal_s(preview->lines[line]->buf, text);
+}
+
+void test_substitute__preview(void) {
+  editor_preview_substitute(editor, "%s/foo/x");
+  cl_assert(!editor->window->substitute_preview);
+
+  type(":set inccommand=nosplit<cr>");
+  editor_preview_substitute(editor, "%s/fo");
+  assert_preview_line(0, "o foo");
+  assert_preview_line(1, "bar o");
+  assert_preview_line(2, "o");
+  assert_preview_line(3, NULL);
+  assert_buffer_contents("foo foo\nbar foo\nfoo\n");
+
+  editor_preview_substitute(editor, "2,$s/(o+)/<\\1>/g");
+  assert_preview_line(0, NULL);
+  assert_preview_line(1, "bar f<oo>");
+  assert_preview_line(2, "f<oo>");
+  struct regionbuf *replaced = editor->window->substitute_preview->replaced[1];
+  cl_assert_equal_i(replaced->len, 1);
+  cl_assert_equal_i(replaced->buf[0].start, 5);
+  cl_assert_equal_i(replaced->buf[0].end, 9);
+
+  editor_preview_substitute(editor, "s/o/\\r/g");
+  assert_preview_line(0, "f\n\n f\n\n");
+
+  editor_preview_substitute(editor, "s/(/x/");
+  cl_assert(!editor->window->substitute_preview);
+  editor_preview_substitute(editor, "split");
+  cl_assert(!editor->window->substitute_preview);
+
+  type(":s/foo/x/<cr>");
+  cl_assert(!editor->window->substitute_preview);
+  assert_buffer_contents("x foo\nbar foo\nfoo\n");
+}
@@ -0,0 +1,448 @@
+#include "clar.h"
+#include "syntax.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "gap.h"
+#include "pool.h"
+#include "util.h"
+
+static struct buffer *buffer = NULL;
+// The same text, always tokenized from the top in one pass.
+static struct buffer *reference = NULL;
+
+static struct buffer *c_buffer(struct buf *text) {
+  struct buffer *buffer = buffer_create(NULL);
+  buffer->opt.filetype = xstrdup("c");
+  buffer_do_insert(buffer, text, 0);
+  return buffer;
+}
+
+void test_syntax__initialize(void) {
+  struct buf *text = buf_create(1 << 16);
+  while (text->len < 1 << 16) {
+    buf_append(text, "#include <stdio.h>\n");
+    buf_append(text, "/* a comment\n   int x; */\n");
+    buf_append(text, "static int f(void) { return \"x\\\"y\" ? 1 : 0; }\n");
+  }
+  buffer = c_buffer(buf_copy(text));
+  reference = c_buffer(text);
+}
+
+void test_syntax__cleanup(void) {
+  buffer_free(buffer);
+  buffer_free(reference);
+}
+
+static enum syntax_token_kind kind_at(struct buffer *buffer, size_t pos) {
+  struct syntax syntax;
+  cl_assert(syntax_init(&syntax, buffer));
+  struct syntax_token token;
+  syntax_token_at(&syntax, &token, pos);
+  syntax_deinit(&syntax);
+  return token.kind;
+}
+
+static void assert_same_tokens(void) {
+  struct syntax syntax;
+  cl_assert(syntax_init(&syntax, reference));
+  struct syntax_token token;
+  size_t size = gb_size(reference->text);
+  for (size_t pos = 0; pos < size; pos += 97) {
+    syntax_token_at(&syntax, &token, pos);
+    cl_assert_equal_i(kind_at(buffer, pos), token.kind);
+  }
+  syntax_deinit(&syntax);
+}
+
+void test_syntax__keywords(void) {
+  struct buffer *words = c_buffer(
+      buf_from_cstr("int integer _Bool NULL while #ifdef #x sizeof_\n"));
+  cl_assert_equal_i(kind_at(words, 0), SYNTAX_TOKEN_TYPE);
+  cl_assert_equal_i(kind_at(words, 4), SYNTAX_TOKEN_IDENTIFIER);
+  cl_assert_equal_i(kind_at(words, 12), SYNTAX_TOKEN_TYPE);
+  cl_assert_equal_i(kind_at(words, 18), SYNTAX_TOKEN_LITERAL_NUMBER);
+  cl_assert_equal_i(kind_at(words, 23), SYNTAX_TOKEN_STATEMENT);
+  cl_assert_equal_i(kind_at(words, 29), SYNTAX_TOKEN_PREPROC);
+  // Not a directive, but the rest of the line is part of the one before.
+  cl_assert_equal_i(kind_at(words, 36), SYNTAX_TOKEN_PREPROC);
+  cl_assert_equal_i(kind_at(words, 40), SYNTAX_TOKEN_PREPROC);
+
+  // A keyword split by the gap is still found.
+  gb_mvgap(words->text, 26);
+  cl_assert_equal_i(kind_at(words, 23), SYNTAX_TOKEN_STATEMENT);
+  buffer_free(words);
+}
+
+static struct buffer *filetype_buffer(char *filetype, char *text) {
+  struct buffer *buffer = buffer_create(NULL);
+  buffer->opt.filetype = xstrdup(filetype);
+  buffer_do_insert(buffer, buf_from_cstr(text), 0);
+  return buffer;
+}
+
+// The token containing the first occurrence of needle in the text.
+static struct syntax_token token_of(
+    struct buffer *buffer, char *text, char *needle) {
+  char *found = strstr(text, needle);
+  cl_assert(found);
+  struct syntax syntax;
+  cl_assert(syntax_init(&syntax, buffer));
+  struct syntax_token token;
+  syntax_token_at(&syntax, &token, (size_t) (found - text));
+  syntax_deinit(&syntax);
+  return token;
+}
+
+static void assert_token(struct buffer *buffer, char *text, char *needle,
+    enum syntax_token_kind kind, char *expected) {
+  struct syntax_token token = token_of(buffer, text, needle);
+  cl_assert_equal_i(token.kind, kind);
+  struct buf *actual = gb_getstring(buffer->text, token.pos, token.len);
+  cl_assert_equal_s(actual->buf, expected);
+  buf_free(actual);
+}
+
+void test_syntax__definitions(void) {
+  char error[256];
+  cl_assert(syntax_load_path(SOURCE_SYNTAX_DIR, error, sizeof(error)));
+  cl_assert_equal_s(syntax_detect_filetype("a/b.py"), "python");
+  cl_assert_equal_s(syntax_detect_filetype("main.go"), "go");
+  cl_assert_equal_s(syntax_detect_filetype("run.sh"), "sh");
+  cl_assert_equal_s(syntax_detect_filetype("ci.yml"), "yaml");
+  cl_assert_equal_s(syntax_detect_filetype("syntax.c"), "c");
+  cl_assert_equal_s(syntax_detect_filetype("notes.txt"), "");
+
+  char *text =
+      "@cache\n"
+      "def f(x):  # hi\n"
+      "    return 'a\\'b' + \"\"\"x\ny\"\"\" + 12 or None\n";
+  struct buffer *python = filetype_buffer("python", text);
+  assert_token(python, text, "@", SYNTAX_TOKEN_PREPROC, "@cache");
+  assert_token(python, text, "def", SYNTAX_TOKEN_STATEMENT, "def");
+  assert_token(python, text, "f(", SYNTAX_TOKEN_IDENTIFIER, "f");
+  assert_token(python, text, "(", SYNTAX_TOKEN_PUNCTUATION, "(");
+  assert_token(python, text, "# hi", SYNTAX_TOKEN_COMMENT, "# hi");
+  assert_token(python, text, "'a", SYNTAX_TOKEN_LITERAL_STRING, "'a\\'b'");
+  // A string that spans lines is a token per line.
+  assert_token(python, text, "\"\"\"x",
+      SYNTAX_TOKEN_LITERAL_STRING, "\"\"\"x");
+  assert_token(python, text, "y\"\"\"",
+      SYNTAX_TOKEN_LITERAL_STRING, "y\"\"\"");
+  assert_token(python, text, "12", SYNTAX_TOKEN_LITERAL_NUMBER, "12");
+  assert_token(python, text, "None", SYNTAX_TOKEN_LITERAL_NUMBER, "None");
+
+  text = "x: &a [1, 2]\ny: *a # z\n";
+  struct buffer *yaml = filetype_buffer("yaml", text);
+  assert_token(yaml, text, "x", SYNTAX_TOKEN_STATEMENT, "x");
+  assert_token(yaml, text, "&a", SYNTAX_TOKEN_TYPE, "&a");
+  assert_token(yaml, text, "*a", SYNTAX_TOKEN_TYPE, "*a");
+  assert_token(yaml, text, "# z", SYNTAX_TOKEN_COMMENT, "# z");
+
+  // Buffers of the same filetype share its compiled definition, and loading
+  // the same path again doesn't load it again.
+  struct buffer *other = filetype_buffer("python", "pass\n");
+  struct syntax a, b;
+  cl_assert(syntax_init(&a, python));
+  cl_assert(syntax_init(&b, other));
+  cl_assert(a.filetype == b.filetype);
+  cl_assert(syntax_load_path(SOURCE_SYNTAX_DIR, error, sizeof(error)));
+  syntax_deinit(&a);
+  cl_assert(syntax_init(&a, python));
+  cl_assert(a.filetype == b.filetype);
+  syntax_deinit(&a);
+  syntax_deinit(&b);
+
+  buffer_free(python);
+  buffer_free(yaml);
+  buffer_free(other);
+}
+
+void test_syntax__definition_rules(void) {
+  char error[256];
+  cl_assert(!syntax_load_path(
+        CLAR_FIXTURE_PATH "/syntax", error, sizeof(error)));
+  cl_assert(strstr(error, "broken.syntax:3: unknown directive: NOPE"));
+  cl_assert_equal_s(syntax_detect_filetype("x.broken"), "");
+  cl_assert_equal_s(syntax_detect_filetype("x.toy"), "toy");
+
+  char *text = "Abc do {{ x\n }} <a%>b> !x\\\ny\nAbc Abc\n";
+  struct buffer *toy = filetype_buffer("toy", text);
+  // A match for ^ only at the start of a line.
+  assert_token(toy, text, "Abc", SYNTAX_TOKEN_TYPE, "Abc");
+  assert_token(toy, text, "Abc Abc", SYNTAX_TOKEN_TYPE, "Abc");
+  assert_token(toy, text, "Abc\n", SYNTAX_TOKEN_IDENTIFIER, "Abc");
+  // Regions can span lines, skip escaped ends, and run to the end of a line.
+  assert_token(toy, text, "do", SYNTAX_TOKEN_STATEMENT, "do");
+  assert_token(toy, text, "{{", SYNTAX_TOKEN_COMMENT, "{{ x");
+  assert_token(toy, text, " }}", SYNTAX_TOKEN_COMMENT, " }}");
+  assert_token(toy, text, "<", SYNTAX_TOKEN_LITERAL_STRING, "<a%>b>");
+  assert_token(toy, text, "!", SYNTAX_TOKEN_PREPROC, "!x\\");
+  assert_token(toy, text, "y\n", SYNTAX_TOKEN_PREPROC, "y");
+  buffer_free(toy);
+}
+
+void test_syntax__multiline(void) {
+  char *text =
+      "#define X /* a\n"
+      "   b */ Y\n"
+      "char *s = \"a\\\n"
+      "b\" + \"c\n"
+      "int x;\n";
+  struct buffer *c = c_buffer(buf_from_cstr(text));
+  assert_token(c, text, "/*", SYNTAX_TOKEN_COMMENT, "/* a");
+  assert_token(c, text, "   b */", SYNTAX_TOKEN_COMMENT, "   b */");
+  // The directive goes on after the comment.
+  assert_token(c, text, "Y\n", SYNTAX_TOKEN_PREPROC, "Y");
+  // A string goes on to the next line after a backslash, but not otherwise.
+  assert_token(c, text, "\"a", SYNTAX_TOKEN_LITERAL_STRING, "\"a\\");
+  assert_token(c, text, "b\"", SYNTAX_TOKEN_LITERAL_STRING, "b\"");
+  assert_token(c, text, "\"c", SYNTAX_TOKEN_LITERAL_STRING, "\"c");
+  assert_token(c, text, "int", SYNTAX_TOKEN_TYPE, "int");
+
+  // The end of a comment split by the gap is still found.
+  gb_mvgap(c->text, (size_t) (strstr(text, "*/") - text) + 1);
+  assert_token(c, text, "   b */", SYNTAX_TOKEN_COMMENT, "   b */");
+  buffer_free(c);
+
+  // A comment that never ends still has checkpoints all through it, so
+  // tokenizing near the end doesn't start over from the top.
+  struct buf *comment = buf_from_cstr("/*\n");
+  while (comment->len < 1 << 16) {
+    buf_append(comment, "int x; // a * b\n");
+  }
+  c = c_buffer(comment);
+  cl_assert_equal_i(kind_at(c, gb_size(c->text) - 3), SYNTAX_TOKEN_COMMENT);
+  cl_assert(syntax_checkpoints_count(c) > 4);
+  buffer_free(c);
+}
+
+void test_syntax__checkpoints(void) {
+  cl_assert_equal_i(syntax_checkpoints_count(buffer), 0);
+  size_t end = gb_size(buffer->text) - 3;
+  cl_assert_equal_i(kind_at(buffer, end), SYNTAX_TOKEN_PUNCTUATION);
+  cl_assert(syntax_checkpoints_count(buffer) > 4);
+  // Picking up from the checkpoints gives the same tokens.
+  assert_same_tokens();
+}
+
+void test_syntax__edits(void) {
+  size_t end = gb_size(buffer->text) - 3;
+  kind_at(buffer, end);
+  size_t count = syntax_checkpoints_count(buffer);
+
+  // A comment opened near the bottom only drops the last checkpoints.
+  size_t pos = gb_size(buffer->text) * 3 / 4;
+  buffer_do_insert(buffer, buf_from_cstr("/*"), pos);
+  buffer_do_insert(reference, buf_from_cstr("/*"), pos);
+  size_t kept = syntax_checkpoints_count(buffer);
+  cl_assert(kept < count && kept > count / 2);
+  cl_assert_equal_i(kind_at(buffer, pos + 2), SYNTAX_TOKEN_COMMENT);
+  assert_same_tokens();
+
+  buffer_do_delete(buffer, 2, pos);
+  buffer_do_delete(reference, 2, pos);
+  cl_assert_equal_i(kind_at(buffer, end), SYNTAX_TOKEN_PUNCTUATION);
+  assert_same_tokens();
+}
+
+// Checks the cached runs on every few lines against the reference.
+static void assert_same_lines(void) {
+  struct syntax syntax;
+  cl_assert(syntax_init(&syntax, reference));
+  struct syntax_token token;
+  struct gapbuf *gb = buffer->text;
+  size_t pos = 0;
+  for (size_t i = 0; i < gb_nlines(gb); ++i) {
+    size_t len = gb->lines->buf[i];
+    if (i % 13 == 0) {
+      struct syntax_line *line = buffer_syntax_line(buffer, i, NULL);
+      size_t run_pos = pos;
+      for (size_t r = 0; r < line->nruns; ++r) {
+        syntax_token_at(&syntax, &token, run_pos);
+        cl_assert_equal_i(SYNTAX_RUN_KIND(line->runs[r]), token.kind);
+        run_pos += SYNTAX_RUN_LEN(line->runs[r]);
+      }
+      cl_assert_equal_i(run_pos, pos + len);
+    }
+    pos += len + 1;
+  }
+  syntax_deinit(&syntax);
+}
+
+void test_syntax__cache(void) {
+  struct syntax_line *first = buffer_syntax_line(buffer, 0, NULL);
+  cl_assert_equal_i(first->nruns, 3);
+  cl_assert_equal_i(SYNTAX_RUN_KIND(first->runs[0]), SYNTAX_TOKEN_PREPROC);
+  cl_assert_equal_i(SYNTAX_RUN_LEN(first->runs[0]), strlen("#include"));
+  cl_assert_equal_i(SYNTAX_RUN_KIND(first->runs[2]), SYNTAX_TOKEN_LITERAL_STRING);
+  assert_same_lines();
+
+  free(buffer->opt.filetype);
+  buffer->opt.filetype = xstrdup("");
+  cl_assert(!buffer_syntax_line(buffer, 0, NULL));
+}
+
+void test_syntax__cache_edits(void) {
+  size_t nlines = gb_nlines(buffer->text);
+  buffer_syntax_line(buffer, nlines - 1, NULL);
+  uint32_t *runs[8];
+  for (size_t i = 0; i < 8; ++i) {
+    runs[i] = buffer_syntax_line(buffer, i, NULL)->runs;
+  }
+
+  // Opening a comment at the start of line 3 runs into the one closed on
+  // line 6; the lines after that are left alone.
+  size_t pos = gb_linecol_to_pos(buffer->text, 3, 0);
+  buffer_do_insert(buffer, buf_from_cstr("/*"), pos);
+  buffer_do_insert(reference, buf_from_cstr("/*"), pos);
+  cl_assert_equal_i(
+      SYNTAX_RUN_KIND(buffer_syntax_line(buffer, 4, NULL)->runs[0]),
+      SYNTAX_TOKEN_COMMENT);
+  for (size_t i = 0; i < 8; ++i) {
+    struct syntax_line *line = buffer_syntax_line(buffer, i, NULL);
+    if (i < 3 || i > 6) {
+      cl_assert(line->runs == runs[i]);
+    }
+  }
+  assert_same_lines();
+
+  // Splitting and joining lines keeps the rest of the cache in step.
+  pos = gb_linecol_to_pos(buffer->text, 10, 4);
+  buffer_do_insert(buffer, buf_from_cstr("\n\nx\n"), pos);
+  buffer_do_insert(reference, buf_from_cstr("\n\nx\n"), pos);
+  assert_same_lines();
+  buffer_do_delete(buffer, 8, pos - 2);
+  buffer_do_delete(reference, 8, pos - 2);
+  cl_assert_equal_i(gb_nlines(buffer->text), nlines);
+  assert_same_lines();
+}
+
+// Tokenizes the lines asked for in the background, until it's done.
+static void wait_for_syntax(struct buffer *buffer, struct pool *pool) {
+  do {
+    sched_yield();
+    buffer_syntax_update(buffer, pool);
+  } while (buffer_syntax_pending(buffer));
+}
+
+static struct buf *big_text(char *line) {
+  struct buf *text = buf_create(1 << 22);
+  while (text->len < 2 << 20) {
+    buf_append(text, line);
+  }
+  return text;
+}
+
+// Checks the cached runs on lines [from, to) against tokenizing the same
+// text from the top.
+static void assert_same_runs(
+    struct buffer *big, struct buffer *ref, size_t from, size_t to) {
+  struct syntax syntax;
+  cl_assert(syntax_init(&syntax, ref));
+  struct syntax_token token;
+  size_t pos = gb_linecol_to_pos(ref->text, from, 0);
+  for (size_t i = from; i < to; ++i) {
+    struct syntax_line *line = buffer_syntax_line(big, i, NULL);
+    cl_assert(line);
+    for (size_t r = 0; r < line->nruns; ++r) {
+      syntax_token_at(&syntax, &token, pos);
+      cl_assert_equal_i(SYNTAX_RUN_KIND(line->runs[r]), token.kind);
+      pos += SYNTAX_RUN_LEN(line->runs[r]);
+    }
+    cl_assert_equal_i(gb_getchar(ref->text, pos), '\n');
+    pos++;
+  }
+  syntax_deinit(&syntax);
+}
+
+void test_syntax__background(void) {
+  struct pool *pool = pool_create();
+  struct buf *text = big_text(
+      "#include <stdio.h>\n/* a comment\n   int x; */\n"
+      "static int f(void) { return \"x\\\"y\" ? 1 : 0; }\n");
+  struct buffer *big = c_buffer(buf_copy(text));
+  struct buffer *ref = c_buffer(text);
+  size_t nlines = gb_nlines(big->text);
+
+  // Nothing is tokenized while drawing.
+  cl_assert(!buffer_syntax_line(big, 0, NULL));
+  cl_assert(buffer_syntax_pending(big));
+  wait_for_syntax(big, pool);
+  assert_same_runs(big, ref, 0, 200);
+  // The lines around the ones drawn come along too.
+  cl_assert(buffer_syntax_line(big, 900, NULL));
+  cl_assert(!buffer_syntax_line(big, nlines - 1, NULL));
+
+  // The checkpoints are kept, so that the next job starts near the lines it
+  // tokenizes.
+  wait_for_syntax(big, pool);
+  cl_assert(syntax_checkpoints_count(big) > 2);
+  assert_same_runs(big, ref, nlines - 50, nlines);
+
+  buffer_free(big);
+  buffer_free(ref);
+  pool_free(pool);
+}
+
+void test_syntax__background_stops_early(void) {
+  struct pool *pool = pool_create();
+  struct buf *text = big_text("int x = 1; // x\n");
+  struct buffer *big = c_buffer(buf_copy(text));
+  struct buffer *ref = c_buffer(text);
+  size_t nlines = gb_nlines(big->text);
+  buffer_syntax_line(big, nlines - 1, NULL);
+  wait_for_syntax(big, pool);
+
+  // An edit that leaves the next line starting in the same state only needs
+  // its own line tokenized again, not everything down to the last one asked
+  // for.
+  buffer_do_insert(big, buf_from_cstr("y"), 4);
+  buffer_do_insert(ref, buf_from_cstr("y"), 4);
+  buffer_syntax_line(big, nlines - 1, NULL);
+  size_t jobs = 0;
+  do {
+    sched_yield();
+    jobs += buffer_syntax_update(big, pool);
+  } while (buffer_syntax_pending(big));
+  cl_assert_equal_i(jobs, 1);
+  assert_same_runs(big, ref, 0, 10);
+  assert_same_runs(big, ref, nlines - 10, nlines);
+
+  buffer_free(big);
+  buffer_free(ref);
+  pool_free(pool);
+}
+
+void test_syntax__background_edits(void) {
+  struct pool *pool = pool_create();
+  struct buffer *big = c_buffer(big_text("int x = 1; // x\n"));
+  buffer_syntax_line(big, 0, NULL);
+  wait_for_syntax(big, pool);
+
+  // An edit leaves the line it's on plain until it's tokenized again. The
+  // lines after it keep their old tokens in the meantime, even though this
+  // turns the rest of the buffer into one huge comment.
+  buffer_do_insert(big, buf_from_cstr("/*"), 0);
+  cl_assert(!buffer_syntax_line(big, 0, NULL));
+  struct syntax_line *line = buffer_syntax_line(big, 3, NULL);
+  cl_assert(line);
+  cl_assert(SYNTAX_RUN_KIND(line->runs[0]) != SYNTAX_TOKEN_COMMENT);
+
+  // Another edit cancels the job in progress.
+  buffer_syntax_update(big, pool);
+  buffer_do_insert(big, buf_from_cstr("x"), 2);
+  wait_for_syntax(big, pool);
+  for (size_t i = 0; i < 1000; ++i) {
+    line = buffer_syntax_line(big, i, NULL);
+    cl_assert_equal_i(line->nruns, 1);
+    cl_assert_equal_i(SYNTAX_RUN_KIND(line->runs[0]), SYNTAX_TOKEN_COMMENT);
+  }
+
+  buffer_free(big);
+  pool_free(pool);
+}
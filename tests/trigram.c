@@ -0,0 +1,162 @@
+#include "clar.h"
+#include "trigram.h"
+
+#include <sched.h>
+#include <string.h>
+
+#include <termbox.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "search_count.h"
+#include "util.h"
+#include "window.h"
+
+#include "asserts.h"
+
+static struct editor *editor = NULL;
+static struct buffer *buffer = NULL;
+// Where "needle" was put in the middle of the text.
+static size_t needle;
+
+static char *type(const char *keys) {
+  editor_send_keys(editor, keys);
+  return editor->status->buf;
+}
+
+static void wait_for_index(void) {
+  do {
+    sched_yield();
+    editor_update_trigram_indexes(editor);
+  } while (editor_trigram_indexing(editor));
+}
+
+void test_trigram__initialize(void) {
+  tb_init();
+  editor = editor_create(tb_width(), tb_height());
+  buffer = editor->window->buffer;
+
+  struct buf *text = buf_create(1 << 22);
+  while (text->len < 3 << 20) {
+    buf_append(text, "foo bar baz quux\n");
+  }
+  needle = text->len / 2;
+  needle -= needle % strlen("foo bar baz quux\n");
+  memcpy(text->buf + needle, "needle", strlen("needle"));
+  buffer_do_insert(buffer, text, 0);
+
+  type(":set trigramindex<cr>");
+  wait_for_index();
+}
+
+void test_trigram__cleanup(void) {
+  editor_free(editor);
+}
+
+static void assert_one_candidate(char *pattern, bool ignore_case) {
+  struct regionbuf *ranges = buffer_search_candidates(
+      buffer, pattern, ignore_case);
+  cl_assert(ranges);
+  cl_assert_equal_i(ranges->len, 1);
+  struct region range = ranges->buf[0];
+  regionbuf_free(ranges);
+  cl_assert(range.start <= needle && needle < range.end);
+  cl_assert(range.end - range.start < gb_size(buffer->text) / 4);
+}
+
+void test_trigram__candidates(void) {
+  cl_assert(buffer->trigrams->nchunks > 4);
+  assert_one_candidate("needle", false);
+  assert_one_candidate("NEEDLE", true);
+  assert_one_candidate("[[:<:]]needle[[:>:]]", false);
+  assert_one_candidate("ne+dle", false);
+  assert_one_candidate("^needle\\w+ baz", false);
+  assert_one_candidate("(x|y)?needle", false);
+
+  struct regionbuf *none = buffer_search_candidates(buffer, "nope!", false);
+  cl_assert(none);
+  cl_assert_equal_i(none->len, 0);
+  regionbuf_free(none);
+
+  // Nothing the index can use.
+  cl_assert(!buffer_search_candidates(buffer, "foo", false));
+  cl_assert(!buffer_search_candidates(buffer, "ne", false));
+  cl_assert(!buffer_search_candidates(buffer, "needle|x", false));
+  cl_assert(!buffer_search_candidates(buffer, "needle\\s", false));
+  cl_assert(!buffer_search_candidates(buffer, "needle[^x]", false));
+  cl_assert(!buffer_search_candidates(buffer, "n(?s)eedle", false));
+}
+
+void test_trigram__search(void) {
+  type("/needle<cr>");
+  cl_assert_equal_i(window_cursor(editor->window), needle);
+  type("n");
+  cl_assert_equal_s(editor->status->buf, "search hit BOTTOM, continuing at TOP");
+  cl_assert_equal_i(window_cursor(editor->window), needle);
+  cl_assert_equal_s(type("/nope!<cr>"), "Pattern not found: \"nope!\"");
+}
+
+void test_trigram__edits(void) {
+  // Until it's indexed again, the edited chunk has to be searched.
+  type("ggineedle <esc>");
+  struct regionbuf *ranges = buffer_search_candidates(buffer, "needle", false);
+  cl_assert_equal_i(ranges->len, 2);
+  cl_assert_equal_i(ranges->buf[0].start, 0);
+  regionbuf_free(ranges);
+  type("G/needle<cr>");
+  assert_cursor_at(0, 0);
+
+  // Joining the lines at a chunk boundary merges the chunks.
+  size_t nchunks = buffer->trigrams->nchunks;
+  size_t boundary = buffer->trigrams->chunks[0].len;
+  buffer_do_delete(buffer, 1, boundary - 1);
+  cl_assert_equal_i(buffer->trigrams->nchunks, nchunks - 1);
+
+  wait_for_index();
+  cl_assert(buffer->trigrams->chunks[0].bits);
+  ranges = buffer_search_candidates(buffer, "needle", false);
+  cl_assert_equal_i(ranges->len, 2);
+  regionbuf_free(ranges);
+
+  size_t size = 0;
+  for (size_t i = 0; i < buffer->trigrams->nchunks; ++i) {
+    size += buffer->trigrams->chunks[i].len;
+  }
+  cl_assert_equal_i(size, gb_size(buffer->text));
+}
+
+void test_trigram__edits_find_their_chunk(void) {
+  struct trigram_index *index = buffer->trigrams;
+  size_t start = 0;
+  for (size_t i = 0; i < index->nchunks; ++i) {
+    size_t len = index->chunks[i].len;
+    cl_assert(index->chunks[i].bits);
+    // Each edit goes in the chunk it's in, and not the one before.
+    buffer_do_insert(buffer, buf_from_cstr("x"), start);
+    cl_assert_equal_i(index->chunks[i].len, len + 1);
+    cl_assert(!index->chunks[i].bits);
+    buffer_do_delete(buffer, 1, start);
+    cl_assert_equal_i(index->chunks[i].len, len);
+    start += len;
+  }
+  cl_assert_equal_i(start, gb_size(buffer->text));
+}
+
+void test_trigram__count(void) {
+  type("gg/needle<cr>");
+  while (!editor->search_count.ready) {
+    sched_yield();
+    editor_update_search_count(editor);
+  }
+  cl_assert_equal_i(editor->search_count.current, 1);
+  cl_assert_equal_i(editor->search_count.total, 1);
+}
+
+void test_trigram__unset(void) {
+  type(":set notrigramindex<cr>");
+  editor_update_trigram_indexes(editor);
+  cl_assert(!buffer->trigrams);
+  cl_assert(!buffer_search_candidates(buffer, "needle", false));
+}
@@ -0,0 +1,97 @@
+#include "clar.h"
+#include "utf8.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "gap.h"
+
+static struct buffer *buffer = NULL;
+
+void test_utf8__initialize(void) {
+  buffer = buffer_create(NULL);
+}
+
+void test_utf8__cleanup(void) {
+  buffer_free(buffer);
+}
+
+static bool valid(char *s) {
+  return utf8_valid((unsigned char*) s, strlen(s));
+}
+
+void test_utf8__valid(void) {
+  cl_assert(valid(""));
+  cl_assert(valid("hello, world"));
+  cl_assert(valid("caf\xc3\xa9"));
+  cl_assert(valid("\xe2\x82\xac 100"));
+  cl_assert(valid("0123456789 \xf0\x9f\x98\x80"));
+  cl_assert(valid("\xef\xbf\xbf \xf4\x8f\xbf\xbf"));
+
+  cl_assert(!valid("caf\xe9"));
+  cl_assert(!valid("\x80"));
+  cl_assert(!valid("0123456789 \xc3"));
+  cl_assert(!valid("\xe2\x82"));
+  cl_assert(!valid("\xe2\x28\xa1"));
+  // Overlong forms, a surrogate and a code point past U+10FFFF.
+  cl_assert(!valid("\xc0\xaf"));
+  cl_assert(!valid("\xe0\x80\xaf"));
+  cl_assert(!valid("\xed\xa0\x80"));
+  cl_assert(!valid("\xf4\x90\x80\x80"));
+}
+
+void test_utf8__width(void) {
+  cl_assert_equal_i(1, utf8_width('a'));
+  cl_assert_equal_i(1, utf8_width(0xe9));
+  cl_assert_equal_i(1, utf8_width(0x20ac));
+  cl_assert_equal_i(2, utf8_width(0x4e2d));
+  cl_assert_equal_i(2, utf8_width(0xac00));
+  cl_assert_equal_i(2, utf8_width(0xff21));
+  cl_assert_equal_i(2, utf8_width(0x1f600));
+  cl_assert_equal_i(1, utf8_width(0x1f650));
+}
+
+void test_utf8__buffer(void) {
+  buffer_do_insert(buffer, buf_from_cstr("caf\xc3\xa9\nbar"), 0);
+  cl_assert(buffer_is_utf8(buffer));
+
+  buffer_do_insert(buffer, buf_from_cstr("\xc3"), 7);
+  cl_assert(!buffer_is_utf8(buffer));
+  buffer_do_insert(buffer, buf_from_cstr("\xa0"), 8);
+  cl_assert(buffer_is_utf8(buffer));
+  // Splitting a character in two.
+  buffer_do_delete(buffer, 1, 4);
+  cl_assert(!buffer_is_utf8(buffer));
+  buffer_do_delete(buffer, 6, 0);
+  cl_assert(buffer_is_utf8(buffer));
+}
+
+void test_utf8__chunks(void) {
+  struct buf *text = buf_create(1 << 21);
+  while (text->len < 1 << 21) {
+    buf_append(text, "\xc3\xa9t\xc3\xa9\n");
+  }
+  buffer_do_insert(buffer, text, 0);
+  cl_assert(buffer_is_utf8(buffer));
+  struct utf8_index *index = buffer->utf8;
+  size_t nchunks = index->nchunks;
+  cl_assert(nchunks > 4);
+
+  // Only the chunk that was edited is checked again.
+  buffer_do_insert(buffer, buf_from_cstr("\xff"), gb_size(buffer->text) / 2);
+  size_t unchecked = 0;
+  for (size_t i = 0; i < index->nchunks; ++i) {
+    unchecked += index->chunks[i].state == UTF8_UNCHECKED;
+  }
+  cl_assert_equal_i(unchecked, 1);
+  cl_assert(!buffer_is_utf8(buffer));
+  cl_assert_equal_i(index->nchunks, nchunks);
+
+  size_t size = 0;
+  for (size_t i = 0; i < index->nchunks; ++i) {
+    size += index->chunks[i].len;
+  }
+  cl_assert_equal_i(size, gb_size(buffer->text));
+}
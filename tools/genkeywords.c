@@ -0,0 +1,144 @@
+// Generates the keyword table for a tokenizer from a file of lines like
+//
+//   KIND word word ...
+//
+// where KIND names a SYNTAX_TOKEN_* kind. Blank lines and lines starting with
+// "//" are skipped. The table is a perfect hash table (see keywords.h) written
+// out as a C header, with the given name:
+//
+//   genkeywords c < syntax/c.keywords > c_keywords.h
+//
+// defines c_keywords, C_KEYWORDS_SEED, C_KEYWORDS_MASK and
+// C_KEYWORDS_MAX_LEN.
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "keywords.h"
+
+#define MAX_WORDS 1024
+#define MAX_SEED (1 << 16)
+
+static struct {
+  char *word;
+  char *kind;
+} words[MAX_WORDS];
+static size_t nwords = 0;
+
+static void die(const char *message, const char *arg) {
+  fprintf(stderr, "genkeywords: %s%s\n", message, arg);
+  exit(1);
+}
+
+static char *copy(const char *s) {
+  char *result = malloc(strlen(s) + 1);
+  if (!result) {
+    die("out of memory", "");
+  }
+  return strcpy(result, s);
+}
+
+static void read_words(FILE *fp) {
+  char line[1024];
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, "//", 2)) {
+      continue;
+    }
+    char *kind = strtok(line, " \t\n");
+    if (!kind) {
+      continue;
+    }
+    kind = copy(kind);
+    char *word;
+    while ((word = strtok(NULL, " \t\n"))) {
+      for (size_t i = 0; i < nwords; ++i) {
+        if (!strcmp(words[i].word, word)) {
+          die("duplicate keyword: ", word);
+        }
+      }
+      if (nwords == MAX_WORDS) {
+        die("too many keywords", "");
+      }
+      words[nwords].word = copy(word);
+      words[nwords].kind = kind;
+      nwords++;
+    }
+  }
+}
+
+// Whether the seed puts every word in a different slot of a table of the
+// given size (a power of two).
+static bool perfect(unsigned int seed, size_t size, bool *used) {
+  memset(used, 0, size * sizeof(*used));
+  for (size_t i = 0; i < nwords; ++i) {
+    size_t slot = keyword_hash(
+        words[i].word, strlen(words[i].word), seed) & (size - 1);
+    if (used[slot]) {
+      return false;
+    }
+    used[slot] = true;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    die("usage: genkeywords <name> < <file> > <header>", "");
+  }
+  char *name = argv[1];
+  char *upper = copy(name);
+  for (char *c = upper; *c; ++c) {
+    *c = (char) toupper((unsigned char) *c);
+  }
+
+  read_words(stdin);
+  if (!nwords) {
+    die("no keywords", "");
+  }
+
+  // Start with the table about twice as big as it has to be, and make it
+  // bigger until some seed works.
+  size_t size = 1;
+  while (size < 2 * nwords) {
+    size *= 2;
+  }
+  bool *used = NULL;
+  unsigned int seed;
+  for (;; size *= 2) {
+    used = realloc(used, size * sizeof(*used));
+    if (!used) {
+      die("out of memory", "");
+    }
+    for (seed = 0; seed < MAX_SEED; ++seed) {
+      if (perfect(seed, size, used)) {
+        break;
+      }
+    }
+    if (seed < MAX_SEED) {
+      break;
+    }
+  }
+
+  size_t max_len = 0;
+  for (size_t i = 0; i < nwords; ++i) {
+    size_t len = strlen(words[i].word);
+    max_len = len > max_len ? len : max_len;
+  }
+
+  printf("// Generated by tools/genkeywords.c. Do not edit.\n\n");
+  printf("#define %s_KEYWORDS_SEED %uu\n", upper, seed);
+  printf("#define %s_KEYWORDS_MASK %zuu\n", upper, size - 1);
+  printf("#define %s_KEYWORDS_MAX_LEN %zu\n\n", upper, max_len);
+  printf("static const struct keyword %s_keywords[%zu] = {\n", name, size);
+  for (size_t i = 0; i < nwords; ++i) {
+    size_t len = strlen(words[i].word);
+    size_t slot = keyword_hash(words[i].word, len, seed) & (size - 1);
+    printf("  [%zu] = {\"%s\", %zu, SYNTAX_TOKEN_%s},\n",
+        slot, words[i].word, len, words[i].kind);
+  }
+  printf("};\n");
+  return 0;
+}
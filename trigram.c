@@ -0,0 +1,677 @@
+#include "trigram.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "buffer.h"
+#include "editor.h"
+#include "gap.h"
+#include "pool.h"
+#include "util.h"
+
+// Chunks are cut at the first newline after this many bytes.
+#define TRIGRAM_CHUNK_SIZE (1 << 18)
+// Stale text is handed out to the pool in pieces of about this size, so that
+// indexing a whole buffer is spread over all the threads.
+#define TRIGRAM_PIECE_SIZE (1 << 24)
+// Trigrams are hashed down to this many bits. With 2^17 bits per chunk, the
+// bitmaps take up about 6% as much memory as the text, and a chunk of typical
+// source code sets around a fifth of the bits.
+#define TRIGRAM_HASH_BITS 17
+#define TRIGRAM_BITMAP_WORDS ((1 << TRIGRAM_HASH_BITS) / 64)
+
+static unsigned char trigram_fold(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? (unsigned char) (c - 'A' + 'a') : c;
+}
+
+static uint32_t trigram_hash(uint32_t trigram) {
+  return (trigram * 2654435761u) >> (32 - TRIGRAM_HASH_BITS);
+}
+
+static bool trigram_bit(uint64_t *bits, uint32_t hash) {
+  return bits[hash / 64] & ((uint64_t) 1 << (hash % 64));
+}
+
+// Returns the bitmap of the trigrams in s[0, n). Trigrams with a newline in
+// them are left out, since they're never looked up.
+static uint64_t *trigram_bitmap(unsigned char *s, size_t n) {
+  uint64_t *bits = xmalloc(TRIGRAM_BITMAP_WORDS * sizeof(*bits));
+  memset(bits, 0, TRIGRAM_BITMAP_WORDS * sizeof(*bits));
+  uint32_t trigram = 0;
+  size_t run = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (s[i] == '\n') {
+      run = 0;
+      continue;
+    }
+    trigram = ((trigram << 8) | trigram_fold(s[i])) & 0xffffff;
+    if (++run >= 3) {
+      uint32_t hash = trigram_hash(trigram);
+      bits[hash / 64] |= (uint64_t) 1 << (hash % 64);
+    }
+  }
+  return bits;
+}
+
+// Some stale text being indexed, read from a snapshot of the buffer's text.
+// The chunks it was read from are remembered by id; if any of them is edited
+// before the results are taken in, the results are thrown away. A long run
+// of stale chunks is cut up into several pieces, and only the first one has
+// the ids: the rest stand or fall with it.
+struct trigram_piece {
+  struct trigram_job *job;
+  size_t *ids;
+  size_t nids;
+  struct gb_snapshot *text;
+  size_t pos;
+  size_t len;
+
+  // The chunks the text was cut into.
+  struct trigram_chunk *chunks;
+  size_t nchunks;
+  size_t cap;
+};
+
+// The pieces are indexed on the editor's thread pool. The index only looks at
+// the results once pending drops to zero, and whoever lets go of the job last
+// frees it, so that dropping an index never has to wait for the threads.
+struct trigram_job {
+  struct trigram_piece *pieces;
+  size_t npieces;
+  size_t cap;
+
+  atomic_bool cancelled;
+  atomic_size_t pending;
+  // One reference for the index, and one for each piece not yet indexed.
+  atomic_size_t refs;
+};
+
+static void trigram_job_release(struct trigram_job *job) {
+  if (atomic_fetch_sub(&job->refs, 1) > 1) {
+    return;
+  }
+  for (size_t i = 0; i < job->npieces; ++i) {
+    struct trigram_piece *piece = &job->pieces[i];
+    free(piece->ids);
+    if (piece->text) {
+      gb_snapshot_free(piece->text);
+    }
+    for (size_t j = 0; j < piece->nchunks; ++j) {
+      free(piece->chunks[j].bits);
+    }
+    free(piece->chunks);
+  }
+  free(job->pieces);
+  free(job);
+}
+
+static void trigram_piece_add_chunk(
+    struct trigram_piece *piece, unsigned char *s, size_t len) {
+  if (piece->nchunks == piece->cap) {
+    piece->cap = max(4, piece->cap * 2);
+    piece->chunks = xrealloc(
+        piece->chunks, piece->cap * sizeof(*piece->chunks));
+  }
+  struct trigram_chunk *chunk = &piece->chunks[piece->nchunks++];
+  chunk->len = len;
+  chunk->bits = trigram_bitmap(s, len);
+  chunk->id = 0;
+}
+
+static void trigram_piece_run(void *arg) {
+  struct trigram_piece *piece = arg;
+  struct trigram_job *job = piece->job;
+
+  // The piece is usually all on one side of the gap. If not, it's copied
+  // here rather than by the editor.
+  size_t len = piece->len;
+  size_t n;
+  unsigned char *text =
+      (unsigned char*) gb_snapshot_span(piece->text, piece->pos, &n);
+  unsigned char *copy = NULL;
+  if (n < len) {
+    copy = xmalloc(len + 1);
+    gb_snapshot_getstring_into(piece->text, piece->pos, len, (char*) copy);
+    text = copy;
+  }
+  size_t start = 0;
+  while (start < len && !atomic_load(&job->cancelled)) {
+    size_t end = min(start + TRIGRAM_CHUNK_SIZE, len);
+    if (end < len) {
+      unsigned char *nl = memchr(text + end - 1, '\n', len - end + 1);
+      end = nl ? (size_t) (nl - text) + 1 : len;
+    }
+    trigram_piece_add_chunk(piece, text + start, end - start);
+    start = end;
+  }
+  free(copy);
+  gb_snapshot_free(piece->text);
+  piece->text = NULL;
+
+  atomic_fetch_sub(&job->pending, 1);
+  trigram_job_release(job);
+}
+
+static struct trigram_piece *trigram_job_add_piece(
+    struct trigram_job *job, struct gapbuf *gb, size_t pos, size_t len) {
+  if (job->npieces == job->cap) {
+    job->cap = max(4, job->cap * 2);
+    job->pieces = xrealloc(job->pieces, job->cap * sizeof(*job->pieces));
+  }
+  struct trigram_piece *piece = &job->pieces[job->npieces++];
+  memset(piece, 0, sizeof(*piece));
+  piece->text = gb_snapshot(gb);
+  piece->pos = pos;
+  piece->len = len;
+  return piece;
+}
+
+static void trigram_chunk_touch(
+    struct trigram_index *index, struct trigram_chunk *chunk) {
+  free(chunk->bits);
+  chunk->bits = NULL;
+  chunk->id = index->next_id++;
+}
+
+static void trigram_sums_build(struct trigram_index *index) {
+  index->sums = xrealloc(index->sums, (index->cap + 1) * sizeof(*index->sums));
+  size_t n = index->nchunks;
+  for (size_t i = 1; i <= n; ++i) {
+    index->sums[i] = index->chunks[i - 1].len;
+  }
+  for (size_t i = 1; i <= n; ++i) {
+    size_t parent = i + (i & -i);
+    if (parent <= n) {
+      index->sums[parent] += index->sums[i];
+    }
+  }
+}
+
+// Adds delta (which may have wrapped around, to take away) to the length of
+// chunk i.
+static void trigram_sums_add(
+    struct trigram_index *index, size_t i, size_t delta) {
+  index->chunks[i].len += delta;
+  for (size_t k = i + 1; k <= index->nchunks; k += k & -k) {
+    index->sums[k] += delta;
+  }
+}
+
+// Returns the index of the chunk containing pos (or of the last chunk, if pos
+// is the end of the text), and sets *start to where the chunk starts.
+static size_t trigram_index_find(
+    struct trigram_index *index, size_t pos, size_t *start) {
+  if (!index->nchunks) {
+    index->chunks[0].len = 0;
+    index->chunks[0].bits = NULL;
+    trigram_chunk_touch(index, &index->chunks[0]);
+    index->nchunks = 1;
+    trigram_sums_build(index);
+  }
+
+  // Find the most chunks whose lengths add up to no more than pos.
+  size_t n = index->nchunks;
+  size_t step = 1;
+  while (step * 2 <= n) {
+    step *= 2;
+  }
+  size_t i = 0;
+  *start = 0;
+  for (; step; step /= 2) {
+    if (i + step <= n && *start + index->sums[i + step] <= pos) {
+      i += step;
+      *start += index->sums[i];
+    }
+  }
+  if (i == n) {
+    i = n - 1;
+    *start -= index->chunks[i].len;
+  }
+  return i;
+}
+
+static void trigram_index_inserted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct trigram_index *index = (struct trigram_index*) listener;
+  size_t start;
+  size_t i = trigram_index_find(index, pos, &start);
+  trigram_sums_add(index, i, n);
+  trigram_chunk_touch(index, &index->chunks[i]);
+}
+
+// The chunks from the one holding the first deleted character to the one
+// holding the character after the last are merged, since a chunk must end
+// with a newline, and the deleted newline may have been the end of one.
+static void trigram_index_deleted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct trigram_index *index = (struct trigram_index*) listener;
+  size_t start;
+  size_t i = trigram_index_find(index, pos, &start);
+  size_t j = i;
+  size_t len = index->chunks[i].len;
+  while (start + len <= pos + n && j + 1 < index->nchunks) {
+    len += index->chunks[++j].len;
+    free(index->chunks[j].bits);
+  }
+
+  trigram_chunk_touch(index, &index->chunks[i]);
+  if (j == i) {
+    trigram_sums_add(index, i, -n);
+    return;
+  }
+  index->chunks[i].len = len - n;
+  memmove(&index->chunks[i + 1], &index->chunks[j + 1],
+      (index->nchunks - j - 1) * sizeof(*index->chunks));
+  index->nchunks -= j - i;
+  trigram_sums_build(index);
+}
+
+struct trigram_index *trigram_index_create(struct buffer *buffer) {
+  struct trigram_index *index = xmalloc(sizeof(*index));
+  index->buffer = buffer;
+  index->listener.inserted = trigram_index_inserted;
+  index->listener.deleted = trigram_index_deleted;
+  buffer_add_listener(buffer, &index->listener);
+
+  index->cap = 16;
+  index->chunks = xmalloc(index->cap * sizeof(*index->chunks));
+  index->nchunks = 1;
+  index->next_id = 0;
+  index->chunks[0].len = gb_size(buffer->text);
+  index->chunks[0].bits = NULL;
+  trigram_chunk_touch(index, &index->chunks[0]);
+  index->sums = NULL;
+  trigram_sums_build(index);
+  index->job = NULL;
+  return index;
+}
+
+static void trigram_index_cancel(struct trigram_index *index) {
+  if (index->job) {
+    atomic_store(&index->job->cancelled, true);
+    trigram_job_release(index->job);
+    index->job = NULL;
+  }
+}
+
+void trigram_index_free(struct trigram_index *index) {
+  trigram_index_cancel(index);
+  buffer_remove_listener(index->buffer, &index->listener);
+  for (size_t i = 0; i < index->nchunks; ++i) {
+    free(index->chunks[i].bits);
+  }
+  free(index->chunks);
+  free(index->sums);
+  free(index);
+}
+
+static void trigram_index_start(
+    struct trigram_index *index, struct pool *pool) {
+  struct gapbuf *gb = index->buffer->text;
+  struct trigram_job *job = NULL;
+
+  size_t pos = 0;
+  for (size_t i = 0; i < index->nchunks;) {
+    if (index->chunks[i].bits) {
+      pos += index->chunks[i++].len;
+      continue;
+    }
+
+    size_t j = i;
+    size_t end = pos;
+    while (j < index->nchunks && !index->chunks[j].bits) {
+      end += index->chunks[j++].len;
+    }
+
+    if (!job) {
+      job = xmalloc(sizeof(*job));
+      memset(job, 0, sizeof(*job));
+      atomic_init(&job->cancelled, false);
+    }
+
+    bool first = true;
+    do {
+      size_t cut = end;
+      if (end - pos > TRIGRAM_PIECE_SIZE) {
+        cut = pos + TRIGRAM_PIECE_SIZE;
+        while (cut < end && gb_getchar(gb, cut - 1) != '\n') {
+          cut++;
+        }
+      }
+      struct trigram_piece *piece =
+          trigram_job_add_piece(job, gb, pos, cut - pos);
+      if (first) {
+        piece->nids = j - i;
+        piece->ids = xmalloc(piece->nids * sizeof(*piece->ids));
+        for (size_t k = i; k < j; ++k) {
+          piece->ids[k - i] = index->chunks[k].id;
+        }
+        first = false;
+      }
+      pos = cut;
+    } while (pos < end);
+    i = j;
+  }
+
+  if (!job) {
+    return;
+  }
+  atomic_init(&job->pending, job->npieces);
+  atomic_init(&job->refs, job->npieces + 1);
+  for (size_t i = 0; i < job->npieces; ++i) {
+    job->pieces[i].job = job;
+    pool_submit(pool, trigram_piece_run, &job->pieces[i]);
+  }
+  index->job = job;
+}
+
+// Swaps the indexed pieces in for the stale chunks they were copied from,
+// unless those have changed since.
+static void trigram_index_take_results(
+    struct trigram_index *index, struct trigram_job *job) {
+  size_t cap = max(1, index->nchunks);
+  for (size_t i = 0; i < job->npieces; ++i) {
+    cap += job->pieces[i].nchunks;
+  }
+  struct trigram_chunk *chunks = xmalloc(cap * sizeof(*chunks));
+  size_t nchunks = 0;
+
+  size_t next = 0;
+  bool valid = false;
+  for (size_t i = 0; i < job->npieces; ++i) {
+    struct trigram_piece *piece = &job->pieces[i];
+    if (piece->nids) {
+      size_t first = next;
+      while (first < index->nchunks &&
+             index->chunks[first].id != piece->ids[0]) {
+        first++;
+      }
+      valid = first + piece->nids <= index->nchunks;
+      for (size_t k = 0; valid && k < piece->nids; ++k) {
+        valid = index->chunks[first + k].id == piece->ids[k];
+      }
+      if (!valid) {
+        continue;
+      }
+
+      memcpy(chunks + nchunks, index->chunks + next,
+          (first - next) * sizeof(*chunks));
+      nchunks += first - next;
+      next = first + piece->nids;
+    }
+    if (!valid) {
+      continue;
+    }
+
+    for (size_t k = 0; k < piece->nchunks; ++k) {
+      chunks[nchunks] = piece->chunks[k];
+      chunks[nchunks++].id = index->next_id++;
+    }
+    piece->nchunks = 0;
+  }
+  memcpy(chunks + nchunks, index->chunks + next,
+      (index->nchunks - next) * sizeof(*chunks));
+  nchunks += index->nchunks - next;
+
+  free(index->chunks);
+  index->chunks = chunks;
+  index->nchunks = nchunks;
+  index->cap = cap;
+  trigram_sums_build(index);
+  if (!index->nchunks) {
+    trigram_index_find(index, 0, &next);
+  }
+}
+
+void trigram_index_update(struct trigram_index *index, struct pool *pool) {
+  struct trigram_job *job = index->job;
+  if (job) {
+    if (atomic_load(&job->pending)) {
+      return;
+    }
+    trigram_index_take_results(index, job);
+    trigram_job_release(job);
+    index->job = NULL;
+  }
+  trigram_index_start(index, pool);
+}
+
+// Skips over the character class starting at p, returning NULL if it could
+// match a newline.
+static char *skip_class(char *p) {
+  p++;
+  if (*p == '^') {
+    return NULL;
+  }
+  if (*p == ']') {
+    p++;
+  }
+  while (*p != ']') {
+    if (!*p || *p == '\\' || *p == '\n') {
+      return NULL;
+    }
+    if (p[0] == '[' && p[1] == ':') {
+      char *end = strstr(p, ":]");
+      if (!end || p[2] == '^' || !strncmp(p, "[:space:]", 9) ||
+          !strncmp(p, "[:cntrl:]", 9)) {
+        return NULL;
+      }
+      p = end + 2;
+      continue;
+    }
+    p++;
+  }
+  return p + 1;
+}
+
+// A {n}, {n,} or {n,m} quantifier, as opposed to a literal {.
+static char *skip_quantifier(char *p) {
+  char *q = p + 1;
+  while (isdigit((unsigned char) *q) || *q == ',') {
+    q++;
+  }
+  return q > p + 1 && *q == '}' ? q + 1 : NULL;
+}
+
+// Finds the runs of literal characters that every match of the pattern must
+// contain, appending each run (case-folded, and if at least three characters
+// long) to runs followed by a newline. Returns false if a match could span
+// lines: since a chunk can only be ruled out if a match would have to lie
+// entirely within it, the index is no use then. This errs on the side of
+// giving up on anything unusual.
+static bool pattern_literal_runs(
+    char *pattern, bool ignore_case, struct buf *runs) {
+  size_t run_start = runs->len;
+  bool last_literal = false;
+  int depth = 0;
+
+#define END_RUN() do { \
+  if (runs->len - run_start < 3) { \
+    runs->len = run_start; \
+  } else { \
+    buf_append_char(runs, '\n'); \
+    run_start = runs->len; \
+  } \
+  last_literal = false; \
+} while (0)
+
+  char *p = pattern;
+  while (*p) {
+    unsigned char c = (unsigned char) *p;
+    char *q;
+    switch (c) {
+    case '\\':
+      c = (unsigned char) p[1];
+      if (!c) {
+        return false;
+      }
+      p += 2;
+      if (isalnum(c)) {
+        // Word and digit classes and assertions are fine; anything else
+        // (\s, \n, \x0a, backreferences...) might match a newline.
+        if (!strchr("wdbBAzZG", c)) {
+          return false;
+        }
+        END_RUN();
+        continue;
+      }
+      break;
+    case '[':
+      p = skip_class(p);
+      if (!p) {
+        return false;
+      }
+      END_RUN();
+      continue;
+    case '(':
+      // Inline options like (?s) and lookarounds aren't worth the trouble.
+      if (p[1] == '?') {
+        return false;
+      }
+      depth++;
+      p++;
+      END_RUN();
+      continue;
+    case ')':
+      depth--;
+      p++;
+      END_RUN();
+      continue;
+    case '|':
+      // Literals in a group are ignored anyway, so an alternation inside one
+      // doesn't matter.
+      if (!depth) {
+        return false;
+      }
+      p++;
+      END_RUN();
+      continue;
+    case '{':
+    case '?':
+    case '*':
+      q = c == '{' ? skip_quantifier(p) : p + 1;
+      if (!q) {
+        p++;
+        break;
+      }
+      // The character before may not be there at all.
+      if (last_literal) {
+        runs->len--;
+      }
+      p = q;
+      END_RUN();
+      continue;
+    case '+':
+    case '.':
+    case '^':
+    case '$':
+      p++;
+      END_RUN();
+      continue;
+    case '\n':
+      return false;
+    default:
+      p++;
+      break;
+    }
+
+    // c is a literal character. Those in groups might be optional, and
+    // non-ASCII ones might be folded by pcre2 in ways the index isn't. So
+    // might k and s, which pcre2 matches to the Kelvin sign and the long s.
+    if (depth || (ignore_case && (c & 0x80 || strchr("kKsS", c)))) {
+      END_RUN();
+      continue;
+    }
+    buf_append_char(runs, (char) trigram_fold(c));
+    last_literal = true;
+  }
+  END_RUN();
+#undef END_RUN
+  return true;
+}
+
+struct regionbuf *buffer_search_candidates(
+    struct buffer *buffer, char *pattern, bool ignore_case) {
+  struct trigram_index *index = buffer->trigrams;
+  if (!index) {
+    return NULL;
+  }
+
+  struct buf *runs = buf_create(strlen(pattern) + 1);
+  if (!pattern_literal_runs(pattern, ignore_case, runs) || !runs->len) {
+    buf_free(runs);
+    return NULL;
+  }
+  uint32_t *hashes = xmalloc(runs->len * sizeof(*hashes));
+  size_t nhashes = 0;
+  unsigned char *s = (unsigned char*) runs->buf;
+  for (size_t i = 0; i + 2 < runs->len; ++i) {
+    if (s[i + 1] != '\n' && s[i + 2] != '\n' && s[i] != '\n') {
+      uint32_t trigram = (uint32_t) (s[i] << 16 | s[i + 1] << 8 | s[i + 2]);
+      hashes[nhashes++] = trigram_hash(trigram);
+    }
+  }
+  buf_free(runs);
+
+  struct regionbuf *ranges = regionbuf_create(16);
+  bool ruled_out = false;
+  size_t pos = 0;
+  for (size_t i = 0; i < index->nchunks; ++i) {
+    struct trigram_chunk *chunk = &index->chunks[i];
+    if (!chunk->len) {
+      continue;
+    }
+    bool candidate = true;
+    for (size_t j = 0; chunk->bits && candidate && j < nhashes; ++j) {
+      candidate = trigram_bit(chunk->bits, hashes[j]);
+    }
+
+    if (!candidate) {
+      ruled_out = true;
+    } else if (ranges->len && ranges->buf[ranges->len - 1].end == pos) {
+      ranges->buf[ranges->len - 1].end += chunk->len;
+    } else {
+      struct region range;
+      region_set(&range, pos, pos + chunk->len);
+      regionbuf_add(ranges, &range);
+    }
+    pos += chunk->len;
+  }
+  free(hashes);
+
+  if (!ruled_out) {
+    regionbuf_free(ranges);
+    return NULL;
+  }
+  return ranges;
+}
+
+void editor_update_trigram_indexes(struct editor *editor) {
+  struct buffer *buffer;
+  TAILQ_FOREACH(buffer, &editor->buffers, pointers) {
+    if (!editor->opt.trigramindex) {
+      if (buffer->trigrams) {
+        trigram_index_free(buffer->trigrams);
+        buffer->trigrams = NULL;
+      }
+      continue;
+    }
+    if (!buffer->trigrams) {
+      buffer->trigrams = trigram_index_create(buffer);
+    }
+    trigram_index_update(buffer->trigrams, editor_pool(editor));
+  }
+}
+
+bool editor_trigram_indexing(struct editor *editor) {
+  struct buffer *buffer;
+  TAILQ_FOREACH(buffer, &editor->buffers, pointers) {
+    if (buffer->trigrams && buffer->trigrams->job) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+struct editor;
+struct pool;
+struct regionbuf;
+struct trigram_job;
+
+// An index of the trigrams (runs of three bytes) in a buffer's text, so that
+// searching a huge buffer over and over only has to look at the parts of it
+// that could contain a match. The text is split into chunks of whole lines,
+// and each chunk has a bitmap of the (hashed, case-folded) trigrams in it.
+// The bitmaps are built on the editor's thread pool. An edit just marks the
+// chunks it touches as stale; stale chunks are searched as if they contained
+// every trigram until they've been indexed again.
+struct trigram_index {
+  // Must be first, so the listener callbacks can get at the index.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+
+  struct trigram_chunk {
+    size_t len;
+    // NULL if the chunk is stale.
+    uint64_t *bits;
+    // Changed whenever the chunk is edited, so that indexing results for
+    // text that has since changed can be told apart and thrown away.
+    size_t id;
+  } *chunks;
+  size_t nchunks;
+  size_t cap;
+  size_t next_id;
+  // A Fenwick tree over the chunks' lengths, so that finding the chunk an
+  // edit is in doesn't mean adding up the lengths of all the chunks before
+  // it. It's built again when chunks are merged or replaced.
+  size_t *sums;
+
+  // The indexing in progress (or NULL).
+  struct trigram_job *job;
+};
+
+// Creates an index for the buffer, with all of the text stale.
+struct trigram_index *trigram_index_create(struct buffer *buffer);
+void trigram_index_free(struct trigram_index *index);
+
+// Takes in the results of the indexing in progress if it's done, and starts
+// indexing whatever is stale if nothing is in progress.
+void trigram_index_update(struct trigram_index *index, struct pool *pool);
+
+// Returns the ranges of the buffer's text (sorted, disjoint and made up of
+// whole lines) in which a match of the pattern could start. Returns NULL if
+// the buffer isn't indexed or the index can't rule anything out, e.g. if the
+// pattern has no three literal characters in a row that every match must
+// contain.
+struct regionbuf *buffer_search_candidates(
+    struct buffer *buffer, char *pattern, bool ignore_case);
+
+// Indexes the loaded buffers if 'trigramindex' is set (dropping the indexes
+// if it isn't), and keeps the indexes up to date as the buffers change.
+void editor_update_trigram_indexes(struct editor *editor);
+
+// Whether any of the loaded buffers are being indexed.
+bool editor_trigram_indexing(struct editor *editor);
@@ -0,0 +1,257 @@
+#include "utf8.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "gap.h"
+#include "util.h"
+
+// Big chunks are cut at the first newline after this many bytes when they're
+// checked, so that an edit only means checking a little text again.
+#define UTF8_CHUNK_SIZE (1 << 18)
+
+static bool is_continuation(unsigned char c) {
+  return (c & 0xc0) == 0x80;
+}
+
+bool utf8_valid(const unsigned char *s, size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    // Skip over ASCII text eight bytes at a time.
+    uint64_t word;
+    while (i + 8 <= n) {
+      memcpy(&word, s + i, sizeof(word));
+      if (word & 0x8080808080808080ull) {
+        break;
+      }
+      i += 8;
+    }
+    if (i == n) {
+      break;
+    }
+
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+
+    size_t len;
+    // The range the second byte must be in, which rules out overlong forms,
+    // surrogates and code points past U+10FFFF.
+    unsigned char lo = 0x80, hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      len = 2;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      len = 3;
+      if (c == 0xe0) {
+        lo = 0xa0;
+      } else if (c == 0xed) {
+        hi = 0x9f;
+      }
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      len = 4;
+      if (c == 0xf0) {
+        lo = 0x90;
+      } else if (c == 0xf4) {
+        hi = 0x8f;
+      }
+    } else {
+      return false;
+    }
+
+    if (n - i < len || s[i + 1] < lo || s[i + 1] > hi) {
+      return false;
+    }
+    for (size_t j = 2; j < len; ++j) {
+      if (!is_continuation(s[i + j])) {
+        return false;
+      }
+    }
+    i += len;
+  }
+  return true;
+}
+
+// Returns the index of the chunk containing pos (or of the last chunk, if pos
+// is the end of the text), and sets *start to where the chunk starts.
+// The ranges of wide characters, from Unicode's EastAsianWidth.txt (W and F),
+// folded together where they're close enough to.
+static const struct {
+  uint32_t first;
+  uint32_t last;
+} wide_ranges[] = {
+  {0x1100, 0x115f},
+  {0x231a, 0x231b},
+  {0x2329, 0x232a},
+  {0x23e9, 0x23ec},
+  {0x2614, 0x2615},
+  {0x2e80, 0x303e},
+  {0x3041, 0x33ff},
+  {0x3400, 0x4dbf},
+  {0x4e00, 0x9fff},
+  {0xa000, 0xa4cf},
+  {0xa960, 0xa97f},
+  {0xac00, 0xd7a3},
+  {0xf900, 0xfaff},
+  {0xfe10, 0xfe19},
+  {0xfe30, 0xfe6f},
+  {0xff00, 0xff60},
+  {0xffe0, 0xffe6},
+  {0x16fe0, 0x18cff},
+  {0x1b000, 0x1b2ff},
+  {0x1f300, 0x1f64f},
+  {0x1f680, 0x1f6ff},
+  {0x1f900, 0x1f9ff},
+  {0x20000, 0x3fffd},
+};
+
+int utf8_width(uint32_t ch) {
+  if (ch < wide_ranges[0].first) {
+    return 1;
+  }
+  size_t lo = 0;
+  size_t hi = sizeof(wide_ranges) / sizeof(wide_ranges[0]);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (ch > wide_ranges[mid].last) {
+      lo = mid + 1;
+    } else if (ch < wide_ranges[mid].first) {
+      hi = mid;
+    } else {
+      return 2;
+    }
+  }
+  return 1;
+}
+
+static size_t utf8_index_find(
+    struct utf8_index *index, size_t pos, size_t *start) {
+  *start = 0;
+  for (size_t i = 0; i + 1 < index->nchunks; ++i) {
+    if (pos < *start + index->chunks[i].len) {
+      return i;
+    }
+    *start += index->chunks[i].len;
+  }
+  return index->nchunks - 1;
+}
+
+static void utf8_index_inserted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct utf8_index *index = (struct utf8_index*) listener;
+  size_t start;
+  size_t i = utf8_index_find(index, pos, &start);
+  index->chunks[i].len += n;
+  index->chunks[i].state = UTF8_UNCHECKED;
+}
+
+// As with the trigram index, the chunks from the one holding the first
+// deleted character to the one holding the character after the last are
+// merged, so that every chunk still ends with a newline.
+static void utf8_index_deleted(
+    struct buffer_listener *listener, size_t pos, size_t n) {
+  struct utf8_index *index = (struct utf8_index*) listener;
+  size_t start;
+  size_t i = utf8_index_find(index, pos, &start);
+  size_t j = i;
+  size_t len = index->chunks[i].len;
+  while (start + len <= pos + n && j + 1 < index->nchunks) {
+    len += index->chunks[++j].len;
+  }
+
+  index->chunks[i].len = len - n;
+  index->chunks[i].state = UTF8_UNCHECKED;
+  memmove(&index->chunks[i + 1], &index->chunks[j + 1],
+      (index->nchunks - j - 1) * sizeof(*index->chunks));
+  index->nchunks -= j - i;
+}
+
+struct utf8_index *utf8_index_create(struct buffer *buffer) {
+  struct utf8_index *index = xmalloc(sizeof(*index));
+  index->buffer = buffer;
+  index->listener.inserted = utf8_index_inserted;
+  index->listener.deleted = utf8_index_deleted;
+  buffer_add_listener(buffer, &index->listener);
+
+  index->cap = 16;
+  index->chunks = xmalloc(index->cap * sizeof(*index->chunks));
+  index->nchunks = 1;
+  index->chunks[0].len = gb_size(buffer->text);
+  index->chunks[0].state = UTF8_UNCHECKED;
+  return index;
+}
+
+void utf8_index_free(struct utf8_index *index) {
+  buffer_remove_listener(index->buffer, &index->listener);
+  free(index->chunks);
+  free(index);
+}
+
+// Returns a pointer to the n characters at offset pos in the buffer, moving
+// the gap out of the way if it's in the middle of them.
+static unsigned char *gb_contiguous(struct gapbuf *gb, size_t pos, size_t n) {
+  size_t before = (size_t) (gb->gapstart - gb->bufstart);
+  if (pos < before && pos + n > before) {
+    gb_mvgap(gb, pos);
+    before = pos;
+  }
+  if (pos < before) {
+    return (unsigned char*) gb->bufstart + pos;
+  }
+  return (unsigned char*) gb->gapend + (pos - before);
+}
+
+// Checks chunk i, first cutting it into pieces of about UTF8_CHUNK_SIZE
+// bytes. Returns the number of chunks it became.
+static size_t utf8_index_check(
+    struct utf8_index *index, size_t i, unsigned char *text) {
+  size_t len = index->chunks[i].len;
+  size_t pieces = 0;
+  size_t start = 0;
+  do {
+    size_t end = min(start + UTF8_CHUNK_SIZE, len);
+    if (end < len) {
+      unsigned char *nl = memchr(text + end - 1, '\n', len - end + 1);
+      end = nl ? (size_t) (nl - text) + 1 : len;
+    }
+
+    if (pieces) {
+      if (index->nchunks == index->cap) {
+        index->cap *= 2;
+        index->chunks = xrealloc(
+            index->chunks, index->cap * sizeof(*index->chunks));
+      }
+      memmove(&index->chunks[i + pieces + 1], &index->chunks[i + pieces],
+          (index->nchunks - i - pieces) * sizeof(*index->chunks));
+      index->nchunks++;
+    }
+    struct utf8_chunk *chunk = &index->chunks[i + pieces++];
+    chunk->len = end - start;
+    chunk->state = utf8_valid(text + start, end - start) ?
+        UTF8_VALID : UTF8_INVALID;
+    start = end;
+  } while (start < len);
+  return pieces;
+}
+
+bool buffer_is_utf8(struct buffer *buffer) {
+  struct utf8_index *index = buffer->utf8;
+  bool valid = true;
+  size_t pos = 0;
+  for (size_t i = 0; i < index->nchunks;) {
+    size_t len = index->chunks[i].len;
+    size_t n = 1;
+    if (index->chunks[i].state == UTF8_UNCHECKED) {
+      n = utf8_index_check(
+          index, i, gb_contiguous(buffer->text, pos, len));
+    }
+    for (; n > 0; --n, ++i) {
+      valid = valid && index->chunks[i].state == UTF8_VALID;
+    }
+    pos += len;
+  }
+  return valid;
+}
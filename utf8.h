@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+// Whether s[0, n) is valid UTF-8 (by the same rules as pcre2: no overlong
+// forms, surrogates or code points past U+10FFFF).
+bool utf8_valid(const unsigned char *s, size_t n);
+
+// The number of cells the character takes up on screen: two for the East
+// Asian wide and fullwidth characters (and emoji), one for everything else.
+int utf8_width(uint32_t ch);
+
+// What's known about whether a buffer's text is valid UTF-8, so that searches
+// can tell pcre2 not to check the text again on every call. The text is split
+// into chunks of whole lines (a newline is never part of a multibyte
+// character, so each chunk can be checked on its own), and each chunk is
+// checked the first time it's needed after the text is loaded or edited.
+struct utf8_index {
+  // Must be first, so the listener callbacks can get at the index.
+  struct buffer_listener listener;
+  struct buffer *buffer;
+
+  struct utf8_chunk {
+    size_t len;
+    enum { UTF8_UNCHECKED, UTF8_VALID, UTF8_INVALID } state;
+  } *chunks;
+  size_t nchunks;
+  size_t cap;
+};
+
+struct utf8_index *utf8_index_create(struct buffer *buffer);
+void utf8_index_free(struct utf8_index *index);
+
+// Whether the whole of the buffer's text is valid UTF-8. Only the chunks
+// edited since the last call are looked at.
+bool buffer_is_utf8(struct buffer *buffer);
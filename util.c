@@ -161,6 +161,52 @@ const char *homedir(void) {
   return home ? home : getpwuid(getuid())->pw_dir;
 }
 
+static bool clock_stopped = false;
+static struct timespec clock_stopped_at;
+static long clock_step_ms;
+
+void clock_now(struct timespec *now) {
+  if (!clock_stopped) {
+    clock_gettime(CLOCK_MONOTONIC, now);
+    return;
+  }
+  *now = clock_stopped_at;
+  clock_stopped_at.tv_nsec += clock_step_ms * 1000000L;
+  clock_stopped_at.tv_sec += clock_stopped_at.tv_nsec / 1000000000L;
+  clock_stopped_at.tv_nsec %= 1000000000L;
+}
+
+void clock_stop(const struct timespec *at, long step_ms) {
+  clock_stopped = at != NULL;
+  if (at) {
+    clock_stopped_at = *at;
+    clock_step_ms = step_ms;
+  }
+}
+
+long elapsed_ms(struct timespec *start) {
+  struct timespec now;
+  clock_now(&now);
+  return (now.tv_sec - start->tv_sec) * 1000 +
+      (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+void deadline_init(struct deadline *deadline, long ms) {
+  clock_now(&deadline->start);
+  deadline->ms = ms;
+  deadline->missed = false;
+}
+
+bool deadline_passed(struct deadline *deadline) {
+  if (!deadline || deadline->ms <= 0) {
+    return false;
+  }
+  if (!deadline->missed && elapsed_ms(&deadline->start) >= deadline->ms) {
+    deadline->missed = true;
+  }
+  return deadline->missed;
+}
+
 struct region *region_set(struct region *region, size_t start, size_t end) {
   region->start = min(start, end);
   region->end = max(start, end);
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <time.h>
 
 #include <sys/queue.h>
 
@@ -48,6 +49,31 @@ char *abspath(const char *path);
 const char *relpath(const char *path, const char *start);
 const char *homedir(void);
 
+// The time on the clock elapsed_ms and deadlines go by. It's CLOCK_MONOTONIC,
+// unless stopped by clock_stop.
+void clock_now(struct timespec *now);
+// Stops the clock at the given time, or starts it again if that's NULL. From
+// then on it only moves step_ms each time it's read. This lets tests say when
+// time passes.
+void clock_stop(const struct timespec *at, long step_ms);
+
+// The number of milliseconds since start (as given by clock_now).
+long elapsed_ms(struct timespec *start);
+
+// A time limit on some work, e.g. on drawing a frame ('redrawtime').
+struct deadline {
+  struct timespec start;
+  // How long the work may take, or 0 (or less) for no limit.
+  long ms;
+  // Set once deadline_passed has returned true, i.e. once some work was cut
+  // short because of it.
+  bool missed;
+};
+
+void deadline_init(struct deadline *deadline, long ms);
+// Whether the time is up. A NULL deadline never passes.
+bool deadline_passed(struct deadline *deadline);
+
 struct region {
   size_t start;
   size_t end;
@@ -9,6 +9,7 @@
 #include "editor.h"
 #include "gap.h"
 #include "options.h"
+#include "substitute.h"
 #include "tags.h"
 #include "util.h"
 
@@ -21,11 +22,13 @@ struct window *window_create(struct buffer *buffer, size_t w, size_t h) {
 
   window->buffer = NULL;
   window->alternate_path = NULL;
+  window->frame = NULL;
   window->cursor = xmalloc(sizeof(*window->cursor));
   if (buffer) {
     window_set_buffer(window, buffer);
   }
   window->visual_mode_selection = NULL;
+  window->substitute_preview = NULL;
 
   window->w = w;
   window->h = h;
@@ -298,6 +301,8 @@ void window_set_buffer(struct window *window, struct buffer* buffer) {
       free(window->alternate_path);
       window->alternate_path = xstrdup(window->buffer->path);
     }
+    window_frame_free(window->frame);
+    window->frame = NULL;
   }
 
   window->buffer = buffer;
@@ -319,7 +324,7 @@ struct window *window_first_leaf(struct window *window) {
   return window;
 }
 
-static struct window *window_last_leaf(struct window *window) {
+struct window *window_last_leaf(struct window *window) {
   while (window->split_type != WINDOW_LEAF) {
     window = window->split.second;
   }
@@ -425,6 +430,8 @@ void window_free(struct window *window) {
     }
     free(window->pwd);
     free(window->alternate_path);
+    substitute_preview_free(window->substitute_preview);
+    window_frame_free(window->frame);
   } else {
     window_free(window->split.first);
     window_free(window->split.second);
@@ -46,12 +46,19 @@ struct window {
       bool have_incsearch_match;
       struct region incsearch_match;
 
+      // The preview of the :s being typed if 'inccommand' is set (or NULL).
+      struct substitute_preview *substitute_preview;
+
       // The visual mode selection.
       // NULL if not in visual mode.
       struct region *visual_mode_selection;
 
       TAILQ_HEAD(tag_list, tag_jump) tag_stack;
       struct tag_jump *tag;
+
+      // What was drawn in the window last time, so that the next frame only
+      // has to draw what changed (or NULL).
+      struct window_frame *frame;
     };
 
     struct {
@@ -90,9 +97,13 @@ struct window *window_up(struct window *window);
 struct window *window_down(struct window *window);
 
 struct window *window_first_leaf(struct window *window);
+struct window *window_last_leaf(struct window *window);
 
 void window_set_buffer(struct window *window, struct buffer *buffer);
 
+// Defined in draw.c.
+void window_frame_free(struct window_frame *frame);
+
 size_t window_cursor(struct window *window);
 void window_set_cursor(struct window *window, size_t pos);
 void window_center_cursor(struct window *window);